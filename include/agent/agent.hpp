@@ -0,0 +1,63 @@
+#ifndef AGENT_AGENT_HPP
+#define AGENT_AGENT_HPP
+
+#include <mutex>
+#include <string>
+
+#include "client/usage_segment.hpp"
+
+#define AGENT_SOCKET_PATH "/run/vcuda/agent.sock"
+
+namespace agent {
+
+// Node agent: owns the usage segment of the node, publishes the memory limits
+// of its config file into it for every hooked process, reclaims the slots of
+// processes that exited and answers queries on a Unix socket. One request
+// line per connection:
+//
+//   usage       used bytes per device, pinned host bytes of the node
+//   processes   one line per occupied slot
+//   policy      the published limits
+//
+// A segment has one agent at most; the policy it published outlives it, so
+// limits hold across a restart of the agent.
+class NodeAgent {
+public:
+    explicit NodeAgent(std::string socket_path);
+    ~NodeAgent();
+    NodeAgent(const NodeAgent&) = delete;
+    NodeAgent& operator=(const NodeAgent&) = delete;
+
+    // open the segment, become its agent, publish and listen; false on failure
+    bool start();
+
+    // serve until stop() or a signal interrupts the loop
+    int run();
+
+    // async-signal-safe
+    static void stop();
+
+    std::string answer(const std::string& request) const;
+
+    // send request to the agent listening on socket_path, the answer in *reply
+    static bool query(const std::string& socket_path, const std::string& request, std::string* reply);
+
+private:
+    void publishPolicy();
+    static void onConfigReload(void* arg);
+    void serve(int fd) const;
+    void reclaim() const;
+
+    std::string usageReport() const;
+    std::string processReport() const;
+    std::string policyReport() const;
+
+    UsageSegment segment_;
+    std::string socket_path_;
+    int listen_fd_ = -1;
+    std::mutex publish_mutex_;
+};
+
+} // namespace agent
+
+#endif // AGENT_AGENT_HPP
@@ -3,31 +3,89 @@
 
 #include <mutex>
 #include <pthread.h>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
 
-#include "util/usage.hpp"
+#include "client/usage_segment.hpp"
+#include "util/config.hpp"
+#include "util/util.hpp"
 
-#define MAX_PROCESS_NUM 8
-
-#define SHM_NAME "vcuda_usage"
-#define SHM_SIZE sizeof(MultiProcessMetricData) * MAX_PROCESS_NUM
+// how often the reaper returns the usage of exited processes
+#define REAPER_INTERVAL std::chrono::seconds(1)
 
 
 class Client {
 public:
-    struct MultiProcessMetricData { // multi process metric data for each process
-        std::atomic<bool> initialized{false};
-        pthread_mutex_t lock;
-        std::array<util::ProcessUsage, MAX_PROCESS_NUM> usage{};
-    } __attribute__((aligned(64)));
-
+    static constexpr int kNoSlot = -1;
 
     static Client& getInstance();
 
     void create_or_attach_process_metric_data();
 
+    // device memory in use by the processes of our container
     size_t get_device_process_metric_data(int);
-    void update_process_metric_data(util::ProcessUsage&);
+
+    // charge size bytes to device idx unless the usage of our container would
+    // exceed limit (0: unlimited); lock-free unless the device looks full and
+    // dead processes are reclaimed
+    bool reserve_device_memory(int idx, size_t size, size_t limit);
+
+    // undo a reservation, or return the bytes of a freed allocation
+    void release_device_memory(int idx, size_t size);
+
+    // page-locked host memory, charged against one node-wide limit (0: unlimited)
+    bool reserve_host_memory(size_t size, size_t limit);
+    void release_host_memory(size_t size);
+    size_t get_host_pinned_usage();
+
+    // give every unused quota lease back to the pool, so that a limit lowered
+    // by a config reload applies to the next reservation; leases stay
+    // suspended until a charge against the shared counter succeeds again
+    void return_quota_leases();
+
+    // Launch scheduling (VCUDA_PRIORITY, VCUDA_TIME_SLICE_MS): each launch of a
+    // process with a priority holds device idx for its time slice; launches of
+    // lower priorities wait on the segment's futex until the hold lapses or
+    // is dropped. Equal priorities share the device. Lock-free while nobody
+    // holds it.
+    void wait_launch_turn(int idx);
+
+    // Device time of launches per second of CLOCK_MONOTONIC, kept in the
+    // process's slot and summed over the processes of its container
+    // (util::Config::containerId). get_device_busy_time reads the last
+    // complete second, so every reader sees the same value whenever it asks.
+    void add_device_busy_time(int idx, uint64_t busy_ns);
+    uint64_t get_device_busy_time(int idx);
+
+    // Policy of the node agent (vcuda-agent), once it published one: memory
+    // limits that replace the config file's, and the pinned host memory
+    // limit. Parsed once per generation; nullptr / false without a policy.
+    std::shared_ptr<const util::DeviceMemoryLimits> policy_memory_limits();
+    bool policy_host_pinned_limit(size_t* limit);
+    uint64_t policy_generation() const;
+
+    // run on the reaper thread after the agent published a new policy
+    using PolicyListener = void (*)(void* arg);
+    void add_policy_listener(PolicyListener listener, void* arg);
+    void remove_policy_listener(PolicyListener listener, void* arg);
+
+    // Quota leases (VCUDA_QUOTA_LEASE): the process charges the shared counter
+    // a chunk at a time and serves reservations from that chunk locally, so
+    // small allocations and frees touch no cross-process cache line. Unused
+    // lease is published to the slot (when it is refilled or returned, and by
+    // the reaper within the staleness bound) and left out of reported usage.
+    // Idle leases go back to the pool after one staleness period. A lease is
+    // suspended while the device refuses us memory: freed bytes then go
+    // straight back instead of being kept for the next reservation.
+    struct QuotaLease {
+        std::atomic<size_t> available{0}; // charged to the pool, not handed out
+        std::atomic<bool> touched{false}; // reserved from since the last reaper tick
+        std::atomic<bool> suspended{false}; // the last charge failed, or the limits were reloaded
+    } __attribute__((aligned(64)));
 
 private:
     Client();
@@ -35,7 +93,47 @@ private:
     Client(const Client&) = delete;
     Client& operator=(const Client&) = delete;
 
-    MultiProcessMetricData* process_metric_data_ = nullptr;
+    void open_process_metric_data();
+    void lock_process_metric_data();
+    void unlock_process_metric_data();
+    int claim_process_slot();
+    bool reclaim_dead_process_slots();
+    bool try_charge_device(int idx, size_t size, size_t limit);
+    bool charge_device_memory(int slot, int idx, size_t size, size_t limit);
+    void uncharge_device_memory(int slot, int idx, size_t size);
+    void return_quota_lease(int slot, int idx, size_t keep);
+    void resume_quota_lease(int idx);
+    void publish_quota_lease(int slot, int idx);
+    void tick_quota_leases();
+    void drop_launch_claims();
+    bool refresh_policy();
+    void notify_policy_listeners();
+
+    bool valid_device(int idx) const { return idx >= 0 && idx < device_count_; }
+
+    void start_reaper();
+    static void* reaper_main(void*);
+    static void reset_after_fork(void* arg);
+
+    UsageSegment& segment_; // the process-wide mapping, see nodeSegment()
+    int device_count_ = 0; // devices tracked, the segment's capacity capped to DEVICE_MAX_NUM
+    std::atomic<int> self_slot_{kNoSlot}; // cached on first claim
+    int group_ = kNoSlot; // usage group of our container, set before self_slot_
+    size_t quota_lease_bytes_ = 0; // 0: every reservation goes to the shared counter
+    std::chrono::milliseconds quota_lease_staleness_{0};
+    std::array<QuotaLease, DEVICE_MAX_NUM> quota_leases_{};
+    uint64_t launch_priority_ = 0; // 0: never holds a device
+    uint64_t time_slice_us_ = 0;
+    std::string container_id_; // util::Config::containerId, picks our policy entries
+    uint64_t container_ = 0;   // hash of the container id, never 0
+    std::array<std::atomic<uint64_t>, DEVICE_MAX_NUM> launch_claims_{}; // our last claim per device
+
+    std::mutex policy_mutex_;
+    uint64_t policy_seen_ = 0; // generation parsed into policy_limits_
+    std::shared_ptr<const util::DeviceMemoryLimits> policy_limits_;
+    size_t policy_host_pinned_limit_ = 0;
+    std::mutex policy_listeners_mutex_;
+    std::vector<std::pair<PolicyListener, void*>> policy_listeners_;
 };
 
 #endif // CLIENT_HPP
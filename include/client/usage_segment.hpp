@@ -0,0 +1,236 @@
+#ifndef CLIENT_USAGE_SEGMENT_HPP
+#define CLIENT_USAGE_SEGMENT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <pthread.h>
+#include <sys/types.h>
+#include <vector>
+
+// Layout of the node-wide usage segment shared by all hooked processes.
+//
+//   Header                       magic, version, capacities, size, lock
+//   HostCounters                 page-locked host memory of all processes
+//   Policy                       limits published by the node agent
+//   DeviceSchedule[max_devices]  launch scheduling, a cache line each
+//   uint64_t group_container[max_processes]        container of each usage group, 0 while free
+//   DeviceCounters[max_processes][max_devices]     per-group aggregates, a cache line each
+//   pid_t  process_id[max_processes]
+//   time_t timestamp[max_processes]
+//   uint64_t container[max_processes]              hash of the process's container
+//   uint32_t group[max_processes]                  usage group of the process
+//   size_t charged[max_devices][max_processes]     one column per device
+//   size_t lease_free[max_devices][max_processes]
+//   size_t host_pinned[max_processes]
+//   uint64_t activity[max_devices][max_processes][kActivityBuckets]
+//
+// The capacities are picked by the process that creates the segment and
+// read back from the header by everyone attaching later, so they can be
+// raised without a rebuild. Per-process values are stored as columns per
+// device: summing a device over all processes is a contiguous loop.
+// The processes of one container share a usage group, the device counters
+// their memory is admitted against; a container never needs more groups
+// than slots, so there are as many of both.
+// Every field is updated with atomic builtins, the layout stays trivially
+// copyable so that readers outside the hook can map it as is.
+class UsageSegment {
+public:
+    static constexpr uint32_t kMagic = 0x53554356; // "VCUS"
+    static constexpr uint32_t kVersion = 10;
+    static constexpr uint32_t kDefaultMaxProcesses = 256;
+    static constexpr uint32_t kDefaultMaxDevices = 16;
+    static constexpr uint32_t kMaxProcesses = 65536;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t max_processes;
+        uint32_t max_devices;
+        uint64_t size; // bytes, as created
+        std::atomic<uint32_t> ready;
+        pthread_mutex_t lock; // slot claims and reclamation only
+    } __attribute__((aligned(64)));
+
+    // usage alone is the admission counter and may move at any time; updates
+    // that change usage and lease_free together do so in a sequence section
+    // so that readers never see one without the other
+    struct DeviceCounters {
+        std::atomic<uint32_t> sequence; // odd while a section is open
+        std::atomic<size_t> usage;      // admission counter, charged bytes of the group's processes
+        std::atomic<size_t> lease_free; // sum of the published unused quota leases
+    } __attribute__((aligned(64)));
+
+    struct HostCounters {
+        std::atomic<size_t> pinned; // admission counter, pinned bytes of all processes
+    } __attribute__((aligned(64)));
+
+    // Launch scheduling of a device. claim packs the priority of the process
+    // holding the device (high 16 bits) and the CLOCK_MONOTONIC microsecond
+    // the hold lapses (low 48 bits) so that both change in one CAS; 0 while
+    // nobody holds it. wake is the futex word waiters sleep on, bumped when a
+    // hold is dropped before it lapses.
+    struct DeviceSchedule {
+        std::atomic<uint64_t> claim;
+        std::atomic<uint32_t> wake;
+    } __attribute__((aligned(64)));
+
+    // Device time of a process's launches in per-second buckets: bucket
+    // s % kActivityBuckets holds the low bits of second s of
+    // CLOCK_MONOTONIC above the microseconds busy in that second, so that a
+    // bucket left from an earlier round reads as idle. Kept per slot, readers
+    // sum the slots of their own container.
+    static constexpr int kActivityBuckets = 4;
+    static constexpr int kActivityBusyBits = 40;
+
+    // Limits published by the node agent (vcuda-agent) for the processes of
+    // the segment, written under sequence by the agent alone. generation is 0
+    // until the first publish; from then on processes take their limits from
+    // here instead of reading a config file. Entries naming a container
+    // replace the node-wide ones for the processes of that container.
+    static constexpr uint32_t kMaxPolicyEntries = 256;
+    static constexpr size_t kPolicyUuidSize = 48;
+    static constexpr size_t kPolicyContainerSize = 64;
+    static constexpr int32_t kPolicyDefault = -1; // index of the entry for every device
+    static constexpr int32_t kPolicyByUuid = -2;  // index of entries keyed by uuid
+
+    struct PolicyEntry {
+        int32_t index;                // device index, kPolicyDefault or kPolicyByUuid
+        char uuid[kPolicyUuidSize];   // normalized, NUL terminated
+        char container[kPolicyContainerSize]; // NUL terminated, empty for every container
+        uint64_t bytes;
+        double percent;               // share of the device's memory when bytes is 0
+    };
+
+    struct Policy {
+        std::atomic<uint32_t> sequence; // odd while the agent writes
+        std::atomic<uint64_t> generation;
+        uint64_t host_pinned_limit;
+        uint32_t entry_count;
+        PolicyEntry entries[kMaxPolicyEntries];
+    } __attribute__((aligned(64)));
+
+    struct PolicySnapshot {
+        uint64_t generation = 0;
+        uint64_t host_pinned_limit = 0;
+        std::vector<PolicyEntry> entries;
+    };
+
+    struct DeviceSnapshot {
+        size_t usage;
+        size_t lease_free;
+    };
+
+    UsageSegment() = default;
+    UsageSegment(const UsageSegment&) = delete;
+    UsageSegment& operator=(const UsageSegment&) = delete;
+
+    // create the named segment with the given capacities, or attach to the
+    // existing one with whatever capacities it was created with
+    bool open(const char* name, uint32_t max_processes, uint32_t max_devices);
+
+    // same layout in anonymous memory, accounting stays within the process
+    bool openPrivate(uint32_t max_processes, uint32_t max_devices);
+
+    // attach to the named segment if it exists, without creating it; quietly
+    // false when there is none
+    bool attach(const char* name);
+
+    bool valid() const { return header_ != nullptr; }
+    int fd() const { return fd_; }
+
+    Header& header() const { return *header_; }
+    uint32_t maxProcesses() const { return max_processes_; }
+    uint32_t maxDevices() const { return max_devices_; }
+
+    DeviceCounters& device(int group, int idx) const {
+        return devices_[static_cast<size_t>(group) * max_devices_ + idx];
+    }
+    uint64_t& groupContainer(int group) const { return group_containers_[group]; }
+    pid_t& processId(int slot) const { return process_ids_[slot]; }
+    time_t& timestamp(int slot) const { return timestamps_[slot]; }
+    uint64_t& container(int slot) const { return containers_[slot]; }
+    uint32_t& group(int slot) const { return groups_[slot]; }
+    size_t* charged(int idx) const { return charged_ + static_cast<size_t>(idx) * max_processes_; }
+    size_t* leaseFree(int idx) const { return lease_free_ + static_cast<size_t>(idx) * max_processes_; }
+    HostCounters& host() const { return *host_; }
+    DeviceSchedule& schedule(int idx) const { return schedules_[idx]; }
+    uint64_t* activity(int idx, int slot) const {
+        return activities_ + (static_cast<size_t>(idx) * max_processes_ + slot) * kActivityBuckets;
+    }
+    Policy& policy() const { return *policy_; }
+    bool hasPolicy() const { return policy_->generation.load(std::memory_order_acquire) != 0; }
+    size_t& hostPinned(int slot) const { return host_pinned_[slot]; }
+
+    // Sequence lock over a group's counters of a device. Writers of other
+    // processes are serialized by it; one that stays inside too long is
+    // presumed dead and its section taken over, readers give up waiting after
+    // a bounded number of retries. Either way the counters themselves stay
+    // exact, only the pair read may be torn.
+    uint32_t beginUpdate(int group, int idx) const;
+    void endUpdate(int group, int idx, uint32_t sequence) const;
+
+    // usage and lease_free of the group on device idx as of one point in
+    // time, lock-free
+    DeviceSnapshot snapshot(int group, int idx) const;
+
+    // The usage group of a container, -1 while none of its processes holds a
+    // slot; lock-free. claimGroup takes a free one for a container without;
+    // callers hold lock(). releaseSlot frees a group with its last slot.
+    int findGroup(uint64_t container) const;
+    int claimGroup(uint64_t container) const;
+
+    // The policy as of one point in time; false while it cannot be read
+    // whole, a writer died inside its section.
+    bool readPolicy(PolicySnapshot* snapshot) const;
+
+    // publish a new policy generation; entries past kMaxPolicyEntries are dropped
+    void writePolicy(uint64_t host_pinned_limit, const std::vector<PolicyEntry>& entries) const;
+
+    // Slots and their leases. Slot i is owned while its owner holds a write
+    // lock on byte i of the segment file; the kernel drops it when the owner
+    // exits, whatever pid namespace the owner lives in. A private segment has
+    // nobody to share slots with. The agent holds byte kMaxProcesses the same
+    // way, so that a segment has one agent at most.
+    void lock() const;
+    void unlock() const;
+    bool acquireSlotLease(int slot) const;
+    bool isSlotLeaseHeld(int slot) const;
+    bool acquireAgentLease() const;
+
+    // take the slot's bytes and published lease out of its group's
+    // aggregates, clear its device time and free it; callers hold lock()
+    void releaseSlot(int slot) const;
+
+    // release the slots whose lease was dropped, all but skip_slot; callers
+    // hold lock(). Returns the number of slots released.
+    int reclaimDeadSlots(int skip_slot) const;
+
+    static size_t sizeFor(uint32_t max_processes, uint32_t max_devices);
+
+private:
+    void initialize(void* base, uint32_t max_processes, uint32_t max_devices, size_t size);
+    void bind(void* base, uint32_t max_processes, uint32_t max_devices);
+    bool attachFd(const char* name, int fd);
+
+    int fd_ = -1;
+    Header* header_ = nullptr;
+    uint32_t max_processes_ = 0;
+    uint32_t max_devices_ = 0;
+    HostCounters* host_ = nullptr;
+    Policy* policy_ = nullptr;
+    DeviceSchedule* schedules_ = nullptr;
+    uint64_t* group_containers_ = nullptr;
+    DeviceCounters* devices_ = nullptr;
+    pid_t* process_ids_ = nullptr;
+    time_t* timestamps_ = nullptr;
+    uint64_t* containers_ = nullptr;
+    uint32_t* groups_ = nullptr;
+    size_t* charged_ = nullptr;
+    size_t* lease_free_ = nullptr;
+    size_t* host_pinned_ = nullptr;
+    uint64_t* activities_ = nullptr;
+};
+
+#endif // CLIENT_USAGE_SEGMENT_HPP
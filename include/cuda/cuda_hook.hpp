@@ -2,34 +2,110 @@
 #define CUDA_HOOK_DEFINE
 #include <cuda.h>
 #include "hook/hook.hpp"
+#include "cuda/mem_pool_tracker.hpp"
+#include "cuda/vmm_tracker.hpp"
+#include "cuda/proc_address_cache.hpp"
+#include "cuda/launch_timer.hpp"
+#include "device/launch_throttle.hpp"
+#include "device/slab_allocator.hpp"
+#include "util/config.hpp"
 #include "client/client.hpp"
 #include "util/util.hpp"
 
 #define CUDA_LIBRARY_SO "libcuda.so.1"
 
+// per-thread default stream entry points, declared by cuda.h only when the
+// application is built with CUDA_API_PER_THREAD_DEFAULT_STREAM
+extern "C" {
+CUresult cuMemAllocAsync_ptsz(CUdeviceptr* dptr, size_t bytesize, CUstream hStream);
+CUresult cuMemAllocFromPoolAsync_ptsz(CUdeviceptr* dptr, size_t bytesize, CUmemoryPool pool, CUstream hStream);
+CUresult cuMemFreeAsync_ptsz(CUdeviceptr dptr, CUstream hStream);
+CUresult cuLaunchKernel_ptsz(CUfunction f, unsigned int gridDimX, unsigned int gridDimY, unsigned int gridDimZ,
+                             unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ,
+                             unsigned int sharedMemBytes, CUstream hStream, void** kernelParams, void** extra);
+CUresult cuLaunchKernelEx_ptsz(const CUlaunchConfig* config, CUfunction f, void** kernelParams, void** extra);
+CUresult cuGraphLaunch_ptsz(CUgraphExec hGraphExec, CUstream hStream);
+}
+
+// Hooked symbols, expanded once for the compile-time name table and once for
+// the HookFuncInfo entries so both stay in the same order.
+// SINGLE registers the plain name, MULTI also registers the versioned name
+// the cuda.h macro maps it to (e.g. cuMemAlloc -> cuMemAlloc_v2).
+#define CUDA_HOOK_SYMBOLS(SINGLE, MULTI) \
+    MULTI(cuGetProcAddress, HOOK_SYMBOL(&cuGetProcAddress)) \
+    MULTI(cuMemAlloc, HOOK_SYMBOL(&cuMemAlloc)) \
+    SINGLE(cuDeviceGet, HOOK_SYMBOL(&cuDeviceGet)) \
+    MULTI(cuMemAllocHost, HOOK_SYMBOL(&cuMemAllocHost)) \
+    SINGLE(cuMemHostAlloc, HOOK_SYMBOL(&cuMemHostAlloc)) \
+    SINGLE(cuMemFreeHost, HOOK_SYMBOL(&cuMemFreeHost)) \
+    MULTI(cuMemHostRegister, HOOK_SYMBOL(&cuMemHostRegister)) \
+    SINGLE(cuMemHostUnregister, HOOK_SYMBOL(&cuMemHostUnregister)) \
+    SINGLE(cuInit, HOOK_SYMBOL(&cuInit)) \
+    SINGLE(cuGetErrorString, NO_HOOK) \
+    MULTI(cuMemFree, HOOK_SYMBOL(&cuMemFree)) \
+    SINGLE(cuCtxGetDevice, HOOK_SYMBOL(&cuCtxGetDevice)) \
+    SINGLE(cuCtxSetCurrent, HOOK_SYMBOL(&cuCtxSetCurrent)) \
+    SINGLE(cuCtxGetCurrent, NO_HOOK) \
+    MULTI(cuCtxDestroy, HOOK_SYMBOL(&cuCtxDestroy)) \
+    SINGLE(cuDevicePrimaryCtxRetain, HOOK_SYMBOL(&cuDevicePrimaryCtxRetain)) \
+    MULTI(cuDevicePrimaryCtxRelease, HOOK_SYMBOL(&cuDevicePrimaryCtxRelease)) \
+    MULTI(cuDevicePrimaryCtxReset, HOOK_SYMBOL(&cuDevicePrimaryCtxReset)) \
+    SINGLE(cuDevicePrimaryCtxGetState, NO_HOOK) \
+    MULTI(cuMemGetInfo, HOOK_SYMBOL(&cuMemGetInfo)) \
+    MULTI(cuDeviceTotalMem, HOOK_SYMBOL(&cuDeviceTotalMem)) \
+    SINGLE(cuMemGetAllocationGranularity, NO_HOOK) \
+    SINGLE(cuMemAddressReserve, NO_HOOK) \
+    SINGLE(cuMemAddressFree, NO_HOOK) \
+    SINGLE(cuMemCreate, HOOK_SYMBOL(&cuMemCreate)) \
+    SINGLE(cuMemRelease, HOOK_SYMBOL(&cuMemRelease)) \
+    SINGLE(cuMemMap, HOOK_SYMBOL(&cuMemMap)) \
+    SINGLE(cuMemUnmap, HOOK_SYMBOL(&cuMemUnmap)) \
+    MULTI(cuDeviceGetUuid, NO_HOOK) \
+    SINGLE(cuMemAllocManaged, NO_HOOK) \
+    SINGLE(cuMemAdvise, NO_HOOK) \
+    SINGLE(cuMemAllocAsync, HOOK_SYMBOL(&cuMemAllocAsync)) \
+    SINGLE(cuMemAllocAsync_ptsz, HOOK_SYMBOL(&cuMemAllocAsync_ptsz)) \
+    SINGLE(cuMemAllocFromPoolAsync, HOOK_SYMBOL(&cuMemAllocFromPoolAsync)) \
+    SINGLE(cuMemAllocFromPoolAsync_ptsz, HOOK_SYMBOL(&cuMemAllocFromPoolAsync_ptsz)) \
+    SINGLE(cuMemFreeAsync, HOOK_SYMBOL(&cuMemFreeAsync)) \
+    SINGLE(cuMemFreeAsync_ptsz, HOOK_SYMBOL(&cuMemFreeAsync_ptsz)) \
+    SINGLE(cuMemPoolCreate, HOOK_SYMBOL(&cuMemPoolCreate)) \
+    SINGLE(cuMemPoolDestroy, HOOK_SYMBOL(&cuMemPoolDestroy)) \
+    SINGLE(cuMemPoolTrimTo, HOOK_SYMBOL(&cuMemPoolTrimTo)) \
+    SINGLE(cuMemPoolGetAttribute, NO_HOOK) \
+    SINGLE(cuDeviceGetMemPool, NO_HOOK) \
+    SINGLE(cuLaunchKernel, HOOK_SYMBOL(&cuLaunchKernel)) \
+    SINGLE(cuLaunchKernel_ptsz, HOOK_SYMBOL(&cuLaunchKernel_ptsz)) \
+    SINGLE(cuLaunchKernelEx, HOOK_SYMBOL(&cuLaunchKernelEx)) \
+    SINGLE(cuLaunchKernelEx_ptsz, HOOK_SYMBOL(&cuLaunchKernelEx_ptsz)) \
+    SINGLE(cuGraphLaunch, HOOK_SYMBOL(&cuGraphLaunch)) \
+    SINGLE(cuGraphLaunch_ptsz, HOOK_SYMBOL(&cuGraphLaunch_ptsz)) \
+    SINGLE(cuEventCreate, NO_HOOK) \
+    SINGLE(cuEventRecord, NO_HOOK) \
+    SINGLE(cuEventRecord_ptsz, NO_HOOK) \
+    SINGLE(cuEventQuery, NO_HOOK) \
+    SINGLE(cuEventElapsedTime, NO_HOOK) \
+    SINGLE(cuStreamIsCapturing, NO_HOOK) \
+    SINGLE(cuStreamIsCapturing_ptsz, NO_HOOK) \
+    MULTI(cuEventDestroy, NO_HOOK)
+
+#define CUDA_SYMBOL_NAME(symbol, hook_ptr) std::string_view{#symbol},
+
+#define MULTI_CUDA_SYMBOL_NAME(symbol, hook_ptr) \
+    std::string_view{#symbol}, std::string_view{SYMBOL_STRING(symbol)},
+
 #define ADD_CUDA_SYMBOL(symbol, hook_ptr) \
-    {#symbol, { \
+    HookFuncInfo{ \
         hook_ptr, \
         [](CudaHook& hook, void* ptr) { \
-            hook.CAT(ori_, EVAL(symbol)) = reinterpret_cast<CudaHook::CAT(EVAL(symbol), _func_ptr)>(ptr); \
+            hook.CAT(ori_, EVAL(symbol)).store(reinterpret_cast<CudaHook::CAT(EVAL(symbol), _func_ptr)>(ptr), \
+                                               std::memory_order_release); \
         } \
-    }}
+    },
 
 #define MULTI_CUDA_SYMBOL(symbol, hook_ptr) \
-    {#symbol, { \
-        hook_ptr, \
-        [](CudaHook& hook, void* ptr) { \
-            hook.CAT(ori_, EVAL(symbol)) = reinterpret_cast<CudaHook::CAT(EVAL(symbol), _func_ptr)>(ptr); \
-        } \
-    }}, \
-    {SYMBOL_STRING(symbol), { \
-        hook_ptr, \
-        [](CudaHook& hook, void* ptr) { \
-            hook.CAT(ori_, EVAL(symbol)) = reinterpret_cast<CudaHook::CAT(EVAL(symbol), _func_ptr)>(ptr); \
-        } \
-    }}
-      
-
+    ADD_CUDA_SYMBOL(symbol, hook_ptr) \
+    ADD_CUDA_SYMBOL(symbol, hook_ptr)
 
 
 class CudaHook : public BaseHook<CudaHook> {
@@ -39,11 +115,21 @@ public:
     ORI_FUNC(cuMemAlloc, CUresult, CUdeviceptr*, size_t);
     ORI_FUNC(cuDeviceGet, CUresult, CUdevice*, int);
     ORI_FUNC(cuMemAllocHost, CUresult, void**, size_t);
+    ORI_FUNC(cuMemHostAlloc, CUresult, void**, size_t, unsigned int);
+    ORI_FUNC(cuMemFreeHost, CUresult, void*);
+    ORI_FUNC(cuMemHostRegister, CUresult, void*, size_t, unsigned int);
+    ORI_FUNC(cuMemHostUnregister, CUresult, void*);
     ORI_FUNC(cuInit, CUresult, unsigned int);
     ORI_FUNC(cuGetErrorString, CUresult, CUresult, const char**);
     ORI_FUNC(cuMemFree, CUresult, CUdeviceptr);
     ORI_FUNC(cuCtxGetDevice, CUresult, CUdevice*);
     ORI_FUNC(cuCtxSetCurrent, CUresult, CUcontext);
+    ORI_FUNC(cuCtxGetCurrent, CUresult, CUcontext*);
+    ORI_FUNC(cuCtxDestroy, CUresult, CUcontext);
+    ORI_FUNC(cuDevicePrimaryCtxRetain, CUresult, CUcontext*, CUdevice);
+    ORI_FUNC(cuDevicePrimaryCtxRelease, CUresult, CUdevice);
+    ORI_FUNC(cuDevicePrimaryCtxReset, CUresult, CUdevice);
+    ORI_FUNC(cuDevicePrimaryCtxGetState, CUresult, CUdevice, unsigned int*, int*);
     ORI_FUNC(cuMemGetInfo, CUresult, size_t*, size_t*);
     ORI_FUNC(cuDeviceTotalMem, CUresult, size_t*, CUdevice);
     ORI_FUNC(cuMemGetAllocationGranularity, CUresult, size_t*, const CUmemAllocationProp*, CUmemAllocationGranularity_flags);
@@ -53,41 +139,91 @@ public:
     ORI_FUNC(cuMemRelease, CUresult, CUmemGenericAllocationHandle);
     ORI_FUNC(cuMemMap, CUresult, CUdeviceptr, size_t, size_t, CUmemGenericAllocationHandle, unsigned long long);
     ORI_FUNC(cuMemUnmap,CUresult, CUdeviceptr, size_t);
+    ORI_FUNC(cuDeviceGetUuid, CUresult, CUuuid*, CUdevice);
+    ORI_FUNC(cuMemAllocManaged, CUresult, CUdeviceptr*, size_t, unsigned int);
+    ORI_FUNC(cuMemAdvise, CUresult, CUdeviceptr, size_t, CUmem_advise, CUdevice);
+    ORI_FUNC(cuMemAllocAsync, CUresult, CUdeviceptr*, size_t, CUstream);
+    ORI_FUNC(cuMemAllocAsync_ptsz, CUresult, CUdeviceptr*, size_t, CUstream);
+    ORI_FUNC(cuMemAllocFromPoolAsync, CUresult, CUdeviceptr*, size_t, CUmemoryPool, CUstream);
+    ORI_FUNC(cuMemAllocFromPoolAsync_ptsz, CUresult, CUdeviceptr*, size_t, CUmemoryPool, CUstream);
+    ORI_FUNC(cuMemFreeAsync, CUresult, CUdeviceptr, CUstream);
+    ORI_FUNC(cuMemFreeAsync_ptsz, CUresult, CUdeviceptr, CUstream);
+    ORI_FUNC(cuMemPoolCreate, CUresult, CUmemoryPool*, const CUmemPoolProps*);
+    ORI_FUNC(cuMemPoolDestroy, CUresult, CUmemoryPool);
+    ORI_FUNC(cuMemPoolTrimTo, CUresult, CUmemoryPool, size_t);
+    ORI_FUNC(cuMemPoolGetAttribute, CUresult, CUmemoryPool, CUmemPool_attribute, void*);
+    ORI_FUNC(cuDeviceGetMemPool, CUresult, CUmemoryPool*, CUdevice);
+    ORI_FUNC(cuLaunchKernel, CUresult, CUfunction, unsigned int, unsigned int, unsigned int,
+             unsigned int, unsigned int, unsigned int, unsigned int, CUstream, void**, void**);
+    ORI_FUNC(cuLaunchKernel_ptsz, CUresult, CUfunction, unsigned int, unsigned int, unsigned int,
+             unsigned int, unsigned int, unsigned int, unsigned int, CUstream, void**, void**);
+    ORI_FUNC(cuLaunchKernelEx, CUresult, const CUlaunchConfig*, CUfunction, void**, void**);
+    ORI_FUNC(cuLaunchKernelEx_ptsz, CUresult, const CUlaunchConfig*, CUfunction, void**, void**);
+    ORI_FUNC(cuGraphLaunch, CUresult, CUgraphExec, CUstream);
+    ORI_FUNC(cuGraphLaunch_ptsz, CUresult, CUgraphExec, CUstream);
+    ORI_FUNC(cuEventCreate, CUresult, CUevent*, unsigned int);
+    ORI_FUNC(cuEventRecord, CUresult, CUevent, CUstream);
+    ORI_FUNC(cuEventRecord_ptsz, CUresult, CUevent, CUstream);
+    ORI_FUNC(cuEventQuery, CUresult, CUevent);
+    ORI_FUNC(cuEventElapsedTime, CUresult, float*, CUevent, CUevent);
+    ORI_FUNC(cuStreamIsCapturing, CUresult, CUstream, CUstreamCaptureStatus*);
+    ORI_FUNC(cuStreamIsCapturing_ptsz, CUresult, CUstream, CUstreamCaptureStatus*);
+    ORI_FUNC(cuEventDestroy, CUresult, CUevent);
 
-    static const std::unordered_map<std::string, HookFuncInfo>& getHookMap() {
-        static const std::unordered_map<std::string, HookFuncInfo> map = {
-            MULTI_CUDA_SYMBOL(cuGetProcAddress, HOOK_SYMBOL(&cuGetProcAddress)),
-            MULTI_CUDA_SYMBOL(cuMemAlloc, HOOK_SYMBOL(&cuMemAlloc)),
-            ADD_CUDA_SYMBOL(cuDeviceGet, HOOK_SYMBOL(&cuDeviceGet)),
-            MULTI_CUDA_SYMBOL(cuMemAllocHost, NO_HOOK),
-            ADD_CUDA_SYMBOL(cuInit, HOOK_SYMBOL(&cuInit)),
-            ADD_CUDA_SYMBOL(cuGetErrorString, NO_HOOK),
-            MULTI_CUDA_SYMBOL(cuMemFree, HOOK_SYMBOL(&cuMemFree)),
-            ADD_CUDA_SYMBOL(cuCtxGetDevice, HOOK_SYMBOL(&cuCtxGetDevice)),
-            ADD_CUDA_SYMBOL(cuCtxSetCurrent, HOOK_SYMBOL(&cuCtxSetCurrent)),
-            MULTI_CUDA_SYMBOL(cuMemGetInfo, HOOK_SYMBOL(&cuMemGetInfo)),
-            MULTI_CUDA_SYMBOL(cuDeviceTotalMem, HOOK_SYMBOL(&cuDeviceTotalMem)),
-            ADD_CUDA_SYMBOL(cuMemGetAllocationGranularity, NO_HOOK),
-            ADD_CUDA_SYMBOL(cuMemAddressReserve, NO_HOOK),
-            ADD_CUDA_SYMBOL(cuMemAddressFree, NO_HOOK),
-            ADD_CUDA_SYMBOL(cuMemCreate, HOOK_SYMBOL(&cuMemCreate)),
-            ADD_CUDA_SYMBOL(cuMemRelease, HOOK_SYMBOL(&cuMemRelease)),
-            ADD_CUDA_SYMBOL(cuMemMap, NO_HOOK),
-            ADD_CUDA_SYMBOL(cuMemUnmap, NO_HOOK),
-        };
+    static constexpr std::string_view kSymbolNames[] = {
+        CUDA_HOOK_SYMBOLS(CUDA_SYMBOL_NAME, MULTI_CUDA_SYMBOL_NAME)
+    };
+    static constexpr hook::SymbolTable<std::size(kSymbolNames)> kSymbolTable{kSymbolNames};
+    static_assert(kSymbolTable.valid(), "cuda hook symbol table has no perfect hash");
+
+    static const std::array<HookFuncInfo, kSymbolTable.size()>& getHookMap() {
+        static const std::array<HookFuncInfo, kSymbolTable.size()> map = {{
+            CUDA_HOOK_SYMBOLS(ADD_CUDA_SYMBOL, MULTI_CUDA_SYMBOL)
+        }};
         return map;
     }
 
+    static constexpr std::string_view kSymbolPrefix = "cu";
+
+    ProcAddressCache& getProcAddressCache() { return proc_address_cache_; }
+
+    SlabAllocator& getSlabAllocator() { return slab_allocator_; }
+
+    MemPoolTracker& getMemPoolTracker() { return mem_pool_tracker_; }
+
+    VmmTracker& getVmmTracker() { return vmm_tracker_; }
+
+    LaunchThrottle& getLaunchThrottle() { return launch_throttle_; }
+
+    LaunchTimer& getLaunchTimer() { return launch_timer_; }
+
+    // Device::DeviceProbe through the driver, for per-device limits
+    static bool probeDevice(int idx, size_t* total_bytes, std::string* uuid);
+
+    // LaunchThrottle::BusyProbe; the driver has no per-process busy time, NVML does
+    static bool probeBusyTime(int idx, uint64_t* busy_ns);
+
     const char* GetSymbolPrefix() const override {
         return symbolPrefixStr;
     }
 private:
     friend class BaseHook<CudaHook>;
-    CudaHook() = default;
+    CudaHook() {
+        bindOriginalSymbols(CUDA_LIBRARY_SO);
+        device_.setDeviceProbe(&CudaHook::probeDevice);
+        launch_throttle_.setBusyProbe(&CudaHook::probeBusyTime);
+        launch_timer_.setEventApi({ori_cuEventCreate, ori_cuEventQuery, ori_cuEventElapsedTime, ori_cuEventDestroy_v2});
+    }
     CudaHook(const CudaHook&) = delete;
     CudaHook& operator=(const CudaHook&) = delete;
 protected:
-    const char* symbolPrefixStr = "cu";    
+    const char* symbolPrefixStr = kSymbolPrefix.data();
+    ProcAddressCache proc_address_cache_{};    
+    SlabAllocator slab_allocator_{util::Config::slabAllocMaxBytes()};
+    MemPoolTracker mem_pool_tracker_{};
+    VmmTracker vmm_tracker_{};
+    LaunchThrottle launch_throttle_{util::Config::computeLimitPercent()};
+    LaunchTimer launch_timer_{util::Config::virtualUtilization()};
 };
 
 
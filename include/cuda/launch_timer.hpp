@@ -0,0 +1,88 @@
+#ifndef CUDA_LAUNCH_TIMER_HPP
+#define CUDA_LAUNCH_TIMER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cuda.h>
+
+// Device time of this process's kernel and graph launches, for utilization
+// reported per container. Each launch is bracketed by a pair of timing events
+// recorded on its stream; a collector thread harvests the pairs that
+// completed every kCollectPeriod and adds their elapsed time to the device's
+// activity in the usage segment. Events are pooled per context and recycled,
+// so a launch costs two cuEventRecord calls. Launches running concurrently on
+// several streams are summed; readers clamp the total to the wall time.
+class LaunchTimer {
+public:
+    struct EventApi {
+        CUresult (*create)(CUevent*, unsigned int) = nullptr;
+        CUresult (*query)(CUevent) = nullptr;
+        CUresult (*elapsed)(float*, CUevent, CUevent) = nullptr;
+        CUresult (*destroy)(CUevent) = nullptr;
+    };
+
+    // cuEventRecord or its per-thread default stream variant, matching the launch
+    using RecordFn = CUresult (*)(CUevent, CUstream);
+
+    static constexpr std::chrono::milliseconds kCollectPeriod{10};
+    // launches in flight that are timed; later ones go unmeasured until the
+    // collector catches up
+    static constexpr std::size_t kMaxPending = 4096;
+
+    struct Span {
+        CUevent start = nullptr;
+        CUevent end = nullptr;
+        CUcontext context = nullptr;
+        int device = 0;
+    };
+
+    explicit LaunchTimer(bool enabled);
+    ~LaunchTimer();
+
+    // set once by the owning hook; timing stays off without the driver's events
+    void setEventApi(const EventApi& api);
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    // record the start of a launch on stream in context ctx of device idx;
+    // the span stays empty when the launch is not timed
+    Span begin(CUcontext ctx, int idx, CUstream stream, RecordFn record);
+
+    // record the end of the launch, whether or not it succeeded
+    void end(const Span& span, CUstream stream, RecordFn record);
+
+    // drop the events of a destroyed context, the driver freed them
+    void forgetContext(CUcontext ctx);
+
+private:
+    LaunchTimer(const LaunchTimer&) = delete;
+    LaunchTimer& operator=(const LaunchTimer&) = delete;
+
+    using EventPair = std::pair<CUevent, CUevent>;
+
+    bool takePair(CUcontext ctx, EventPair* pair);
+    void collect();
+    void startCollector();
+    static void* collectorMain(void* arg);
+    static void resetAfterFork(void* arg);
+
+    std::atomic<bool> enabled_{false}; // turned off by a launching thread if the collector cannot start
+    EventApi api_{};
+    std::atomic<bool> collector_started_{false};
+
+    std::mutex mutex_;
+    std::unordered_map<CUcontext, std::vector<EventPair>> free_pairs_;
+    std::vector<Span> pending_;
+    // contexts forgotten while collect() works on spans it took out of
+    // pending_; their spans are dropped instead of being put back
+    bool collecting_ = false;
+    std::vector<CUcontext> forgotten_;
+};
+
+#endif // CUDA_LAUNCH_TIMER_HPP
@@ -0,0 +1,52 @@
+#ifndef CUDA_MEM_POOL_TRACKER_HPP
+#define CUDA_MEM_POOL_TRACKER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cuda.h>
+
+// Stream-ordered allocations are charged by what their memory pool holds
+// from the device (CU_MEMPOOL_ATTR_RESERVED_MEM_CURRENT), not per call: a
+// pool serves most allocations out of memory it already reserved. The
+// tracker remembers the device and the bytes charged for every pool, and
+// which pool each live pointer came from, so that frees know which pool
+// to look at again. The driver is queried by the hook, not here.
+class MemPoolTracker {
+public:
+    static constexpr int kNoDevice = -1;
+
+    // pool whose memory lives on device, kNoDevice for host pools
+    void addPool(CUmemoryPool pool, int device);
+
+    // forget a destroyed pool; returns the bytes still charged for it
+    size_t removePool(CUmemoryPool pool, int* device);
+
+    // device of pool, added on first sight for pools created before us
+    int deviceOf(CUmemoryPool pool, int fallback_device);
+
+    // record reserved as what pool holds now; returns the change in bytes
+    // charged for it, negative when the pool shrank
+    int64_t observe(CUmemoryPool pool, size_t reserved);
+
+    void track(CUdeviceptr ptr, CUmemoryPool pool);
+
+    // pool ptr was allocated from, false for pointers we never saw
+    bool untrack(CUdeviceptr ptr, CUmemoryPool* pool);
+
+    std::vector<CUmemoryPool> poolsOf(int device) const;
+
+private:
+    struct Pool {
+        int device = kNoDevice;
+        size_t charged = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<CUmemoryPool, Pool> pools_;
+    std::unordered_map<CUdeviceptr, CUmemoryPool> pointers_;
+};
+
+#endif // CUDA_MEM_POOL_TRACKER_HPP
@@ -0,0 +1,45 @@
+#ifndef CUDA_PROC_ADDRESS_CACHE_HPP
+#define CUDA_PROC_ADDRESS_CACHE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <cuda.h>
+
+// Resolution cache for cuGetProcAddress, keyed by (symbol, cudaVersion, flags).
+// Lookups are lock-free and allocation-free; inserts are serialized and a
+// slot is published by its key hash, so a reader never sees a partial entry.
+// Once the table is three quarters full, new results are simply not cached.
+class ProcAddressCache {
+public:
+    struct Entry {
+        void* pfn = nullptr;
+        CUresult result = CUDA_SUCCESS;
+        CUdriverProcAddressQueryResult status = CU_GET_PROC_ADDRESS_SUCCESS;
+    };
+
+    bool lookup(const char* symbol, int cudaVersion, cuuint64_t flags, Entry& entry) const;
+
+    void insert(const char* symbol, int cudaVersion, cuuint64_t flags, const Entry& entry);
+
+private:
+    static constexpr std::size_t kCapacity = 2048; // power of two
+    static constexpr std::size_t kMaxSymbolLength = 64;
+
+    struct Slot {
+        std::atomic<uint64_t> key{0}; // 0 marks an empty slot
+        int cuda_version = 0;
+        cuuint64_t flags = 0;
+        char symbol[kMaxSymbolLength] = {};
+        Entry entry{};
+    };
+
+    static uint64_t keyOf(const char* symbol, std::size_t length, int cudaVersion, cuuint64_t flags);
+
+    std::array<Slot, kCapacity> slots_{};
+    std::mutex mutex_{};
+    std::size_t size_ = 0;
+};
+
+#endif // CUDA_PROC_ADDRESS_CACHE_HPP
@@ -0,0 +1,52 @@
+#ifndef CUDA_VMM_TRACKER_HPP
+#define CUDA_VMM_TRACKER_HPP
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cuda.h>
+
+// Physical memory of the virtual memory management API belongs to the
+// handle from cuMemCreate and stays allocated until the handle is released
+// and no longer mapped anywhere: cuMemRelease of a mapped handle only drops
+// the reference, the last cuMemUnmap frees it. The tracker keeps every
+// mapped range in an interval map, so one handle may be mapped several times
+// and unmaps may cover part of a mapping or several mappings at once, and
+// tells the hook when a released handle's memory is really gone.
+class VmmTracker {
+public:
+    // device memory handle, charged by the hook
+    void addHandle(CUmemGenericAllocationHandle handle);
+
+    // cuMemRelease of handle; true when its memory is gone now, false when
+    // a mapping keeps it alive. Handles we never saw count as gone.
+    bool release(CUmemGenericAllocationHandle handle);
+
+    void map(CUdeviceptr ptr, size_t size, CUmemGenericAllocationHandle handle);
+
+    // drop [ptr, ptr + size) from the mappings; returns the released handles
+    // that were only kept alive by it
+    std::vector<CUmemGenericAllocationHandle> unmap(CUdeviceptr ptr, size_t size);
+
+    // bytes of virtual address space handle is mapped to
+    size_t mappedBytes(CUmemGenericAllocationHandle handle) const;
+
+private:
+    struct Handle {
+        size_t mapped = 0;
+        bool released = false;
+    };
+
+    struct Mapping {
+        CUdeviceptr end;
+        CUmemGenericAllocationHandle handle;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<CUmemGenericAllocationHandle, Handle> handles_;
+    std::map<CUdeviceptr, Mapping> mappings_; // by start address, never overlapping
+};
+
+#endif // CUDA_VMM_TRACKER_HPP
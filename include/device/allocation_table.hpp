@@ -0,0 +1,76 @@
+#ifndef DEVICE_ALLOCATION_TABLE_HPP
+#define DEVICE_ALLOCATION_TABLE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Live allocations keyed by device pointer (or VMM handle).
+// The key space is split over kShards independently locked shards picked by
+// a hash of the pointer, so threads allocating concurrently rarely meet on a
+// lock. Each shard is a flat linear-probing table whose records live inline
+// in one array: inserting a record never allocates, the array only doubles
+// when the shard passes half load. Key 0 is reserved for empty slots.
+// Records may name the context that owns them, to be dropped all at once
+// when it goes away.
+class AllocationTable {
+public:
+    struct Record {
+        uint64_t ptr = 0;
+        uint64_t size = 0;
+        int device = 0;
+        uint64_t context = 0; // owning context, 0 if none
+    };
+
+    static constexpr std::size_t kShards = 64;
+    static constexpr std::size_t kInitialShardCapacity = 32;
+
+    AllocationTable();
+    ~AllocationTable();
+
+    // returns true and the replaced record when ptr was already present
+    bool insert(uint64_t ptr, uint64_t size, int device, Record& replaced, uint64_t context = 0);
+
+    bool erase(uint64_t ptr, Record& removed);
+
+    // remove every record owned by context, appending them to removed;
+    // walks all shards, for teardown paths only
+    std::size_t eraseContext(uint64_t context, std::vector<Record>& removed);
+
+    bool find(uint64_t ptr, Record& record) const;
+
+    std::size_t size() const;
+
+private:
+    AllocationTable(const AllocationTable&) = delete;
+    AllocationTable& operator=(const AllocationTable&) = delete;
+
+    // critical sections are a few probes long, spinning beats parking
+    class SpinLock {
+    public:
+        void lock();
+        void unlock() { locked_.store(false, std::memory_order_release); }
+
+    private:
+        std::atomic<bool> locked_{false};
+    };
+
+    struct alignas(64) Shard {
+        mutable SpinLock lock;
+        std::unique_ptr<Record[]> slots;
+        std::size_t capacity = 0;
+        std::size_t count = 0;
+    };
+
+    static uint64_t hashPointer(uint64_t ptr);
+    Shard& shardOf(uint64_t hash) const;
+    static std::size_t probe(const Shard& shard, uint64_t ptr, uint64_t hash);
+    static void grow(Shard& shard);
+    static void eraseSlot(Shard& shard, std::size_t hole);
+
+    std::unique_ptr<Shard[]> shards_;
+};
+
+#endif // DEVICE_ALLOCATION_TABLE_HPP
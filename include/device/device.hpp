@@ -1,43 +1,107 @@
 #ifndef DEVICE_HPP
 #define DEVICE_HPP
 
-#include <mutex>
-#include <map>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <cuda.h>
 
-#include "util/usage.hpp"
+#include "util/util.hpp"
+#include "device/allocation_table.hpp"
 #include "client/client.hpp"
 
 enum MemOperation {MemAlloc,MemFree};
 
 class Device {
 public:
+    // total memory and UUID of device idx, asked of the driver by the hook
+    // owning this Device; false while the driver cannot answer yet
+    using DeviceProbe = bool (*)(int idx, size_t* total_bytes, std::string* uuid);
+
    Device();
    ~Device();
 
-    struct MemoryBlock {
-        int idx;
-        CUdeviceptr ptr;
-        size_t size;
-    };
-    
+    // set once by the owning hook, before the first limit lookup
+    void setDeviceProbe(DeviceProbe probe);
+
+    // Current device, tracked per thread: the hook derives it from the
+    // thread's current context and records it here. DEVICE_INDEX_CURRENT
+    // arguments below resolve to the calling thread's device.
     void setDeviceId(int);
-    
+
     int getDeviceId();
 
-    void recordAllocation(CUdeviceptr, size_t, int);
+    // Context to device cache: a thread's last context is answered without
+    // a lookup, others from a table shared by all threads; false for a
+    // context never recorded. Contexts are forgotten when they are
+    // destroyed, the driver may hand their address to a new one.
+    bool contextDevice(CUcontext ctx, int* idx) const;
+
+    void setContextDevice(CUcontext ctx, int idx);
+
+    void forgetContext(CUcontext ctx);
+
+    void recordAllocation(CUdeviceptr, size_t, int, CUcontext ctx = nullptr);
 
     void recordFree(CUdeviceptr);
 
 	// get device memory usage
     size_t getDeviceMemoryUsage(int idx = DEVICE_INDEX_CURRENT) const;
 
-    // get device memory limit
+    // get device memory limit, 0 means unlimited; follows config file reloads
     size_t getDeviceMemoryLimit(int idx = DEVICE_INDEX_CURRENT) const;
 
-	// update memory usage
-    void updateMemoryUsage(const MemOperation, CUdeviceptr, size_t size = 0, int idx = DEVICE_INDEX_CURRENT);
+    // admission: charge size bytes against the limit before calling the driver,
+    // then either record the allocation or roll the reservation back
+    bool reserveMemory(size_t size, int idx = DEVICE_INDEX_CURRENT);
+
+    void rollbackMemory(size_t size, int idx = DEVICE_INDEX_CURRENT);
+
+    // charge memory the driver already handed out, whatever the limit
+    void chargeMemory(size_t size, int idx = DEVICE_INDEX_CURRENT);
+
+	// update memory usage; MemAlloc commits a reservation, MemFree releases it.
+	// Allocations recorded with their context go away with it.
+    void updateMemoryUsage(const MemOperation, CUdeviceptr, size_t size = 0, int idx = DEVICE_INDEX_CURRENT,
+                           CUcontext ctx = nullptr);
+
+    // forget a destroyed context and every allocation of it, giving their
+    // bytes back with one usage segment update per device; returns the
+    // device pointers
+    std::vector<CUdeviceptr> releaseContext(CUcontext ctx);
+
+    // Oversubscription: allocations past the limit are served from managed
+    // memory kept on the host, up to (ratio - 1) times the limit (or the
+    // device memory when there is no limit) per process. These blocks are
+    // tracked apart from device memory and never count as device usage.
+    bool oversubscriptionEnabled() const { return oversubscription_ratio_ > 0; }
+
+    bool reserveOversubscribed(size_t size, int idx = DEVICE_INDEX_CURRENT);
+
+    void rollbackOversubscribed(size_t size, int idx = DEVICE_INDEX_CURRENT);
+
+    void recordOversubscribed(CUdeviceptr, size_t, int idx = DEVICE_INDEX_CURRENT, CUcontext ctx = nullptr);
+
+    // bytes of managed memory handed out past the limit
+    size_t getOversubscribedUsage(int idx = DEVICE_INDEX_CURRENT) const;
+
+    // Page-locked host memory (cuMemAllocHost, cuMemHostAlloc,
+    // cuMemHostRegister), charged to the usage segment against one limit for
+    // all hooked processes; tracked by host address until freed or unregistered.
+    bool reservePinnedHost(size_t size);
+
+    void rollbackPinnedHost(size_t size);
+
+    void recordPinnedHost(const void* ptr, size_t size);
+
+    // false when ptr was not pinned through the hook
+    bool releasePinnedHost(const void* ptr);
+
+    // pinned bytes of all hooked processes, and their limit (0 means unlimited)
+    size_t getPinnedHostUsage() const;
+    size_t getPinnedHostLimit() const { return pinned_host_limit_bytes_.load(std::memory_order_relaxed); }
 
     // get device name
     std::string getDeviceName() const;
@@ -46,12 +110,25 @@ private:
     Device& operator=(const Device&) = delete;
 
     // member variables
-    int device_id_ = 0; // device id
-    mutable std::mutex mutex_{}; 
-    size_t device_memory_limit_bytes_ = 0; // 0 means unlimited
+    size_t resolveDeviceMemoryLimit(int idx) const;
+    size_t getOversubscriptionBudget(int idx) const;
+    void reloadLimits();
+    static void onConfigReload(void* arg);
+
+    static constexpr size_t kLimitUnresolved = SIZE_MAX;
+
+    AllocationTable context_devices_{}; // keyed by context, device of each
+    std::atomic<uint64_t> context_generation_{0}; // bumped when a context is forgotten
+    DeviceProbe probe_ = nullptr;
+    mutable std::array<std::atomic<size_t>, DEVICE_MAX_NUM> device_memory_limit_bytes_; // 0 means unlimited
     std::string device_name_ = ""; // device name 
-    util::ProcessUsage& process_usage_;
-    std::map<CUdeviceptr, MemoryBlock> device_memory_blocks_ {};
+    AllocationTable device_memory_blocks_{};
+    double oversubscription_ratio_ = 0; // 0 means disabled
+    mutable std::array<std::atomic<size_t>, DEVICE_MAX_NUM> oversubscription_budget_bytes_;
+    std::array<std::atomic<size_t>, DEVICE_MAX_NUM> oversubscribed_bytes_{};
+    AllocationTable oversubscribed_blocks_{};
+    std::atomic<size_t> pinned_host_limit_bytes_{0}; // 0 means unlimited
+    AllocationTable pinned_host_blocks_{};
 };
 
 
@@ -0,0 +1,74 @@
+#ifndef DEVICE_LAUNCH_THROTTLE_HPP
+#define DEVICE_LAUNCH_THROTTLE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "util/util.hpp"
+
+// Kernel launches throttled to a share of each GPU's time.
+// Every device has a token bucket of GPU time in nanoseconds. A sampler
+// thread credits it with share * elapsed every kSamplePeriod and debits the
+// busy time the process was measured to use in that period; launches wait
+// while the bucket is in debt. Credit is capped at kBurst worth of the share
+// so an idle process cannot save up for a long burst, debt is not, so
+// overuse is paid back in full. Work is measured rather than estimated per
+// launch: the throttle follows what the kernels really cost, one sampling
+// period late.
+class LaunchThrottle {
+public:
+    // cumulative GPU time this process has used on device idx
+    using BusyProbe = bool (*)(int idx, uint64_t* busy_ns);
+
+    static constexpr std::chrono::milliseconds kSamplePeriod{20};
+    static constexpr std::chrono::milliseconds kBurst{100};
+
+    // percent of the GPU's time, 0 disables throttling
+    explicit LaunchThrottle(double percent);
+    ~LaunchThrottle();
+
+    // set once by the owning hook, before the first launch
+    void setBusyProbe(BusyProbe probe) { probe_ = probe; }
+
+    bool enabled() const { return share_.load(std::memory_order_relaxed) > 0; }
+
+    // wait until device idx has credit left; lock-free while it has
+    void acquire(int idx);
+
+    // credit share of elapsed_ns and debit busy_ns
+    void refill(int idx, uint64_t elapsed_ns, uint64_t busy_ns);
+
+    int64_t tokens(int idx) const { return buckets_[idx].tokens.load(std::memory_order_relaxed); }
+
+private:
+    LaunchThrottle(const LaunchThrottle&) = delete;
+    LaunchThrottle& operator=(const LaunchThrottle&) = delete;
+
+    struct Bucket {
+        std::atomic<int64_t> tokens{0};
+        std::atomic<bool> active{false}; // launched on, sampled from then on
+        // sampler thread only
+        bool primed = false;
+        uint64_t last_busy_ns = 0;
+    } __attribute__((aligned(64)));
+
+    void startSampler();
+    static void* samplerMain(void* arg);
+    void sample(uint64_t elapsed_ns);
+    static void resetAfterFork(void* arg);
+
+    std::atomic<double> share_{0}; // dropped to 0 by a launching thread if the sampler cannot start
+    int64_t burst_ns_ = 0;
+    BusyProbe probe_ = nullptr;
+    std::unique_ptr<Bucket[]> buckets_;
+    std::atomic<bool> sampler_started_{false};
+
+    std::mutex wait_mutex_;
+    std::condition_variable refilled_;
+};
+
+#endif // DEVICE_LAUNCH_THROTTLE_HPP
@@ -0,0 +1,92 @@
+#ifndef DEVICE_SLAB_ALLOCATOR_HPP
+#define DEVICE_SLAB_ALLOCATOR_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "util/util.hpp"
+
+// Small device allocations carved out of kSlabSize slabs.
+// Requests are rounded up to a power of two size class; every slab serves a
+// single class on a single device and keeps its free blocks on a stack. The
+// slabs themselves are ordinary allocations of the caller, accounted once
+// each, so the allocator never talks to the driver: it asks for a slab by
+// failing allocate() and hands slabs it no longer needs back from free() and
+// trim(). Each class keeps at most one empty slab around.
+class SlabAllocator {
+public:
+    static constexpr std::size_t kSlabSize = 2ull << 20;
+    static constexpr std::size_t kMinBlockSize = 512;
+    static constexpr std::size_t kMaxBlockSize = kSlabSize / 4;
+
+    // blocks up to max_block_size bytes (rounded to a class), 0 disables
+    explicit SlabAllocator(std::size_t max_block_size);
+    ~SlabAllocator();
+
+    bool enabled() const { return max_block_size_ > 0; }
+    bool handles(std::size_t size) const { return size > 0 && size <= max_block_size_; }
+
+    // a block from a slab with room, false when a new slab is needed
+    bool allocate(int device, std::size_t size, uint64_t* ptr);
+
+    // adopt base (kSlabSize bytes on device) for size's class and take a block from it
+    void addSlab(int device, std::size_t size, uint64_t base, uint64_t* ptr);
+
+    // false when ptr is no block of ours; *released is the base of a slab
+    // that the free left empty and surplus, 0 if none
+    bool free(uint64_t ptr, uint64_t* released);
+
+    // detach every empty slab of device, for the caller to free
+    std::vector<uint64_t> trim(int device);
+
+    // drop the slab at base, whose memory went away with its context, blocks
+    // still handed out included; false when base is no slab of ours
+    bool discard(uint64_t base);
+
+private:
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    static constexpr std::size_t kClasses = 11; // kMinBlockSize .. kMaxBlockSize
+
+    struct Slab {
+        uint64_t base = 0;
+        int device = 0;
+        std::size_t klass = 0;
+        uint32_t used = 0;
+        bool discarded = false;
+        std::vector<uint32_t> free_blocks;
+    };
+
+    // slabs of one class on one device
+    struct Bin {
+        std::mutex lock;
+        std::vector<Slab*> available; // with at least one free block
+        Slab* spare = nullptr;        // the one empty slab kept, also in available
+    };
+
+    static std::size_t classOf(std::size_t size);
+    static std::size_t blockSize(std::size_t klass) { return kMinBlockSize << klass; }
+
+    Bin& binOf(int device, std::size_t klass) { return bins_[device * kClasses + klass]; }
+    static uint64_t takeBlock(Slab& slab);
+    void forget(Slab* slab);
+
+    std::size_t max_block_size_ = 0;
+    std::unique_ptr<Bin[]> bins_;
+
+    // slab by base address, for free()
+    mutable std::shared_mutex index_lock_;
+    std::map<uint64_t, std::unique_ptr<Slab>> index_;
+    // discarded slabs that still had blocks out; a free racing with the
+    // discard may hold one, so they are never deleted
+    std::vector<std::unique_ptr<Slab>> discarded_;
+};
+
+#endif // DEVICE_SLAB_ALLOCATOR_HPP
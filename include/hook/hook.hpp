@@ -1,10 +1,17 @@
 #ifndef HOOK_HPP
 #define HOOK_HPP
-#include <string>
-#include <unordered_map>
-#include <functional>
+#include <dlfcn.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <mutex>
+#include <string_view>
+#include <vector>
 
+#include "spdlog/spdlog.h"
 #include "device/device.hpp"
+#include "hook/symbol_table.hpp"
 
 #define NO_HOOK reinterpret_cast<void*>(static_cast<intptr_t>(-1))
 #define HOOK_SYMBOL(x) reinterpret_cast<void*>(x)
@@ -21,7 +28,7 @@ class BaseHook {
 public:
     struct HookFuncInfo {
         void* hookedFunc;
-        std::function<void(Derived&, void*)> original;
+        void (*original)(Derived&, void*);
     };
 
     static Derived& getInstance() {
@@ -29,25 +36,98 @@ public:
         return instance;
     }
 
-    static HookFuncInfo getHookedSymbol(const std::string& symbolName) {
-        const auto& map = Derived::getHookMap();
-        if (auto it = map.find(symbolName);it != map.end()) {
-            return it->second;
+    // nullptr when the symbol is not in the hook table
+    static const HookFuncInfo* getHookedSymbol(std::string_view symbolName) {
+        const int idx = Derived::kSymbolTable.find(symbolName);
+        if (idx == Derived::kSymbolTable.kNotFound) {
+            return nullptr;
         }
-        return { nullptr, nullptr };
+        return &Derived::getHookMap()[idx];
     }
 
     Device& getDevice() { return device_; }
 
+    // original entry point resolved for a hook table index, nullptr if unbound
+    void* getBoundSymbol(int idx) const {
+        if (idx < 0 || idx >= static_cast<int>(bound_symbols_.size())) {
+            return nullptr;
+        }
+        return bound_symbols_[idx].load(std::memory_order_acquire);
+    }
+
+    // hook table index whose original entry point is symbol, or kNotFound
+    int findBoundSymbol(const void* symbol) const {
+        for (std::size_t i = 0; i < bound_symbols_.size(); ++i) {
+            if (bound_symbols_[i].load(std::memory_order_acquire) == symbol) {
+                return static_cast<int>(i);
+            }
+        }
+        return Derived::kSymbolTable.kNotFound;
+    }
+
+    // adopt an original entry point found through the application's own handle
+    // for a symbol the eager binding could not resolve. Callers race through
+    // dlsym and cuGetProcAddress: the first binds the ori_* pointer, and only
+    // then publishes the slot, so whoever sees it bound can call through it.
+    void adoptOriginalSymbol(int idx, void* symbol) {
+        if (!symbol || idx < 0 || idx >= static_cast<int>(bound_symbols_.size()) ||
+            getBoundSymbol(idx) != nullptr) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(adopt_mutex_);
+        if (bound_symbols_[idx].load(std::memory_order_relaxed) != nullptr) {
+            return;
+        }
+        Derived::getHookMap()[idx].original(static_cast<Derived&>(*this), symbol);
+        bound_symbols_[idx].store(symbol, std::memory_order_release);
+    }
+
     virtual const char* GetSymbolPrefix() const = 0;
 protected:
     BaseHook() = default;
     BaseHook(const BaseHook&) = delete;
     BaseHook& operator=(const BaseHook&) = delete;
 
+    // Resolve the ori_* pointer of every hook table symbol in one pass through a
+    // single library handle, so hooked entry points never check them per call.
+    // Later names win, which binds MULTI entries to the versioned symbol
+    // whenever the library exports it.
+    void bindOriginalSymbols(const char* library) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto& map = Derived::getHookMap();
+        bound_symbols_ = std::vector<std::atomic<void*>>(map.size());
+
+        library_handle_ = dlopen(library, RTLD_LAZY | RTLD_LOCAL);
+        if (!library_handle_) {
+            spdlog::error("dlopen {} failed while binding original symbols: {}", library, dlerror());
+            return;
+        }
+
+        std::size_t bound = 0;
+        for (std::size_t i = 0; i < map.size(); ++i) {
+            const auto name = Derived::kSymbolTable.name(i);
+            void* symbol = real_dlsym(library_handle_, name.data());
+            if (!symbol) {
+                spdlog::trace("Original symbol {} not exported by {}", name, library);
+                continue;
+            }
+
+            map[i].original(static_cast<Derived&>(*this), symbol);
+            bound_symbols_[i].store(symbol, std::memory_order_release);
+            ++bound;
+        }
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        spdlog::debug("Bound {}/{} original symbols from {} in {} us", bound, map.size(), library, elapsed.count());
+    }
+
     // class var member
     Device device_;
     char* symbolPrefixStr = nullptr;
+    void* library_handle_ = nullptr; // kept open for the process lifetime
+    std::vector<std::atomic<void*>> bound_symbols_{}; // sized once, before any adoption
+    std::mutex adopt_mutex_;
 };
 
 #endif
@@ -0,0 +1,164 @@
+#ifndef HOOK_SYMBOL_TABLE_HPP
+#define HOOK_SYMBOL_TABLE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace hook {
+
+// Cheap rotate-xor fold over the symbol name, usable both at compile time and
+// on the dlsym path; the seeded finalizer below does the actual mixing.
+constexpr uint64_t hashSymbol(std::string_view name) {
+    uint64_t hash = name.size();
+    for (char ch : name) {
+        hash = ((hash << 7) | (hash >> 57)) ^ static_cast<unsigned char>(ch);
+    }
+    return hash;
+}
+
+// splitmix64 finalizer; the high half picks the bucket, the low half the slot
+constexpr uint64_t mixSymbolHash(uint64_t hash) {
+    uint64_t z = hash + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+constexpr std::size_t nextPowerOfTwo(std::size_t value) {
+    std::size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Perfect hash (hash-and-displace) over a fixed set of symbol names.
+// The whole table is built at compile time; find() hashes the name once,
+// does two array reads and a single string compare, and never allocates.
+// Duplicate names are allowed and resolve to their first occurrence.
+template <std::size_t N>
+class SymbolTable {
+public:
+    static constexpr int kNotFound = -1;
+    static constexpr std::size_t kBuckets = N / 2 + 1;
+    static constexpr std::size_t kSlots = nextPowerOfTwo(N * 2);
+
+    constexpr explicit SymbolTable(const std::string_view (&names)[N]) {
+        for (std::size_t i = 0; i < N; ++i) {
+            names_[i] = names[i];
+            hashes_[i] = mixSymbolHash(hashSymbol(names[i]));
+        }
+        for (auto& slot : slots_) {
+            slot = kNotFound;
+        }
+
+        std::array<std::size_t, kBuckets> bucket_size{};
+        std::size_t max_size = 0;
+        for (std::size_t i = 0; i < N; ++i) {
+            if (isDuplicate(i)) {
+                continue;
+            }
+            const std::size_t size = ++bucket_size[bucketOf(hashes_[i])];
+            max_size = size > max_size ? size : max_size;
+        }
+
+        // place the most crowded buckets first, they are the hardest to fit
+        for (std::size_t size = max_size; size > 0; --size) {
+            for (std::size_t bucket = 0; bucket < kBuckets; ++bucket) {
+                if (bucket_size[bucket] == size && !placeBucket(bucket)) {
+                    valid_ = false;
+                    return;
+                }
+            }
+        }
+    }
+
+    constexpr int find(std::string_view name) const {
+        const uint64_t hash = mixSymbolHash(hashSymbol(name));
+        const int idx = slots_[slotOf(hash, seeds_[bucketOf(hash)])];
+        if (idx == kNotFound || names_[idx] != name) {
+            return kNotFound;
+        }
+        return idx;
+    }
+
+    constexpr std::string_view name(std::size_t idx) const { return names_[idx]; }
+
+    // false for aliases that repeat an earlier name (e.g. MULTI_* without a versioned macro)
+    constexpr bool isCanonical(std::size_t idx) const { return !isDuplicate(idx); }
+
+    constexpr bool valid() const { return valid_; }
+
+    static constexpr std::size_t size() { return N; }
+
+private:
+    static constexpr uint32_t kMaxSeed = 1u << 16;
+
+    static constexpr std::size_t bucketOf(uint64_t hash) {
+        return static_cast<std::size_t>((hash >> 32) % kBuckets);
+    }
+
+    // displacement d = (d0, d1) packed into the seed: slot = f1 + d0 * f2 + d1
+    static constexpr std::size_t slotOf(uint64_t hash, uint32_t seed) {
+        const uint64_t f1 = hash & 0xffff;
+        const uint64_t f2 = ((hash >> 16) & 0xffff) | 1;
+        return static_cast<std::size_t>((f1 + (seed >> 8) * f2 + (seed & 0xff)) & (kSlots - 1));
+    }
+
+    constexpr bool isDuplicate(std::size_t idx) const {
+        for (std::size_t i = 0; i < idx; ++i) {
+            if (names_[i] == names_[idx]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    constexpr bool placeBucket(std::size_t bucket) {
+        for (uint32_t seed = 0; seed < kMaxSeed; ++seed) {
+            std::array<std::size_t, N> taken{};
+            std::size_t count = 0;
+            bool fits = true;
+
+            for (std::size_t i = 0; i < N && fits; ++i) {
+                if (isDuplicate(i) || bucketOf(hashes_[i]) != bucket) {
+                    continue;
+                }
+                const std::size_t slot = slotOf(hashes_[i], seed);
+                if (slots_[slot] != kNotFound) {
+                    fits = false;
+                }
+                for (std::size_t j = 0; j < count && fits; ++j) {
+                    fits = taken[j] != slot;
+                }
+                taken[count++] = slot;
+            }
+
+            if (!fits) {
+                continue;
+            }
+
+            count = 0;
+            for (std::size_t i = 0; i < N; ++i) {
+                if (!isDuplicate(i) && bucketOf(hashes_[i]) == bucket) {
+                    slots_[taken[count++]] = static_cast<int>(i);
+                }
+            }
+            seeds_[bucket] = seed;
+            return true;
+        }
+        return false;
+    }
+
+    std::array<std::string_view, N> names_{};
+    std::array<uint64_t, N> hashes_{};
+    std::array<uint32_t, kBuckets> seeds_{};
+    std::array<int, kSlots> slots_{};
+    bool valid_ = true;
+};
+
+} // namespace hook
+
+#endif // HOOK_SYMBOL_TABLE_HPP
@@ -0,0 +1,43 @@
+#ifndef NVML_DEVICE_HANDLE_CACHE_HPP
+#define NVML_DEVICE_HANDLE_CACHE_HPP
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <nvml.h>
+
+#include "util/util.hpp"
+
+// NVML device handles with their index and UUID, so that queries naming a
+// device by handle are answered without asking NVML which device it is.
+// NVML hands out one handle per device that stays the same for the life of
+// the process, hence entries are never replaced. Entry i belongs to device
+// index i and is published by storing its handle last; lookups scan the
+// entries without locks.
+class DeviceHandleCache {
+public:
+    // record handle as device index; the first record of an index wins
+    void add(unsigned int index, nvmlDevice_t handle, const char* uuid);
+
+    // index of handle, false for a handle never added
+    bool indexOf(nvmlDevice_t handle, unsigned int* index) const;
+
+    // handle of device index, nullptr while unknown
+    nvmlDevice_t handleOf(unsigned int index) const;
+
+    // UUID of device index, empty while unknown or when NVML had none
+    std::string uuidOf(unsigned int index) const;
+
+private:
+    enum State : int { kEmpty, kWriting, kReady };
+
+    struct Entry {
+        std::atomic<int> state{kEmpty};
+        std::atomic<nvmlDevice_t> handle{nullptr};
+        char uuid[NVML_DEVICE_UUID_V2_BUFFER_SIZE] = {};
+    };
+
+    std::array<Entry, DEVICE_MAX_NUM> entries_{};
+};
+
+#endif // NVML_DEVICE_HANDLE_CACHE_HPP
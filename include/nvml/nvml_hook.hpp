@@ -3,18 +3,37 @@
 
 #include <nvml.h>
 #include "hook/hook.hpp"
+#include "nvml/device_handle_cache.hpp"
 #include "client/client.hpp"
+#include "util/config.hpp"
 #include "util/util.hpp"
 
 #define NVML_LIBRARY_SO "libnvidia-ml.so.1"
 
+// Hooked symbols, expanded for both the name table and the HookFuncInfo entries
+#define NVML_HOOK_SYMBOLS(SINGLE) \
+    SINGLE(nvmlErrorString, NO_HOOK) \
+    SINGLE(nvmlDeviceGetMemoryInfo, HOOK_SYMBOL(&nvmlDeviceGetMemoryInfo)) \
+    SINGLE(nvmlDeviceGetMemoryInfo_v2, HOOK_SYMBOL(&nvmlDeviceGetMemoryInfo_v2)) \
+    SINGLE(nvmlDeviceGetName, HOOK_SYMBOL(&nvmlDeviceGetName)) \
+    SINGLE(nvmlDeviceGetUtilizationRates, HOOK_SYMBOL(&nvmlDeviceGetUtilizationRates)) \
+    SINGLE(nvmlDeviceGetIndex, NO_HOOK) \
+    SINGLE(nvmlDeviceGetHandleByIndex_v2, NO_HOOK) \
+    SINGLE(nvmlDeviceGetUUID, NO_HOOK) \
+    SINGLE(nvmlInit_v2, HOOK_SYMBOL(&nvmlInit_v2)) \
+    SINGLE(nvmlDeviceGetCount_v2, NO_HOOK) \
+    SINGLE(nvmlDeviceGetProcessUtilization, NO_HOOK)
+
+#define NVML_SYMBOL_NAME(symbol, hook_ptr) std::string_view{#symbol},
+
 #define ADD_NVML_SYMBOL(symbol, hook_ptr) \
-    {#symbol, { \
+    HookFuncInfo{ \
         hook_ptr, \
         [](NvmlHook& hook, void* ptr) { \
-            hook.CAT(ori_, EVAL(symbol)) = reinterpret_cast<NvmlHook::CAT(EVAL(symbol), _func_ptr)>(ptr); \
+            hook.CAT(ori_, EVAL(symbol)).store(reinterpret_cast<NvmlHook::CAT(EVAL(symbol), _func_ptr)>(ptr), \
+                                               std::memory_order_release); \
         } \
-    }}
+    },
 
 
 class NvmlHook : public BaseHook<NvmlHook> {
@@ -24,29 +43,56 @@ public:
     ORI_FUNC(nvmlDeviceGetMemoryInfo, nvmlReturn_t, nvmlDevice_t, nvmlMemory_t*);
     ORI_FUNC(nvmlDeviceGetMemoryInfo_v2, nvmlReturn_t, nvmlDevice_t, nvmlMemory_v2_t*);
     ORI_FUNC(nvmlDeviceGetName, nvmlReturn_t, nvmlDevice_t, char*, unsigned int);
+    ORI_FUNC(nvmlDeviceGetUtilizationRates, nvmlReturn_t, nvmlDevice_t, nvmlUtilization_t*);
     ORI_FUNC(nvmlDeviceGetIndex, nvmlReturn_t, nvmlDevice_t, unsigned int *);
+    ORI_FUNC(nvmlDeviceGetHandleByIndex_v2, nvmlReturn_t, unsigned int, nvmlDevice_t*);
+    ORI_FUNC(nvmlDeviceGetUUID, nvmlReturn_t, nvmlDevice_t, char*, unsigned int);
+    ORI_FUNC(nvmlInit_v2, nvmlReturn_t);
+    ORI_FUNC(nvmlDeviceGetCount_v2, nvmlReturn_t, unsigned int*);
+    ORI_FUNC(nvmlDeviceGetProcessUtilization, nvmlReturn_t, nvmlDevice_t, nvmlProcessUtilizationSample_t*,
+             unsigned int*, unsigned long long);
+
+    static constexpr std::string_view kSymbolNames[] = {
+        NVML_HOOK_SYMBOLS(NVML_SYMBOL_NAME)
+    };
+    static constexpr hook::SymbolTable<std::size(kSymbolNames)> kSymbolTable{kSymbolNames};
+    static_assert(kSymbolTable.valid(), "nvml hook symbol table has no perfect hash");
 
-    static const std::unordered_map<std::string, HookFuncInfo>& getHookMap() {
-        static const std::unordered_map<std::string, HookFuncInfo> map = {
-            ADD_NVML_SYMBOL(nvmlErrorString, NO_HOOK),
-            ADD_NVML_SYMBOL(nvmlDeviceGetMemoryInfo, HOOK_SYMBOL(&nvmlDeviceGetMemoryInfo)),
-            ADD_NVML_SYMBOL(nvmlDeviceGetMemoryInfo_v2, HOOK_SYMBOL(&nvmlDeviceGetMemoryInfo_v2)),
-            ADD_NVML_SYMBOL(nvmlDeviceGetName, HOOK_SYMBOL(&nvmlDeviceGetName)),
-            ADD_NVML_SYMBOL(nvmlDeviceGetIndex, NO_HOOK),
-        };
+    static const std::array<HookFuncInfo, kSymbolTable.size()>& getHookMap() {
+        static const std::array<HookFuncInfo, kSymbolTable.size()> map = {{
+            NVML_HOOK_SYMBOLS(ADD_NVML_SYMBOL)
+        }};
         return map;
     }
 
+    static constexpr std::string_view kSymbolPrefix = "nvml";
+
+    // Device::DeviceProbe through NVML, for per-device limits
+    static bool probeDevice(int idx, size_t* total_bytes, std::string* uuid);
+
+    // LaunchThrottle::BusyProbe from the process utilization samples
+    static bool probeBusyTime(int idx, uint64_t* busy_ns);
+
+    DeviceHandleCache& getDeviceHandleCache() { return device_handles_; }
+
+    // GPU utilization from the launches of the processes of our container
+    bool virtualUtilization() const { return virtual_utilization_; }
+
     const char* GetSymbolPrefix() const override {
         return symbolPrefixStr;
     }
 private:
     friend class BaseHook<NvmlHook>;
-    NvmlHook() = default;
+    NvmlHook() {
+        bindOriginalSymbols(NVML_LIBRARY_SO);
+        device_.setDeviceProbe(&NvmlHook::probeDevice);
+    }
     NvmlHook(const NvmlHook&) = delete;
     NvmlHook& operator=(const NvmlHook&) = delete; 
+    DeviceHandleCache device_handles_{};
+    bool virtual_utilization_ = util::Config::virtualUtilization();
 protected:
-    const char* symbolPrefixStr = "nvml";   
+    const char* symbolPrefixStr = kSymbolPrefix.data();   
 };
 
 #endif
\ No newline at end of file
@@ -1,21 +1,149 @@
 #ifndef UTIL_CONFIG_HPP
 #define UTIL_CONFIG_HPP
 
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
 
 namespace util {
 
+// A device memory limit, either absolute or a share of the device's memory.
+struct MemoryLimit {
+    std::size_t bytes = 0;
+    double percent = 0; // (0, 100], used when bytes is 0
+
+    bool isSet() const { return bytes > 0 || percent > 0; }
+    bool isRelative() const { return bytes == 0 && percent > 0; }
+
+    // limit in bytes for a device of total_bytes, 0 if it cannot be resolved
+    std::size_t resolve(std::size_t total_bytes) const;
+};
+
+// Limits per device: by UUID first, then by device index, then the default.
+struct DeviceMemoryLimits {
+    MemoryLimit fallback;
+    std::map<int, MemoryLimit> by_index;
+    std::map<std::string, MemoryLimit> by_uuid; // normalized, see normalizeUuid
+
+    // nullptr when no limit applies; uuid may be empty when it is unknown
+    const MemoryLimit* find(int idx, const std::string& uuid) const;
+
+    // whether resolving a limit needs the device's UUID or total memory
+    bool needsDeviceInfo() const;
+};
+
 class Config {
 public:
     // Returns configured memory limit (bytes) from config file or environment.
     static std::size_t memoryLimitBytes();
 
+    // Per-device memory limits from config file or environment:
+    //   memory_limit: 20g                    # every device, absolute or "50%"
+    //   device_memory_limits:                # or VCUDA_DEVICE_MEMORY_LIMITS=0=70g,GPU-...=50%
+    //     0: 70g
+    //     GPU-3f1b2c4d-...: 50%
+    // The limits of the current snapshot, kept alive as long as the caller holds them.
+    static std::shared_ptr<const DeviceMemoryLimits> deviceMemoryLimits();
+
+    // Limits of single containers, by container id (see containerId), that
+    // replace the ones above for that container's processes. Config file only,
+    // published by the node agent:
+    //   containers:
+    //     training-0:
+    //       memory_limit: 40g
+    //       device_memory_limits:
+    //         1: 20g
+    using ContainerMemoryLimits = std::map<std::string, DeviceMemoryLimits>;
+    static std::shared_ptr<const ContainerMemoryLimits> containerMemoryLimits();
+
+    // Quota lease chunk (VCUDA_QUOTA_LEASE / quota_lease, e.g. "256m"); 0 disables leasing.
+    static std::size_t quotaLeaseBytes();
+
+    // How long published usage may lag behind a leasing process, and how long
+    // an idle lease is kept (VCUDA_QUOTA_LEASE_STALENESS_MS / quota_lease_staleness_ms).
+    static std::chrono::milliseconds quotaLeaseStaleness();
+
+    // Oversubscription (VCUDA_OVERSUBSCRIPTION_RATIO / oversubscription_ratio,
+    // e.g. 1.5): allocations past the device limit fall back to managed memory
+    // until limit * ratio bytes are allocated; 0 when disabled.
+    static double oversubscriptionRatio();
+
+    // Largest cuMemAlloc served from the in-hook slab pool (VCUDA_SLAB_ALLOC_MAX /
+    // slab_alloc_max, e.g. "64k"); 0 disables pooling.
+    static std::size_t slabAllocMaxBytes();
+
+    // Page-locked host memory all hooked processes on the node may hold
+    // (VCUDA_HOST_PINNED_LIMIT / host_pinned_limit, e.g. "16g"); 0 is unlimited.
+    static std::size_t hostPinnedLimitBytes();
+
+    // Share of each GPU's time this process may keep busy with kernels
+    // (VCUDA_COMPUTE_LIMIT / compute_limit, e.g. "30%"); 0 when unthrottled.
+    static double computeLimitPercent();
+
+    // Launch scheduling priority (VCUDA_PRIORITY / priority): launches of a
+    // process wait while one with a higher priority has the device. 0, the
+    // default, never holds a device.
+    static std::size_t launchPriority();
+
+    // How long a prioritized process holds a device after its last launch
+    // (VCUDA_TIME_SLICE_MS / time_slice_ms).
+    static std::chrono::milliseconds timeSlice();
+
+    // GPU utilization reported by NVML computed from the device time of the
+    // processes of our container instead of the whole GPU's
+    // (VCUDA_VIRTUAL_UTILIZATION / virtual_utilization, "1" or "true").
+    static bool virtualUtilization();
+
+    // Capacities of the node-wide usage segment when this process creates it
+    // (VCUDA_USAGE_MAX_PROCESSES / usage_max_processes, VCUDA_USAGE_MAX_DEVICES /
+    // usage_max_devices); 0 picks the default. Later processes use the creator's.
+    static std::size_t usageMaxProcesses();
+    static std::size_t usageMaxDevices();
+
+    // Name of the usage segment under /dev/shm (VCUDA_USAGE_SEGMENT,
+    // vcuda_usage otherwise); the hooked processes and the agent of a node
+    // must agree on it. Environment only: the segment gates the config file.
+    static std::string usageSegmentName();
+
+    // Identity of the container the process runs in, shared by the processes
+    // whose device time is reported together (VCUDA_CONTAINER_ID, the host
+    // name of the container's UTS namespace otherwise). Environment only.
+    static std::string containerId();
+
+    // lower case without the "GPU-" prefix, so both spellings match
+    static std::string normalizeUuid(const std::string& uuid);
+
     // Returns configured target device name from config file or environment.
     static std::string targetDeviceName();
 
+    // Hot reload. The config file (VCUDA_CONFIG_FILE, default
+    // /etc/vcuda/config.yaml) is watched with inotify by a thread started with
+    // the first listener. Every change that parses is published as a new
+    // snapshot, generation() moves on, then the listeners run on that thread;
+    // a file that fails to parse or goes missing keeps the previous snapshot.
+    // The accessors above always answer from the current snapshot, it is up
+    // to their callers to read them again.
+    using ReloadListener = void (*)(void* arg);
+    static void addReloadListener(ReloadListener listener, void* arg);
+    static void removeReloadListener(ReloadListener listener, void* arg);
+
+    // start the watcher unless it runs, again in a forked child
+    static void watchConfigFile();
+
+    // Asked once, before the config file is first read: false skips the
+    // file for the life of the process, as if it did not exist, and nothing
+    // is watched. Set by the hook while a node agent owns the configuration.
+    using FileGate = bool (*)();
+    static void setFileGate(FileGate gate);
+
+    static uint64_t generation();
+
 private:
     static std::string getEnv(const char* name);
     static std::size_t parseByteSize(const std::string& value);
+    static MemoryLimit parseMemoryLimit(const std::string& value);
 };
 
 } // namespace util
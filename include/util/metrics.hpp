@@ -0,0 +1,207 @@
+#ifndef UTIL_METRICS_HPP
+#define UTIL_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Hooked APIs with call metrics. Append only: the position is the index in
+// the shared segment, readers match on the names stored in the header.
+#define VCUDA_METRIC_APIS(X) \
+    X(cuGetProcAddress) \
+    X(cuInit) \
+    X(cuMemAlloc) \
+    X(cuDeviceGet) \
+    X(cuMemFree) \
+    X(cuCtxGetDevice) \
+    X(cuCtxSetCurrent) \
+    X(cuMemGetInfo) \
+    X(cuDeviceTotalMem) \
+    X(cuMemCreate) \
+    X(cuMemRelease) \
+    X(cuMemMap) \
+    X(cuMemUnmap) \
+    X(cuMemAllocHost) \
+    X(cuMemHostAlloc) \
+    X(cuMemFreeHost) \
+    X(cuMemHostRegister) \
+    X(cuMemHostUnregister) \
+    X(cuMemAllocAsync) \
+    X(cuMemAllocFromPoolAsync) \
+    X(cuMemFreeAsync) \
+    X(cuMemPoolCreate) \
+    X(cuMemPoolDestroy) \
+    X(cuMemPoolTrimTo) \
+    X(cuCtxDestroy) \
+    X(cuDevicePrimaryCtxRetain) \
+    X(cuDevicePrimaryCtxRelease) \
+    X(cuDevicePrimaryCtxReset) \
+    X(cuLaunchKernel) \
+    X(cuLaunchKernelEx) \
+    X(cuGraphLaunch) \
+    X(nvmlInit_v2) \
+    X(nvmlDeviceGetMemoryInfo) \
+    X(nvmlDeviceGetMemoryInfo_v2) \
+    X(nvmlDeviceGetName) \
+    X(nvmlDeviceGetUtilizationRates)
+
+// cuda.h maps several of these names to their _v2 symbols through macros;
+// pasting keeps the ids stable whether or not it is included
+#define VCUDA_METRIC_ID(name) util::ApiId::api_##name
+
+namespace util {
+
+enum class ApiId : uint16_t {
+#define VCUDA_METRIC_ENUM(name) api_##name,
+    VCUDA_METRIC_APIS(VCUDA_METRIC_ENUM)
+#undef VCUDA_METRIC_ENUM
+    Count
+};
+
+// Per-API call count, error count and latency histogram, recorded into
+// per-thread blocks of a shared memory segment
+// (/dev/shm/vcuda_metrics.<pid>.<random>, unique across pid namespaces).
+// Each thread owns its block, so recording is a handful of relaxed
+// load/store pairs without locks or atomic read-modify-writes; a reader maps
+// the segment and merges the blocks while the process runs. Histogram
+// buckets are log2 octaves split into four linear sub-buckets (HDR style).
+// The segment only exists while VCUDA_METRICS is set: 1/on/true collects
+// from the start, any other value exports the segment with collection off.
+// Either way it can be toggled at runtime through the enabled flag in the
+// segment header. The owner holds a write lock on byte 0 of the segment for
+// its lifetime; a segment nobody holds is stale, whatever pid namespace the
+// owner lived in.
+class Metrics {
+public:
+    static constexpr uint32_t kMagic = 0x544d4356; // "VCMT"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint32_t kMaxApis = 128;
+    static constexpr uint32_t kApiNameLength = 48;
+    static constexpr uint32_t kBuckets = 128;
+    static constexpr uint32_t kMaxThreads = 256;
+
+    struct ApiCounters {
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> total_ns;
+        std::atomic<uint64_t> buckets[kBuckets];
+    };
+
+    struct ThreadBlock {
+        ApiCounters apis[static_cast<std::size_t>(ApiId::Count)];
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t api_count;
+        uint32_t bucket_count;
+        uint32_t max_threads;
+        uint32_t block_size;
+        pid_t pid;
+        std::atomic<uint32_t> enabled;
+        std::atomic<uint32_t> blocks_used; // high water mark of claimed blocks
+        char api_names[kMaxApis][kApiNameLength];
+    } __attribute__((aligned(64)));
+
+    // merged view of one process, as returned to readers
+    struct ApiSnapshot {
+        std::string name;
+        uint64_t calls = 0;
+        uint64_t errors = 0;
+        uint64_t total_ns = 0;
+        std::array<uint64_t, kBuckets> buckets{};
+
+        // lower bound of the bucket holding the given quantile (0..1)
+        uint64_t percentileNs(double quantile) const;
+    };
+
+    static Metrics& getInstance();
+
+    bool enabled() const { return header_->enabled.load(std::memory_order_relaxed) != 0; }
+
+    void setEnabled(bool enabled);
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return steadyNowNs();
+#endif
+    }
+
+    void record(ApiId api, uint64_t start, bool error);
+
+    static uint32_t bucketOf(uint64_t ns);
+    static uint64_t bucketLowerBoundNs(uint32_t bucket);
+
+    // reader side: the segments of processes with this pid (one per pid
+    // namespace sharing /dev/shm), then merge all thread blocks of one
+    static std::vector<std::string> findSegments(pid_t pid);
+    static bool readSnapshot(const std::string& segment, std::vector<ApiSnapshot>& snapshot);
+    static bool setEnabled(const std::string& segment, bool enabled);
+
+    // unlink segments left behind by processes that did not exit cleanly
+    static std::size_t pruneStaleSegments();
+
+private:
+    Metrics();
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    void open();
+    static void reopenAfterFork(void* arg);
+    static uint64_t steadyNowNs();
+    uint64_t ticksToNs(uint64_t ticks);
+    void calibrate();
+    ThreadBlock* threadBlock(bool& exclusive);
+
+    Header* header_ = nullptr;
+    ThreadBlock* blocks_ = nullptr;
+    std::size_t mapped_size_ = 0;
+    std::string segment_name_; // empty without a shared segment
+    int segment_fd_ = -1;      // kept open, closing it would drop the lock
+    std::atomic<uint64_t> ns_per_tick_q32_{0}; // fixed point, 0 until calibrated
+};
+
+// Times one hooked call; every return of the wrapper goes through finish()
+// so that non-zero CUresult/nvmlReturn_t codes are counted as errors.
+class ApiScope {
+public:
+    explicit ApiScope(ApiId api)
+        : api_(api), start_(Metrics::getInstance().enabled() ? Metrics::now() : 0) {}
+
+    ~ApiScope() {
+        if (start_) {
+            Metrics::getInstance().record(api_, start_, false);
+        }
+    }
+
+    template <typename Result>
+    Result finish(Result result) {
+        if (start_) {
+            Metrics::getInstance().record(api_, start_, result != 0);
+            start_ = 0;
+        }
+        return result;
+    }
+
+private:
+    ApiScope(const ApiScope&) = delete;
+    ApiScope& operator=(const ApiScope&) = delete;
+
+    ApiId api_;
+    uint64_t start_;
+};
+
+} // namespace util
+
+#endif // UTIL_METRICS_HPP
@@ -0,0 +1,18 @@
+#ifndef UTIL_THREAD_HPP
+#define UTIL_THREAD_HPP
+
+namespace util {
+
+// Start a detached helper thread named name (15 characters at most). Every
+// signal is blocked on it, so the application's handlers never run there.
+// false when the thread could not be created.
+bool startDetachedThread(const char* name, void* (*main)(void*), void* arg);
+
+// Run handler(arg) in the child after every fork, in registration order.
+// Registering the same pair again does nothing.
+using ForkHandler = void (*)(void* arg);
+void atForkChild(ForkHandler handler, void* arg);
+
+} // namespace util
+
+#endif // UTIL_THREAD_HPP
@@ -1,10 +1,12 @@
 #ifndef UTIL_DEFINDE
 #define UTIL_DEFINDE 
 
+#include <atomic>
+
 #define MACRO_TAG_YES 1
 #define MACRO_TAG_NO  0
 
-#define DEVICE_MAX_NUM 8
+#define DEVICE_MAX_NUM 64
 #define DEVICE_INDEX_CURRENT -1
 
 #define likely(x)       __builtin_expect(!!(x), 1)
@@ -19,8 +21,9 @@
 #define CAT(a, b) CAT_IMPL(a, b)
 #define CAT_IMPL(a, b) a##b
 
+// bound once, or adopted later from another thread; calls load it atomically
 #define ORI_FUNC(name, return_type, ...) \
     using CAT(EVAL(name), _func_ptr) = return_type (*)(__VA_ARGS__); \
-    CAT(EVAL(name), _func_ptr) CAT(ori_, EVAL(name)) = nullptr;
+    std::atomic<CAT(EVAL(name), _func_ptr)> CAT(ori_, EVAL(name)){nullptr};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,338 @@
+#include "agent/agent.hpp"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "client/client.hpp"
+#include "spdlog/spdlog.h"
+#include "util/config.hpp"
+#include "util/logger.hpp"
+
+namespace {
+    struct LoggerInitializer {
+        LoggerInitializer() {
+            util::Logger::init();
+        }
+    };
+
+    LoggerInitializer g_logger_initializer;
+
+    volatile sig_atomic_t g_stop = 0;
+
+    constexpr size_t kMaxRequest = 256;
+
+    bool fillAddress(const std::string& path, sockaddr_un* address) {
+        if (path.size() >= sizeof(address->sun_path)) {
+            spdlog::error("Socket path {} is too long", path);
+            return false;
+        }
+        std::memset(address, 0, sizeof(*address));
+        address->sun_family = AF_UNIX;
+        std::memcpy(address->sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    bool writeAll(int fd, const std::string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            const ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    UsageSegment::PolicyEntry makeEntry(int32_t index, const util::MemoryLimit& limit) {
+        UsageSegment::PolicyEntry entry{};
+        entry.index = index;
+        entry.bytes = limit.bytes;
+        entry.percent = limit.percent;
+        return entry;
+    }
+
+    // the entries of limits, for every container when container is empty
+    void addEntries(const util::DeviceMemoryLimits& limits, const std::string& container,
+                    std::vector<UsageSegment::PolicyEntry>* entries) {
+        const auto add = [&](UsageSegment::PolicyEntry entry) {
+            std::memcpy(entry.container, container.c_str(), container.size() + 1);
+            entries->push_back(entry);
+        };
+        if (limits.fallback.isSet()) {
+            add(makeEntry(UsageSegment::kPolicyDefault, limits.fallback));
+        }
+        for (const auto& [idx, limit] : limits.by_index) {
+            add(makeEntry(idx, limit));
+        }
+        for (const auto& [uuid, limit] : limits.by_uuid) {
+            auto entry = makeEntry(UsageSegment::kPolicyByUuid, limit);
+            if (uuid.size() >= sizeof(entry.uuid)) {
+                spdlog::warn("Device UUID {} is too long, its limit is not published", uuid);
+                continue;
+            }
+            std::memcpy(entry.uuid, uuid.c_str(), uuid.size() + 1);
+            add(entry);
+        }
+    }
+}
+
+namespace agent {
+
+NodeAgent::NodeAgent(std::string socket_path) : socket_path_(std::move(socket_path)) {}
+
+NodeAgent::~NodeAgent() {
+    if (listen_fd_ >= 0) {
+        util::Config::removeReloadListener(onConfigReload, this);
+        close(listen_fd_);
+        unlink(socket_path_.c_str());
+    }
+}
+
+bool NodeAgent::start() {
+    size_t max_processes = util::Config::usageMaxProcesses();
+    size_t max_devices = util::Config::usageMaxDevices();
+    max_processes = std::clamp<size_t>(max_processes ? max_processes : UsageSegment::kDefaultMaxProcesses,
+                                       1, UsageSegment::kMaxProcesses);
+    max_devices = std::clamp<size_t>(max_devices ? max_devices : UsageSegment::kDefaultMaxDevices,
+                                     1, DEVICE_MAX_NUM);
+
+    const std::string segment_name = util::Config::usageSegmentName();
+    if (!segment_.open(segment_name.c_str(), max_processes, max_devices)) {
+        spdlog::error("Cannot open the usage segment {}", segment_name);
+        return false;
+    }
+    if (!segment_.acquireAgentLease()) {
+        spdlog::error("Another agent owns the usage segment {}", segment_name);
+        return false;
+    }
+
+    sockaddr_un address;
+    if (!fillAddress(socket_path_, &address)) {
+        return false;
+    }
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        spdlog::error("socket: {}", std::strerror(errno));
+        return false;
+    }
+    // we own the segment, so a socket left at the path is a dead agent's
+    unlink(socket_path_.c_str());
+    if (bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd_, 16) != 0) {
+        spdlog::error("Cannot listen on {}: {}", socket_path_, std::strerror(errno));
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+
+    publishPolicy();
+    util::Config::addReloadListener(onConfigReload, this);
+    util::Config::watchConfigFile();
+    spdlog::info("Agent of {} listening on {}, {} processes, {} devices",
+                 segment_name, socket_path_, segment_.maxProcesses(), segment_.maxDevices());
+    return true;
+}
+
+void NodeAgent::onConfigReload(void* arg) {
+    static_cast<NodeAgent*>(arg)->publishPolicy();
+}
+
+// Runs at start and on the config watcher thread; the hooked processes pick
+// the new generation up within a reaper interval.
+void NodeAgent::publishPolicy() {
+    std::vector<UsageSegment::PolicyEntry> entries;
+    addEntries(*util::Config::deviceMemoryLimits(), "", &entries);
+    for (const auto& [container, limits] : *util::Config::containerMemoryLimits()) {
+        if (container.size() >= UsageSegment::kPolicyContainerSize) {
+            spdlog::warn("Container id {} is too long, its limits are not published", container);
+            continue;
+        }
+        addEntries(limits, container, &entries);
+    }
+    if (entries.size() > UsageSegment::kMaxPolicyEntries) {
+        spdlog::warn("{} memory limits, only the first {} are published", entries.size(), UsageSegment::kMaxPolicyEntries);
+    }
+
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    segment_.writePolicy(util::Config::hostPinnedLimitBytes(), entries);
+    spdlog::info("Published policy generation {}: {} memory limits",
+                 segment_.policy().generation.load(std::memory_order_relaxed), entries.size());
+}
+
+int NodeAgent::run() {
+    auto last_reclaim = std::chrono::steady_clock::now();
+    const auto interval = std::chrono::duration_cast<std::chrono::milliseconds>(REAPER_INTERVAL);
+    while (!g_stop) {
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        const int ready = poll(&pfd, 1, static_cast<int>(interval.count()));
+        if (ready < 0 && errno != EINTR) {
+            spdlog::error("poll: {}", std::strerror(errno));
+            return 1;
+        }
+        if (ready > 0) {
+            if (const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC); fd >= 0) {
+                serve(fd);
+                close(fd);
+            }
+        }
+
+        if (const auto now = std::chrono::steady_clock::now(); now - last_reclaim >= interval) {
+            last_reclaim = now;
+            reclaim();
+        }
+    }
+    spdlog::info("Agent stopping");
+    return 0;
+}
+
+void NodeAgent::stop() {
+    g_stop = 1;
+}
+
+void NodeAgent::reclaim() const {
+    segment_.lock();
+    const int reclaimed = segment_.reclaimDeadSlots(Client::kNoSlot);
+    segment_.unlock();
+    if (reclaimed > 0) {
+        spdlog::info("Reclaimed {} slots of exited processes", reclaimed);
+    }
+}
+
+// one line in, the answer out; a client that stalls for a second is dropped
+void NodeAgent::serve(int fd) const {
+    const timeval timeout{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[kMaxRequest];
+    while (request.find('\n') == std::string::npos && request.size() < kMaxRequest) {
+        const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        request.append(buffer, static_cast<size_t>(n));
+    }
+    request = request.substr(0, request.find('\n'));
+    writeAll(fd, answer(request));
+}
+
+std::string NodeAgent::answer(const std::string& request) const {
+    if (request == "usage") {
+        return usageReport();
+    }
+    if (request == "processes") {
+        return processReport();
+    }
+    if (request == "policy") {
+        return policyReport();
+    }
+    return "error unknown request, expected usage, processes or policy\n";
+}
+
+// bytes in use by all containers, the unused quota leases left out
+std::string NodeAgent::usageReport() const {
+    std::string report;
+    for (int idx = 0; idx < static_cast<int>(segment_.maxDevices()); ++idx) {
+        size_t used = 0;
+        for (int group = 0; group < static_cast<int>(segment_.maxProcesses()); ++group) {
+            if (__atomic_load_n(&segment_.groupContainer(group), __ATOMIC_ACQUIRE) == 0) {
+                continue;
+            }
+            const auto snapshot = segment_.snapshot(group, idx);
+            used += snapshot.usage > snapshot.lease_free ? snapshot.usage - snapshot.lease_free : 0;
+        }
+        report += "device " + std::to_string(idx) + " used " + std::to_string(used) + "\n";
+    }
+    report += "host pinned " + std::to_string(segment_.host().pinned.load(std::memory_order_relaxed)) + "\n";
+    return report;
+}
+
+std::string NodeAgent::processReport() const {
+    std::string report;
+    for (int slot = 0; slot < static_cast<int>(segment_.maxProcesses()); ++slot) {
+        const pid_t pid = __atomic_load_n(&segment_.processId(slot), __ATOMIC_ACQUIRE);
+        if (pid == 0) {
+            continue;
+        }
+        report += "slot " + std::to_string(slot) + " pid " + std::to_string(pid);
+        for (int idx = 0; idx < static_cast<int>(segment_.maxDevices()); ++idx) {
+            if (const size_t charged = __atomic_load_n(&segment_.charged(idx)[slot], __ATOMIC_RELAXED); charged > 0) {
+                report += " device " + std::to_string(idx) + " " + std::to_string(charged);
+            }
+        }
+        report += " host pinned " + std::to_string(__atomic_load_n(&segment_.hostPinned(slot), __ATOMIC_RELAXED)) + "\n";
+    }
+    return report;
+}
+
+std::string NodeAgent::policyReport() const {
+    UsageSegment::PolicySnapshot snapshot;
+    if (!segment_.readPolicy(&snapshot)) {
+        return "error policy is being written\n";
+    }
+
+    std::string report = "generation " + std::to_string(snapshot.generation) + "\n";
+    for (const auto& entry : snapshot.entries) {
+        if (const size_t length = strnlen(entry.container, sizeof(entry.container)); length > 0) {
+            report += "container " + std::string(entry.container, length) + " ";
+        }
+        if (entry.index == UsageSegment::kPolicyDefault) {
+            report += "default";
+        } else if (entry.index == UsageSegment::kPolicyByUuid) {
+            report += "uuid " + std::string(entry.uuid, strnlen(entry.uuid, sizeof(entry.uuid)));
+        } else {
+            report += "device " + std::to_string(entry.index);
+        }
+        report += entry.bytes > 0 ? " bytes " + std::to_string(entry.bytes) : " percent " + std::to_string(entry.percent);
+        report += "\n";
+    }
+    report += "host pinned limit " + std::to_string(snapshot.host_pinned_limit) + "\n";
+    return report;
+}
+
+bool NodeAgent::query(const std::string& socket_path, const std::string& request, std::string* reply) {
+    sockaddr_un address;
+    if (!fillAddress(socket_path, &address)) {
+        return false;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    bool answered = false;
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 &&
+        writeAll(fd, request + "\n")) {
+        shutdown(fd, SHUT_WR);
+        reply->clear();
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) {
+                reply->append(buffer, static_cast<size_t>(n));
+            }
+        }
+        answered = n == 0;
+    }
+    close(fd);
+    return answered;
+}
+
+} // namespace agent
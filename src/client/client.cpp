@@ -1,16 +1,19 @@
-
-
 #include <fcntl.h>
-#include <sys/mman.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <signal.h>
-#include <fstream>
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <thread>
 
 #include "client/client.hpp"
 #include "spdlog/spdlog.h"
+#include "util/config.hpp"
 #include "util/logger.hpp"
+#include "util/thread.hpp"
 
 namespace {
     struct LoggerInitializer {
@@ -19,22 +22,93 @@ namespace {
         }
     };
 
-    bool isProcessExists(pid_t pid) {
-        if (pid <= 0) {
-            return false;
+    LoggerInitializer g_logger_initializer;
+
+    // The usage segment of the process, attached when it already exists. The
+    // config gate may look into it before the Client exists; both share this
+    // mapping, which stays for good: closing any descriptor of the segment
+    // file would drop every slot lease the process holds on it.
+    UsageSegment& nodeSegment() {
+        static UsageSegment* segment = [] {
+            auto* attached = new UsageSegment();
+            attached->attach(util::Config::usageSegmentName().c_str());
+            return attached;
+        }();
+        return *segment;
+    }
+
+    // With a policy published by the node agent the config file is the
+    // agent's: processes take their limits from the segment instead.
+    bool readConfigFile() {
+        const UsageSegment& segment = nodeSegment();
+        return !segment.valid() || !segment.hasPolicy();
+    }
+
+    struct ConfigFileGate {
+        ConfigFileGate() {
+            util::Config::setFileGate(readConfigFile);
         }
-        
-        std::string path = "/proc/" + std::to_string(pid);
-        std::ifstream proc_dir(path);
-        if (proc_dir.good()) {
-            // Double-check with kill syscall
-            return (kill(pid, 0) == 0 || errno == EPERM);
+    };
+
+    ConfigFileGate g_config_file_gate;
+
+    std::atomic<bool> g_reaper_started{false};
+
+    // add size to an admission counter unless that would pass limit (0: unlimited)
+    bool chargeCounter(std::atomic<size_t>& counter, size_t size, size_t limit) {
+        if (limit == 0) {
+            counter.fetch_add(size, std::memory_order_relaxed);
+            return true;
         }
-        
-        return false;
+
+        size_t current = counter.load(std::memory_order_relaxed);
+        do {
+            if (current + size > limit || current + size < current) {
+                return false;
+            }
+        } while (!counter.compare_exchange_weak(current, current + size, std::memory_order_relaxed));
+        return true;
     }
 
-    LoggerInitializer g_logger_initializer;
+    constexpr int kClaimUntilBits = 48;
+    constexpr uint64_t kClaimUntilMask = (uint64_t{1} << kClaimUntilBits) - 1;
+    constexpr uint64_t kMaxLaunchPriority = 0xffff;
+
+    uint64_t claimPriority(uint64_t claim) { return claim >> kClaimUntilBits; }
+    uint64_t claimUntil(uint64_t claim) { return claim & kClaimUntilMask; }
+    uint64_t packClaim(uint64_t priority, uint64_t until_us) {
+        return (priority << kClaimUntilBits) | (until_us & kClaimUntilMask);
+    }
+
+    // the same clock in every process of the node
+    uint64_t monotonicMicros() {
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000 + static_cast<uint64_t>(now.tv_nsec) / 1000;
+    }
+
+    constexpr uint64_t kActivityBusyMask = (uint64_t{1} << UsageSegment::kActivityBusyBits) - 1;
+
+    uint64_t activityTag(uint64_t second) { return second << UsageSegment::kActivityBusyBits; }
+
+    // FNV-1a; 0 marks a slot without a process
+    uint64_t containerHash(const std::string& id) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const unsigned char ch : id) {
+            hash = (hash ^ ch) * 0x100000001b3ull;
+        }
+        return hash != 0 ? hash : 1;
+    }
+
+    // shared futex, the segment is mapped by other processes
+    void futexWait(std::atomic<uint32_t>& word, uint32_t expected, uint64_t timeout_us) {
+        const timespec timeout{static_cast<time_t>(timeout_us / 1000000), static_cast<long>(timeout_us % 1000000) * 1000};
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    }
+
+    void futexWakeAll(std::atomic<uint32_t>& word) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
 }
 
 Client& Client::getInstance() {
@@ -42,149 +116,597 @@ Client& Client::getInstance() {
     return client;
 }
 
-Client::Client() {
+Client::Client() : segment_(nodeSegment()) {
     create_or_attach_process_metric_data();
+
+    quota_lease_bytes_ = util::Config::quotaLeaseBytes();
+    quota_lease_staleness_ = util::Config::quotaLeaseStaleness();
+    if (quota_lease_bytes_ > 0) {
+        spdlog::debug("Quota leases of {} bytes, staleness {} ms", quota_lease_bytes_, quota_lease_staleness_.count());
+    }
+
+    launch_priority_ = std::min<uint64_t>(util::Config::launchPriority(), kMaxLaunchPriority);
+    time_slice_us_ = std::chrono::duration_cast<std::chrono::microseconds>(util::Config::timeSlice()).count();
+    if (launch_priority_ > 0) {
+        spdlog::debug("Launch priority {}, time slice {} us", launch_priority_, time_slice_us_);
+    }
+    container_id_ = util::Config::containerId();
+    container_ = containerHash(container_id_);
+
+    util::atForkChild(reset_after_fork, this);
 }
 
+// The mapping stays: the reaper and other threads may still use it while
+// the process exits. Our slot is handed back right away instead of waiting
+// for a reaper elsewhere to notice the dropped lease.
 Client::~Client() {
-    if (process_metric_data_ != nullptr) {
-        munmap(static_cast<void*>(process_metric_data_), SHM_SIZE);
-        process_metric_data_ = nullptr;
+    drop_launch_claims();
+
+    const int slot = self_slot_.load(std::memory_order_acquire);
+    if (slot != kNoSlot && segment_.valid()) {
+        lock_process_metric_data();
+        segment_.releaseSlot(slot);
+        unlock_process_metric_data();
     }
 }
 
-// create or attach shared memory
+// Fork copies neither our slot lease nor the reaper thread: the child takes
+// a slot of its own on its first allocation.
+void Client::reset_after_fork(void* arg) {
+    auto& client = *static_cast<Client*>(arg);
+    client.self_slot_.store(kNoSlot, std::memory_order_relaxed);
+    for (auto& lease : client.quota_leases_) {
+        lease.available.store(0, std::memory_order_relaxed); // charged to the parent's slot
+    }
+    g_reaper_started.store(false, std::memory_order_relaxed);
+    for (auto& claim : client.launch_claims_) {
+        claim.store(0, std::memory_order_relaxed); // the parent's to drop
+    }
+}
+
+// create or attach shared memory, unless the config gate attached it
+// already; the capacities only matter when we create it
 void Client::create_or_attach_process_metric_data() {
-    if (process_metric_data_ != nullptr){
-        return;
+    if (!segment_.valid()) {
+        open_process_metric_data();
     }
 
-    int fd = shm_open(SHM_NAME, O_RDWR, 0666);
-    if (fd == -1) {
-        fd = shm_open(SHM_NAME, O_CREAT | O_RDWR | O_EXCL, 0666);
-        if (fd == -1) {
-            perror("shm_open create");
+    device_count_ = static_cast<int>(std::min<uint32_t>(segment_.maxDevices(), DEVICE_MAX_NUM));
+    if (device_count_ < static_cast<int>(segment_.maxDevices())) {
+        spdlog::warn("Usage segment tracks {} devices, this build at most {}", segment_.maxDevices(), DEVICE_MAX_NUM);
+    }
+}
+
+void Client::open_process_metric_data() {
+    size_t max_processes = util::Config::usageMaxProcesses();
+    size_t max_devices = util::Config::usageMaxDevices();
+    max_processes = std::clamp<size_t>(max_processes ? max_processes : UsageSegment::kDefaultMaxProcesses,
+                                       1, UsageSegment::kMaxProcesses);
+    max_devices = std::clamp<size_t>(max_devices ? max_devices : UsageSegment::kDefaultMaxDevices,
+                                     1, DEVICE_MAX_NUM);
+
+    if (!segment_.open(util::Config::usageSegmentName().c_str(), max_processes, max_devices)) {
+        spdlog::error("Usage of other processes is not visible, limits apply to this process only");
+        if (!segment_.openPrivate(max_processes, max_devices)) {
+            perror("mmap");
             std::exit(EXIT_FAILURE);
         }
     }
+}
+
+void Client::lock_process_metric_data() {
+    segment_.lock();
+}
+
+void Client::unlock_process_metric_data() {
+    segment_.unlock();
+}
+
+// Give the slots whose lease was dropped back. Caller holds the lock.
+bool Client::reclaim_dead_process_slots() {
+    return segment_.reclaimDeadSlots(self_slot_.load(std::memory_order_relaxed)) > 0;
+}
+
+// Slot of this process, claimed on first use and cached: the first slot whose
+// lease we can take. process_id is informational only, pids differ between
+// namespaces.
+int Client::claim_process_slot() {
+    if (const int self = self_slot_.load(std::memory_order_acquire); likely(self != kNoSlot)) {
+        return self;
+    }
+
+    lock_process_metric_data();
+    int self = self_slot_.load(std::memory_order_relaxed);
+    if (self == kNoSlot) {
+        reclaim_dead_process_slots();
+        for (int slot = 0; slot < static_cast<int>(segment_.maxProcesses()) && self == kNoSlot; ++slot) {
+            if (segment_.processId(slot) == 0 && segment_.acquireSlotLease(slot)) {
+                self = slot;
+            }
+        }
+        if (self != kNoSlot) {
+            // there are as many groups as slots and a group has a slot, so
+            // the container finds one whenever it finds a slot
+            group_ = segment_.claimGroup(container_);
+            __atomic_store_n(&segment_.group(self), static_cast<uint32_t>(group_), __ATOMIC_RELAXED);
+            __atomic_store_n(&segment_.processId(self), getpid(), __ATOMIC_RELEASE);
+            __atomic_store_n(&segment_.timestamp(self), time(nullptr), __ATOMIC_RELAXED);
+            __atomic_store_n(&segment_.container(self), container_, __ATOMIC_RELAXED);
+            self_slot_.store(self, std::memory_order_release);
+        } else {
+            spdlog::error("No free usage slot for process {}, at most {} processes per node",
+                          getpid(), segment_.maxProcesses());
+        }
+    }
+    unlock_process_metric_data();
 
-    if (ftruncate(fd, SHM_SIZE) == -1) {
-        perror("ftruncate");
-        close(fd);
-        std::exit(EXIT_FAILURE);
+    if (self != kNoSlot) {
+        start_reaper();
+        util::Config::watchConfigFile(); // after fork the child's first claim lands here
     }
+    return self;
+}
 
-    void* ptr = mmap(nullptr, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    close(fd);
-    if (ptr == MAP_FAILED) {
-        perror("mmap");
-        std::exit(EXIT_FAILURE);
+void Client::start_reaper() {
+    if (g_reaper_started.exchange(true, std::memory_order_acq_rel)) {
+        return;
     }
 
-    process_metric_data_ = static_cast<MultiProcessMetricData*>(ptr);
-    bool expected = false;
-    if (process_metric_data_->initialized.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
-        std::memset(process_metric_data_, 0, SHM_SIZE);
+    if (!util::startDetachedThread("vcuda-reaper", reaper_main, this)) {
+        spdlog::warn("Failed to start the usage reaper, dead processes are reclaimed on allocation failure only");
+    }
+}
 
-        pthread_mutexattr_t attr;
-        pthread_mutexattr_init(&attr);
-        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
-        pthread_mutex_init(&process_metric_data_->lock, &attr);
-        pthread_mutexattr_destroy(&attr);
+// Reclaims dead slots and looks for a new policy every REAPER_INTERVAL; with
+// quota leases it also wakes once per staleness period to publish and return
+// idle leases.
+void* Client::reaper_main(void* arg) {
+    auto* client = static_cast<Client*>(arg);
+    uint64_t policy_notified = client->policy_generation();
+    const auto tick = client->quota_lease_bytes_ > 0
+        ? std::min<std::chrono::milliseconds>(client->quota_lease_staleness_, REAPER_INTERVAL)
+        : std::chrono::duration_cast<std::chrono::milliseconds>(REAPER_INTERVAL);
+
+    auto since_reclaim = std::chrono::milliseconds(0);
+    for (;;) {
+        std::this_thread::sleep_for(tick);
+
+        if (client->quota_lease_bytes_ > 0) {
+            client->tick_quota_leases();
+        }
 
-        process_metric_data_->initialized.store(true, std::memory_order_release);
-    } else {
-        while (!process_metric_data_->initialized.load(std::memory_order_acquire)) {
-            sched_yield();
+        since_reclaim += tick;
+        if (since_reclaim >= REAPER_INTERVAL) {
+            since_reclaim = std::chrono::milliseconds(0);
+            client->lock_process_metric_data();
+            client->reclaim_dead_process_slots();
+            client->unlock_process_metric_data();
+
+            if (const uint64_t generation = client->policy_generation(); generation != policy_notified) {
+                policy_notified = generation;
+                client->notify_policy_listeners();
+            }
         }
     }
+    return nullptr;
 }
 
-size_t Client::get_device_process_metric_data(int idx){
-    size_t summary = 0;
-    if (process_metric_data_ == nullptr) {
-        return summary;
-    }
+uint64_t Client::policy_generation() const {
+    return segment_.valid() ? segment_.policy().generation.load(std::memory_order_acquire) : 0;
+}
 
-    if(int rc = pthread_mutex_lock(&process_metric_data_->lock); rc == EOWNERDEAD){
-        pthread_mutex_consistent(&process_metric_data_->lock);
+// Entries become limits the way Config builds them from a file, those of our
+// container instead of the node-wide ones if there are any; a torn read keeps
+// the previous generation until the next call.
+bool Client::refresh_policy() {
+    const uint64_t generation = policy_generation();
+    std::lock_guard<std::mutex> lock(policy_mutex_);
+    if (generation == policy_seen_) {
+        return false;
     }
 
-    for (int i = 0; i < MAX_PROCESS_NUM; ++i) {
-        auto& entry = process_metric_data_->usage[i];
+    UsageSegment::PolicySnapshot snapshot;
+    if (!segment_.readPolicy(&snapshot) || snapshot.generation == 0) {
+        return false;
+    }
 
-        if (entry.process_id == 0) {
+    auto node_limits = std::make_shared<util::DeviceMemoryLimits>();
+    auto container_limits = std::make_shared<util::DeviceMemoryLimits>();
+    bool container_listed = false;
+    for (const auto& entry : snapshot.entries) {
+        const std::string container(entry.container, strnlen(entry.container, sizeof(entry.container)));
+        if (!container.empty() && container != container_id_) {
             continue;
         }
+        container_listed |= !container.empty();
+        auto& limits = container.empty() ? node_limits : container_limits;
 
-        if (!isProcessExists(entry.process_id)) {
-            entry.process_id = 0;
-            entry.clearUsage();
+        util::MemoryLimit limit;
+        limit.bytes = entry.bytes;
+        limit.percent = entry.percent;
+        if (!limit.isSet()) {
             continue;
         }
+        if (entry.index == UsageSegment::kPolicyDefault) {
+            limits->fallback = limit;
+        } else if (entry.index == UsageSegment::kPolicyByUuid) {
+            limits->by_uuid[std::string(entry.uuid, strnlen(entry.uuid, sizeof(entry.uuid)))] = limit;
+        } else if (entry.index >= 0) {
+            limits->by_index[entry.index] = limit;
+        }
+    }
+    policy_limits_ = container_listed ? std::move(container_limits) : std::move(node_limits);
+    policy_host_pinned_limit_ = snapshot.host_pinned_limit;
+    policy_seen_ = snapshot.generation;
+    spdlog::debug("Node agent policy generation {}: {} memory limits, pinned host memory limit {} bytes",
+                  snapshot.generation, snapshot.entries.size(), snapshot.host_pinned_limit);
+    return true;
+}
+
+std::shared_ptr<const util::DeviceMemoryLimits> Client::policy_memory_limits() {
+    refresh_policy();
+    std::lock_guard<std::mutex> lock(policy_mutex_);
+    return policy_limits_;
+}
+
+bool Client::policy_host_pinned_limit(size_t* limit) {
+    refresh_policy();
+    std::lock_guard<std::mutex> lock(policy_mutex_);
+    if (!policy_limits_) {
+        return false;
+    }
+    *limit = policy_host_pinned_limit_;
+    return true;
+}
+
+void Client::add_policy_listener(PolicyListener listener, void* arg) {
+    std::lock_guard<std::mutex> lock(policy_listeners_mutex_);
+    policy_listeners_.emplace_back(listener, arg);
+}
+
+void Client::remove_policy_listener(PolicyListener listener, void* arg) {
+    std::lock_guard<std::mutex> lock(policy_listeners_mutex_);
+    for (auto it = policy_listeners_.begin(); it != policy_listeners_.end(); ++it) {
+        if (it->first == listener && it->second == arg) {
+            policy_listeners_.erase(it);
+            return;
+        }
+    }
+}
+
+void Client::notify_policy_listeners() {
+    std::lock_guard<std::mutex> lock(policy_listeners_mutex_);
+    for (const auto& [listener, arg] : policy_listeners_) {
+        listener(arg);
+    }
+}
+
+bool Client::try_charge_device(int idx, size_t size, size_t limit) {
+    return chargeCounter(segment_.device(group_, idx).usage, size, limit);
+}
+
+// The device counter is charged before the process slot: a process dying in
+// between leaks the reservation until restart rather than letting the
+// reclaimer subtract bytes that were never added, so the limit stays strict.
+bool Client::charge_device_memory(int slot, int idx, size_t size, size_t limit) {
+    if (!try_charge_device(idx, size, limit)) {
+        lock_process_metric_data();
+        const bool reclaimed = reclaim_dead_process_slots();
+        unlock_process_metric_data();
+
+        if (!reclaimed || !try_charge_device(idx, size, limit)) {
+            return false;
+        }
+    }
+
+    __atomic_fetch_add(&segment_.charged(idx)[slot], size, __ATOMIC_RELAXED);
+    return true;
+}
+
+void Client::uncharge_device_memory(int slot, int idx, size_t size) {
+    __atomic_fetch_sub(&segment_.charged(idx)[slot], size, __ATOMIC_RELAXED);
+    segment_.device(group_, idx).usage.fetch_sub(size, std::memory_order_relaxed);
+}
+
+// the group keeps the sum of its published leases, so readers need no scan
+void Client::publish_quota_lease(int slot, int idx) {
+    const size_t available = quota_leases_[idx].available.load(std::memory_order_relaxed);
+    const size_t previous = __atomic_exchange_n(&segment_.leaseFree(idx)[slot], available, __ATOMIC_RELAXED);
+    if (available != previous) {
+        segment_.device(group_, idx).lease_free.fetch_add(available - previous, std::memory_order_relaxed);
+    }
+}
+
+// give back whatever unused lease exceeds keep bytes
+void Client::return_quota_lease(int slot, int idx, size_t keep) {
+    auto& lease = quota_leases_[idx];
+    size_t available = lease.available.load(std::memory_order_relaxed);
+    while (available > keep && !lease.available.compare_exchange_weak(available, keep, std::memory_order_relaxed)) {
+    }
+
+    const uint32_t sequence = segment_.beginUpdate(group_, idx);
+    if (available > keep) {
+        uncharge_device_memory(slot, idx, available - keep);
+    }
+    publish_quota_lease(slot, idx);
+    segment_.endUpdate(group_, idx, sequence);
+}
+
+void Client::tick_quota_leases() {
+    const int slot = self_slot_.load(std::memory_order_acquire);
+    if (slot == kNoSlot) {
+        return;
+    }
+
+    for (int idx = 0; idx < device_count_; ++idx) {
+        auto& lease = quota_leases_[idx];
+        if (!lease.touched.exchange(false, std::memory_order_relaxed)) {
+            return_quota_lease(slot, idx, 0);
+        } else {
+            publish_quota_lease(slot, idx);
+        }
+    }
+}
+
+void Client::return_quota_leases() {
+    const int slot = self_slot_.load(std::memory_order_acquire);
+    if (slot == kNoSlot || quota_lease_bytes_ == 0) {
+        return;
+    }
+
+    for (int idx = 0; idx < device_count_; ++idx) {
+        quota_leases_[idx].suspended.store(true, std::memory_order_relaxed);
+        return_quota_lease(slot, idx, 0);
+    }
+}
+
+// Usage of our container. Unused lease counts as charged in the group's usage
+// but not as used memory; both come from one consistent snapshot, without a
+// lock or a syscall. Before our first charge the group is looked up, a
+// container without one uses nothing.
+size_t Client::get_device_process_metric_data(int idx){
+    if (!segment_.valid() || !valid_device(idx)) {
+        return 0;
+    }
+
+    const int group =
+        self_slot_.load(std::memory_order_acquire) != kNoSlot ? group_ : segment_.findGroup(container_);
+    if (group < 0) {
+        return 0;
+    }
+    const auto snapshot = segment_.snapshot(group, idx);
+    return snapshot.usage > snapshot.lease_free ? snapshot.usage - snapshot.lease_free : 0;
+}
+
+bool Client::reserve_device_memory(int idx, size_t size, size_t limit) {
+    if (!segment_.valid() || !valid_device(idx)) {
+        return true;
+    }
+
+    const int slot = claim_process_slot();
+    if (slot == kNoSlot) {
+        return false;
+    }
+
+    if (quota_lease_bytes_ == 0) {
+        return charge_device_memory(slot, idx, size, limit);
+    }
+
+    auto& lease = quota_leases_[idx];
+    lease.touched.store(true, std::memory_order_relaxed);
+
+    size_t available = lease.available.load(std::memory_order_relaxed);
+    while (available >= size) {
+        if (lease.available.compare_exchange_weak(available, available - size, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
 
-        summary += entry.getUsage(idx);
+    // refill with a whole chunk, charged and published in one section so that
+    // the chunk never shows up as used; close to the limit, charge exactly
+    // what is asked, reclaiming dead processes if need be
+    if (size <= SIZE_MAX - quota_lease_bytes_) {
+        const uint32_t sequence = segment_.beginUpdate(group_, idx);
+        const bool refilled = try_charge_device(idx, size + quota_lease_bytes_, limit);
+        if (refilled) {
+            __atomic_fetch_add(&segment_.charged(idx)[slot], size + quota_lease_bytes_, __ATOMIC_RELAXED);
+            lease.available.fetch_add(quota_lease_bytes_, std::memory_order_relaxed);
+            publish_quota_lease(slot, idx);
+        }
+        segment_.endUpdate(group_, idx, sequence);
+        if (refilled) {
+            resume_quota_lease(idx);
+            return true;
+        }
+    }
+    if (!charge_device_memory(slot, idx, size, limit)) {
+        lease.suspended.store(true, std::memory_order_relaxed);
+        return false;
     }
-    pthread_mutex_unlock(&process_metric_data_->lock);
+    resume_quota_lease(idx);
+    return true;
+}
 
-    return summary;
+void Client::resume_quota_lease(int idx) {
+    auto& lease = quota_leases_[idx];
+    if (unlikely(lease.suspended.load(std::memory_order_relaxed))) {
+        lease.suspended.store(false, std::memory_order_relaxed);
+    }
 }
-void Client::update_process_metric_data(util::ProcessUsage& usage){
-    if (process_metric_data_ == nullptr) {
-        spdlog::error("process_metric_data_ is null");
+
+void Client::release_device_memory(int idx, size_t size) {
+    if (!segment_.valid() || !valid_device(idx)) {
+        return;
+    }
+
+    const int slot = self_slot_.load(std::memory_order_acquire);
+    if (slot == kNoSlot) {
+        return;
+    }
+
+    if (quota_lease_bytes_ == 0) {
+        uncharge_device_memory(slot, idx, size);
         return;
     }
 
-    if(int rc = pthread_mutex_lock(&process_metric_data_->lock); rc == EOWNERDEAD){
-        pthread_mutex_consistent(&process_metric_data_->lock);
+    // freed bytes stay charged as lease, beyond two chunks the surplus goes
+    // back; while the device is refused to us, all of them go back
+    if (unlikely(quota_leases_[idx].suspended.load(std::memory_order_relaxed))) {
+        uncharge_device_memory(slot, idx, size);
+        return;
     }
+    const size_t available = quota_leases_[idx].available.fetch_add(size, std::memory_order_relaxed) + size;
+    if (available > 2 * quota_lease_bytes_) {
+        return_quota_lease(slot, idx, quota_lease_bytes_);
+    }
+}
 
-    // update current process id
-    if (usage.process_id == 0) {
-        usage.process_id = getpid();
+// Same order as charge_device_memory: the node counter first, then the slot.
+// Pinning is a syscall per call already, so there are no leases here.
+bool Client::reserve_host_memory(size_t size, size_t limit) {
+    if (!segment_.valid()) {
+        return true;
     }
 
-    int self_slot = -1;
-    int free_slot = -1;
-    // find usage slot
-    for (int i = 0; i < MAX_PROCESS_NUM; ++i) {
-        auto& entry = process_metric_data_->usage[i];
+    const int slot = claim_process_slot();
+    if (slot == kNoSlot) {
+        return false;
+    }
 
-        if (entry.process_id == 0) {
-            if (free_slot == -1) {
-                free_slot = i;
-            }
-            continue;
+    auto& pinned = segment_.host().pinned;
+    if (!chargeCounter(pinned, size, limit)) {
+        lock_process_metric_data();
+        const bool reclaimed = reclaim_dead_process_slots();
+        unlock_process_metric_data();
+
+        if (!reclaimed || !chargeCounter(pinned, size, limit)) {
+            return false;
         }
+    }
+
+    __atomic_fetch_add(&segment_.hostPinned(slot), size, __ATOMIC_RELAXED);
+    return true;
+}
+
+void Client::release_host_memory(size_t size) {
+    if (!segment_.valid()) {
+        return;
+    }
+
+    const int slot = self_slot_.load(std::memory_order_acquire);
+    if (slot == kNoSlot) {
+        return;
+    }
+
+    __atomic_fetch_sub(&segment_.hostPinned(slot), size, __ATOMIC_RELAXED);
+    segment_.host().pinned.fetch_sub(size, std::memory_order_relaxed);
+}
+
+size_t Client::get_host_pinned_usage() {
+    if (!segment_.valid()) {
+        return 0;
+    }
+
+    return segment_.host().pinned.load(std::memory_order_relaxed);
+}
 
-        if (!isProcessExists(entry.process_id)) {
-            entry.process_id = 0;
-            entry.clearUsage();
-            if (free_slot == -1) {
-                free_slot = i;
+void Client::wait_launch_turn(int idx) {
+    if (!segment_.valid() || !valid_device(idx)) {
+        return;
+    }
+
+    auto& schedule = segment_.schedule(idx);
+    uint64_t claim = schedule.claim.load(std::memory_order_acquire);
+    if (claim == 0 && launch_priority_ == 0) {
+        return;
+    }
+
+    for (;;) {
+        const uint64_t now = monotonicMicros();
+        const uint64_t holder = claimPriority(claim);
+        const uint64_t until = claimUntil(claim);
+        if (holder > launch_priority_ && until > now) {
+            // a drop bumps wake after changing the claim: read wake first, then
+            // recheck the claim, and the futex cannot miss it
+            const uint32_t wake = schedule.wake.load(std::memory_order_acquire);
+            if (schedule.claim.load(std::memory_order_acquire) == claim) {
+                futexWait(schedule.wake, wake, until - now);
             }
+            claim = schedule.claim.load(std::memory_order_acquire);
             continue;
         }
+        if (launch_priority_ == 0) {
+            return;
+        }
+        // extend a hold of our priority only once half of it is gone, so a
+        // stream of launches writes the line a couple of times per slice
+        if (holder == launch_priority_ && until > now + time_slice_us_ / 2) {
+            return;
+        }
 
-        if (entry.process_id == usage.process_id) {
-            self_slot = i;
-            entry.devices = usage.devices;
-            entry.timestamp = usage.timestamp;
+        const uint64_t desired = packClaim(launch_priority_, now + time_slice_us_);
+        if (schedule.claim.compare_exchange_weak(claim, desired, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            launch_claims_[idx].store(desired, std::memory_order_relaxed);
+            return;
         }
     }
+}
+
+// Hand back the devices we still hold so that waiters need not sit out the
+// rest of the slice. A hold extended by another process is theirs now.
+void Client::drop_launch_claims() {
+    if (!segment_.valid()) {
+        return;
+    }
 
-    // update slot process usage
-    if (self_slot != -1 || free_slot != -1) {
-        if (self_slot != -1){
-            free_slot = self_slot;
+    for (int idx = 0; idx < device_count_; ++idx) {
+        uint64_t claim = launch_claims_[idx].exchange(0, std::memory_order_relaxed);
+        auto& schedule = segment_.schedule(idx);
+        if (claim != 0 && schedule.claim.compare_exchange_strong(claim, 0, std::memory_order_acq_rel)) {
+            schedule.wake.fetch_add(1, std::memory_order_release);
+            futexWakeAll(schedule.wake);
         }
+    }
+}
+
+void Client::add_device_busy_time(int idx, uint64_t busy_ns) {
+    if (!segment_.valid() || !valid_device(idx) || busy_ns < 1000) {
+        return;
+    }
+    const int slot = claim_process_slot();
+    if (slot == kNoSlot) {
+        return;
+    }
 
-        auto& entry = process_metric_data_->usage[free_slot];
-        entry.process_id = usage.process_id;
-        entry.devices = usage.devices;
-        entry.timestamp = usage.timestamp;
+    const uint64_t second = monotonicMicros() / 1000000;
+    const uint64_t tag = activityTag(second);
+    uint64_t& bucket = segment_.activity(idx, slot)[second % UsageSegment::kActivityBuckets];
+    uint64_t current = __atomic_load_n(&bucket, __ATOMIC_RELAXED);
+    uint64_t next = 0;
+    do {
+        // a bucket of an earlier round starts over
+        const uint64_t busy_us = (current & ~kActivityBusyMask) == tag ? current & kActivityBusyMask : 0;
+        next = tag | std::min(busy_us + busy_ns / 1000, kActivityBusyMask);
+    } while (!__atomic_compare_exchange_n(&bucket, &current, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t Client::get_device_busy_time(int idx) {
+    if (!segment_.valid() || !valid_device(idx)) {
+        return 0;
     }
 
-    pthread_mutex_unlock(&process_metric_data_->lock);
+    const uint64_t second = monotonicMicros() / 1000000 - 1;
+    const uint64_t tag = activityTag(second);
+    uint64_t busy_us = 0;
+    for (int slot = 0; slot < static_cast<int>(segment_.maxProcesses()); ++slot) {
+        if (__atomic_load_n(&segment_.container(slot), __ATOMIC_RELAXED) != container_) {
+            continue;
+        }
+        const uint64_t value =
+            __atomic_load_n(&segment_.activity(idx, slot)[second % UsageSegment::kActivityBuckets], __ATOMIC_RELAXED);
+        if ((value & ~kActivityBusyMask) == tag) {
+            busy_us += value & kActivityBusyMask;
+        }
+    }
+    return busy_us * 1000;
 }
@@ -0,0 +1,427 @@
+#include "client/usage_segment.hpp"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr size_t kAlignment = 64;
+// how long attachers wait for the creator to finish initializing
+constexpr auto kReadyTimeout = std::chrono::seconds(2);
+// a section is a handful of atomic operations; this many spins means its
+// writer died inside it
+constexpr int kWriterSpins = 1 << 16;
+constexpr int kReaderRetries = 1 << 10;
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+constexpr size_t alignUp(size_t value) {
+    return (value + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+struct Offsets {
+    size_t host;
+    size_t policy;
+    size_t schedules;
+    size_t group_containers;
+    size_t devices;
+    size_t process_ids;
+    size_t timestamps;
+    size_t containers;
+    size_t groups;
+    size_t charged;
+    size_t lease_free;
+    size_t host_pinned;
+    size_t activities;
+    size_t size;
+};
+
+Offsets offsetsFor(uint32_t max_processes, uint32_t max_devices) {
+    Offsets offsets{};
+    offsets.host = alignUp(sizeof(UsageSegment::Header));
+    offsets.policy = alignUp(offsets.host + sizeof(UsageSegment::HostCounters));
+    offsets.schedules = alignUp(offsets.policy + sizeof(UsageSegment::Policy));
+    offsets.group_containers = alignUp(offsets.schedules + sizeof(UsageSegment::DeviceSchedule) * max_devices);
+    offsets.devices = alignUp(offsets.group_containers + sizeof(uint64_t) * max_processes);
+    offsets.process_ids = alignUp(offsets.devices +
+                                  sizeof(UsageSegment::DeviceCounters) * max_processes * max_devices);
+    offsets.timestamps = alignUp(offsets.process_ids + sizeof(pid_t) * max_processes);
+    offsets.containers = alignUp(offsets.timestamps + sizeof(time_t) * max_processes);
+    offsets.groups = alignUp(offsets.containers + sizeof(uint64_t) * max_processes);
+    offsets.charged = alignUp(offsets.groups + sizeof(uint32_t) * max_processes);
+    offsets.lease_free = alignUp(offsets.charged + sizeof(size_t) * max_processes * max_devices);
+    offsets.host_pinned = alignUp(offsets.lease_free + sizeof(size_t) * max_processes * max_devices);
+    offsets.activities = alignUp(offsets.host_pinned + sizeof(size_t) * max_processes);
+    offsets.size = alignUp(offsets.activities +
+                           sizeof(uint64_t) * UsageSegment::kActivityBuckets * max_processes * max_devices);
+    return offsets;
+}
+
+} // namespace
+
+size_t UsageSegment::sizeFor(uint32_t max_processes, uint32_t max_devices) {
+    return offsetsFor(max_processes, max_devices).size;
+}
+
+void UsageSegment::bind(void* base, uint32_t max_processes, uint32_t max_devices) {
+    const auto offsets = offsetsFor(max_processes, max_devices);
+    auto* bytes = static_cast<char*>(base);
+
+    header_ = static_cast<Header*>(base);
+    max_processes_ = max_processes;
+    max_devices_ = max_devices;
+    host_ = reinterpret_cast<HostCounters*>(bytes + offsets.host);
+    policy_ = reinterpret_cast<Policy*>(bytes + offsets.policy);
+    schedules_ = reinterpret_cast<DeviceSchedule*>(bytes + offsets.schedules);
+    group_containers_ = reinterpret_cast<uint64_t*>(bytes + offsets.group_containers);
+    devices_ = reinterpret_cast<DeviceCounters*>(bytes + offsets.devices);
+    process_ids_ = reinterpret_cast<pid_t*>(bytes + offsets.process_ids);
+    timestamps_ = reinterpret_cast<time_t*>(bytes + offsets.timestamps);
+    containers_ = reinterpret_cast<uint64_t*>(bytes + offsets.containers);
+    groups_ = reinterpret_cast<uint32_t*>(bytes + offsets.groups);
+    charged_ = reinterpret_cast<size_t*>(bytes + offsets.charged);
+    lease_free_ = reinterpret_cast<size_t*>(bytes + offsets.lease_free);
+    host_pinned_ = reinterpret_cast<size_t*>(bytes + offsets.host_pinned);
+    activities_ = reinterpret_cast<uint64_t*>(bytes + offsets.activities);
+}
+
+// the memory is zero filled, only the header needs values
+void UsageSegment::initialize(void* base, uint32_t max_processes, uint32_t max_devices, size_t size) {
+    auto* header = static_cast<Header*>(base);
+    header->magic = kMagic;
+    header->version = kVersion;
+    header->max_processes = max_processes;
+    header->max_devices = max_devices;
+    header->size = size;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    bind(base, max_processes, max_devices);
+    header->ready.store(1, std::memory_order_release);
+}
+
+bool UsageSegment::open(const char* name, uint32_t max_processes, uint32_t max_devices) {
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd != -1) {
+        // creator: sized from our capacities; readable by other users' containers too
+        fchmod(fd, 0666);
+        const size_t size = sizeFor(max_processes, max_devices);
+        void* base = MAP_FAILED;
+        if (ftruncate(fd, size) == 0) {
+            base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (base == MAP_FAILED) {
+            spdlog::error("Failed to create usage segment {}: {}", name, std::strerror(errno));
+            shm_unlink(name);
+            close(fd);
+            return false;
+        }
+        fd_ = fd;
+        initialize(base, max_processes, max_devices, size);
+        return true;
+    }
+
+    if (errno != EEXIST || (fd = shm_open(name, O_RDWR, 0666)) == -1) {
+        spdlog::error("Failed to open usage segment {}: {}", name, std::strerror(errno));
+        return false;
+    }
+    return attachFd(name, fd);
+}
+
+bool UsageSegment::attach(const char* name) {
+    const int fd = shm_open(name, O_RDWR, 0666);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            spdlog::error("Failed to open usage segment {}: {}", name, std::strerror(errno));
+        }
+        return false;
+    }
+    return attachFd(name, fd);
+}
+
+// takes fd, closed again on failure
+bool UsageSegment::attachFd(const char* name, int fd) {
+    // wait for the creator to size and initialize it, then map it
+    // with the creator's capacities
+    const auto deadline = std::chrono::steady_clock::now() + kReadyTimeout;
+    void* head = MAP_FAILED;
+    for (;;) {
+        struct stat st {};
+        if (head == MAP_FAILED && fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+            head = mmap(nullptr, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (head != MAP_FAILED && static_cast<Header*>(head)->ready.load(std::memory_order_acquire) != 0) {
+            break;
+        }
+        if (std::chrono::steady_clock::now() > deadline) {
+            spdlog::error("Usage segment {} was never initialized", name);
+            if (head != MAP_FAILED) {
+                munmap(head, sizeof(Header));
+            }
+            close(fd);
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const auto* header = static_cast<const Header*>(head);
+    const uint32_t magic = header->magic;
+    const uint32_t version = header->version;
+    const uint32_t created_processes = header->max_processes;
+    const uint32_t created_devices = header->max_devices;
+    const size_t size = header->size;
+    munmap(head, sizeof(Header));
+
+    if (magic != kMagic || version != kVersion || size != sizeFor(created_processes, created_devices)) {
+        spdlog::error("Usage segment {} has layout version {} (magic {:#x}), expected {}; "
+                      "it was created by another vcuda-hook build",
+                      name, version, magic, kVersion);
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        spdlog::error("Failed to map usage segment {}: {}", name, std::strerror(errno));
+        close(fd);
+        return false;
+    }
+    fd_ = fd;
+    bind(base, created_processes, created_devices);
+    return true;
+}
+
+bool UsageSegment::openPrivate(uint32_t max_processes, uint32_t max_devices) {
+    const size_t size = sizeFor(max_processes, max_devices);
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    initialize(base, max_processes, max_devices, size);
+    return true;
+}
+
+uint32_t UsageSegment::beginUpdate(int group, int idx) const {
+    auto& sequence = device(group, idx).sequence;
+    uint32_t current = sequence.load(std::memory_order_relaxed);
+    for (int spins = 0; spins < kWriterSpins; ++spins) {
+        if ((current & 1) == 0 &&
+            sequence.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return current + 1;
+        }
+        if (spins % 64 == 63) {
+            sched_yield(); // the writer may have been preempted
+        } else {
+            cpuRelax();
+        }
+        current = sequence.load(std::memory_order_relaxed);
+    }
+
+    spdlog::warn("Taking over the usage section of device {}, group {} left open by an exited process", idx, group);
+    return current | 1;
+}
+
+void UsageSegment::endUpdate(int group, int idx, uint32_t sequence) const {
+    device(group, idx).sequence.store(sequence + 1, std::memory_order_release);
+}
+
+UsageSegment::DeviceSnapshot UsageSegment::snapshot(int group, int idx) const {
+    const auto& device = this->device(group, idx);
+    DeviceSnapshot snapshot{};
+    for (int retries = 0; retries < kReaderRetries; ++retries) {
+        const uint32_t before = device.sequence.load(std::memory_order_acquire);
+        snapshot.usage = device.usage.load(std::memory_order_relaxed);
+        snapshot.lease_free = device.lease_free.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((before & 1) == 0 && device.sequence.load(std::memory_order_relaxed) == before) {
+            break;
+        }
+        cpuRelax();
+    }
+    return snapshot;
+}
+
+int UsageSegment::findGroup(uint64_t container) const {
+    for (int group = 0; group < static_cast<int>(max_processes_); ++group) {
+        if (__atomic_load_n(&groupContainer(group), __ATOMIC_ACQUIRE) == container) {
+            return group;
+        }
+    }
+    return -1;
+}
+
+// a free group's counters were cleared when its last slot went
+int UsageSegment::claimGroup(uint64_t container) const {
+    if (const int group = findGroup(container); group >= 0) {
+        return group;
+    }
+    for (int group = 0; group < static_cast<int>(max_processes_); ++group) {
+        if (__atomic_load_n(&groupContainer(group), __ATOMIC_RELAXED) == 0) {
+            __atomic_store_n(&groupContainer(group), container, __ATOMIC_RELEASE);
+            return group;
+        }
+    }
+    return -1;
+}
+
+bool UsageSegment::readPolicy(PolicySnapshot* snapshot) const {
+    const Policy& policy = *policy_;
+    for (int retries = 0; retries < kReaderRetries; ++retries) {
+        const uint32_t before = policy.sequence.load(std::memory_order_acquire);
+        if ((before & 1) == 0) {
+            snapshot->generation = policy.generation.load(std::memory_order_relaxed);
+            snapshot->host_pinned_limit = policy.host_pinned_limit;
+            const uint32_t count = std::min(policy.entry_count, kMaxPolicyEntries);
+            snapshot->entries.assign(policy.entries, policy.entries + count);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (policy.sequence.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+        cpuRelax();
+    }
+    return false;
+}
+
+void UsageSegment::writePolicy(uint64_t host_pinned_limit, const std::vector<PolicyEntry>& entries) const {
+    Policy& policy = *policy_;
+    const uint32_t sequence = policy.sequence.load(std::memory_order_relaxed) | 1;
+    policy.sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    policy.host_pinned_limit = host_pinned_limit;
+    policy.entry_count = static_cast<uint32_t>(std::min<size_t>(entries.size(), kMaxPolicyEntries));
+    std::copy_n(entries.begin(), policy.entry_count, policy.entries);
+    policy.generation.fetch_add(1, std::memory_order_relaxed);
+
+    policy.sequence.store(sequence + 1, std::memory_order_release);
+}
+
+void UsageSegment::lock() const {
+    if (int rc = pthread_mutex_lock(&header_->lock); rc == EOWNERDEAD) {
+        pthread_mutex_consistent(&header_->lock);
+    }
+}
+
+void UsageSegment::unlock() const {
+    pthread_mutex_unlock(&header_->lock);
+}
+
+namespace {
+
+// F_GETLK reports conflicting locks only, so this is false for our own byte
+bool isByteLocked(int fd, off_t byte) {
+    struct flock lease {};
+    lease.l_type = F_WRLCK;
+    lease.l_whence = SEEK_SET;
+    lease.l_start = byte;
+    lease.l_len = 1;
+    if (fcntl(fd, F_GETLK, &lease) == -1) {
+        return true; // unknown, keep the slot
+    }
+    return lease.l_type != F_UNLCK;
+}
+
+bool lockByte(int fd, off_t byte) {
+    struct flock lease {};
+    lease.l_type = F_WRLCK;
+    lease.l_whence = SEEK_SET;
+    lease.l_start = byte;
+    lease.l_len = 1;
+    return fcntl(fd, F_SETLK, &lease) == 0;
+}
+
+} // namespace
+
+bool UsageSegment::acquireSlotLease(int slot) const {
+    return fd_ < 0 || lockByte(fd_, slot);
+}
+
+bool UsageSegment::isSlotLeaseHeld(int slot) const {
+    return fd_ < 0 || isByteLocked(fd_, slot);
+}
+
+bool UsageSegment::acquireAgentLease() const {
+    return fd_ >= 0 && lockByte(fd_, kMaxProcesses);
+}
+
+void UsageSegment::releaseSlot(int slot) const {
+    const int group = static_cast<int>(this->group(slot));
+    for (int idx = 0; idx < static_cast<int>(max_devices_); ++idx) {
+        auto& device = this->device(group, idx);
+        const uint32_t sequence = beginUpdate(group, idx);
+        const size_t charged = __atomic_exchange_n(&this->charged(idx)[slot], 0, __ATOMIC_RELAXED);
+        if (charged > 0) {
+            device.usage.fetch_sub(charged, std::memory_order_relaxed);
+        }
+        const size_t lease_free = __atomic_exchange_n(&leaseFree(idx)[slot], 0, __ATOMIC_RELAXED);
+        if (lease_free > 0) {
+            device.lease_free.fetch_sub(lease_free, std::memory_order_relaxed);
+        }
+        endUpdate(group, idx, sequence);
+
+        uint64_t* busy = activity(idx, slot);
+        for (int bucket = 0; bucket < kActivityBuckets; ++bucket) {
+            __atomic_store_n(&busy[bucket], 0, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&container(slot), 0, __ATOMIC_RELAXED);
+    if (const size_t pinned = __atomic_exchange_n(&hostPinned(slot), 0, __ATOMIC_RELAXED); pinned > 0) {
+        host_->pinned.fetch_sub(pinned, std::memory_order_relaxed);
+    }
+    __atomic_store_n(&processId(slot), 0, __ATOMIC_RELEASE);
+
+    // the group goes with the last slot of its container; anything left in
+    // its counters leaked from a process that died between charging the group
+    // and its slot
+    for (int other = 0; other < static_cast<int>(max_processes_); ++other) {
+        if (__atomic_load_n(&processId(other), __ATOMIC_RELAXED) != 0 &&
+            this->group(other) == static_cast<uint32_t>(group)) {
+            return;
+        }
+    }
+    for (int idx = 0; idx < static_cast<int>(max_devices_); ++idx) {
+        device(group, idx).usage.store(0, std::memory_order_relaxed);
+        device(group, idx).lease_free.store(0, std::memory_order_relaxed);
+    }
+    __atomic_store_n(&groupContainer(group), 0, __ATOMIC_RELEASE);
+}
+
+int UsageSegment::reclaimDeadSlots(int skip_slot) const {
+    int reclaimed = 0;
+    for (int slot = 0; slot < static_cast<int>(max_processes_); ++slot) {
+        const pid_t pid = __atomic_load_n(&processId(slot), __ATOMIC_ACQUIRE);
+        if (slot == skip_slot || pid == 0 || isSlotLeaseHeld(slot)) {
+            continue;
+        }
+
+        releaseSlot(slot);
+        spdlog::debug("Reclaimed usage slot {} of exited process {}", slot, pid);
+        ++reclaimed;
+    }
+    return reclaimed;
+}
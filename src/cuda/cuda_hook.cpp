@@ -1,12 +1,14 @@
 #include <dlfcn.h>
+#include <unistd.h>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 
 #include "spdlog/spdlog.h"
 #include "util/logger.hpp"
+#include "util/metrics.hpp"
 #include "cuda/cuda_hook.hpp"
-
-extern void* real_dlsym(void*, const char*);
+#include "nvml/nvml_hook.hpp"
 
 namespace {
     struct LoggerInitializer {
@@ -16,147 +18,528 @@ namespace {
     };
 
     LoggerInitializer g_logger_initializer;
-    template <typename FnPtr>
-    bool ensureCudaSymbol(FnPtr& fn, const char* symbol_name) {
-        if (fn) {
+
+    // primary context of each device as last retained, to know which
+    // allocations a primary context release or reset takes along
+    std::array<std::atomic<CUcontext>, DEVICE_MAX_NUM> g_primary_contexts{};
+
+    void logCudaError(CudaHook& hook, const char* context, CUresult code) {
+        const char* error_string = nullptr;
+        if (hook.ori_cuGetErrorString) {
+            if (hook.ori_cuGetErrorString(code, &error_string) != CUDA_SUCCESS) {
+                error_string = nullptr;
+            }
+        }
+
+        if (error_string) {
+            spdlog::error("{}: {}", context, error_string);
+        } else {
+            spdlog::error("{} (code {})", context, static_cast<int>(code));
+        }
+    }
+
+    // owner of allocations made now, nullptr when the driver cannot tell
+    CUcontext currentContext(CudaHook& hook) {
+        CUcontext ctx = nullptr;
+        if (!hook.ori_cuCtxGetCurrent || hook.ori_cuCtxGetCurrent(&ctx) != CUDA_SUCCESS) {
+            return nullptr;
+        }
+        return ctx;
+    }
+
+    // The calling thread's device, from its current context: a context seen
+    // before is answered by the Device's cache, a new one costs a single
+    // cuCtxGetDevice. Without a context the thread keeps its last device.
+    int currentDevice(CudaHook& hook, CUcontext ctx) {
+        Device& device = hook.getDevice();
+        int idx = 0;
+        if (!device.contextDevice(ctx, &idx)) {
+            CUdevice dev = 0;
+            if (ctx == nullptr || hook.ori_cuCtxGetDevice(&dev) != CUDA_SUCCESS) {
+                return device.getDeviceId();
+            }
+            idx = int(dev);
+            device.setContextDevice(ctx, idx);
+        }
+        device.setDeviceId(idx);
+        return idx;
+    }
+
+    int currentDevice(CudaHook& hook) {
+        return currentDevice(hook, currentContext(hook));
+    }
+
+    // The driver frees everything a context allocated when it is destroyed:
+    // give its bytes back in one update per device and drop the slabs and
+    // timing events that went with it.
+    void releaseContextMemory(CudaHook& hook, CUcontext ctx) {
+        for (const CUdeviceptr ptr : hook.getDevice().releaseContext(ctx)) {
+            hook.getSlabAllocator().discard(ptr);
+        }
+        hook.getLaunchTimer().forgetContext(ctx);
+    }
+
+    void releasePrimaryContextMemory(CudaHook& hook, CUdevice dev) {
+        if (dev >= 0 && dev < DEVICE_MAX_NUM) {
+            releaseContextMemory(hook, g_primary_contexts[dev].load(std::memory_order_acquire));
+        }
+    }
+
+    // hand a slab the pool no longer needs back to the driver and the quota
+    void releaseSlab(CudaHook& hook, CUdeviceptr base) {
+        if (const CUresult result = hook.ori_cuMemFree_v2(base); result != CUDA_SUCCESS) {
+            logCudaError(hook, "cuMemFree of an idle slab failed", result);
+        }
+        hook.getDevice().updateMemoryUsage(MemFree, base);
+    }
+
+    // Reserve first so concurrent processes cannot all pass the limit check;
+    // empty pooled slabs are trimmed before the reservation is refused.
+    bool reserveDeviceMemory(CudaHook& hook, size_t byteSize, int idx) {
+        if (hook.getDevice().reserveMemory(byteSize, idx)) {
             return true;
         }
 
-        void* handle = dlopen(CUDA_LIBRARY_SO, RTLD_LAZY | RTLD_LOCAL);
-        if (!handle) {
-            spdlog::error("dlopen {} failed while loading {}: {}", CUDA_LIBRARY_SO, symbol_name, dlerror());
-            return false;
+        const auto released = hook.getSlabAllocator().trim(idx);
+        for (const uint64_t base : released) {
+            releaseSlab(hook, base);
         }
+        return !released.empty() && hook.getDevice().reserveMemory(byteSize, idx);
+    }
 
-        dlerror();
-        void* symbol = real_dlsym(handle, symbol_name);
-        const char* error = dlerror();
-        dlclose(handle);
+    // A block from the slab pool; a new slab is allocated and charged as one
+    // allocation when the size class has no room. False sends the request
+    // down the unpooled path.
+    bool allocFromSlab(CudaHook& hook, CUdeviceptr* dptr, size_t byteSize, int idx, CUcontext ctx) {
+        SlabAllocator& slabs = hook.getSlabAllocator();
+        uint64_t ptr = 0;
+        if (slabs.allocate(idx, byteSize, &ptr)) {
+            *dptr = ptr;
+            return true;
+        }
 
-        if (error != nullptr || symbol == nullptr) {
-            spdlog::error("real_dlsym failed to load {}: {}", symbol_name, error ? error : "unknown error");
+        if (!reserveDeviceMemory(hook, SlabAllocator::kSlabSize, idx)) {
             return false;
         }
+        CUdeviceptr base = 0;
+        if (hook.ori_cuMemAlloc_v2(&base, SlabAllocator::kSlabSize) != CUDA_SUCCESS) {
+            hook.getDevice().rollbackMemory(SlabAllocator::kSlabSize, idx);
+            return false;
+        }
+        hook.getDevice().updateMemoryUsage(MemAlloc, base, SlabAllocator::kSlabSize, idx, ctx);
 
-        fn = reinterpret_cast<FnPtr>(symbol);
-        spdlog::trace("Loaded original symbol {}", symbol_name);
+        slabs.addSlab(idx, byteSize, base, &ptr);
+        *dptr = ptr;
         return true;
     }
 
-    void logCudaError(CudaHook& hook, const char* context, CUresult code) {
-        const char* error_string = nullptr;
-        if (hook.ori_cuGetErrorString || ensureCudaSymbol(hook.ori_cuGetErrorString, SYMBOL_STRING(cuGetErrorString))) {
-            if (hook.ori_cuGetErrorString(code, &error_string) != CUDA_SUCCESS) {
-                error_string = nullptr;
+    // Serve an allocation past the limit from managed memory that prefers to
+    // stay on the host: the device maps it and reads it over the bus instead
+    // of migrating pages into memory that belongs to other processes.
+    CUresult allocOversubscribed(CudaHook& hook, CUdeviceptr* dptr, size_t byteSize, int idx, CUcontext ctx) {
+        Device& device = hook.getDevice();
+        if (!hook.ori_cuMemAllocManaged || !device.reserveOversubscribed(byteSize, idx)) {
+            spdlog::error("Out of memory, trying to allocate {} bytes, current usage {}, oversubscribed {}",
+                          byteSize, device.getDeviceMemoryUsage(idx), device.getOversubscribedUsage(idx));
+            return CUDA_ERROR_OUT_OF_MEMORY;
+        }
+
+        const CUresult result = hook.ori_cuMemAllocManaged(dptr, byteSize, CU_MEM_ATTACH_GLOBAL);
+        if (result != CUDA_SUCCESS) {
+            device.rollbackOversubscribed(byteSize, idx);
+            logCudaError(hook, "cuMemAllocManaged failed", result);
+            return result;
+        }
+
+        // advice only places pages, the allocation is usable without it
+        if (hook.ori_cuMemAdvise) {
+            hook.ori_cuMemAdvise(*dptr, byteSize, CU_MEM_ADVISE_SET_PREFERRED_LOCATION, CU_DEVICE_CPU);
+            hook.ori_cuMemAdvise(*dptr, byteSize, CU_MEM_ADVISE_SET_ACCESSED_BY, idx);
+        }
+        device.recordOversubscribed(*dptr, byteSize, idx, ctx);
+        spdlog::debug("Oversubscribed {} bytes on device {}, {} bytes in managed memory",
+                      byteSize, idx, device.getOversubscribedUsage(idx));
+        return CUDA_SUCCESS;
+    }
+
+    // host pages that pinning [ptr, ptr + size) locks
+    size_t pinnedSpan(const void* ptr, size_t size) {
+        static const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        const auto start = reinterpret_cast<uintptr_t>(ptr) & ~(page - 1);
+        const auto end = (reinterpret_cast<uintptr_t>(ptr) + size + page - 1) & ~(page - 1);
+        return end - start;
+    }
+
+    // Pin size bytes with pin() within the pinned host memory limit; *ptr is
+    // what the pages are tracked by once pinned.
+    template <typename Pin>
+    CUresult pinHostMemory(CudaHook& hook, void* const* ptr, size_t bytes, const char* context, Pin&& pin) {
+        if (!hook.getDevice().reservePinnedHost(bytes)) {
+            spdlog::error("Pinned host memory limit reached, trying to pin {} bytes, usage {}, limit {}",
+                          bytes, hook.getDevice().getPinnedHostUsage(), hook.getDevice().getPinnedHostLimit());
+            return CUDA_ERROR_OUT_OF_MEMORY;
+        }
+
+        const CUresult result = pin();
+        if (result != CUDA_SUCCESS) {
+            hook.getDevice().rollbackPinnedHost(bytes);
+            logCudaError(hook, context, result);
+            return result;
+        }
+
+        hook.getDevice().recordPinnedHost(*ptr, bytes);
+        return result;
+    }
+
+    // Physical memory behind a cuMemCreate of size bytes: the driver hands out
+    // whole pages of the allocation granularity.
+    size_t vmmPhysicalSize(CudaHook& hook, size_t size, const CUmemAllocationProp* prop) {
+        size_t granularity = 0;
+        if (!hook.ori_cuMemGetAllocationGranularity ||
+            hook.ori_cuMemGetAllocationGranularity(&granularity, prop, CU_MEM_ALLOC_GRANULARITY_MINIMUM) != CUDA_SUCCESS ||
+            granularity == 0) {
+            return size;
+        }
+        return (size + granularity - 1) / granularity * granularity;
+    }
+
+    // Charge or release the change in what pool holds from its device since it
+    // was last looked at; prepaid bytes were reserved up front for this call.
+    void reconcileMemPool(CudaHook& hook, CUmemoryPool pool, int idx, size_t prepaid) {
+        MemPoolTracker& tracker = hook.getMemPoolTracker();
+        cuuint64_t reserved = 0;
+        int64_t delta = static_cast<int64_t>(prepaid); // unknown: keep what was prepaid
+        if (hook.ori_cuMemPoolGetAttribute &&
+            hook.ori_cuMemPoolGetAttribute(pool, CU_MEMPOOL_ATTR_RESERVED_MEM_CURRENT, &reserved) == CUDA_SUCCESS) {
+            delta = tracker.observe(pool, static_cast<size_t>(reserved));
+        }
+
+        const int64_t unpaid = delta - static_cast<int64_t>(prepaid);
+        if (unpaid > 0) {
+            // grown by more than asked for, e.g. rounded up to the pool's granularity
+            hook.getDevice().chargeMemory(static_cast<size_t>(unpaid), idx);
+        } else if (unpaid < 0) {
+            hook.getDevice().rollbackMemory(static_cast<size_t>(-unpaid), idx);
+        }
+    }
+
+    // give the unused reservations of every pool on device idx back
+    bool trimMemPools(CudaHook& hook, int idx) {
+        if (!hook.ori_cuMemPoolTrimTo) {
+            return false;
+        }
+
+        const size_t before = hook.getDevice().getDeviceMemoryUsage(idx);
+        for (CUmemoryPool pool : hook.getMemPoolTracker().poolsOf(idx)) {
+            hook.ori_cuMemPoolTrimTo(pool, 0);
+            reconcileMemPool(hook, pool, idx, 0);
+        }
+        return hook.getDevice().getDeviceMemoryUsage(idx) < before;
+    }
+
+    // True when size fits in what pool already reserved: the allocation
+    // cannot grow it, so there is nothing to admit.
+    bool fitsInMemPool(CudaHook& hook, CUmemoryPool pool, size_t size) {
+        cuuint64_t reserved = 0;
+        cuuint64_t used = 0;
+        return hook.ori_cuMemPoolGetAttribute &&
+               hook.ori_cuMemPoolGetAttribute(pool, CU_MEMPOOL_ATTR_RESERVED_MEM_CURRENT, &reserved) == CUDA_SUCCESS &&
+               hook.ori_cuMemPoolGetAttribute(pool, CU_MEMPOOL_ATTR_USED_MEM_CURRENT, &used) == CUDA_SUCCESS &&
+               used <= reserved && reserved - used >= size;
+    }
+
+    // Stream-ordered allocation from pool: admitted against the limit only when
+    // the pool may have to grow, then charged by how much it actually grew.
+    template <typename Allocate>
+    CUresult allocFromMemPool(CudaHook& hook, CUdeviceptr* dptr, size_t byteSize, CUmemoryPool pool, Allocate&& allocate) {
+        const int idx = hook.getMemPoolTracker().deviceOf(pool, currentDevice(hook));
+        if (idx == MemPoolTracker::kNoDevice) {
+            return allocate();
+        }
+
+        size_t prepaid = 0;
+        if (!fitsInMemPool(hook, pool, byteSize)) {
+            if (!hook.getDevice().reserveMemory(byteSize, idx) &&
+                !(trimMemPools(hook, idx) && hook.getDevice().reserveMemory(byteSize, idx))) {
+                spdlog::error("Out of memory, trying to allocate {} bytes from a memory pool, current usage {}",
+                              byteSize, hook.getDevice().getDeviceMemoryUsage(idx));
+                return CUDA_ERROR_OUT_OF_MEMORY;
             }
+            prepaid = byteSize;
         }
 
-        if (error_string) {
-            spdlog::error("{}: {}", context, error_string);
+        const CUresult result = allocate();
+        if (result != CUDA_SUCCESS) {
+            hook.getDevice().rollbackMemory(prepaid, idx);
+            logCudaError(hook, "Stream-ordered allocation failed", result);
+            return result;
+        }
+
+        hook.getMemPoolTracker().track(*dptr, pool);
+        reconcileMemPool(hook, pool, idx, prepaid);
+        return CUDA_SUCCESS;
+    }
+
+    // cuMemAllocAsync allocates from the current pool of the current device
+    CUmemoryPool currentMemPool(CudaHook& hook, int idx) {
+        CUmemoryPool pool = nullptr;
+        if (!hook.ori_cuDeviceGetMemPool || hook.ori_cuDeviceGetMemPool(&pool, idx) != CUDA_SUCCESS) {
+            return nullptr;
+        }
+        return pool;
+    }
+
+    CUresult allocAsync(CudaHook& hook, CUdeviceptr* dptr, size_t byteSize, CUstream stream,
+                        CudaHook::cuMemAllocAsync_func_ptr allocate) {
+        if (!allocate) {
+            return CUDA_ERROR_NOT_SUPPORTED;
+        }
+
+        const int idx = currentDevice(hook);
+        CUmemoryPool pool = currentMemPool(hook, idx);
+        if (pool == nullptr) {
+            return allocate(dptr, byteSize, stream); // nothing to account against
+        }
+        return allocFromMemPool(hook, dptr, byteSize, pool, [&] { return allocate(dptr, byteSize, stream); });
+    }
+
+    CUresult freeAsync(CudaHook& hook, CUdeviceptr dptr, CUstream stream, CudaHook::cuMemFreeAsync_func_ptr release) {
+        if (!release) {
+            return CUDA_ERROR_NOT_SUPPORTED;
+        }
+
+        const CUresult result = release(dptr, stream);
+        if (result != CUDA_SUCCESS) {
+            logCudaError(hook, "cuMemFreeAsync failed", result);
+            return result;
+        }
+
+        // the pool keeps the memory up to its release threshold; charge what it kept
+        if (CUmemoryPool pool = nullptr; hook.getMemPoolTracker().untrack(dptr, &pool)) {
+            reconcileMemPool(hook, pool, hook.getMemPoolTracker().deviceOf(pool, MemPoolTracker::kNoDevice), 0);
         } else {
-            spdlog::error("{} (code {})", context, static_cast<int>(code));
+            hook.getDevice().updateMemoryUsage(MemFree, dptr); // cuMemFreeAsync also takes cuMemAlloc pointers
+        }
+        return result;
+    }
+
+    // launches on the current device wait for their turn among the processes
+    // sharing it, then while it is over its share of GPU time
+    inline void gateLaunch(CudaHook& hook) {
+        const int idx = currentDevice(hook);
+        Client::getInstance().wait_launch_turn(idx);
+        LaunchThrottle& throttle = hook.getLaunchThrottle();
+        if (throttle.enabled()) {
+            throttle.acquire(idx);
+        }
+    }
+
+    // the per-thread default stream variants of a launch go with those of
+    // the event and capture calls
+    constexpr bool kLegacyStream = false;
+    constexpr bool kPerThreadStream = true;
+
+    // A launch on a stream under graph capture is recorded into the graph,
+    // and so would be its events; they never complete on their own. So is a
+    // launch on the legacy stream while another stream captures globally,
+    // which the driver reports as an error.
+    bool isCapturing(CudaHook& hook, CUstream stream, bool per_thread) {
+        const auto is_capturing = per_thread ? hook.ori_cuStreamIsCapturing_ptsz.load(std::memory_order_relaxed)
+                                             : hook.ori_cuStreamIsCapturing.load(std::memory_order_relaxed);
+        if (is_capturing == nullptr) {
+            return false; // a driver without graph capture
+        }
+        CUstreamCaptureStatus status = CU_STREAM_CAPTURE_STATUS_NONE;
+        return is_capturing(stream, &status) != CUDA_SUCCESS || status != CU_STREAM_CAPTURE_STATUS_NONE;
+    }
+
+    // launches are bracketed by timing events on their stream while
+    // utilization is virtualized, unless the stream is being captured
+    template <typename Launch>
+    CUresult timedLaunch(CudaHook& hook, CUstream stream, bool per_thread, Launch&& launch) {
+        LaunchTimer& timer = hook.getLaunchTimer();
+        if (likely(!timer.enabled()) || isCapturing(hook, stream, per_thread)) {
+            return launch();
+        }
+
+        const LaunchTimer::RecordFn record = per_thread ? hook.ori_cuEventRecord_ptsz.load(std::memory_order_relaxed)
+                                                        : hook.ori_cuEventRecord.load(std::memory_order_relaxed);
+        const CUcontext ctx = currentContext(hook);
+        const LaunchTimer::Span span = timer.begin(ctx, currentDevice(hook, ctx), stream, record);
+        const CUresult result = launch();
+        timer.end(span, stream, record);
+        return result;
+    }
+
+    // hook table index of a per-thread default stream variant of symbol
+    int findPerThreadVariant(const char* symbol) {
+        for (const char* suffix : {"_ptsz", "_ptds"}) {
+            char name[128];
+            if (std::snprintf(name, sizeof(name), "%s%s", symbol, suffix) >= static_cast<int>(sizeof(name))) {
+                continue;
+            }
+            if (int idx = CudaHook::kSymbolTable.find(name); idx != CudaHook::kSymbolTable.kNotFound) {
+                return idx;
+            }
         }
+        return CudaHook::kSymbolTable.kNotFound;
     }
+
+    // Map the entry point the driver picked for (symbol, cudaVersion, flags) to
+    // its accounting wrapper. Matching the returned pointer against the eagerly
+    // bound originals identifies the exact ABI variant (_v2/_v3, _ptds/_ptsz);
+    // the requested name is only a fallback, and it never rebinds a bound slot.
+    void* resolveHookedVariant(CudaHook& hook, const char* symbol, void* driver_fn, cuuint64_t flags) {
+        int idx = hook.findBoundSymbol(driver_fn);
+        if (idx == CudaHook::kSymbolTable.kNotFound && (flags & CU_GET_PROC_ADDRESS_PER_THREAD_DEFAULT_STREAM)) {
+            idx = findPerThreadVariant(symbol);
+        }
+        if (idx == CudaHook::kSymbolTable.kNotFound) {
+            idx = CudaHook::kSymbolTable.find(symbol);
+        }
+        if (idx == CudaHook::kSymbolTable.kNotFound) {
+            return nullptr;
+        }
+
+        hook.adoptOriginalSymbol(idx, driver_fn);
+
+        const auto& hookInfo = CudaHook::getHookMap()[idx];
+        return hookInfo.hookedFunc == NO_HOOK ? nullptr : hookInfo.hookedFunc;
+    }
+}
+
+bool CudaHook::probeDevice(int idx, size_t* total_bytes, std::string* uuid) {
+    CudaHook& hook = CudaHook::getInstance();
+
+    CUdevice device;
+    if (!hook.ori_cuDeviceGet || !hook.ori_cuDeviceTotalMem_v2 ||
+        hook.ori_cuDeviceGet(&device, idx) != CUDA_SUCCESS ||
+        hook.ori_cuDeviceTotalMem_v2(total_bytes, device) != CUDA_SUCCESS) {
+        return false;
+    }
+
+    // same spelling as nvidia-smi: GPU-xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
+    CUuuid raw;
+    if (hook.ori_cuDeviceGetUuid && hook.ori_cuDeviceGetUuid(&raw, device) == CUDA_SUCCESS) {
+        const auto* b = reinterpret_cast<const unsigned char*>(raw.bytes);
+        char text[48];
+        std::snprintf(text, sizeof(text),
+                      "GPU-%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                      b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+                      b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+        *uuid = text;
+    }
+    return true;
+}
+
+bool CudaHook::probeBusyTime(int idx, uint64_t* busy_ns) {
+    return NvmlHook::probeBusyTime(idx, busy_ns);
 }
 
 #pragma GCC visibility push(default)
 
 CUresult cuGetProcAddress(const char* symbol, void** pfn, int cudaVersion, cuuint64_t flags, CUdriverProcAddressQueryResult* symbolStatus) {
     CudaHook& hook = CudaHook::getInstance();
-    if (!ensureCudaSymbol(hook.ori_cuGetProcAddress_v2, SYMBOL_STRING(cuGetProcAddress))) {
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
+    util::ApiScope scope(VCUDA_METRIC_ID(cuGetProcAddress));
 
     if (std::strcmp(symbol, "cuGetProcAddress") == 0) {
         *pfn = HOOK_SYMBOL(&cuGetProcAddress);
-        return CUDA_SUCCESS;
+        return scope.finish(CUDA_SUCCESS);
     }
 
-    
-    if (CudaHook::HookFuncInfo hookInfo = CudaHook::getHookedSymbol(symbol);hookInfo.hookedFunc) {
-        auto result = hook.ori_cuGetProcAddress_v2(symbol, pfn, cudaVersion, flags, symbolStatus);
-        if (result != CUDA_SUCCESS) {
-            return result;
-        }
-        
-        if (hookInfo.original) {
-            hookInfo.original(hook, *pfn);
+    ProcAddressCache::Entry cached{};
+    if (hook.getProcAddressCache().lookup(symbol, cudaVersion, flags, cached)) {
+        *pfn = cached.pfn;
+        if (symbolStatus) {
+            *symbolStatus = cached.status;
         }
-        
-        if (hookInfo.hookedFunc != NO_HOOK) {
-            spdlog::debug("cuGetProcAddress Hook: {}", symbol);
-            *pfn = hookInfo.hookedFunc;
+        return scope.finish(cached.result);
+    }
+
+    CUdriverProcAddressQueryResult status = CU_GET_PROC_ADDRESS_SUCCESS;
+    const CUresult result = hook.ori_cuGetProcAddress_v2(symbol, pfn, cudaVersion, flags, &status);
+    if (result == CUDA_SUCCESS && status == CU_GET_PROC_ADDRESS_SUCCESS && *pfn) {
+        if (void* wrapper = resolveHookedVariant(hook, symbol, *pfn, flags); wrapper) {
+            spdlog::debug("cuGetProcAddress Hook: {} (version {}, flags {})", symbol, cudaVersion, flags);
+            *pfn = wrapper;
         }
+    }
 
-        return result;
+    if (symbolStatus) {
+        *symbolStatus = status;
     }
-    
-    if (hook.ori_cuGetProcAddress_v2) {
-        return hook.ori_cuGetProcAddress_v2(symbol, pfn, cudaVersion, flags, symbolStatus);
+
+    // lookup results are deterministic per key, transient failures are not cached
+    if (result == CUDA_SUCCESS || result == CUDA_ERROR_NOT_FOUND) {
+        hook.getProcAddressCache().insert(symbol, cudaVersion, flags, {result == CUDA_SUCCESS ? *pfn : nullptr, result, status});
     }
-    
-    return CUDA_ERROR_NOT_INITIALIZED;
+
+    return scope.finish(result);
 }
 
 CUresult cuInit(unsigned int flags) {
     CudaHook& hook = CudaHook::getInstance();
-
-    if (!ensureCudaSymbol(hook.ori_cuInit, SYMBOL_STRING(cuInit))) {
-        spdlog::error("Unable to resolve original cuInit");
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
+    util::ApiScope scope(VCUDA_METRIC_ID(cuInit));
 
     const CUresult result = hook.ori_cuInit(flags);
     if (result != CUDA_SUCCESS) {
         logCudaError(hook, "cuInit failed", result);
     }
 
-    return result;
+    return scope.finish(result);
 }
 
 CUresult cuMemAlloc(CUdeviceptr* dptr, size_t byteSize) {
     CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemAlloc));
 
-    if (!ensureCudaSymbol(hook.ori_cuMemAlloc_v2, SYMBOL_STRING(cuMemAlloc))) {
-        spdlog::error("Unable to resolve original cuMemAlloc");
-        return CUDA_ERROR_NOT_INITIALIZED;
+    const CUcontext ctx = currentContext(hook);
+    const int idx = currentDevice(hook, ctx);
+    if (hook.getSlabAllocator().handles(byteSize) && allocFromSlab(hook, dptr, byteSize, idx, ctx)) {
+        return scope.finish(CUDA_SUCCESS);
     }
 
-    if(auto limit = hook.getDevice().getDeviceMemoryLimit();limit > 0){
-        if(hook.getDevice().getDeviceMemoryUsage() + byteSize > limit){
-            spdlog::error("Out of memory, trying to allocate {} bytes, current usage {}", byteSize, hook.getDevice().getDeviceMemoryUsage());
-            return CUDA_ERROR_OUT_OF_MEMORY;
+    if(!reserveDeviceMemory(hook, byteSize, idx)){
+        if (hook.getDevice().oversubscriptionEnabled()) {
+            return scope.finish(allocOversubscribed(hook, dptr, byteSize, idx, ctx));
         }
+        spdlog::error("Out of memory, trying to allocate {} bytes, current usage {}", byteSize, hook.getDevice().getDeviceMemoryUsage(idx));
+        return scope.finish(CUDA_ERROR_OUT_OF_MEMORY);
     }
 
     const CUresult result = hook.ori_cuMemAlloc_v2(dptr, byteSize);
     if (result != CUDA_SUCCESS) {
+        hook.getDevice().rollbackMemory(byteSize, idx);
+        // physically full below the limit, e.g. memory held outside the hook
+        if (result == CUDA_ERROR_OUT_OF_MEMORY && hook.getDevice().oversubscriptionEnabled()) {
+            return scope.finish(allocOversubscribed(hook, dptr, byteSize, idx, ctx));
+        }
         logCudaError(hook, "cuMemAlloc failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    hook.getDevice().updateMemoryUsage(MemAlloc,*dptr,byteSize);
+    hook.getDevice().updateMemoryUsage(MemAlloc, *dptr, byteSize, idx, ctx);
 
-    return result;
+    return scope.finish(result);
 }
 
 CUresult cuDeviceGet(CUdevice* device, int ordinal) {
     CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuDeviceGet));
 
-    if (!ensureCudaSymbol(hook.ori_cuDeviceGet, SYMBOL_STRING(cuDeviceGet))) {
-        spdlog::error("Unable to resolve original cuDeviceGet");
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
-
-    return hook.ori_cuDeviceGet(device, ordinal);
+    return scope.finish(hook.ori_cuDeviceGet(device, ordinal));
 }
 
 CUresult cuMemFree(CUdeviceptr dptr) {
     CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemFree));
 
-    if (!ensureCudaSymbol(hook.ori_cuMemFree_v2, SYMBOL_STRING(cuMemFree))) {
-        spdlog::error("Unable to resolve original cuMemFree");
-        return CUDA_ERROR_NOT_INITIALIZED;
+    // pooled blocks never reach the driver, only slabs the pool lets go of
+    if (uint64_t released = 0; hook.getSlabAllocator().enabled() && hook.getSlabAllocator().free(dptr, &released)) {
+        if (released != 0) {
+            releaseSlab(hook, released);
+        }
+        return scope.finish(CUDA_SUCCESS);
     }
 
     const CUresult result = hook.ori_cuMemFree_v2(dptr);
@@ -166,113 +549,148 @@ CUresult cuMemFree(CUdeviceptr dptr) {
 
     hook.getDevice().updateMemoryUsage(MemFree, dptr);
 
-    return result;
+    return scope.finish(result);
 }
 
 CUresult cuCtxGetDevice(CUdevice* device) {
     CudaHook& hook = CudaHook::getInstance();
-
-    if (!ensureCudaSymbol(hook.ori_cuCtxGetDevice, SYMBOL_STRING(cuCtxGetDevice))) {
-        spdlog::error("Unable to resolve original cuCtxGetDevice");
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
+    util::ApiScope scope(VCUDA_METRIC_ID(cuCtxGetDevice));
 
     CUresult result = hook.ori_cuCtxGetDevice(device);
     if (result != CUDA_SUCCESS) {
         logCudaError(hook, "cuCtxGetDevice failed", result);
-        return result;
+        return scope.finish(result);
     }
 
+    const CUcontext ctx = currentContext(hook);
+    int known = 0;
+    if (!hook.getDevice().contextDevice(ctx, &known) || known != int(*device)) {
+        hook.getDevice().setContextDevice(ctx, int(*device));
+    }
     hook.getDevice().setDeviceId(int(*device));
 
-    return result;
+    return scope.finish(result);
 }
 
 CUresult cuCtxSetCurrent(CUcontext ctx) {
     CudaHook& hook = CudaHook::getInstance();
-
-    if (!ensureCudaSymbol(hook.ori_cuCtxSetCurrent, SYMBOL_STRING(cuCtxSetCurrent))) {
-        spdlog::error("Unable to resolve original cuCtxSetCurrent");
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
-
-    if (!ensureCudaSymbol(hook.ori_cuCtxGetDevice, SYMBOL_STRING(cuCtxGetDevice))) {
-        spdlog::error("Unable to resolve original cuCtxGetDevice");
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
+    util::ApiScope scope(VCUDA_METRIC_ID(cuCtxSetCurrent));
 
     CUresult result = hook.ori_cuCtxSetCurrent(ctx);
     if (result != CUDA_SUCCESS) {
         logCudaError(hook, "cuCtxSetCurrent failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    CUdevice device;
-    result = hook.ori_cuCtxGetDevice(&device);
+    currentDevice(hook, ctx);
+
+    return scope.finish(result);
+}
+
+CUresult cuCtxDestroy(CUcontext ctx) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuCtxDestroy));
+
+    const CUresult result = hook.ori_cuCtxDestroy_v2(ctx);
     if (result != CUDA_SUCCESS) {
-        logCudaError(hook, "cuCtxGetDevice failed", result);
-        return result;
+        logCudaError(hook, "cuCtxDestroy failed", result);
+        return scope.finish(result);
     }
 
-    hook.getDevice().setDeviceId(int(device));
+    releaseContextMemory(hook, ctx);
+    return scope.finish(result);
+}
+
+CUresult cuDevicePrimaryCtxRetain(CUcontext* pctx, CUdevice dev) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuDevicePrimaryCtxRetain));
 
-    return result;
+    const CUresult result = hook.ori_cuDevicePrimaryCtxRetain(pctx, dev);
+    if (result == CUDA_SUCCESS && dev >= 0 && dev < DEVICE_MAX_NUM) {
+        g_primary_contexts[dev].store(*pctx, std::memory_order_release);
+    }
+    return scope.finish(result);
 }
-CUresult cuMemGetInfo(size_t* free, size_t* total) {
+
+// the primary context outlives a release while other retains hold it
+CUresult cuDevicePrimaryCtxRelease(CUdevice dev) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuDevicePrimaryCtxRelease));
+
+    const CUresult result = hook.ori_cuDevicePrimaryCtxRelease_v2(dev);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuDevicePrimaryCtxRelease failed", result);
+        return scope.finish(result);
+    }
+
+    unsigned int flags = 0;
+    int active = 1;
+    if (hook.ori_cuDevicePrimaryCtxGetState &&
+        hook.ori_cuDevicePrimaryCtxGetState(dev, &flags, &active) == CUDA_SUCCESS && !active) {
+        releasePrimaryContextMemory(hook, dev);
+    }
+    return scope.finish(result);
+}
+
+CUresult cuDevicePrimaryCtxReset(CUdevice dev) {
     CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuDevicePrimaryCtxReset));
 
-    if (!ensureCudaSymbol(hook.ori_cuMemGetInfo_v2, SYMBOL_STRING(cuMemGetInfo))) {
-        spdlog::error("Unable to resolve original cuMemGetInfo");
-        return CUDA_ERROR_NOT_INITIALIZED;
+    const CUresult result = hook.ori_cuDevicePrimaryCtxReset_v2(dev);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuDevicePrimaryCtxReset failed", result);
+        return scope.finish(result);
     }
 
-    if (auto limit = hook.getDevice().getDeviceMemoryLimit(); limit > 0){
+    releasePrimaryContextMemory(hook, dev);
+    return scope.finish(result);
+}
+
+CUresult cuMemGetInfo(size_t* free, size_t* total) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemGetInfo));
+
+    const int idx = currentDevice(hook);
+    if (auto limit = hook.getDevice().getDeviceMemoryLimit(idx); limit > 0){
+        const size_t used = hook.getDevice().getDeviceMemoryUsage(idx);
         *total = limit;
-        *free = limit - hook.getDevice().getDeviceMemoryUsage();
-        return CUDA_SUCCESS;
+        *free = used < limit ? limit - used : 0;
+        return scope.finish(CUDA_SUCCESS);
     }
 
     const CUresult result = hook.ori_cuMemGetInfo_v2(free, total);
     if (result != CUDA_SUCCESS) {
         logCudaError(hook, "cuMemGetInfo failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    return result;
+    return scope.finish(result);
 }
 
 CUresult cuDeviceTotalMem(size_t *bytes, CUdevice dev){
     CudaHook& hook = CudaHook::getInstance();
-
-    if (!ensureCudaSymbol(hook.ori_cuDeviceTotalMem_v2, SYMBOL_STRING(cuDeviceTotalMem))) {
-        spdlog::error("Unable to resolve original cuDeviceTotalMem");
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
+    util::ApiScope scope(VCUDA_METRIC_ID(cuDeviceTotalMem));
 
     if (auto limit = hook.getDevice().getDeviceMemoryLimit(int(dev)); limit > 0){
         *bytes = limit;
-        return CUDA_SUCCESS;
+        return scope.finish(CUDA_SUCCESS);
     }
 
     const CUresult result = hook.ori_cuDeviceTotalMem_v2(bytes, dev);
     if (result != CUDA_SUCCESS) {
         logCudaError(hook, "cuDeviceTotalMem failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    return result;
+    return scope.finish(result);
 }
 
 CUresult cuMemCreate(CUmemGenericAllocationHandle* handle, size_t size, const CUmemAllocationProp* prop, unsigned long long flags){
     CudaHook& hook = CudaHook::getInstance();
-
-    if (!ensureCudaSymbol(hook.ori_cuMemCreate, SYMBOL_STRING(cuMemCreate))) {
-        spdlog::error("Unable to resolve original cuMemCreate");
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemCreate));
 
     if(!prop){
-        return CUDA_ERROR_INVALID_VALUE;
+        return scope.finish(CUDA_ERROR_INVALID_VALUE);
     }
 
     CUresult result = CUDA_SUCCESS;
@@ -283,44 +701,296 @@ CUresult cuMemCreate(CUmemGenericAllocationHandle* handle, size_t size, const CU
             logCudaError(hook, "cuMemCreate failed", result);
         }
 
-        return result;
+        return scope.finish(result);
     }
 
     int idx = prop->location.id;
-    if(auto limit = hook.getDevice().getDeviceMemoryLimit(idx);limit > 0){
-        if(hook.getDevice().getDeviceMemoryUsage(idx) + size > limit){
-            spdlog::error("VMM Out of memory, trying to allocate {} bytes, current usage {}", size, hook.getDevice().getDeviceMemoryUsage(idx));
-            return CUDA_ERROR_OUT_OF_MEMORY;
-        }
+    const size_t charged = vmmPhysicalSize(hook, size, prop);
+    if(!hook.getDevice().reserveMemory(charged, idx)){
+        spdlog::error("VMM Out of memory, trying to allocate {} bytes, current usage {}", charged, hook.getDevice().getDeviceMemoryUsage(idx));
+        return scope.finish(CUDA_ERROR_OUT_OF_MEMORY);
     }
 
     result = hook.ori_cuMemCreate(handle, size, prop, flags);
     if (result != CUDA_SUCCESS) {
+        hook.getDevice().rollbackMemory(charged, idx);
         logCudaError(hook, "cuMemCreate failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    hook.getDevice().updateMemoryUsage(MemAlloc, reinterpret_cast<CUdeviceptr>(*handle), size, idx);
-    return result;
+    hook.getDevice().updateMemoryUsage(MemAlloc, reinterpret_cast<CUdeviceptr>(*handle), charged, idx);
+    hook.getVmmTracker().addHandle(*handle);
+    return scope.finish(result);
 }
 
 CUresult cuMemRelease(CUmemGenericAllocationHandle handle){
     CudaHook& hook = CudaHook::getInstance();
-
-    if (!ensureCudaSymbol(hook.ori_cuMemRelease, SYMBOL_STRING(cuMemRelease))) {
-        spdlog::error("Unable to resolve original cuMemRelease");
-        return CUDA_ERROR_NOT_INITIALIZED;
-    }
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemRelease));
 
     CUresult result = hook.ori_cuMemRelease(handle);
     if (result != CUDA_SUCCESS) {
         logCudaError(hook, "cuMemRelease failed", result);
-        return result;
+        return scope.finish(result);
     }
 
+    // a mapped handle keeps its memory until the last cuMemUnmap
+    if (!hook.getVmmTracker().release(handle)) {
+        spdlog::debug("VMM handle {} released while mapped, kept charged until unmapped", handle);
+        return scope.finish(result);
+    }
     hook.getDevice().updateMemoryUsage(MemFree, reinterpret_cast<CUdeviceptr>(handle));
-    return result;
+    return scope.finish(result);
+}
+
+CUresult cuMemMap(CUdeviceptr ptr, size_t size, size_t offset, CUmemGenericAllocationHandle handle, unsigned long long flags){
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemMap));
+
+    CUresult result = hook.ori_cuMemMap(ptr, size, offset, handle, flags);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuMemMap failed", result);
+        return scope.finish(result);
+    }
+
+    hook.getVmmTracker().map(ptr, size, handle);
+    return scope.finish(result);
+}
+
+CUresult cuMemUnmap(CUdeviceptr ptr, size_t size){
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemUnmap));
+
+    CUresult result = hook.ori_cuMemUnmap(ptr, size);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuMemUnmap failed", result);
+        return scope.finish(result);
+    }
+
+    for (const CUmemGenericAllocationHandle handle : hook.getVmmTracker().unmap(ptr, size)) {
+        hook.getDevice().updateMemoryUsage(MemFree, reinterpret_cast<CUdeviceptr>(handle));
+    }
+    return scope.finish(result);
+}
+
+CUresult cuMemAllocHost(void** pp, size_t bytesize) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemAllocHost));
+
+    return scope.finish(pinHostMemory(hook, pp, pinnedSpan(nullptr, bytesize), "cuMemAllocHost failed", [&] {
+        return hook.ori_cuMemAllocHost_v2(pp, bytesize);
+    }));
+}
+
+CUresult cuMemHostAlloc(void** pp, size_t bytesize, unsigned int flags) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemHostAlloc));
+
+    return scope.finish(pinHostMemory(hook, pp, pinnedSpan(nullptr, bytesize), "cuMemHostAlloc failed", [&] {
+        return hook.ori_cuMemHostAlloc(pp, bytesize, flags);
+    }));
+}
+
+CUresult cuMemFreeHost(void* p) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemFreeHost));
+
+    const CUresult result = hook.ori_cuMemFreeHost(p);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuMemFreeHost failed", result);
+        return scope.finish(result);
+    }
+
+    hook.getDevice().releasePinnedHost(p);
+    return scope.finish(result);
+}
+
+// registering pins the whole pages the range touches
+CUresult cuMemHostRegister(void* p, size_t bytesize, unsigned int flags) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemHostRegister));
+
+    return scope.finish(pinHostMemory(hook, &p, pinnedSpan(p, bytesize), "cuMemHostRegister failed", [&] {
+        return hook.ori_cuMemHostRegister_v2(p, bytesize, flags);
+    }));
+}
+
+CUresult cuMemHostUnregister(void* p) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemHostUnregister));
+
+    const CUresult result = hook.ori_cuMemHostUnregister(p);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuMemHostUnregister failed", result);
+        return scope.finish(result);
+    }
+
+    hook.getDevice().releasePinnedHost(p);
+    return scope.finish(result);
+}
+
+CUresult cuMemAllocAsync(CUdeviceptr* dptr, size_t byteSize, CUstream hStream) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemAllocAsync));
+
+    return scope.finish(allocAsync(hook, dptr, byteSize, hStream, hook.ori_cuMemAllocAsync));
+}
+
+CUresult cuMemAllocAsync_ptsz(CUdeviceptr* dptr, size_t byteSize, CUstream hStream) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemAllocAsync));
+
+    return scope.finish(allocAsync(hook, dptr, byteSize, hStream, hook.ori_cuMemAllocAsync_ptsz));
+}
+
+CUresult cuMemAllocFromPoolAsync(CUdeviceptr* dptr, size_t byteSize, CUmemoryPool pool, CUstream hStream) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemAllocFromPoolAsync));
+
+    if (!hook.ori_cuMemAllocFromPoolAsync) {
+        return scope.finish(CUDA_ERROR_NOT_SUPPORTED);
+    }
+    return scope.finish(allocFromMemPool(hook, dptr, byteSize, pool, [&] {
+        return hook.ori_cuMemAllocFromPoolAsync(dptr, byteSize, pool, hStream);
+    }));
+}
+
+CUresult cuMemAllocFromPoolAsync_ptsz(CUdeviceptr* dptr, size_t byteSize, CUmemoryPool pool, CUstream hStream) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemAllocFromPoolAsync));
+
+    if (!hook.ori_cuMemAllocFromPoolAsync_ptsz) {
+        return scope.finish(CUDA_ERROR_NOT_SUPPORTED);
+    }
+    return scope.finish(allocFromMemPool(hook, dptr, byteSize, pool, [&] {
+        return hook.ori_cuMemAllocFromPoolAsync_ptsz(dptr, byteSize, pool, hStream);
+    }));
+}
+
+CUresult cuMemFreeAsync(CUdeviceptr dptr, CUstream hStream) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemFreeAsync));
+
+    return scope.finish(freeAsync(hook, dptr, hStream, hook.ori_cuMemFreeAsync));
 }
 
+CUresult cuMemFreeAsync_ptsz(CUdeviceptr dptr, CUstream hStream) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemFreeAsync));
+
+    return scope.finish(freeAsync(hook, dptr, hStream, hook.ori_cuMemFreeAsync_ptsz));
+}
+
+CUresult cuMemPoolCreate(CUmemoryPool* pool, const CUmemPoolProps* poolProps) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemPoolCreate));
+
+    const CUresult result = hook.ori_cuMemPoolCreate(pool, poolProps);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuMemPoolCreate failed", result);
+        return scope.finish(result);
+    }
+
+    // only device pools count against the limit
+    const bool on_device = poolProps->location.type == CU_MEM_LOCATION_TYPE_DEVICE;
+    hook.getMemPoolTracker().addPool(*pool, on_device ? poolProps->location.id : MemPoolTracker::kNoDevice);
+    return scope.finish(result);
+}
+
+CUresult cuMemPoolDestroy(CUmemoryPool pool) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemPoolDestroy));
+
+    const CUresult result = hook.ori_cuMemPoolDestroy(pool);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuMemPoolDestroy failed", result);
+        return scope.finish(result);
+    }
+
+    int idx = MemPoolTracker::kNoDevice;
+    if (const size_t charged = hook.getMemPoolTracker().removePool(pool, &idx); charged > 0) {
+        hook.getDevice().rollbackMemory(charged, idx);
+    }
+    return scope.finish(result);
+}
+
+CUresult cuMemPoolTrimTo(CUmemoryPool pool, size_t minBytesToKeep) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuMemPoolTrimTo));
+
+    const CUresult result = hook.ori_cuMemPoolTrimTo(pool, minBytesToKeep);
+    if (result != CUDA_SUCCESS) {
+        logCudaError(hook, "cuMemPoolTrimTo failed", result);
+        return scope.finish(result);
+    }
+
+    reconcileMemPool(hook, pool, hook.getMemPoolTracker().deviceOf(pool, currentDevice(hook)), 0);
+    return scope.finish(result);
+}
+
+CUresult cuLaunchKernel(CUfunction f, unsigned int gridDimX, unsigned int gridDimY, unsigned int gridDimZ,
+                        unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ,
+                        unsigned int sharedMemBytes, CUstream hStream, void** kernelParams, void** extra) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuLaunchKernel));
+
+    gateLaunch(hook);
+    return scope.finish(timedLaunch(hook, hStream, kLegacyStream, [&] {
+        return hook.ori_cuLaunchKernel(f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
+                                       sharedMemBytes, hStream, kernelParams, extra);
+    }));
+}
+
+CUresult cuLaunchKernel_ptsz(CUfunction f, unsigned int gridDimX, unsigned int gridDimY, unsigned int gridDimZ,
+                             unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ,
+                             unsigned int sharedMemBytes, CUstream hStream, void** kernelParams, void** extra) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuLaunchKernel));
+
+    gateLaunch(hook);
+    return scope.finish(timedLaunch(hook, hStream, kPerThreadStream, [&] {
+        return hook.ori_cuLaunchKernel_ptsz(f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
+                                            sharedMemBytes, hStream, kernelParams, extra);
+    }));
+}
+
+CUresult cuLaunchKernelEx(const CUlaunchConfig* config, CUfunction f, void** kernelParams, void** extra) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuLaunchKernelEx));
+
+    gateLaunch(hook);
+    return scope.finish(timedLaunch(hook, config ? config->hStream : nullptr, kLegacyStream, [&] {
+        return hook.ori_cuLaunchKernelEx(config, f, kernelParams, extra);
+    }));
+}
+
+CUresult cuLaunchKernelEx_ptsz(const CUlaunchConfig* config, CUfunction f, void** kernelParams, void** extra) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuLaunchKernelEx));
+
+    gateLaunch(hook);
+    return scope.finish(timedLaunch(hook, config ? config->hStream : nullptr, kPerThreadStream, [&] {
+        return hook.ori_cuLaunchKernelEx_ptsz(config, f, kernelParams, extra);
+    }));
+}
+
+CUresult cuGraphLaunch(CUgraphExec hGraphExec, CUstream hStream) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuGraphLaunch));
+
+    gateLaunch(hook);
+    return scope.finish(timedLaunch(hook, hStream, kLegacyStream, [&] {
+        return hook.ori_cuGraphLaunch(hGraphExec, hStream);
+    }));
+}
+
+CUresult cuGraphLaunch_ptsz(CUgraphExec hGraphExec, CUstream hStream) {
+    CudaHook& hook = CudaHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(cuGraphLaunch));
+
+    gateLaunch(hook);
+    return scope.finish(timedLaunch(hook, hStream, kPerThreadStream, [&] {
+        return hook.ori_cuGraphLaunch_ptsz(hGraphExec, hStream);
+    }));
+}
 
 #pragma GCC visibility pop
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "cuda/launch_timer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+#include "client/client.hpp"
+#include "util/thread.hpp"
+#include "util/util.hpp"
+
+LaunchTimer::LaunchTimer(bool enabled) : enabled_(enabled) {
+    if (!enabled) {
+        return;
+    }
+
+    util::atForkChild(resetAfterFork, this);
+}
+
+LaunchTimer::~LaunchTimer() = default;
+
+void LaunchTimer::setEventApi(const EventApi& api) {
+    api_ = api;
+    if (enabled() && (!api_.create || !api_.query || !api_.elapsed || !api_.destroy)) {
+        spdlog::warn("The driver has no timing events, launches are not timed");
+        enabled_.store(false, std::memory_order_relaxed);
+    }
+}
+
+// the collector thread does not survive fork
+void LaunchTimer::resetAfterFork(void* arg) {
+    auto* timer = static_cast<LaunchTimer*>(arg);
+    timer->collector_started_.store(false, std::memory_order_relaxed);
+    timer->collecting_ = false;
+    timer->forgotten_.clear();
+}
+
+bool LaunchTimer::takePair(CUcontext ctx, EventPair* pair) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.size() >= kMaxPending) {
+            return false;
+        }
+        auto& pairs = free_pairs_[ctx];
+        if (!pairs.empty()) {
+            *pair = pairs.back();
+            pairs.pop_back();
+            return true;
+        }
+    }
+
+    // created in ctx, which is current on the launching thread
+    if (api_.create(&pair->first, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+        return false;
+    }
+    if (api_.create(&pair->second, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+        api_.destroy(pair->first);
+        return false;
+    }
+    return true;
+}
+
+LaunchTimer::Span LaunchTimer::begin(CUcontext ctx, int idx, CUstream stream, RecordFn record) {
+    Span span;
+    EventPair pair;
+    if (ctx == nullptr || record == nullptr || idx < 0 || idx >= DEVICE_MAX_NUM || !takePair(ctx, &pair)) {
+        return span;
+    }
+    if (record(pair.first, stream) != CUDA_SUCCESS) {
+        api_.destroy(pair.first);
+        api_.destroy(pair.second);
+        return span;
+    }
+
+    if (unlikely(!collector_started_.load(std::memory_order_relaxed))) {
+        startCollector();
+    }
+    span.start = pair.first;
+    span.end = pair.second;
+    span.context = ctx;
+    span.device = idx;
+    return span;
+}
+
+void LaunchTimer::end(const Span& span, CUstream stream, RecordFn record) {
+    if (span.start == nullptr) {
+        return;
+    }
+    if (record(span.end, stream) != CUDA_SUCCESS) {
+        api_.destroy(span.start);
+        api_.destroy(span.end);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(span);
+}
+
+void LaunchTimer::forgetContext(CUcontext ctx) {
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (collecting_) {
+        forgotten_.push_back(ctx);
+    }
+    free_pairs_.erase(ctx);
+    pending_.erase(std::remove_if(pending_.begin(), pending_.end(), [&](const Span& span) { return span.context == ctx; }),
+                   pending_.end());
+}
+
+// driver calls are made outside the lock, launches keep appending meanwhile
+void LaunchTimer::collect() {
+    std::vector<Span> spans;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        spans.swap(pending_);
+        collecting_ = !spans.empty();
+    }
+    if (spans.empty()) {
+        return;
+    }
+
+    // A context destroyed meanwhile took its events along: those queries fail
+    // or are stale, and its spans must not go back to the pool. Any other
+    // failure, such as an event recorded into a graph capture, leaves the
+    // pair unusable, and its events are destroyed.
+    std::vector<Span> waiting;
+    std::vector<Span> failed;
+    std::vector<std::pair<Span, uint64_t>> done;
+    for (const Span& span : spans) {
+        const CUresult state = api_.query(span.end);
+        if (state == CUDA_ERROR_NOT_READY) {
+            waiting.push_back(span);
+            continue;
+        }
+        if (state == CUDA_ERROR_CONTEXT_IS_DESTROYED || state == CUDA_ERROR_INVALID_CONTEXT ||
+            state == CUDA_ERROR_INVALID_HANDLE) {
+            continue; // gone with its context
+        }
+        if (state != CUDA_SUCCESS) {
+            failed.push_back(span);
+            continue;
+        }
+        float elapsed_ms = 0;
+        uint64_t elapsed_ns = 0;
+        if (api_.elapsed(&elapsed_ms, span.start, span.end) == CUDA_SUCCESS && elapsed_ms > 0) {
+            elapsed_ns = static_cast<uint64_t>(static_cast<double>(elapsed_ms) * 1e6);
+        }
+        done.emplace_back(span, elapsed_ns);
+    }
+
+    std::array<uint64_t, DEVICE_MAX_NUM> busy_ns{};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto forgotten = [this](const Span& span) {
+            return std::find(forgotten_.begin(), forgotten_.end(), span.context) != forgotten_.end();
+        };
+        for (const auto& [span, elapsed_ns] : done) {
+            if (!forgotten(span)) {
+                free_pairs_[span.context].emplace_back(span.start, span.end);
+                busy_ns[span.device] += elapsed_ns;
+            }
+        }
+        for (const Span& span : failed) {
+            if (!forgotten(span)) {
+                api_.destroy(span.start);
+                api_.destroy(span.end);
+            }
+        }
+        waiting.erase(std::remove_if(waiting.begin(), waiting.end(), forgotten), waiting.end());
+        pending_.insert(pending_.begin(), waiting.begin(), waiting.end());
+        collecting_ = false;
+        forgotten_.clear();
+    }
+
+    for (int idx = 0; idx < DEVICE_MAX_NUM; ++idx) {
+        if (busy_ns[idx] > 0) {
+            Client::getInstance().add_device_busy_time(idx, busy_ns[idx]);
+        }
+    }
+}
+
+void LaunchTimer::startCollector() {
+    if (collector_started_.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    if (!util::startDetachedThread("vcuda-timer", collectorMain, this)) {
+        spdlog::warn("Failed to start the launch timer collector, launches are not timed");
+        enabled_.store(false, std::memory_order_relaxed);
+    }
+}
+
+void* LaunchTimer::collectorMain(void* arg) {
+    auto* timer = static_cast<LaunchTimer*>(arg);
+    for (;;) {
+        std::this_thread::sleep_for(kCollectPeriod);
+        timer->collect();
+    }
+    return nullptr;
+}
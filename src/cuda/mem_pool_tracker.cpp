@@ -0,0 +1,71 @@
+#include "cuda/mem_pool_tracker.hpp"
+
+#include <iterator>
+
+void MemPoolTracker::addPool(CUmemoryPool pool, int device) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pools_[pool] = Pool{device, 0};
+}
+
+size_t MemPoolTracker::removePool(CUmemoryPool pool, int* device) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = pools_.find(pool);
+    if (it == pools_.end()) {
+        *device = kNoDevice;
+        return 0;
+    }
+
+    *device = it->second.device;
+    const size_t charged = it->second.charged;
+    pools_.erase(it);
+
+    // the driver frees whatever was still allocated from it
+    for (auto ptr = pointers_.begin(); ptr != pointers_.end();) {
+        ptr = ptr->second == pool ? pointers_.erase(ptr) : std::next(ptr);
+    }
+    return charged;
+}
+
+int MemPoolTracker::deviceOf(CUmemoryPool pool, int fallback_device) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pools_.try_emplace(pool, Pool{fallback_device, 0}).first->second.device;
+}
+
+int64_t MemPoolTracker::observe(CUmemoryPool pool, size_t reserved) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = pools_.find(pool);
+    if (it == pools_.end() || it->second.device == kNoDevice) {
+        return 0;
+    }
+
+    const int64_t delta = static_cast<int64_t>(reserved) - static_cast<int64_t>(it->second.charged);
+    it->second.charged = reserved;
+    return delta;
+}
+
+void MemPoolTracker::track(CUdeviceptr ptr, CUmemoryPool pool) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pointers_[ptr] = pool;
+}
+
+bool MemPoolTracker::untrack(CUdeviceptr ptr, CUmemoryPool* pool) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = pointers_.find(ptr);
+    if (it == pointers_.end()) {
+        return false;
+    }
+    *pool = it->second;
+    pointers_.erase(it);
+    return true;
+}
+
+std::vector<CUmemoryPool> MemPoolTracker::poolsOf(int device) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<CUmemoryPool> pools;
+    for (const auto& [pool, state] : pools_) {
+        if (state.device == device) {
+            pools.push_back(pool);
+        }
+    }
+    return pools;
+}
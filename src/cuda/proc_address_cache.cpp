@@ -0,0 +1,68 @@
+#include "cuda/proc_address_cache.hpp"
+
+#include <cstring>
+#include <string_view>
+
+#include "hook/symbol_table.hpp"
+
+uint64_t ProcAddressCache::keyOf(const char* symbol, std::size_t length, int cudaVersion, cuuint64_t flags) {
+    const uint64_t hash = hook::hashSymbol(std::string_view(symbol, length));
+    const uint64_t key = hook::mixSymbolHash(hash ^ (static_cast<uint64_t>(cudaVersion) << 32) ^ flags);
+    return key | 1;
+}
+
+bool ProcAddressCache::lookup(const char* symbol, int cudaVersion, cuuint64_t flags, Entry& entry) const {
+    const std::size_t length = std::strlen(symbol);
+    if (length >= kMaxSymbolLength) {
+        return false;
+    }
+
+    const uint64_t key = keyOf(symbol, length, cudaVersion, flags);
+    for (std::size_t i = 0; i < kCapacity; ++i) {
+        const Slot& slot = slots_[(key + i) & (kCapacity - 1)];
+        const uint64_t slot_key = slot.key.load(std::memory_order_acquire);
+        if (slot_key == 0) {
+            return false;
+        }
+
+        if (slot_key == key && slot.cuda_version == cudaVersion && slot.flags == flags &&
+            std::memcmp(slot.symbol, symbol, length + 1) == 0) {
+            entry = slot.entry;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ProcAddressCache::insert(const char* symbol, int cudaVersion, cuuint64_t flags, const Entry& entry) {
+    const std::size_t length = std::strlen(symbol);
+    if (length >= kMaxSymbolLength) {
+        return;
+    }
+
+    const uint64_t key = keyOf(symbol, length, cudaVersion, flags);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size_ >= kCapacity / 4 * 3) {
+        return;
+    }
+
+    for (std::size_t i = 0; i < kCapacity; ++i) {
+        Slot& slot = slots_[(key + i) & (kCapacity - 1)];
+        const uint64_t slot_key = slot.key.load(std::memory_order_relaxed);
+        if (slot_key == key && slot.cuda_version == cudaVersion && slot.flags == flags &&
+            std::memcmp(slot.symbol, symbol, length + 1) == 0) {
+            return; // another thread resolved it first
+        }
+
+        if (slot_key == 0) {
+            slot.cuda_version = cudaVersion;
+            slot.flags = flags;
+            std::memcpy(slot.symbol, symbol, length + 1);
+            slot.entry = entry;
+            slot.key.store(key, std::memory_order_release);
+            ++size_;
+            return;
+        }
+    }
+}
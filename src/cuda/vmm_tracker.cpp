@@ -0,0 +1,75 @@
+#include "cuda/vmm_tracker.hpp"
+
+#include <algorithm>
+
+void VmmTracker::addHandle(CUmemGenericAllocationHandle handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    handles_[handle] = Handle{};
+}
+
+bool VmmTracker::release(CUmemGenericAllocationHandle handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = handles_.find(handle);
+    if (it == handles_.end()) {
+        return true;
+    }
+    if (it->second.mapped > 0) {
+        it->second.released = true;
+        return false;
+    }
+    handles_.erase(it);
+    return true;
+}
+
+void VmmTracker::map(CUdeviceptr ptr, size_t size, CUmemGenericAllocationHandle handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = handles_.find(handle);
+    if (it == handles_.end() || size == 0) {
+        return; // host memory, nothing to keep alive
+    }
+    it->second.mapped += size;
+    mappings_[ptr] = Mapping{ptr + size, handle};
+}
+
+std::vector<CUmemGenericAllocationHandle> VmmTracker::unmap(CUdeviceptr ptr, size_t size) {
+    std::vector<CUmemGenericAllocationHandle> freed;
+    const CUdeviceptr end = ptr + size;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = mappings_.upper_bound(ptr);
+    if (it != mappings_.begin() && std::prev(it)->second.end > ptr) {
+        --it; // starts below ptr and reaches into the range
+    }
+
+    while (it != mappings_.end() && it->first < end) {
+        const CUdeviceptr start = it->first;
+        const Mapping mapping = it->second;
+        it = mappings_.erase(it);
+
+        // keep what lies outside the range
+        if (start < ptr) {
+            mappings_.emplace(start, Mapping{ptr, mapping.handle});
+        }
+        if (mapping.end > end) {
+            it = mappings_.emplace(end, Mapping{mapping.end, mapping.handle}).first;
+            ++it;
+        }
+
+        const auto handle = handles_.find(mapping.handle);
+        if (handle == handles_.end()) {
+            continue;
+        }
+        handle->second.mapped -= std::min(mapping.end, end) - std::max(start, ptr);
+        if (handle->second.mapped == 0 && handle->second.released) {
+            freed.push_back(mapping.handle);
+            handles_.erase(handle);
+        }
+    }
+    return freed;
+}
+
+size_t VmmTracker::mappedBytes(CUmemGenericAllocationHandle handle) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = handles_.find(handle);
+    return it == handles_.end() ? 0 : it->second.mapped;
+}
@@ -0,0 +1,192 @@
+#include "device/allocation_table.hpp"
+
+#include <sched.h>
+
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr int kShardBits = 6;
+static_assert((std::size_t{1} << kShardBits) == AllocationTable::kShards, "kShards must match kShardBits");
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+} // namespace
+
+void AllocationTable::SpinLock::lock() {
+    for (unsigned spins = 0;; ++spins) {
+        if (!locked_.exchange(true, std::memory_order_acquire)) {
+            return;
+        }
+        while (locked_.load(std::memory_order_relaxed)) {
+            if (++spins % 64 == 0) {
+                sched_yield(); // the holder may have been preempted
+            } else {
+                cpuRelax();
+            }
+        }
+    }
+}
+
+AllocationTable::AllocationTable() : shards_(new Shard[kShards]) {
+    for (std::size_t i = 0; i < kShards; ++i) {
+        shards_[i].slots.reset(new Record[kInitialShardCapacity]);
+        shards_[i].capacity = kInitialShardCapacity;
+    }
+}
+
+AllocationTable::~AllocationTable() = default;
+
+// device pointers are 512-byte aligned or better; mix so every bit counts
+uint64_t AllocationTable::hashPointer(uint64_t ptr) {
+    ptr ^= ptr >> 33;
+    ptr *= 0xff51afd7ed558ccdull;
+    ptr ^= ptr >> 33;
+    ptr *= 0xc4ceb9fe1a85ec53ull;
+    return ptr ^ (ptr >> 33);
+}
+
+AllocationTable::Shard& AllocationTable::shardOf(uint64_t hash) const {
+    return shards_[hash >> (64 - kShardBits)];
+}
+
+// slot holding ptr, or the empty slot ending its probe sequence
+std::size_t AllocationTable::probe(const Shard& shard, uint64_t ptr, uint64_t hash) {
+    const std::size_t mask = shard.capacity - 1;
+    std::size_t slot = hash & mask;
+    while (shard.slots[slot].ptr != 0 && shard.slots[slot].ptr != ptr) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void AllocationTable::grow(Shard& shard) {
+    const std::size_t old_capacity = shard.capacity;
+    std::unique_ptr<Record[]> old_slots(shard.slots.release());
+
+    shard.capacity = old_capacity * 2;
+    shard.slots.reset(new Record[shard.capacity]);
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+        if (old_slots[i].ptr != 0) {
+            shard.slots[probe(shard, old_slots[i].ptr, hashPointer(old_slots[i].ptr))] = old_slots[i];
+        }
+    }
+}
+
+bool AllocationTable::insert(uint64_t ptr, uint64_t size, int device, Record& replaced, uint64_t context) {
+    if (ptr == 0) {
+        return false;
+    }
+
+    const uint64_t hash = hashPointer(ptr);
+    Shard& shard = shardOf(hash);
+    std::lock_guard<SpinLock> lock(shard.lock);
+
+    std::size_t slot = probe(shard, ptr, hash);
+    Record& current = shard.slots[slot];
+    if (current.ptr == ptr) {
+        replaced = current;
+        current = Record{ptr, size, device, context};
+        return true;
+    }
+
+    if ((shard.count + 1) * 2 > shard.capacity) {
+        grow(shard);
+        slot = probe(shard, ptr, hash);
+    }
+    shard.slots[slot] = Record{ptr, size, device, context};
+    ++shard.count;
+    return false;
+}
+
+bool AllocationTable::erase(uint64_t ptr, Record& removed) {
+    if (ptr == 0) {
+        return false;
+    }
+
+    const uint64_t hash = hashPointer(ptr);
+    Shard& shard = shardOf(hash);
+    std::lock_guard<SpinLock> lock(shard.lock);
+
+    std::size_t hole = probe(shard, ptr, hash);
+    if (shard.slots[hole].ptr != ptr) {
+        return false;
+    }
+    removed = shard.slots[hole];
+    eraseSlot(shard, hole);
+    return true;
+}
+
+// backward shift deletion: pull later records of the cluster into the hole
+// unless that would move them in front of their home slot
+void AllocationTable::eraseSlot(Shard& shard, std::size_t hole) {
+    --shard.count;
+    const std::size_t mask = shard.capacity - 1;
+    for (std::size_t next = (hole + 1) & mask; shard.slots[next].ptr != 0; next = (next + 1) & mask) {
+        const std::size_t home = hashPointer(shard.slots[next].ptr) & mask;
+        const bool movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable) {
+            shard.slots[hole] = shard.slots[next];
+            hole = next;
+        }
+    }
+    shard.slots[hole] = Record{};
+}
+
+// Shifting pulls records back into the slot just emptied, so each slot is
+// looked at again until it holds a record of another context.
+std::size_t AllocationTable::eraseContext(uint64_t context, std::vector<Record>& removed) {
+    if (context == 0) {
+        return 0;
+    }
+
+    std::size_t erased = 0;
+    for (std::size_t i = 0; i < kShards; ++i) {
+        Shard& shard = shards_[i];
+        std::lock_guard<SpinLock> lock(shard.lock);
+        for (std::size_t slot = 0; slot < shard.capacity;) {
+            if (shard.slots[slot].ptr != 0 && shard.slots[slot].context == context) {
+                removed.push_back(shard.slots[slot]);
+                eraseSlot(shard, slot);
+                ++erased;
+            } else {
+                ++slot;
+            }
+        }
+    }
+    return erased;
+}
+
+bool AllocationTable::find(uint64_t ptr, Record& record) const {
+    if (ptr == 0) {
+        return false;
+    }
+
+    const uint64_t hash = hashPointer(ptr);
+    const Shard& shard = shardOf(hash);
+    std::lock_guard<SpinLock> lock(shard.lock);
+
+    const std::size_t slot = probe(shard, ptr, hash);
+    if (shard.slots[slot].ptr != ptr) {
+        return false;
+    }
+    record = shard.slots[slot];
+    return true;
+}
+
+std::size_t AllocationTable::size() const {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < kShards; ++i) {
+        std::lock_guard<SpinLock> lock(shards_[i].lock);
+        total += shards_[i].count;
+    }
+    return total;
+}
@@ -11,85 +11,387 @@ namespace {
     };
 
     LoggerInitializer g_logger_initializer;
+
+    // moves whenever either source of limits does: the config file, or the
+    // node agent's policy
+    uint64_t limitsGeneration() {
+        return util::Config::generation() + Client::getInstance().policy_generation();
+    }
+
+    size_t hostPinnedLimit() {
+        size_t limit = 0;
+        if (Client::getInstance().policy_host_pinned_limit(&limit)) {
+            return limit;
+        }
+        return util::Config::hostPinnedLimitBytes();
+    }
+
+    // the calling thread's current device, and the context it last resolved
+    // through the cache of owner; stale once owner's generation moved on
+    struct ThreadDevice {
+        int idx = 0;
+        const Device* owner = nullptr;
+        CUcontext context = nullptr;
+        int context_device = 0;
+        uint64_t generation = 0;
+    };
+
+    thread_local ThreadDevice t_device;
 }
 
 // Device constructor
-Device::Device() :process_usage_(util::ProcessUsage::getInstance())
+Device::Device()
 { 
-    if (auto limit = util::Config::memoryLimitBytes();limit > 0) {
-        device_memory_limit_bytes_ = limit;
+    for (auto& limit : device_memory_limit_bytes_) {
+        limit.store(kLimitUnresolved, std::memory_order_relaxed);
+    }
+    for (auto& budget : oversubscription_budget_bytes_) {
+        budget.store(kLimitUnresolved, std::memory_order_relaxed);
+    }
+
+    oversubscription_ratio_ = util::Config::oversubscriptionRatio();
+    if (oversubscription_ratio_ > 0) {
+        spdlog::debug("Oversubscription up to {}x the device memory limit", oversubscription_ratio_);
+    }
+
+    pinned_host_limit_bytes_.store(hostPinnedLimit(), std::memory_order_relaxed);
+    if (const size_t limit = getPinnedHostLimit(); limit > 0) {
+        spdlog::debug("Pinned host memory limit: {} bytes", limit);
     }
 
     if (auto deviceName = util::Config::targetDeviceName();size(deviceName) > 0) {
         device_name_ = deviceName;
     }
+
+    util::Config::addReloadListener(onConfigReload, this);
+    Client::getInstance().add_policy_listener(onConfigReload, this);
 }
 
-Device::~Device() {}
+Device::~Device() {
+    Client::getInstance().remove_policy_listener(onConfigReload, this);
+    util::Config::removeReloadListener(onConfigReload, this);
+}
+
+void Device::onConfigReload(void* arg) {
+    static_cast<Device*>(arg)->reloadLimits();
+}
+
+// Runs on the config watcher thread, or on the reaper for a new policy of the
+// node agent. Cached limits are dropped and resolved
+// again on their next lookup; unused quota leases go back so that a lowered
+// limit holds from the very next reservation. Memory allocated past a lowered
+// limit stays, new allocations fail until enough of it is freed.
+void Device::reloadLimits() {
+    pinned_host_limit_bytes_.store(hostPinnedLimit(), std::memory_order_relaxed);
+    for (auto& limit : device_memory_limit_bytes_) {
+        limit.store(kLimitUnresolved, std::memory_order_relaxed);
+    }
+    for (auto& budget : oversubscription_budget_bytes_) {
+        budget.store(kLimitUnresolved, std::memory_order_relaxed);
+    }
+    Client::getInstance().return_quota_leases();
+    spdlog::info("Memory limits reloaded, pinned host memory limit: {} bytes", getPinnedHostLimit());
+}
+
+void Device::setDeviceProbe(DeviceProbe probe) {
+    probe_ = probe;
+}
 
 void Device::setDeviceId(int idx) {
-    device_id_ = idx;
+    t_device.idx = idx;
 }
 
 int Device::getDeviceId() {
-    return device_id_;
+    return t_device.idx;
 }
 
+bool Device::contextDevice(CUcontext ctx, int* idx) const {
+    if (ctx == nullptr) {
+        return false;
+    }
+    const uint64_t generation = context_generation_.load(std::memory_order_acquire);
+    if (likely(t_device.owner == this && t_device.context == ctx && t_device.generation == generation)) {
+        *idx = t_device.context_device;
+        return true;
+    }
 
-// record allocation action
-void Device::recordAllocation(CUdeviceptr ptr, size_t size, int idx) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        device_memory_blocks_[ptr] = MemoryBlock{idx, ptr, size};
+    AllocationTable::Record record;
+    if (!context_devices_.find(reinterpret_cast<uint64_t>(ctx), record)) {
+        return false;
+    }
+    t_device.owner = this;
+    t_device.context = ctx;
+    t_device.context_device = record.device;
+    t_device.generation = generation;
+    *idx = record.device;
+    return true;
+}
 
-        process_usage_.updateUsage(idx, size);
+void Device::setContextDevice(CUcontext ctx, int idx) {
+    if (ctx == nullptr) {
+        return;
+    }
+    AllocationTable::Record replaced;
+    if (context_devices_.insert(reinterpret_cast<uint64_t>(ctx), 0, idx, replaced) && replaced.device != idx) {
+        context_generation_.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void Device::forgetContext(CUcontext ctx) {
+    AllocationTable::Record removed;
+    if (ctx != nullptr && context_devices_.erase(reinterpret_cast<uint64_t>(ctx), removed)) {
+        context_generation_.fetch_add(1, std::memory_order_release);
+    }
+}
+
+
+// record allocation action
+void Device::recordAllocation(CUdeviceptr ptr, size_t size, int idx, CUcontext ctx) {
+    AllocationTable::Record replaced;
+    if (device_memory_blocks_.insert(ptr, size, idx, replaced, reinterpret_cast<uint64_t>(ctx))) {
+        // the driver reused an address we never saw freed
+        Client::getInstance().release_device_memory(replaced.device, replaced.size);
+    }
 }
 
 // record free action
 void Device::recordFree(CUdeviceptr ptr) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (const auto it = device_memory_blocks_.find(ptr); it != device_memory_blocks_.end()) {
-        const size_t freed_size = it->second.size;
-        const int idx = it->second.idx;
-        device_memory_blocks_.erase(it);
-
+    AllocationTable::Record removed;
+    if (device_memory_blocks_.erase(ptr, removed)) {
         // update memory usage
-        process_usage_.updateUsage(idx, -freed_size);
+        Client::getInstance().release_device_memory(removed.device, removed.size);
+    } else if (oversubscriptionEnabled() && oversubscribed_blocks_.erase(ptr, removed)) {
+        oversubscribed_bytes_[removed.device].fetch_sub(removed.size, std::memory_order_relaxed);
+    }
+}
+
+bool Device::reserveOversubscribed(size_t size, int idx) {
+    if (likely(idx == DEVICE_INDEX_CURRENT)){
+        idx = t_device.idx;
+    }
+    if (!oversubscriptionEnabled() || idx < 0 || idx >= DEVICE_MAX_NUM) {
+        return false;
+    }
+
+    const size_t budget = getOversubscriptionBudget(idx);
+    auto& used = oversubscribed_bytes_[idx];
+    size_t current = used.load(std::memory_order_relaxed);
+    do {
+        if (current + size > budget || current + size < current) {
+            return false;
+        }
+    } while (!used.compare_exchange_weak(current, current + size, std::memory_order_relaxed));
+    return true;
+}
+
+void Device::rollbackOversubscribed(size_t size, int idx) {
+    if (likely(idx == DEVICE_INDEX_CURRENT)){
+        idx = t_device.idx;
     }
+
+    oversubscribed_bytes_[idx].fetch_sub(size, std::memory_order_relaxed);
+}
+
+void Device::recordOversubscribed(CUdeviceptr ptr, size_t size, int idx, CUcontext ctx) {
+    if (likely(idx == DEVICE_INDEX_CURRENT)){
+        idx = t_device.idx;
+    }
+
+    AllocationTable::Record replaced;
+    if (oversubscribed_blocks_.insert(ptr, size, idx, replaced, reinterpret_cast<uint64_t>(ctx))) {
+        oversubscribed_bytes_[replaced.device].fetch_sub(replaced.size, std::memory_order_relaxed);
+    }
+}
+
+size_t Device::getOversubscribedUsage(int idx) const {
+    if (likely(idx == DEVICE_INDEX_CURRENT)){
+        idx = t_device.idx;
+    }
+    if (idx < 0 || idx >= DEVICE_MAX_NUM) {
+        return 0;
+    }
+
+    return oversubscribed_bytes_[idx].load(std::memory_order_relaxed);
+}
+
+// Managed bytes allowed past the limit; without a limit the device memory is
+// the base, which needs the driver and is resolved again until it answers.
+size_t Device::getOversubscriptionBudget(int idx) const {
+    if (const size_t budget = oversubscription_budget_bytes_[idx].load(std::memory_order_relaxed); likely(budget != kLimitUnresolved)) {
+        return budget;
+    }
+
+    const uint64_t generation = limitsGeneration();
+    size_t base = getDeviceMemoryLimit(idx);
+    std::string uuid;
+    if (base == 0 && (!probe_ || !probe_(idx, &base, &uuid))) {
+        return 0;
+    }
+
+    const auto budget = static_cast<size_t>(static_cast<long double>(base) * (oversubscription_ratio_ - 1));
+    oversubscription_budget_bytes_[idx].store(budget, std::memory_order_relaxed);
+    if (limitsGeneration() != generation) {
+        oversubscription_budget_bytes_[idx].store(kLimitUnresolved, std::memory_order_relaxed);
+    }
+    spdlog::debug("Device {} oversubscription budget: {} bytes", idx, budget);
+    return budget;
+}
+
+bool Device::reserveMemory(size_t size, int idx) {
+    if (likely(idx == DEVICE_INDEX_CURRENT)){
+        idx = t_device.idx;
+    }
+
+    return Client::getInstance().reserve_device_memory(idx, size, getDeviceMemoryLimit(idx));
+}
+
+void Device::rollbackMemory(size_t size, int idx) {
+    if (likely(idx == DEVICE_INDEX_CURRENT)){
+        idx = t_device.idx;
+    }
+
+    Client::getInstance().release_device_memory(idx, size);
+}
+
+void Device::chargeMemory(size_t size, int idx) {
+    if (likely(idx == DEVICE_INDEX_CURRENT)){
+        idx = t_device.idx;
+    }
+
+    Client::getInstance().reserve_device_memory(idx, size, 0);
+}
+
+bool Device::reservePinnedHost(size_t size) {
+    return Client::getInstance().reserve_host_memory(size, getPinnedHostLimit());
+}
+
+void Device::rollbackPinnedHost(size_t size) {
+    Client::getInstance().release_host_memory(size);
+}
+
+void Device::recordPinnedHost(const void* ptr, size_t size) {
+    AllocationTable::Record replaced;
+    if (pinned_host_blocks_.insert(reinterpret_cast<uint64_t>(ptr), size, 0, replaced)) {
+        Client::getInstance().release_host_memory(replaced.size);
+    }
+}
+
+bool Device::releasePinnedHost(const void* ptr) {
+    AllocationTable::Record removed;
+    if (!pinned_host_blocks_.erase(reinterpret_cast<uint64_t>(ptr), removed)) {
+        return false;
+    }
+    Client::getInstance().release_host_memory(removed.size);
+    return true;
+}
+
+size_t Device::getPinnedHostUsage() const {
+    return Client::getInstance().get_host_pinned_usage();
 }
 
 // get device memory usage
 size_t Device::getDeviceMemoryUsage(int idx) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-
     if (likely(idx == DEVICE_INDEX_CURRENT)){
-        idx = device_id_;
+        idx = t_device.idx;
     }
 
-    if (idx >= 0 && idx < static_cast<int>(process_usage_.devices.size())) {
-        return Client::getInstance().get_device_process_metric_data(idx);
+    return Client::getInstance().get_device_process_metric_data(idx);
+}
+
+size_t Device::getDeviceMemoryLimit(int idx) const {
+    if (likely(idx == DEVICE_INDEX_CURRENT)){
+        idx = t_device.idx;
+    }
+    if (idx < 0 || idx >= DEVICE_MAX_NUM) {
+        return 0;
     }
 
-    return 0;
+    if (const size_t limit = device_memory_limit_bytes_[idx].load(std::memory_order_relaxed); likely(limit != kLimitUnresolved)) {
+        return limit;
+    }
+    return resolveDeviceMemoryLimit(idx);
 }
 
-size_t Device::getDeviceMemoryLimit(int _) const {
-    return device_memory_limit_bytes_;
+// Pick the limit for device idx and cache it until the config is reloaded or
+// the node agent publishes a policy, whose limits replace the config's:
+// UUID keys and percentages need the driver, which may not be initialized
+// yet, so those are resolved again on the next call until the probe works.
+// A reload racing with us may have dropped the cache before our store, so
+// the value is only kept if the generation did not move meanwhile.
+size_t Device::resolveDeviceMemoryLimit(int idx) const {
+    const uint64_t generation = limitsGeneration();
+    auto shared_limits = Client::getInstance().policy_memory_limits();
+    if (!shared_limits) {
+        shared_limits = util::Config::deviceMemoryLimits();
+    }
+    const auto& limits = *shared_limits;
+
+    size_t total_bytes = 0;
+    std::string uuid;
+    const bool probed = limits.needsDeviceInfo() && probe_ && probe_(idx, &total_bytes, &uuid);
+
+    const util::MemoryLimit* limit = limits.find(idx, uuid);
+    size_t bytes = limit ? limit->resolve(total_bytes) : 0;
+    if (probed && total_bytes > 0 && bytes > total_bytes) {
+        bytes = total_bytes;
+    }
+
+    if (probed || !limits.needsDeviceInfo()) {
+        device_memory_limit_bytes_[idx].store(bytes, std::memory_order_relaxed);
+        if (limitsGeneration() != generation) {
+            device_memory_limit_bytes_[idx].store(kLimitUnresolved, std::memory_order_relaxed);
+        }
+        spdlog::debug("Device {} memory limit: {} bytes", idx, bytes);
+    }
+    return bytes;
 }
 
 
 // update memory usage
-void Device::updateMemoryUsage(const enum MemOperation operation, CUdeviceptr ptr, size_t size, int idx) {
+void Device::updateMemoryUsage(const enum MemOperation operation, CUdeviceptr ptr, size_t size, int idx, CUcontext ctx) {
     if (likely(idx == DEVICE_INDEX_CURRENT)){
-        idx = device_id_;
+        idx = t_device.idx;
     }
 
     if (operation == MemAlloc) {
-        recordAllocation(ptr, size, idx);
+        recordAllocation(ptr, size, idx, ctx);
     } else {
         recordFree(ptr);
     }
+}
+
+std::vector<CUdeviceptr> Device::releaseContext(CUcontext ctx) {
+    std::vector<CUdeviceptr> released;
+    const auto context = reinterpret_cast<uint64_t>(ctx);
+    if (context == 0) {
+        return released;
+    }
+    forgetContext(ctx);
 
-    Client::getInstance().update_process_metric_data(process_usage_);
+    std::vector<AllocationTable::Record> removed;
+    device_memory_blocks_.eraseContext(context, removed);
+    std::array<size_t, DEVICE_MAX_NUM> bytes{};
+    for (const auto& record : removed) {
+        bytes[record.device] += record.size;
+        released.push_back(record.ptr);
+    }
+    for (int idx = 0; idx < DEVICE_MAX_NUM; ++idx) {
+        if (bytes[idx] > 0) {
+            Client::getInstance().release_device_memory(idx, bytes[idx]);
+        }
+    }
+
+    removed.clear();
+    if (oversubscriptionEnabled() && oversubscribed_blocks_.eraseContext(context, removed) > 0) {
+        for (const auto& record : removed) {
+            oversubscribed_bytes_[record.device].fetch_sub(record.size, std::memory_order_relaxed);
+        }
+    }
+
+    if (!released.empty()) {
+        spdlog::debug("Context {} destroyed, released {} allocations", static_cast<const void*>(ctx), released.size());
+    }
+    return released;
 }
 
 // get device name
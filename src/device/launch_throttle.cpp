@@ -0,0 +1,110 @@
+#include "device/launch_throttle.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+#include "util/thread.hpp"
+
+LaunchThrottle::LaunchThrottle(double percent)
+    : share_(percent > 0 && percent < 100 ? percent / 100 : 0),
+      buckets_(new Bucket[DEVICE_MAX_NUM]) {
+    if (!enabled()) {
+        return;
+    }
+
+    burst_ns_ = static_cast<int64_t>(share_.load(std::memory_order_relaxed) * std::chrono::nanoseconds(kBurst).count());
+    for (int idx = 0; idx < DEVICE_MAX_NUM; ++idx) {
+        buckets_[idx].tokens.store(burst_ns_, std::memory_order_relaxed);
+    }
+    spdlog::debug("Kernel launches throttled to {}% of the GPU", percent);
+
+    util::atForkChild(resetAfterFork, this);
+}
+
+LaunchThrottle::~LaunchThrottle() = default;
+
+// the sampler thread does not survive fork
+void LaunchThrottle::resetAfterFork(void* arg) {
+    static_cast<LaunchThrottle*>(arg)->sampler_started_.store(false, std::memory_order_relaxed);
+}
+
+void LaunchThrottle::acquire(int idx) {
+    if (idx < 0 || idx >= DEVICE_MAX_NUM) {
+        return;
+    }
+
+    Bucket& bucket = buckets_[idx];
+    if (unlikely(!bucket.active.load(std::memory_order_relaxed))) {
+        bucket.active.store(true, std::memory_order_relaxed);
+        startSampler();
+    }
+    if (likely(bucket.tokens.load(std::memory_order_relaxed) > 0)) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    while (bucket.tokens.load(std::memory_order_relaxed) <= 0) {
+        refilled_.wait_for(lock, kSamplePeriod);
+        if (!sampler_started_.load(std::memory_order_relaxed)) {
+            break; // no sampler, nobody would ever refill
+        }
+    }
+}
+
+void LaunchThrottle::refill(int idx, uint64_t elapsed_ns, uint64_t busy_ns) {
+    const auto credit = static_cast<int64_t>(share_.load(std::memory_order_relaxed) * static_cast<double>(elapsed_ns)) - static_cast<int64_t>(busy_ns);
+    auto& tokens = buckets_[idx].tokens;
+    int64_t current = tokens.load(std::memory_order_relaxed);
+    while (!tokens.compare_exchange_weak(current, std::min(current + credit, burst_ns_), std::memory_order_relaxed)) {
+    }
+}
+
+void LaunchThrottle::sample(uint64_t elapsed_ns) {
+    for (int idx = 0; idx < DEVICE_MAX_NUM; ++idx) {
+        Bucket& bucket = buckets_[idx];
+        if (!bucket.active.load(std::memory_order_relaxed)) {
+            continue;
+        }
+
+        uint64_t busy_ns = 0;
+        if (!probe_ || !probe_(idx, &busy_ns)) {
+            refill(idx, elapsed_ns, 0); // unmeasurable, keep launches going
+            continue;
+        }
+        if (!bucket.primed) {
+            bucket.primed = true;
+            bucket.last_busy_ns = busy_ns;
+            continue;
+        }
+        refill(idx, elapsed_ns, busy_ns > bucket.last_busy_ns ? busy_ns - bucket.last_busy_ns : 0);
+        bucket.last_busy_ns = busy_ns;
+    }
+
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    refilled_.notify_all();
+}
+
+void LaunchThrottle::startSampler() {
+    if (sampler_started_.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    if (!util::startDetachedThread("vcuda-throttle", samplerMain, this)) {
+        spdlog::warn("Failed to start the launch throttle sampler, kernel launches are not throttled");
+        sampler_started_.store(false, std::memory_order_relaxed);
+        share_.store(0, std::memory_order_relaxed);
+    }
+}
+
+void* LaunchThrottle::samplerMain(void* arg) {
+    auto* throttle = static_cast<LaunchThrottle*>(arg);
+    auto last = std::chrono::steady_clock::now();
+    for (;;) {
+        std::this_thread::sleep_for(kSamplePeriod);
+        const auto now = std::chrono::steady_clock::now();
+        throttle->sample(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count());
+        last = now;
+    }
+    return nullptr;
+}
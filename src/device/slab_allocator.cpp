@@ -0,0 +1,180 @@
+#include "device/slab_allocator.hpp"
+
+#include <algorithm>
+
+static_assert((SlabAllocator::kMinBlockSize << 10) == SlabAllocator::kMaxBlockSize, "kClasses must cover every class");
+
+SlabAllocator::SlabAllocator(std::size_t max_block_size)
+    : max_block_size_(std::min(max_block_size, kMaxBlockSize)) {
+    if (max_block_size_ > 0) {
+        bins_.reset(new Bin[DEVICE_MAX_NUM * kClasses]);
+    }
+}
+
+SlabAllocator::~SlabAllocator() = default;
+
+std::size_t SlabAllocator::classOf(std::size_t size) {
+    std::size_t klass = 0;
+    while (blockSize(klass) < size) {
+        ++klass;
+    }
+    return klass;
+}
+
+uint64_t SlabAllocator::takeBlock(Slab& slab) {
+    const uint32_t block = slab.free_blocks.back();
+    slab.free_blocks.pop_back();
+    ++slab.used;
+    return slab.base + static_cast<uint64_t>(block) * blockSize(slab.klass);
+}
+
+bool SlabAllocator::allocate(int device, std::size_t size, uint64_t* ptr) {
+    if (!handles(size) || device < 0 || device >= DEVICE_MAX_NUM) {
+        return false;
+    }
+
+    Bin& bin = binOf(device, classOf(size));
+    std::lock_guard<std::mutex> guard(bin.lock);
+    if (bin.available.empty()) {
+        return false;
+    }
+
+    Slab* slab = bin.available.back();
+    if (slab == bin.spare) {
+        bin.spare = nullptr;
+    }
+    *ptr = takeBlock(*slab);
+    if (slab->free_blocks.empty()) {
+        bin.available.pop_back();
+    }
+    return true;
+}
+
+void SlabAllocator::addSlab(int device, std::size_t size, uint64_t base, uint64_t* ptr) {
+    auto owned = std::make_unique<Slab>();
+    Slab* slab = owned.get();
+    slab->base = base;
+    slab->device = device;
+    slab->klass = classOf(size);
+
+    // handed out from the lowest address up
+    const auto blocks = static_cast<uint32_t>(kSlabSize / blockSize(slab->klass));
+    slab->free_blocks.reserve(blocks);
+    for (uint32_t block = blocks; block > 0; --block) {
+        slab->free_blocks.push_back(block - 1);
+    }
+    *ptr = takeBlock(*slab);
+
+    {
+        std::unique_lock<std::shared_mutex> guard(index_lock_);
+        index_[base] = std::move(owned);
+    }
+
+    Bin& bin = binOf(device, slab->klass);
+    std::lock_guard<std::mutex> guard(bin.lock);
+    bin.available.push_back(slab);
+}
+
+// A slab is only forgotten once it holds no block, and a discarded one is
+// kept, so the slab found for a live ptr stays valid after the index lock is
+// dropped.
+bool SlabAllocator::free(uint64_t ptr, uint64_t* released) {
+    *released = 0;
+
+    Slab* slab = nullptr;
+    {
+        std::shared_lock<std::shared_mutex> guard(index_lock_);
+        auto it = index_.upper_bound(ptr);
+        if (it == index_.begin()) {
+            return false;
+        }
+        --it;
+        slab = it->second.get();
+    }
+    const uint64_t offset = ptr - slab->base;
+    if (offset >= kSlabSize || offset % blockSize(slab->klass) != 0) {
+        return false;
+    }
+
+    Bin& bin = binOf(slab->device, slab->klass);
+    {
+        std::lock_guard<std::mutex> guard(bin.lock);
+        if (slab->discarded) {
+            return false;
+        }
+        slab->free_blocks.push_back(static_cast<uint32_t>(offset / blockSize(slab->klass)));
+        --slab->used;
+        if (slab->free_blocks.size() == 1) {
+            bin.available.push_back(slab); // was full
+        }
+        if (slab->used > 0) {
+            return true;
+        }
+        if (bin.spare == nullptr) {
+            bin.spare = slab;
+            return true;
+        }
+        bin.available.erase(std::find(bin.available.begin(), bin.available.end(), slab));
+    }
+
+    *released = slab->base;
+    forget(slab);
+    return true;
+}
+
+std::vector<uint64_t> SlabAllocator::trim(int device) {
+    std::vector<uint64_t> released;
+    if (!enabled() || device < 0 || device >= DEVICE_MAX_NUM) {
+        return released;
+    }
+
+    std::vector<Slab*> empty;
+    for (std::size_t klass = 0; klass < kClasses; ++klass) {
+        Bin& bin = binOf(device, klass);
+        std::lock_guard<std::mutex> guard(bin.lock);
+        auto kept = std::partition(bin.available.begin(), bin.available.end(),
+                                   [](const Slab* slab) { return slab->used > 0; });
+        empty.insert(empty.end(), kept, bin.available.end());
+        bin.available.erase(kept, bin.available.end());
+        bin.spare = nullptr;
+    }
+
+    for (Slab* slab : empty) {
+        released.push_back(slab->base);
+        forget(slab);
+    }
+    return released;
+}
+
+bool SlabAllocator::discard(uint64_t base) {
+    if (!enabled()) {
+        return false;
+    }
+
+    Slab* slab = nullptr;
+    {
+        std::unique_lock<std::shared_mutex> guard(index_lock_);
+        const auto it = index_.find(base);
+        if (it == index_.end()) {
+            return false;
+        }
+        slab = it->second.get();
+        discarded_.push_back(std::move(it->second));
+        index_.erase(it);
+    }
+
+    Bin& bin = binOf(slab->device, slab->klass);
+    std::lock_guard<std::mutex> guard(bin.lock);
+    slab->discarded = true;
+    bin.available.erase(std::remove(bin.available.begin(), bin.available.end(), slab), bin.available.end());
+    if (bin.spare == slab) {
+        bin.spare = nullptr;
+    }
+    std::vector<uint32_t>().swap(slab->free_blocks);
+    return true;
+}
+
+void SlabAllocator::forget(Slab* slab) {
+    std::unique_lock<std::shared_mutex> guard(index_lock_);
+    index_.erase(slab->base);
+}
@@ -69,24 +69,29 @@ static int fd_path(int fd, char *buf, size_t sz) {
 }
 
 namespace {
+    // The table lookup runs before the hook instance is touched, so unrelated
+    // symbols sharing a prefix (e.g. curl_*) never trigger the eager binding.
     template <typename HookT>
-    void* tryHookSymbol(HookT& hook, const char* symbol, void* original_sym) {
-        const auto hookInfo = HookT::getHookedSymbol(symbol);
-        if (!hookInfo.hookedFunc || hookInfo.hookedFunc == NO_HOOK) {
+    void* tryHookSymbol(const char* symbol, void* original_sym) {
+        const int idx = HookT::kSymbolTable.find(symbol);
+        if (idx == HookT::kSymbolTable.kNotFound || !original_sym) {
             return original_sym;
         }
 
-        if (original_sym && hookInfo.original) {
-            hookInfo.original(hook, original_sym);
+        const auto& hookInfo = HookT::getHookMap()[idx];
+        if (hookInfo.hookedFunc == NO_HOOK) {
+            return original_sym;
         }
 
+        HookT::getInstance().adoptOriginalSymbol(idx, original_sym);
+
         spdlog::debug("Hook {}", symbol);
         return hookInfo.hookedFunc;
     }
 
     template <typename HookT>
-    bool matchSymbol(HookT& hook,const char* symbol) {
-        return strncmp(symbol, hook.GetSymbolPrefix(), strlen(hook.GetSymbolPrefix())) == 0;
+    bool matchSymbol(const char* symbol) {
+        return strncmp(symbol, HookT::kSymbolPrefix.data(), HookT::kSymbolPrefix.size()) == 0;
     }
 } 
 
@@ -100,12 +105,12 @@ void* dlsym(void* handle, const char* symbol){
     auto sym = real_dlsym(handle, symbol);
     spdlog::trace("Dlsym {}", symbol);
 
-    if (auto& hook = CudaHook::getInstance();matchSymbol(hook, symbol)){
-        return tryHookSymbol(hook, symbol, sym);
+    if (matchSymbol<CudaHook>(symbol)){
+        return tryHookSymbol<CudaHook>(symbol, sym);
     }
 
-    if (auto& hook = NvmlHook::getInstance();matchSymbol(hook, symbol)) {
-        return tryHookSymbol(hook, symbol, sym);
+    if (matchSymbol<NvmlHook>(symbol)) {
+        return tryHookSymbol<NvmlHook>(symbol, sym);
     }
 
 
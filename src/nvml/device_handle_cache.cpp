@@ -0,0 +1,43 @@
+#include "nvml/device_handle_cache.hpp"
+
+#include <cstring>
+
+void DeviceHandleCache::add(unsigned int index, nvmlDevice_t handle, const char* uuid) {
+    if (index >= entries_.size() || handle == nullptr) {
+        return;
+    }
+    Entry& entry = entries_[index];
+    int expected = kEmpty;
+    if (!entry.state.compare_exchange_strong(expected, kWriting, std::memory_order_acq_rel)) {
+        return;
+    }
+    if (uuid) {
+        std::strncpy(entry.uuid, uuid, sizeof(entry.uuid) - 1);
+    }
+    entry.handle.store(handle, std::memory_order_release);
+    entry.state.store(kReady, std::memory_order_release);
+}
+
+bool DeviceHandleCache::indexOf(nvmlDevice_t handle, unsigned int* index) const {
+    if (handle == nullptr) {
+        return false;
+    }
+    for (unsigned int i = 0; i < entries_.size(); ++i) {
+        if (entries_[i].handle.load(std::memory_order_acquire) == handle) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+nvmlDevice_t DeviceHandleCache::handleOf(unsigned int index) const {
+    return index < entries_.size() ? entries_[index].handle.load(std::memory_order_acquire) : nullptr;
+}
+
+std::string DeviceHandleCache::uuidOf(unsigned int index) const {
+    if (index >= entries_.size() || entries_[index].state.load(std::memory_order_acquire) != kReady) {
+        return {};
+    }
+    return entries_[index].uuid;
+}
@@ -1,13 +1,16 @@
 #include <dlfcn.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
 #include <cstring>
 #include <iostream>
+#include <vector>
 
 #include "spdlog/spdlog.h"
 #include "util/logger.hpp"
+#include "util/metrics.hpp"
 #include "nvml/nvml_hook.hpp"
 
-extern void* real_dlsym(void* handle, const char* symbol);
-
 namespace {
     struct LoggerInitializer {
         LoggerInitializer() {
@@ -16,36 +19,24 @@ namespace {
     };
 
     LoggerInitializer g_logger_initializer;
-    template <typename FnPtr>
-    bool ensureNvmlSymbol(FnPtr& fn, const char* symbol_name) {
-        if (fn) {
-            return true;
-        }
 
-        void* handle = dlopen(NVML_LIBRARY_SO, RTLD_LAZY | RTLD_LOCAL);
-        if (!handle) {
-            spdlog::error("dlopen {} failed while loading {}: {}", NVML_LIBRARY_SO, symbol_name, dlerror());
-            return false;
-        }
+    // a sample's SM utilization covers at most this long before it, so an idle
+    // spell between two samples of ours is not counted as busy
+    constexpr unsigned long long kMaxSampleIntervalUs = 1000000;
 
-        dlerror();
-        void* symbol = real_dlsym(handle, symbol_name);
-        const char* error = dlerror();
-        dlclose(handle);
-
-        if (error != nullptr || symbol == nullptr) {
-            spdlog::error("real_dlsym failed to load {}: {}", symbol_name, error ? error : "unknown error");
-            return false;
-        }
+    // state of NvmlHook::probeBusyTime per device, touched by the launch
+    // throttle's sampler thread only
+    struct BusySampler {
+        unsigned long long last_seen_us = 0; // newest sample timestamp of any process
+        unsigned long long own_last_us = 0;  // newest sample timestamp of this process
+        uint64_t busy_ns = 0;
+    };
 
-        fn = reinterpret_cast<FnPtr>(symbol);
-        spdlog::trace("Loaded original symbol {}", symbol_name);
-        return true;
-    }
+    std::array<BusySampler, DEVICE_MAX_NUM> g_busy_samplers{};
 
     void logNvmlError(NvmlHook& hook, const char* context, nvmlReturn_t code) {
         const char* error_string = nullptr;
-        if (hook.ori_nvmlErrorString || ensureNvmlSymbol(hook.ori_nvmlErrorString, SYMBOL_STRING(nvmlErrorString))) {
+        if (hook.ori_nvmlErrorString) {
             if (hook.ori_nvmlErrorString(code, &error_string) != NVML_SUCCESS) {
                 error_string = nullptr;
             }
@@ -58,103 +49,239 @@ namespace {
         }
     }
 
+    // handle of device index with its UUID, from the cache or once from NVML
+    nvmlDevice_t deviceHandle(NvmlHook& hook, unsigned int index) {
+        DeviceHandleCache& cache = hook.getDeviceHandleCache();
+        if (nvmlDevice_t device = cache.handleOf(index)) {
+            return device;
+        }
+
+        nvmlDevice_t device = nullptr;
+        if (!hook.ori_nvmlDeviceGetHandleByIndex_v2 ||
+            hook.ori_nvmlDeviceGetHandleByIndex_v2(index, &device) != NVML_SUCCESS) {
+            return nullptr;
+        }
+        char uuid[NVML_DEVICE_UUID_V2_BUFFER_SIZE] = {};
+        if (!hook.ori_nvmlDeviceGetUUID || hook.ori_nvmlDeviceGetUUID(device, uuid, sizeof(uuid)) != NVML_SUCCESS) {
+            uuid[0] = '\0';
+        }
+        cache.add(index, device, uuid);
+        return device;
+    }
+
+    // index of a handle the application got from NVML; only a handle not
+    // seen yet costs a call into NVML
+    nvmlReturn_t deviceIndex(NvmlHook& hook, nvmlDevice_t device, unsigned int* index) {
+        if (hook.getDeviceHandleCache().indexOf(device, index)) {
+            return NVML_SUCCESS;
+        }
+        if (!hook.ori_nvmlDeviceGetIndex) {
+            return NVML_ERROR_FUNCTION_NOT_FOUND;
+        }
+        const nvmlReturn_t result = hook.ori_nvmlDeviceGetIndex(device, index);
+        if (result == NVML_SUCCESS) {
+            deviceHandle(hook, *index);
+        }
+        return result;
+    }
+
+    // every device NVML reports, right after initialization
+    void cacheDeviceHandles(NvmlHook& hook) {
+        unsigned int count = 0;
+        if (!hook.ori_nvmlDeviceGetCount_v2 || hook.ori_nvmlDeviceGetCount_v2(&count) != NVML_SUCCESS) {
+            return;
+        }
+        for (unsigned int index = 0; index < count && index < DEVICE_MAX_NUM; ++index) {
+            deviceHandle(hook, index);
+        }
+    }
+
 } // namespace
 
+bool NvmlHook::probeDevice(int idx, size_t* total_bytes, std::string* uuid) {
+    auto& hook = NvmlHook::getInstance();
+
+    nvmlDevice_t device = deviceHandle(hook, static_cast<unsigned int>(idx));
+    nvmlMemory_t memory;
+    if (device == nullptr || !hook.ori_nvmlDeviceGetMemoryInfo ||
+        hook.ori_nvmlDeviceGetMemoryInfo(device, &memory) != NVML_SUCCESS) {
+        return false;
+    }
+    *total_bytes = memory.total;
+    *uuid = hook.getDeviceHandleCache().uuidOf(static_cast<unsigned int>(idx));
+    return true;
+}
+
+// Cumulative GPU time of this process on device idx, integrated from its NVML
+// utilization samples: each one's SM utilization applies to the time since
+// the one before. NVML reports pids of the host's pid namespace, so a process
+// in a namespace of its own finds no samples and is never throttled.
+bool NvmlHook::probeBusyTime(int idx, uint64_t* busy_ns) {
+    auto& hook = NvmlHook::getInstance();
+    if (idx < 0 || idx >= DEVICE_MAX_NUM || !hook.ori_nvmlInit_v2 || !hook.ori_nvmlDeviceGetProcessUtilization) {
+        return false;
+    }
+
+    // the application may never have initialized NVML itself
+    static const bool initialized = hook.ori_nvmlInit_v2() == NVML_SUCCESS;
+    nvmlDevice_t device = initialized ? deviceHandle(hook, static_cast<unsigned int>(idx)) : nullptr;
+    if (device == nullptr) {
+        return false;
+    }
+
+    BusySampler& sampler = g_busy_samplers[idx];
+    std::vector<nvmlProcessUtilizationSample_t> samples;
+    unsigned int count = 0;
+    nvmlReturn_t result = hook.ori_nvmlDeviceGetProcessUtilization(device, nullptr, &count, sampler.last_seen_us);
+    if (result == NVML_ERROR_INSUFFICIENT_SIZE || (result == NVML_SUCCESS && count > 0)) {
+        samples.resize(count);
+        result = hook.ori_nvmlDeviceGetProcessUtilization(device, samples.data(), &count, sampler.last_seen_us);
+        samples.resize(std::min<size_t>(count, samples.size()));
+    }
+    if (result == NVML_ERROR_NOT_FOUND) {
+        samples.clear(); // nothing newer than last_seen_us
+    } else if (result != NVML_SUCCESS) {
+        return false;
+    }
+
+    std::sort(samples.begin(), samples.end(), [](const auto& a, const auto& b) { return a.timeStamp < b.timeStamp; });
+    const auto pid = static_cast<unsigned int>(getpid());
+    const auto seen_before_us = sampler.last_seen_us;
+    for (const auto& sample : samples) {
+        if (sample.timeStamp <= seen_before_us) {
+            continue;
+        }
+        sampler.last_seen_us = std::max(sampler.last_seen_us, sample.timeStamp);
+        if (sample.pid != pid) {
+            continue;
+        }
+        if (sampler.own_last_us != 0) {
+            const auto interval = std::min(sample.timeStamp - sampler.own_last_us, kMaxSampleIntervalUs);
+            sampler.busy_ns += interval * sample.smUtil * 10; // us * percent -> ns
+        }
+        sampler.own_last_us = sample.timeStamp;
+    }
+    *busy_ns = sampler.busy_ns;
+    return true;
+}
+
 #pragma GCC visibility push(default)
-nvmlReturn_t nvmlDeviceGetMemoryInfo(nvmlDevice_t device, nvmlMemory_t* memory){
+nvmlReturn_t nvmlInit_v2() {
     auto& hook = NvmlHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(nvmlInit_v2));
 
-    if (!ensureNvmlSymbol(hook.ori_nvmlDeviceGetIndex, SYMBOL_STRING(nvmlDeviceGetIndex))) {
-        spdlog::error("Unable to resolve original nvmlDeviceGetIndex");
-        return NVML_ERROR_UNINITIALIZED ;
+    const nvmlReturn_t result = hook.ori_nvmlInit_v2();
+    if (result != NVML_SUCCESS) {
+        logNvmlError(hook, "nvmlInit failed", result);
+        return scope.finish(result);
     }
 
-    uint index = 0;
-    auto result = hook.ori_nvmlDeviceGetIndex(device, &index);
+    cacheDeviceHandles(hook);
+    return scope.finish(result);
+}
+
+nvmlReturn_t nvmlDeviceGetMemoryInfo(nvmlDevice_t device, nvmlMemory_t* memory){
+    auto& hook = NvmlHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(nvmlDeviceGetMemoryInfo));
+
+    unsigned int index = 0;
+    auto result = deviceIndex(hook, device, &index);
     if (result != NVML_SUCCESS) {
         logNvmlError(hook, "nvmlDeviceGetIndex failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    if (size_t limit = hook.getDevice().getDeviceMemoryLimit();limit > 0){
+    if (size_t limit = hook.getDevice().getDeviceMemoryLimit(int(index));limit > 0){
         memory->total = limit;
         memory->used = hook.getDevice().getDeviceMemoryUsage(int(index));
-        memory->free = memory->total - memory->used;
+        memory->free = memory->used < limit ? limit - memory->used : 0;
         spdlog::trace("[nvmlDeviceGetMemoryInfo] Total: {}, Used: {}, Free: {}",
                       memory->total,
                       memory->used,
                       memory->free);
-        return NVML_SUCCESS;
-    }
-
-    if (!ensureNvmlSymbol(hook.ori_nvmlDeviceGetMemoryInfo, SYMBOL_STRING(nvmlDeviceGetMemoryInfo))) {
-        spdlog::error("Unable to resolve original nvmlDeviceGetMemoryInfo");
-        return NVML_ERROR_UNINITIALIZED ;
+        return scope.finish(NVML_SUCCESS);
     }
 
     result = hook.ori_nvmlDeviceGetMemoryInfo(device, memory);
     if (result != NVML_SUCCESS) {
         logNvmlError(hook, "nvmlDeviceGetMemoryInfo failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    return result;
+    return scope.finish(result);
 }
 nvmlReturn_t nvmlDeviceGetMemoryInfo_v2(nvmlDevice_t device, nvmlMemory_v2_t* memory){
     auto& hook = NvmlHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(nvmlDeviceGetMemoryInfo_v2));
 
-    if (!ensureNvmlSymbol(hook.ori_nvmlDeviceGetIndex, SYMBOL_STRING(nvmlDeviceGetIndex))) {
-        spdlog::error("Unable to resolve original nvmlDeviceGetIndex");
-        return NVML_ERROR_UNINITIALIZED ;
-    }
-
-    uint index = 0;
-    auto result = hook.ori_nvmlDeviceGetIndex(device, &index);
+    unsigned int index = 0;
+    auto result = deviceIndex(hook, device, &index);
     if (result != NVML_SUCCESS) {
         logNvmlError(hook, "nvmlDeviceGetIndex failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    if (size_t limit = hook.getDevice().getDeviceMemoryLimit();limit > 0){
+    if (size_t limit = hook.getDevice().getDeviceMemoryLimit(int(index));limit > 0){
         memory->total = limit;
         memory->used = hook.getDevice().getDeviceMemoryUsage(int(index));
-        memory->free = memory->total - memory->used;
+        memory->free = memory->used < limit ? limit - memory->used : 0;
         spdlog::trace("[nvmlDeviceGetMemoryInfo_v2] Total: {}, Used: {}, Free: {}",
                       memory->total,
                       memory->used,
                       memory->free);
-        return NVML_SUCCESS;
-    }
-
-    if (!ensureNvmlSymbol(hook.ori_nvmlDeviceGetMemoryInfo_v2, SYMBOL_STRING(nvmlDeviceGetMemoryInfo_v2))) {
-        spdlog::error("Unable to resolve original nvmlDeviceGetMemoryInfo_v2");
-        return NVML_ERROR_UNINITIALIZED ;
+        return scope.finish(NVML_SUCCESS);
     }
 
     result = hook.ori_nvmlDeviceGetMemoryInfo_v2(device, memory);
     if (result != NVML_SUCCESS) {
         logNvmlError(hook, "nvmlDeviceGetMemoryInfo_v2 failed", result);
-        return result;
+        return scope.finish(result);
     }
 
-    return result;
+    return scope.finish(result);
 }
 
 nvmlReturn_t nvmlDeviceGetName(nvmlDevice_t device, char* name, unsigned int length){
     auto& hook = NvmlHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(nvmlDeviceGetName));
 
     if (hook.getDevice().getDeviceName() != ""){
         strncpy(name, hook.getDevice().getDeviceName().c_str(), length);
-        return NVML_SUCCESS;
+        return scope.finish(NVML_SUCCESS);
     }
 
-    if (!ensureNvmlSymbol(hook.ori_nvmlDeviceGetName, SYMBOL_STRING(nvmlDeviceGetName))) {
-        spdlog::error("Unable to resolve original nvmlDeviceGetName");
-        return NVML_ERROR_UNINITIALIZED ;
+    return scope.finish(hook.ori_nvmlDeviceGetName(device, name, length));
+}
+
+// With virtual utilization the GPU figure is the device time the launches of
+// the caller's container (util::Config::containerId) took in the last complete
+// second, summed over its processes, so a container sees its own load and not
+// its neighbours'; memory utilization stays the device's.
+nvmlReturn_t nvmlDeviceGetUtilizationRates(nvmlDevice_t device, nvmlUtilization_t* utilization) {
+    auto& hook = NvmlHook::getInstance();
+    util::ApiScope scope(VCUDA_METRIC_ID(nvmlDeviceGetUtilizationRates));
+
+    if (!hook.virtualUtilization()) {
+        return scope.finish(hook.ori_nvmlDeviceGetUtilizationRates(device, utilization));
     }
 
-    return hook.ori_nvmlDeviceGetName(device, name, length);
-}
+    unsigned int index = 0;
+    const nvmlReturn_t result = deviceIndex(hook, device, &index);
+    if (result != NVML_SUCCESS) {
+        logNvmlError(hook, "nvmlDeviceGetIndex failed", result);
+        return scope.finish(result);
+    }
 
+    nvmlUtilization_t device_utilization{};
+    if (!hook.ori_nvmlDeviceGetUtilizationRates ||
+        hook.ori_nvmlDeviceGetUtilizationRates(device, &device_utilization) != NVML_SUCCESS) {
+        device_utilization.memory = 0;
+    }
+    const uint64_t busy_ns = Client::getInstance().get_device_busy_time(int(index));
+    utilization->gpu = static_cast<unsigned int>(std::min<uint64_t>(busy_ns / 10000000, 100)); // of 1 s, in percent
+    utilization->memory = device_utilization.memory;
+    spdlog::trace("[nvmlDeviceGetUtilizationRates] device {}: gpu {}%, busy {} ns", index, utilization->gpu, busy_ns);
+    return scope.finish(NVML_SUCCESS);
+}
 
 #pragma GCC visibility pop
\ No newline at end of file
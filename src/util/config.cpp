@@ -1,22 +1,71 @@
 #include "util/config.hpp"
 
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
 #include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <mutex>
 #include <optional>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <yaml-cpp/yaml.h>
+#include "spdlog/spdlog.h"
+#include "util/thread.hpp"
 
 namespace util {
 namespace {
 
 constexpr const char* kMemoryLimitEnv = "VCUDA_MEMORY_LIMIT";
 constexpr const char* kDeviceNameEnv = "VCUDA_DEVICE_NAME";
+constexpr const char* kDeviceMemoryLimitsEnv = "VCUDA_DEVICE_MEMORY_LIMITS";
+constexpr const char* kQuotaLeaseEnv = "VCUDA_QUOTA_LEASE";
+constexpr const char* kQuotaLeaseStalenessEnv = "VCUDA_QUOTA_LEASE_STALENESS_MS";
+constexpr std::chrono::milliseconds kDefaultQuotaLeaseStaleness{100};
+constexpr const char* kOversubscriptionRatioEnv = "VCUDA_OVERSUBSCRIPTION_RATIO";
+constexpr const char* kSlabAllocMaxEnv = "VCUDA_SLAB_ALLOC_MAX";
+constexpr const char* kHostPinnedLimitEnv = "VCUDA_HOST_PINNED_LIMIT";
+constexpr const char* kComputeLimitEnv = "VCUDA_COMPUTE_LIMIT";
+constexpr const char* kPriorityEnv = "VCUDA_PRIORITY";
+constexpr const char* kTimeSliceEnv = "VCUDA_TIME_SLICE_MS";
+constexpr std::chrono::milliseconds kDefaultTimeSlice{10};
+constexpr const char* kVirtualUtilizationEnv = "VCUDA_VIRTUAL_UTILIZATION";
+constexpr const char* kUsageMaxProcessesEnv = "VCUDA_USAGE_MAX_PROCESSES";
+constexpr const char* kUsageMaxDevicesEnv = "VCUDA_USAGE_MAX_DEVICES";
+constexpr const char* kUsageSegmentEnv = "VCUDA_USAGE_SEGMENT";
+constexpr const char* kDefaultUsageSegment = "vcuda_usage";
+constexpr const char* kContainerIdEnv = "VCUDA_CONTAINER_ID";
+constexpr const char* kConfigFileEnv = "VCUDA_CONFIG_FILE";
 constexpr const char* kConfigFilePath = "/etc/vcuda/config.yaml";
+// editors and ConfigMap updates change the file in several steps
+constexpr std::chrono::milliseconds kReloadSettle{100};
 
 struct FileConfig {
     std::optional<std::size_t> memory_limit;
+    std::optional<MemoryLimit> default_memory_limit; // memory_limit, absolute or percent
     std::optional<std::string> device_name;
+    DeviceMemoryLimits device_memory_limits;
+    Config::ContainerMemoryLimits container_memory_limits;
+    std::optional<std::size_t> quota_lease;
+    std::optional<std::size_t> quota_lease_staleness_ms;
+    std::optional<double> oversubscription_ratio;
+    std::optional<std::size_t> slab_alloc_max;
+    std::optional<std::size_t> host_pinned_limit;
+    std::optional<double> compute_limit;
+    std::optional<std::size_t> priority;
+    std::optional<std::size_t> time_slice_ms;
+    std::optional<bool> virtual_utilization;
+    std::optional<std::size_t> usage_max_processes;
+    std::optional<std::size_t> usage_max_devices;
 };
 
 std::string trim(const std::string& input) {
@@ -74,6 +123,32 @@ std::size_t parseUnsigned(const std::string& text) {
     return static_cast<std::size_t>(number);
 }
 
+// a ratio of at least 1, 0 when the text is not one
+double parseRatio(const std::string& text) {
+    const auto cleaned = trim(text);
+    char* end = nullptr;
+    const double ratio = std::strtod(cleaned.c_str(), &end);
+    if (cleaned.empty() || *end != '\0' || !std::isfinite(ratio) || ratio < 1) {
+        return 0;
+    }
+    return ratio;
+}
+
+// a share of the GPU in (0, 100), "30" or "30%"; 0 when the text is not one
+// or asks for the whole GPU
+double parseComputePercent(const std::string& text) {
+    auto cleaned = trim(text);
+    if (!cleaned.empty() && cleaned.back() == '%') {
+        cleaned.pop_back();
+    }
+    char* end = nullptr;
+    const double percent = std::strtod(cleaned.c_str(), &end);
+    if (cleaned.empty() || *end != '\0' || !std::isfinite(percent) || percent <= 0 || percent >= 100) {
+        return 0;
+    }
+    return percent;
+}
+
 std::string toLowerCopy(std::string value) {
     std::transform(value.begin(), value.end(), value.begin(), [](unsigned char ch) {
         if (ch >= 'A' && ch <= 'Z') {
@@ -84,6 +159,12 @@ std::string toLowerCopy(std::string value) {
     return value;
 }
 
+// "1", "true", "yes" or "on", any case
+bool parseFlag(const std::string& text) {
+    const auto cleaned = toLowerCopy(trim(text));
+    return cleaned == "1" || cleaned == "true" || cleaned == "yes" || cleaned == "on";
+}
+
 std::size_t multiplyWithOverflowCheck(std::size_t value, std::size_t multiplier) {
     if (value == 0 || multiplier == 0) {
         return static_cast<std::size_t>(0);
@@ -141,11 +222,46 @@ std::size_t parseByteSizeInternal(const std::string& value) {
     return multiplyWithOverflowCheck(baseValue, multiplier);
 }
 
-FileConfig loadConfigFile() {
+// "20g" or "50%"; an unset limit when the value is neither
+MemoryLimit parseMemoryLimitInternal(const std::string& value) {
+    MemoryLimit limit;
+    const auto trimmed = trim(value);
+    if (!trimmed.empty() && trimmed.back() == '%') {
+        const auto number = trim(trimmed.substr(0, trimmed.size() - 1));
+        char* end = nullptr;
+        const double percent = std::strtod(number.c_str(), &end);
+        if (!number.empty() && *end == '\0' && std::isfinite(percent) && percent > 0 && percent <= 100) {
+            limit.percent = percent;
+        }
+        return limit;
+    }
+
+    limit.bytes = parseByteSizeInternal(trimmed);
+    return limit;
+}
+
+// a key made of digits only is a device index, anything else a UUID
+void addDeviceMemoryLimit(DeviceMemoryLimits& limits, const std::string& key, const MemoryLimit& limit) {
+    const auto trimmed = trim(key);
+    if (trimmed.empty() || !limit.isSet()) {
+        return;
+    }
+
+    if (trimmed.find_first_not_of("0123456789") == std::string::npos) {
+        if (trimmed.size() <= 4) {
+            limits.by_index[std::stoi(trimmed)] = limit;
+        }
+        return;
+    }
+    limits.by_uuid[Config::normalizeUuid(trimmed)] = limit;
+}
+
+// nullopt when the text is not YAML
+std::optional<FileConfig> parseConfig(const std::string& text) {
     FileConfig config;
 
     try {
-        YAML::Node root = YAML::LoadFile(kConfigFilePath);
+        YAML::Node root = YAML::Load(text);
         if (!root || !root.IsMap()) {
             return config;
         }
@@ -159,6 +275,9 @@ FileConfig loadConfigFile() {
                 if (auto parsed = parseByteSizeInternal(raw)) {
                     config.memory_limit = parsed;
                 }
+                if (auto limit = parseMemoryLimitInternal(raw); limit.isSet()) {
+                    config.default_memory_limit = limit;
+                }
             } catch (const YAML::Exception&) {
                 // ignore invalid entries
             }
@@ -178,10 +297,75 @@ FileConfig loadConfigFile() {
         };
 
         loadMemory(root["memory_limit"]);
-        if (!config.memory_limit) {
+        if (!config.default_memory_limit) {
             loadMemory(root["memoryLimit"]);
         }
 
+        const auto loadSize = [](const YAML::Node& node, std::optional<std::size_t>& value, bool bytes) {
+            if (!node || !node.IsScalar()) {
+                return;
+            }
+            try {
+                const std::string raw = node.as<std::string>();
+                value = bytes ? parseByteSizeInternal(raw) : parseUnsigned(raw);
+            } catch (const YAML::Exception&) {
+                // ignore invalid entries
+            }
+        };
+
+        loadSize(root["quota_lease"], config.quota_lease, true);
+        loadSize(root["quota_lease_staleness_ms"], config.quota_lease_staleness_ms, false);
+        if (const auto node = root["oversubscription_ratio"]; node && node.IsScalar()) {
+            config.oversubscription_ratio = parseRatio(node.as<std::string>());
+        }
+        loadSize(root["slab_alloc_max"], config.slab_alloc_max, true);
+        loadSize(root["host_pinned_limit"], config.host_pinned_limit, true);
+        if (const auto node = root["compute_limit"]; node && node.IsScalar()) {
+            config.compute_limit = parseComputePercent(node.as<std::string>());
+        }
+        loadSize(root["priority"], config.priority, false);
+        loadSize(root["time_slice_ms"], config.time_slice_ms, false);
+        if (const auto node = root["virtual_utilization"]; node && node.IsScalar()) {
+            config.virtual_utilization = parseFlag(node.as<std::string>());
+        }
+        loadSize(root["usage_max_processes"], config.usage_max_processes, false);
+        loadSize(root["usage_max_devices"], config.usage_max_devices, false);
+
+        const auto loadDeviceLimits = [](const YAML::Node& node, DeviceMemoryLimits& limits) {
+            if (!node || !node.IsMap()) {
+                return;
+            }
+            for (const auto& entry : node) {
+                try {
+                    addDeviceMemoryLimit(limits, entry.first.as<std::string>(),
+                                         parseMemoryLimitInternal(entry.second.as<std::string>()));
+                } catch (const YAML::Exception&) {
+                    // ignore invalid entries
+                }
+            }
+        };
+
+        loadDeviceLimits(root["device_memory_limits"], config.device_memory_limits);
+
+        if (const auto node = root["containers"]; node && node.IsMap()) {
+            for (const auto& entry : node) {
+                try {
+                    const auto id = trim(entry.first.as<std::string>());
+                    if (id.empty() || !entry.second.IsMap()) {
+                        continue;
+                    }
+                    DeviceMemoryLimits limits;
+                    if (const auto limit = entry.second["memory_limit"]; limit && limit.IsScalar()) {
+                        limits.fallback = parseMemoryLimitInternal(limit.as<std::string>());
+                    }
+                    loadDeviceLimits(entry.second["device_memory_limits"], limits);
+                    config.container_memory_limits[id] = std::move(limits);
+                } catch (const YAML::Exception&) {
+                    // ignore invalid entries
+                }
+            }
+        }
+
         loadDevice(root["device_name"]);
         if (!config.device_name) {
             loadDevice(root["target_device"]);
@@ -190,30 +374,196 @@ FileConfig loadConfigFile() {
             loadDevice(root["target_device_name"]);
         }
 
-        if (config.memory_limit || config.device_name) {
+        if (config.default_memory_limit || config.device_name) {
             return config;
         }
     } catch (const YAML::Exception&) {
-        return config;
+        return std::nullopt;
     }
 
     return config;
 }
 
-FileConfig& cachedFileConfig() {
+std::string envString(const char* name) {
+    const char* value = std::getenv(name);
+    return value ? value : "";
+}
+
+std::string configFilePath() {
+    const auto path = envString(kConfigFileEnv);
+    return path.empty() ? kConfigFilePath : path;
+}
+
+bool readFile(const std::string& path, std::string* text) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    *text = contents.str();
+    return !file.bad();
+}
+
+// Environment first, the config file overrides it per key.
+DeviceMemoryLimits mergeDeviceMemoryLimits(const FileConfig& fileCfg) {
+    DeviceMemoryLimits limits;
+    limits.fallback = parseMemoryLimitInternal(envString(kMemoryLimitEnv));
+
+    const auto raw = envString(kDeviceMemoryLimitsEnv);
+    std::size_t start = 0;
+    while (start < raw.size()) {
+        std::size_t end = raw.find(',', start);
+        if (end == std::string::npos) {
+            end = raw.size();
+        }
+        const auto entry = raw.substr(start, end - start);
+        if (const auto eq = entry.find('='); eq != std::string::npos) {
+            addDeviceMemoryLimit(limits, entry.substr(0, eq), parseMemoryLimitInternal(entry.substr(eq + 1)));
+        }
+        start = end + 1;
+    }
+
+    if (fileCfg.default_memory_limit) {
+        limits.fallback = fileCfg.default_memory_limit.value();
+    }
+    for (const auto& [idx, limit] : fileCfg.device_memory_limits.by_index) {
+        limits.by_index[idx] = limit;
+    }
+    for (const auto& [uuid, limit] : fileCfg.device_memory_limits.by_uuid) {
+        limits.by_uuid[uuid] = limit;
+    }
+    return limits;
+}
+
+// One version of the configuration, immutable once published: readers keep
+// the one they loaded while a reload swaps in the next.
+struct Snapshot {
+    FileConfig file;
+    DeviceMemoryLimits device_memory_limits;
+    std::string text; // the file as read, to skip reloads that change nothing
+};
+
+Config::FileGate g_file_gate = nullptr;
+bool g_file_skipped = false; // decided by the gate with the first snapshot
+
+// the next snapshot, or nullptr to keep previous: the file is unchanged,
+// unreadable or not YAML. Without a previous one the file is optional.
+std::shared_ptr<const Snapshot> loadSnapshot(const Snapshot* previous) {
+    const auto path = configFilePath();
+    auto next = std::make_shared<Snapshot>();
+    std::optional<FileConfig> parsed;
+    if (g_file_skipped) {
+        parsed = FileConfig{};
+    } else if (readFile(path, &next->text)) {
+        if (previous && next->text == previous->text) {
+            return nullptr;
+        }
+        parsed = parseConfig(next->text);
+    }
+    if (!parsed) {
+        if (previous) {
+            spdlog::warn("Config file {} is missing or invalid, keeping the previous configuration", path);
+            return nullptr;
+        }
+        parsed = FileConfig{};
+    }
+
+    next->file = std::move(parsed.value());
+    next->device_memory_limits = mergeDeviceMemoryLimits(next->file);
+    return next;
+}
+
+std::shared_ptr<const Snapshot> g_snapshot; // accessed with std::atomic_load/atomic_store only
+std::atomic<uint64_t> g_generation{0};
+
+std::shared_ptr<const Snapshot> currentSnapshot() {
     static std::once_flag flag;
-    static FileConfig cache;
     std::call_once(flag, [] {
-        cache = loadConfigFile();
+        g_file_skipped = g_file_gate && !g_file_gate();
+        std::atomic_store(&g_snapshot, loadSnapshot(nullptr));
     });
-    return cache;
+    return std::atomic_load(&g_snapshot);
+}
+
+std::shared_ptr<const FileConfig> fileConfig() {
+    auto snapshot = currentSnapshot();
+    return std::shared_ptr<const FileConfig>(snapshot, &snapshot->file);
+}
+
+std::mutex g_listeners_mutex;
+std::vector<std::pair<Config::ReloadListener, void*>> g_listeners;
+std::atomic<bool> g_watcher_started{false};
+std::atomic<int> g_watch_fd{-1};
+
+// the snapshot is published before the listeners run, so whatever they read
+// is at least as new as the change that woke them
+void reloadConfig() {
+    auto next = loadSnapshot(currentSnapshot().get());
+    if (!next) {
+        return;
+    }
+    std::atomic_store(&g_snapshot, std::move(next));
+    g_generation.fetch_add(1);
+    spdlog::info("Reloaded config file {}", configFilePath());
+
+    std::lock_guard<std::mutex> lock(g_listeners_mutex);
+    for (const auto& [listener, arg] : g_listeners) {
+        listener(arg);
+    }
+}
+
+// The directory is watched rather than the file: editors replace the file
+// and ConfigMap volumes swap a symlink next to it, either leaves a watch on
+// the file itself pointing at the old inode.
+void* watcherMain(void*) {
+    const auto path = configFilePath();
+    const auto slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+
+    const int fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1) {
+        spdlog::warn("Failed to watch config file {}: {}", path, std::strerror(errno));
+        return nullptr;
+    }
+    if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB) == -1) {
+        spdlog::debug("Not watching config file {}: {}", path, std::strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    g_watch_fd.store(fd, std::memory_order_relaxed);
+
+    alignas(inotify_event) char events[4096];
+    for (;;) {
+        const ssize_t length = read(fd, events, sizeof(events));
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            break;
+        }
+        // events of the remaining steps only cause reloads that find nothing new
+        std::this_thread::sleep_for(kReloadSettle);
+        reloadConfig();
+    }
+    g_watch_fd.store(-1, std::memory_order_relaxed);
+    close(fd);
+    return nullptr;
+}
+
+// the watcher thread does not survive fork, its descriptor does
+void resetWatcherAfterFork(void*) {
+    if (const int fd = g_watch_fd.exchange(-1, std::memory_order_relaxed); fd != -1) {
+        close(fd);
+    }
+    g_watcher_started.store(false, std::memory_order_relaxed);
 }
 
 } // namespace
 
 std::size_t Config::memoryLimitBytes() {
-    if (const auto& fileCfg = cachedFileConfig(); fileCfg.memory_limit) {
-        return fileCfg.memory_limit.value();
+    if (const auto fileCfg = fileConfig(); fileCfg->memory_limit) {
+        return fileCfg->memory_limit.value();
     }
 
     auto raw = getEnv(kMemoryLimitEnv);
@@ -224,14 +574,194 @@ std::size_t Config::memoryLimitBytes() {
     return parseByteSize(raw);
 }
 
+std::shared_ptr<const DeviceMemoryLimits> Config::deviceMemoryLimits() {
+    auto snapshot = currentSnapshot();
+    return std::shared_ptr<const DeviceMemoryLimits>(snapshot, &snapshot->device_memory_limits);
+}
+
+std::shared_ptr<const Config::ContainerMemoryLimits> Config::containerMemoryLimits() {
+    auto fileCfg = fileConfig();
+    return std::shared_ptr<const ContainerMemoryLimits>(fileCfg, &fileCfg->container_memory_limits);
+}
+
+std::size_t Config::quotaLeaseBytes() {
+    if (const auto fileCfg = fileConfig(); fileCfg->quota_lease) {
+        return fileCfg->quota_lease.value();
+    }
+
+    return parseByteSize(getEnv(kQuotaLeaseEnv));
+}
+
+std::chrono::milliseconds Config::quotaLeaseStaleness() {
+    std::size_t ms = 0;
+    if (const auto fileCfg = fileConfig(); fileCfg->quota_lease_staleness_ms) {
+        ms = fileCfg->quota_lease_staleness_ms.value();
+    } else {
+        ms = parseUnsigned(getEnv(kQuotaLeaseStalenessEnv));
+    }
+
+    return ms > 0 ? std::chrono::milliseconds(ms) : kDefaultQuotaLeaseStaleness;
+}
+
+double Config::oversubscriptionRatio() {
+    if (const auto fileCfg = fileConfig(); fileCfg->oversubscription_ratio) {
+        return fileCfg->oversubscription_ratio.value();
+    }
+
+    return parseRatio(getEnv(kOversubscriptionRatioEnv));
+}
+
+std::size_t Config::slabAllocMaxBytes() {
+    if (const auto fileCfg = fileConfig(); fileCfg->slab_alloc_max) {
+        return fileCfg->slab_alloc_max.value();
+    }
+
+    return parseByteSize(getEnv(kSlabAllocMaxEnv));
+}
+
+std::size_t Config::hostPinnedLimitBytes() {
+    if (const auto fileCfg = fileConfig(); fileCfg->host_pinned_limit) {
+        return fileCfg->host_pinned_limit.value();
+    }
+
+    return parseByteSize(getEnv(kHostPinnedLimitEnv));
+}
+
+double Config::computeLimitPercent() {
+    if (const auto fileCfg = fileConfig(); fileCfg->compute_limit) {
+        return fileCfg->compute_limit.value();
+    }
+
+    return parseComputePercent(getEnv(kComputeLimitEnv));
+}
+
+std::size_t Config::launchPriority() {
+    if (const auto fileCfg = fileConfig(); fileCfg->priority) {
+        return fileCfg->priority.value();
+    }
+
+    return parseUnsigned(getEnv(kPriorityEnv));
+}
+
+std::chrono::milliseconds Config::timeSlice() {
+    std::size_t ms = 0;
+    if (const auto fileCfg = fileConfig(); fileCfg->time_slice_ms) {
+        ms = fileCfg->time_slice_ms.value();
+    } else {
+        ms = parseUnsigned(getEnv(kTimeSliceEnv));
+    }
+
+    return ms > 0 ? std::chrono::milliseconds(ms) : kDefaultTimeSlice;
+}
+
+bool Config::virtualUtilization() {
+    if (const auto fileCfg = fileConfig(); fileCfg->virtual_utilization) {
+        return fileCfg->virtual_utilization.value();
+    }
+
+    return parseFlag(getEnv(kVirtualUtilizationEnv));
+}
+
+std::size_t Config::usageMaxProcesses() {
+    if (const auto fileCfg = fileConfig(); fileCfg->usage_max_processes) {
+        return fileCfg->usage_max_processes.value();
+    }
+
+    return parseUnsigned(getEnv(kUsageMaxProcessesEnv));
+}
+
+std::size_t Config::usageMaxDevices() {
+    if (const auto fileCfg = fileConfig(); fileCfg->usage_max_devices) {
+        return fileCfg->usage_max_devices.value();
+    }
+
+    return parseUnsigned(getEnv(kUsageMaxDevicesEnv));
+}
+
+std::string Config::usageSegmentName() {
+    auto name = getEnv(kUsageSegmentEnv);
+    if (!name.empty() && name.front() == '/') {
+        name.erase(0, 1);
+    }
+    if (name.empty()) {
+        return kDefaultUsageSegment;
+    }
+    if (name.find('/') != std::string::npos) {
+        spdlog::warn("{} {} is not a shared memory name, using {}", kUsageSegmentEnv, name, kDefaultUsageSegment);
+        return kDefaultUsageSegment;
+    }
+    return name;
+}
+
+std::string Config::containerId() {
+    if (auto id = getEnv(kContainerIdEnv); !id.empty()) {
+        return id;
+    }
+
+    char hostname[HOST_NAME_MAX + 1] = {};
+    if (gethostname(hostname, sizeof(hostname) - 1) != 0) {
+        return "";
+    }
+    return hostname;
+}
+
+std::string Config::normalizeUuid(const std::string& uuid) {
+    auto normalized = toLowerCopy(trim(uuid));
+    if (normalized.compare(0, 4, "gpu-") == 0) {
+        normalized.erase(0, 4);
+    }
+    return normalized;
+}
+
 std::string Config::targetDeviceName() {
-    if (const auto& fileCfg = cachedFileConfig(); fileCfg.device_name) {
-        return fileCfg.device_name.value();
+    if (const auto fileCfg = fileConfig(); fileCfg->device_name) {
+        return fileCfg->device_name.value();
     }
 
     return getEnv(kDeviceNameEnv);
 }
 
+void Config::addReloadListener(ReloadListener listener, void* arg) {
+    {
+        std::lock_guard<std::mutex> lock(g_listeners_mutex);
+        g_listeners.emplace_back(listener, arg);
+    }
+    watchConfigFile();
+}
+
+void Config::removeReloadListener(ReloadListener listener, void* arg) {
+    std::lock_guard<std::mutex> lock(g_listeners_mutex);
+    for (auto it = g_listeners.begin(); it != g_listeners.end(); ++it) {
+        if (it->first == listener && it->second == arg) {
+            g_listeners.erase(it);
+            return;
+        }
+    }
+}
+
+void Config::watchConfigFile() {
+    if (g_watcher_started.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    util::atForkChild(resetWatcherAfterFork, nullptr);
+    currentSnapshot(); // changes are judged against the file as first read
+    if (g_file_skipped) {
+        return;
+    }
+
+    if (!startDetachedThread("vcuda-config", watcherMain, nullptr)) {
+        spdlog::warn("Failed to start the config file watcher, changes need a restart");
+    }
+}
+
+void Config::setFileGate(FileGate gate) {
+    g_file_gate = gate;
+}
+
+uint64_t Config::generation() {
+    return g_generation.load();
+}
+
 std::string Config::getEnv(const char* name) {
     if (!name) {
         return "";
@@ -248,6 +778,44 @@ std::size_t Config::parseByteSize(const std::string& value) {
     return parseByteSizeInternal(value);
 }
 
+MemoryLimit Config::parseMemoryLimit(const std::string& value) {
+    return parseMemoryLimitInternal(value);
+}
+
+std::size_t MemoryLimit::resolve(std::size_t total_bytes) const {
+    if (bytes > 0) {
+        return bytes;
+    }
+    if (percent <= 0 || total_bytes == 0) {
+        return 0;
+    }
+    return static_cast<std::size_t>(static_cast<long double>(total_bytes) * percent / 100);
+}
+
+const MemoryLimit* DeviceMemoryLimits::find(int idx, const std::string& uuid) const {
+    if (!uuid.empty()) {
+        if (const auto it = by_uuid.find(Config::normalizeUuid(uuid)); it != by_uuid.end()) {
+            return &it->second;
+        }
+    }
+    if (const auto it = by_index.find(idx); it != by_index.end()) {
+        return &it->second;
+    }
+    return fallback.isSet() ? &fallback : nullptr;
+}
+
+bool DeviceMemoryLimits::needsDeviceInfo() const {
+    if (!by_uuid.empty() || fallback.isRelative()) {
+        return true;
+    }
+    for (const auto& [idx, limit] : by_index) {
+        if (limit.isRelative()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 } // namespace util
 
 
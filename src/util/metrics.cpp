@@ -0,0 +1,456 @@
+#include "util/metrics.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "spdlog/spdlog.h"
+#include "util/thread.hpp"
+
+namespace util {
+namespace {
+
+constexpr const char* kMetricsEnv = "VCUDA_METRICS";
+constexpr const char* kSegmentPrefix = "vcuda_metrics.";
+constexpr int kCreateAttempts = 8;
+constexpr std::size_t kApiCount = static_cast<std::size_t>(ApiId::Count);
+
+constexpr const char* kApiNames[] = {
+#define VCUDA_METRIC_NAME(name) #name,
+    VCUDA_METRIC_APIS(VCUDA_METRIC_NAME)
+#undef VCUDA_METRIC_NAME
+};
+
+static_assert(kApiCount <= Metrics::kMaxApis, "too many metric APIs for the segment header");
+
+std::size_t segmentSize() {
+    return sizeof(Metrics::Header) + sizeof(Metrics::ThreadBlock) * Metrics::kMaxThreads;
+}
+
+// Blocks of exited threads are handed to new threads; counters are
+// cumulative so a reused block still sums correctly. Block 0 is shared (with
+// atomic adds) by threads beyond kMaxThreads - 1 and is never recycled.
+struct FreeBlocks {
+    std::mutex mutex;
+    std::vector<uint32_t> indexes;
+};
+
+FreeBlocks* g_free_blocks = new FreeBlocks();
+
+struct ThreadSlot {
+    bool claimed = false;
+    uint32_t index = 0;
+
+    ~ThreadSlot() {
+        if (index == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(g_free_blocks->mutex);
+        g_free_blocks->indexes.push_back(index);
+    }
+};
+
+thread_local ThreadSlot t_slot;
+
+bool envEnabled() {
+    const char* value = std::getenv(kMetricsEnv);
+    return value && (std::strcmp(value, "1") == 0 || std::strcmp(value, "on") == 0 || std::strcmp(value, "true") == 0);
+}
+
+// map an existing segment of another process
+void* mapSegment(const std::string& name, std::size_t size) {
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+        return MAP_FAILED;
+    }
+
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return ptr;
+}
+
+// The owner's lease on its segment, byte 0 write-locked for its lifetime;
+// the kernel drops it when the owner exits.
+bool lockSegment(int fd) {
+    struct flock lease {};
+    lease.l_type = F_WRLCK;
+    lease.l_whence = SEEK_SET;
+    lease.l_start = 0;
+    lease.l_len = 1;
+    return fcntl(fd, F_SETLK, &lease) == 0;
+}
+
+bool isSegmentLocked(int fd) {
+    struct flock lease {};
+    lease.l_type = F_WRLCK;
+    lease.l_whence = SEEK_SET;
+    lease.l_start = 0;
+    lease.l_len = 1;
+    if (fcntl(fd, F_GETLK, &lease) == -1) {
+        return true; // unknown, keep the segment
+    }
+    return lease.l_type != F_UNLCK;
+}
+
+uint32_t randomSuffix() {
+    uint32_t value = 0;
+    if (getrandom(&value, sizeof(value), GRND_NONBLOCK) != static_cast<ssize_t>(sizeof(value))) {
+        value = static_cast<uint32_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+                static_cast<uint32_t>(getpid());
+    }
+    return value;
+}
+
+// A fresh segment under a name nobody else holds: pids repeat across pid
+// namespaces sharing /dev/shm. It is locked before it gets a size, so that a
+// pruner never takes it for stale in between.
+int createSegment(std::size_t size, std::string* name) {
+    for (int attempt = 0; attempt < kCreateAttempts; ++attempt) {
+        char candidate[64];
+        std::snprintf(candidate, sizeof(candidate), "%s%d.%08x", kSegmentPrefix, static_cast<int>(getpid()), randomSuffix());
+        const int fd = shm_open(candidate, O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (fd == -1) {
+            if (errno == EEXIST) {
+                continue;
+            }
+            return -1;
+        }
+        if (!lockSegment(fd) || ftruncate(fd, size) != 0) {
+            close(fd);
+            shm_unlink(candidate);
+            return -1;
+        }
+        *name = candidate;
+        return fd;
+    }
+    return -1;
+}
+
+// F_GETLK does not report our own locks, and closing an fd of our own
+// segment would drop its lease, so the caller's segment is skipped by name.
+std::size_t pruneSegments(const std::string& own) {
+    DIR* dir = opendir("/dev/shm");
+    if (dir == nullptr) {
+        return 0;
+    }
+
+    std::size_t pruned = 0;
+    const std::size_t prefix_length = std::strlen(kSegmentPrefix);
+    while (const dirent* entry = readdir(dir)) {
+        if (std::strncmp(entry->d_name, kSegmentPrefix, prefix_length) != 0 || own == entry->d_name) {
+            continue;
+        }
+        const int fd = shm_open(entry->d_name, O_RDONLY, 0);
+        if (fd == -1) {
+            continue;
+        }
+        // an empty segment is still being created
+        struct stat st {};
+        const bool stale = fstat(fd, &st) == 0 && st.st_size > 0 && !isSegmentLocked(fd);
+        close(fd);
+        if (stale && shm_unlink(entry->d_name) == 0) {
+            ++pruned;
+        }
+    }
+    closedir(dir);
+    return pruned;
+}
+
+} // namespace
+
+Metrics& Metrics::getInstance() {
+    static Metrics instance;
+    return instance;
+}
+
+Metrics::Metrics() {
+    open();
+
+    util::atForkChild(reopenAfterFork, this);
+
+    setEnabled(envEnabled());
+}
+
+void Metrics::open() {
+    static Header disabled{};
+    header_ = &disabled;
+    blocks_ = nullptr;
+    mapped_size_ = segmentSize();
+    segment_name_.clear();
+    segment_fd_ = -1;
+    if (std::getenv(kMetricsEnv) == nullptr) {
+        return; // nothing exported, nothing recorded
+    }
+
+    void* ptr = MAP_FAILED;
+    segment_fd_ = createSegment(mapped_size_, &segment_name_);
+    if (segment_fd_ >= 0) {
+        ptr = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, segment_fd_, 0);
+        pruneSegments(segment_name_);
+    }
+    if (ptr == MAP_FAILED) {
+        spdlog::warn("Metrics segment unavailable, keeping metrics process-local");
+        if (segment_fd_ >= 0) {
+            close(segment_fd_);
+            shm_unlink(segment_name_.c_str());
+            segment_fd_ = -1;
+            segment_name_.clear();
+        }
+        ptr = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        return;
+    }
+
+    header_ = static_cast<Header*>(ptr);
+    blocks_ = reinterpret_cast<ThreadBlock*>(static_cast<char*>(ptr) + sizeof(Header));
+    header_->magic = kMagic;
+    header_->version = kVersion;
+    header_->api_count = kApiCount;
+    header_->bucket_count = kBuckets;
+    header_->max_threads = kMaxThreads;
+    header_->block_size = sizeof(ThreadBlock);
+    header_->pid = getpid();
+    header_->blocks_used.store(1, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < kApiCount; ++i) {
+        std::strncpy(header_->api_names[i], kApiNames[i], kApiNameLength - 1);
+    }
+}
+
+// A forked child would keep recording into its parent's segment; give it its
+// own, with the parent's mapping left alone and the enabled state inherited.
+// The child holds no lock on the parent's segment, closing its fd is safe.
+void Metrics::reopenAfterFork(void* arg) {
+    g_free_blocks = new FreeBlocks(); // the parent's lock may be held by a thread that does not exist here
+    t_slot.claimed = false;
+    t_slot.index = 0;
+
+    auto& metrics = *static_cast<Metrics*>(arg);
+    const bool was_enabled = metrics.enabled();
+    if (metrics.segment_fd_ >= 0) {
+        close(metrics.segment_fd_);
+    }
+    metrics.open();
+    metrics.setEnabled(was_enabled);
+}
+
+// The mapping and the lease are left in place: other threads may still
+// record while the process exits. Only the name is removed so the segment
+// dies with us.
+Metrics::~Metrics() {
+    if (!segment_name_.empty()) {
+        shm_unlink(segment_name_.c_str());
+    }
+}
+
+void Metrics::setEnabled(bool enabled) {
+    if (!blocks_) {
+        return;
+    }
+    if (enabled) {
+        calibrate();
+    }
+    header_->enabled.store(enabled ? 1 : 0, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// derive the tick length once, against the steady clock, over about a millisecond
+void Metrics::calibrate() {
+    if (ns_per_tick_q32_.load(std::memory_order_acquire) != 0) {
+        return;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    const uint64_t start_ns = steadyNowNs();
+    const uint64_t start_ticks = now();
+    uint64_t elapsed_ns = 0;
+    while (elapsed_ns < 1000000) {
+        elapsed_ns = steadyNowNs() - start_ns;
+    }
+    const uint64_t elapsed_ticks = now() - start_ticks;
+    const uint64_t q32 = elapsed_ticks ? (elapsed_ns << 32) / elapsed_ticks : (1ull << 32);
+#else
+    const uint64_t q32 = 1ull << 32;
+#endif
+    ns_per_tick_q32_.store(q32 ? q32 : 1, std::memory_order_release);
+}
+
+uint64_t Metrics::ticksToNs(uint64_t ticks) {
+    uint64_t q32 = ns_per_tick_q32_.load(std::memory_order_relaxed);
+    if (__builtin_expect(q32 == 0, 0)) {
+        // enabled from outside the process through the segment header
+        calibrate();
+        q32 = ns_per_tick_q32_.load(std::memory_order_relaxed);
+    }
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(ticks) * q32) >> 32);
+}
+
+Metrics::ThreadBlock* Metrics::threadBlock(bool& exclusive) {
+    if (__builtin_expect(!t_slot.claimed, 0)) {
+        t_slot.claimed = true;
+        {
+            std::lock_guard<std::mutex> lock(g_free_blocks->mutex);
+            if (!g_free_blocks->indexes.empty()) {
+                t_slot.index = g_free_blocks->indexes.back();
+                g_free_blocks->indexes.pop_back();
+            }
+        }
+        if (t_slot.index == 0) {
+            const uint32_t index = header_->blocks_used.fetch_add(1, std::memory_order_relaxed);
+            t_slot.index = index < kMaxThreads ? index : 0;
+        }
+    }
+
+    exclusive = t_slot.index != 0;
+    return &blocks_[t_slot.index];
+}
+
+void Metrics::record(ApiId api, uint64_t start, bool error) {
+    if (!blocks_) {
+        return;
+    }
+
+    const uint64_t ns = ticksToNs(now() - start);
+    bool exclusive = false;
+    auto& counters = threadBlock(exclusive)->apis[static_cast<std::size_t>(api)];
+
+    const auto bump = [exclusive](std::atomic<uint64_t>& counter, uint64_t delta) {
+        if (exclusive) {
+            counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        } else {
+            counter.fetch_add(delta, std::memory_order_relaxed);
+        }
+    };
+
+    bump(counters.calls, 1);
+    if (error) {
+        bump(counters.errors, 1);
+    }
+    bump(counters.total_ns, ns);
+    bump(counters.buckets[bucketOf(ns)], 1);
+}
+
+// values below 4 ns get their own bucket, then four sub-buckets per octave
+uint32_t Metrics::bucketOf(uint64_t ns) {
+    if (ns < 4) {
+        return static_cast<uint32_t>(ns);
+    }
+    const uint32_t msb = 63 - __builtin_clzll(ns);
+    const uint32_t bucket = (msb - 1) * 4 + static_cast<uint32_t>((ns >> (msb - 2)) & 3);
+    return bucket < kBuckets ? bucket : kBuckets - 1;
+}
+
+uint64_t Metrics::bucketLowerBoundNs(uint32_t bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    const uint32_t msb = bucket / 4 + 1;
+    return (4ull + bucket % 4) << (msb - 2);
+}
+
+uint64_t Metrics::ApiSnapshot::percentileNs(double quantile) const {
+    if (calls == 0) {
+        return 0;
+    }
+    const uint64_t target = static_cast<uint64_t>(quantile * calls);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if (seen > target) {
+            return bucketLowerBoundNs(i);
+        }
+    }
+    return bucketLowerBoundNs(kBuckets - 1);
+}
+
+std::size_t Metrics::pruneStaleSegments() {
+    return pruneSegments(std::string());
+}
+
+std::vector<std::string> Metrics::findSegments(pid_t pid) {
+    std::vector<std::string> segments;
+    DIR* dir = opendir("/dev/shm");
+    if (dir == nullptr) {
+        return segments;
+    }
+
+    const std::string prefix = kSegmentPrefix + std::to_string(pid) + ".";
+    while (const dirent* entry = readdir(dir)) {
+        if (std::strncmp(entry->d_name, prefix.c_str(), prefix.size()) == 0) {
+            segments.emplace_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+bool Metrics::readSnapshot(const std::string& segment, std::vector<ApiSnapshot>& snapshot) {
+    const std::size_t size = segmentSize();
+    void* ptr = mapSegment(segment, size);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+
+    const auto* header = static_cast<const Header*>(ptr);
+    if (header->magic != kMagic || header->version != kVersion || header->bucket_count != kBuckets ||
+        header->max_threads != kMaxThreads || header->block_size != sizeof(ThreadBlock)) {
+        munmap(ptr, size);
+        return false;
+    }
+
+    const auto* blocks = reinterpret_cast<const ThreadBlock*>(static_cast<const char*>(ptr) + sizeof(Header));
+    const uint32_t used = std::min(header->blocks_used.load(std::memory_order_relaxed), kMaxThreads);
+    const uint32_t api_count = std::min<uint32_t>(header->api_count, kApiCount);
+
+    snapshot.assign(api_count, ApiSnapshot{});
+    for (uint32_t api = 0; api < api_count; ++api) {
+        auto& merged = snapshot[api];
+        merged.name.assign(header->api_names[api], strnlen(header->api_names[api], kApiNameLength));
+        for (uint32_t block = 0; block < used; ++block) {
+            const auto& counters = blocks[block].apis[api];
+            merged.calls += counters.calls.load(std::memory_order_relaxed);
+            merged.errors += counters.errors.load(std::memory_order_relaxed);
+            merged.total_ns += counters.total_ns.load(std::memory_order_relaxed);
+            for (uint32_t i = 0; i < kBuckets; ++i) {
+                merged.buckets[i] += counters.buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    munmap(ptr, size);
+    return true;
+}
+
+bool Metrics::setEnabled(const std::string& segment, bool enabled) {
+    const std::size_t size = sizeof(Header);
+    void* ptr = mapSegment(segment, size);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+
+    auto* header = static_cast<Header*>(ptr);
+    const bool valid = header->magic == kMagic && header->version == kVersion;
+    if (valid) {
+        header->enabled.store(enabled ? 1 : 0, std::memory_order_relaxed);
+    }
+    munmap(ptr, size);
+    return valid;
+}
+
+} // namespace util
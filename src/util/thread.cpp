@@ -0,0 +1,75 @@
+#include "util/thread.hpp"
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "spdlog/spdlog.h"
+
+namespace util {
+namespace {
+
+// Fixed storage: the child runs the handlers without taking a lock, another
+// thread of the parent may have held it at fork time.
+constexpr int kMaxForkHandlers = 16;
+
+struct ForkEntry {
+    ForkHandler handler;
+    void* arg;
+};
+
+ForkEntry g_fork_handlers[kMaxForkHandlers];
+std::atomic<int> g_fork_handler_count{0};
+std::mutex g_fork_handlers_mutex;
+
+void runForkHandlers() {
+    const int count = g_fork_handler_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        g_fork_handlers[i].handler(g_fork_handlers[i].arg);
+    }
+}
+
+} // namespace
+
+bool startDetachedThread(const char* name, void* (*main)(void*), void* arg) {
+    sigset_t all_signals;
+    sigset_t previous;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    const bool started = pthread_create(&thread, &attr, main, arg) == 0;
+    if (started) {
+        pthread_setname_np(thread, name);
+    }
+    pthread_attr_destroy(&attr);
+
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return started;
+}
+
+void atForkChild(ForkHandler handler, void* arg) {
+    static std::once_flag atfork_flag;
+    std::call_once(atfork_flag, [] { pthread_atfork(nullptr, nullptr, runForkHandlers); });
+
+    std::lock_guard<std::mutex> lock(g_fork_handlers_mutex);
+    const int count = g_fork_handler_count.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; ++i) {
+        if (g_fork_handlers[i].handler == handler && g_fork_handlers[i].arg == arg) {
+            return;
+        }
+    }
+    if (count == kMaxForkHandlers) {
+        spdlog::error("Too many fork handlers, a forked child keeps some of its parent's state");
+        return;
+    }
+    g_fork_handlers[count] = ForkEntry{handler, arg};
+    g_fork_handler_count.store(count + 1, std::memory_order_release);
+}
+
+} // namespace util
@@ -0,0 +1,276 @@
+// Node agent against the mock driver: the hooked process takes its memory
+// limit from the policy the agent published, not from its own config file,
+// follows a change of the agent's config file, and shows up in the agent's
+// usage report; a process of a container with limits of its own gets those,
+// and the memory another container holds does not count against them.
+// Killed without freeing, its usage is reclaimed by the agent.
+// The parent starts the agent before running the scenarios.
+//
+//   agent_test [--hook path/to/libvcuda-hook.so] [--agent path/to/vcuda-agent]
+#include <signal.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr const char* kAgentEnv = "VCUDA_TEST_AGENT";
+constexpr const char* kSocketEnv = "VCUDA_TEST_AGENT_SOCKET";
+constexpr const char* kAgentConfigEnv = "VCUDA_TEST_AGENT_CONFIG";
+constexpr const char* kDirEnv = "VCUDA_TEST_AGENT_DIR";
+constexpr size_t kMiB = 1ull << 20;
+constexpr const char* kAgentConfig = "memory_limit: 1g\n"
+                                     "containers:\n"
+                                     "  special:\n"
+                                     "    memory_limit: 3g\n"
+                                     "  other:\n"
+                                     "    memory_limit: 3g\n";
+constexpr auto kTimeout = std::chrono::seconds(3);
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemAlloc_t = CUresult (*)(CUdeviceptr*, size_t);
+using cuMemGetInfo_t = CUresult (*)(size_t*, size_t*);
+
+struct Driver {
+    cuInit_t cuInit;
+    cuMemAlloc_t cuMemAlloc;
+    cuMemGetInfo_t cuMemGetInfo;
+};
+
+// replaced in one rename, the way editors and ConfigMap updates do it
+void writeConfig(const std::string& path, const std::string& text) {
+    const std::string staged = path + ".tmp";
+    std::ofstream(staged) << text;
+    if (std::rename(staged.c_str(), path.c_str()) != 0) {
+        std::perror("rename");
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+// the agent's answer through its own command line, false without an agent
+bool query(const char* request, std::string* reply) {
+    const std::string command = std::string(std::getenv(kAgentEnv)) + " --socket " +
+                                std::getenv(kSocketEnv) + " --query " + request + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        return false;
+    }
+    reply->clear();
+    char buffer[4096];
+    size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        reply->append(buffer, n);
+    }
+    return pclose(pipe) == 0;
+}
+
+bool reportsUsage(size_t bytes) {
+    std::string reply;
+    return query("usage", &reply) && reply.find("device 0 used " + std::to_string(bytes) + "\n") != std::string::npos;
+}
+
+template <typename Predicate>
+bool waitFor(Predicate predicate) {
+    const auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return true;
+}
+
+size_t totalMemory(const Driver& drv) {
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    return total_bytes;
+}
+
+size_t freeMemory(const Driver& drv) {
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    return free_bytes;
+}
+
+// a marker in the test's directory, how the two containers take turns
+std::string marker(const char* name) {
+    return std::string(std::getenv(kDirEnv)) + "/" + name;
+}
+
+bool hasMarker(const char* name) {
+    return access(marker(name).c_str(), F_OK) == 0;
+}
+
+void policyScenario(const Driver& drv) {
+    // 1g from the agent, the 4g of our own config file are ignored
+    EXPECT(totalMemory(drv) == 1024 * kMiB);
+    CUdeviceptr large = 0;
+    CUdeviceptr medium = 0;
+    EXPECT(drv.cuMemAlloc(&large, 768 * kMiB) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAlloc(&medium, 512 * kMiB) == CUDA_ERROR_OUT_OF_MEMORY);
+    EXPECT(reportsUsage(768 * kMiB));
+
+    // the agent's config changes, every process follows
+    writeConfig(std::getenv(kAgentConfigEnv), "memory_limit: 2g\n");
+    EXPECT(waitFor([&] { return totalMemory(drv) == 2048 * kMiB; }));
+    EXPECT(drv.cuMemAlloc(&medium, 512 * kMiB) == CUDA_SUCCESS);
+    EXPECT(reportsUsage(1280 * kMiB));
+}
+
+// the limit of our container, not the node-wide one
+void containerScenario(const Driver& drv) {
+    EXPECT(totalMemory(drv) == 3072 * kMiB);
+}
+
+// two containers with a limit of 3g each at the same time: the memory one
+// holds counts against its own limit only
+void holderScenario(const Driver& drv) {
+    CUdeviceptr held = 0;
+    EXPECT(drv.cuMemAlloc(&held, 2048 * kMiB) == CUDA_SUCCESS);
+    EXPECT(freeMemory(drv) == 1024 * kMiB);
+    std::ofstream(marker("held"));
+
+    EXPECT(waitFor([] { return hasMarker("done"); }));
+    EXPECT(freeMemory(drv) == 1024 * kMiB);
+}
+
+void neighbourScenario(const Driver& drv) {
+    EXPECT(waitFor([] { return hasMarker("held"); }));
+    EXPECT(totalMemory(drv) == 3072 * kMiB);
+    EXPECT(freeMemory(drv) == 3072 * kMiB);
+
+    CUdeviceptr own = 0;
+    EXPECT(drv.cuMemAlloc(&own, 2048 * kMiB) == CUDA_SUCCESS);
+    EXPECT(freeMemory(drv) == 1024 * kMiB);
+    std::ofstream(marker("done"));
+}
+
+// exits without freeing or releasing its slot, as a crash would
+int runChild(const std::string& scenario) {
+    unsetenv("LD_PRELOAD"); // queries run the agent binary, unhooked
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuMemAlloc_t>(cuda, "cuMemAlloc_v2"),
+        load<cuMemGetInfo_t>(cuda, "cuMemGetInfo_v2"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        _exit(EXIT_FAILURE);
+    }
+
+    if (scenario == "container") {
+        containerScenario(drv);
+    } else if (scenario == "holder") {
+        holderScenario(drv);
+    } else if (scenario == "neighbour") {
+        neighbourScenario(drv);
+    } else {
+        policyScenario(drv);
+    }
+    std::fflush(stderr);
+    _exit(preload::exitCode());
+}
+
+pid_t startAgent(const std::string& agent, const std::string& socket, const std::string& config) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        execl(agent.c_str(), agent.c_str(), "--socket", socket.c_str(), "--config", config.c_str(),
+              static_cast<char*>(nullptr));
+        std::perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+// the policy scenario left the agent's config without containers
+bool runNeighbours(const std::string& agent_config) {
+    writeConfig(agent_config, kAgentConfig);
+    std::string reply;
+    if (!waitFor([&] { return query("policy", &reply) && reply.find("container other") != std::string::npos; })) {
+        std::printf("%-10s %s\n", "neighbours", "FAILED");
+        return false;
+    }
+
+    const pid_t holder = preload::startScenario("holder", {{"VCUDA_CONTAINER_ID", "special"}});
+    const pid_t neighbour = preload::startScenario("neighbour", {{"VCUDA_CONTAINER_ID", "other"}});
+    const bool holder_passed = preload::waitScenario(holder) == EXIT_SUCCESS;
+    const bool passed = preload::waitScenario(neighbour) == EXIT_SUCCESS && holder_passed;
+    std::printf("%-10s %s\n", "neighbours", passed ? "ok" : "FAILED");
+    return passed;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (const char* scenario = preload::childScenario()) {
+        return runChild(scenario);
+    }
+
+    preload::setUp(argc, argv);
+    const std::string agent = preload::option(argc, argv, "--agent", VCUDA_AGENT_BINARY);
+    unsetenv("VCUDA_MEMORY_LIMIT");
+    unsetenv("VCUDA_DEVICE_MEMORY_LIMITS");
+    unsetenv("VCUDA_OVERSUBSCRIPTION_RATIO");
+    unsetenv("VCUDA_QUOTA_LEASE");
+
+    char dir[] = "/tmp/vcuda_agent_XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    const std::string agent_config = std::string(dir) + "/agent.yaml";
+    const std::string own_config = std::string(dir) + "/config.yaml";
+    const std::string socket = std::string(dir) + "/agent.sock";
+    std::ofstream(agent_config) << kAgentConfig;
+    std::ofstream(own_config) << "memory_limit: 4g\n";
+    setenv(kAgentEnv, agent.c_str(), 1);
+    setenv(kSocketEnv, socket.c_str(), 1);
+    setenv(kAgentConfigEnv, agent_config.c_str(), 1);
+    setenv(kDirEnv, dir, 1);
+
+    const pid_t agent_pid = startAgent(agent, socket, agent_config);
+    std::string reply;
+    bool passed = waitFor([&] { return query("policy", &reply); });
+    std::printf("%-10s %s\n", "start", passed ? "ok" : "FAILED");
+
+    if (passed) {
+        setenv("VCUDA_CONFIG_FILE", own_config.c_str(), 1);
+        passed &= preload::runScenario("container", {{"VCUDA_CONTAINER_ID", "special"}});
+        passed &= preload::runScenario("policy", {{"VCUDA_CONTAINER_ID", "ours"}});
+        passed &= runNeighbours(agent_config);
+        unsetenv("VCUDA_CONFIG_FILE");
+
+        const bool reclaimed = waitFor([] { return reportsUsage(0); });
+        std::printf("%-10s %s\n", "reclaim", reclaimed ? "ok" : "FAILED");
+        passed &= reclaimed;
+    }
+
+    kill(agent_pid, SIGTERM);
+    int status = 0;
+    waitpid(agent_pid, &status, 0);
+    const bool stopped = WIFEXITED(status) && WEXITSTATUS(status) == 0 && access(socket.c_str(), F_OK) != 0;
+    std::printf("%-10s %s\n", "stop", stopped ? "ok" : "FAILED");
+    passed &= stopped;
+
+    std::remove(agent_config.c_str());
+    std::remove(own_config.c_str());
+    std::remove(marker("held").c_str());
+    std::remove(marker("done").c_str());
+    rmdir(dir);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
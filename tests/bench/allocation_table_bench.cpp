@@ -0,0 +1,119 @@
+// Concurrent alloc/free throughput of the sharded allocation table against
+// the std::map + std::mutex bookkeeping Device used before, for 1..N threads.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "device/allocation_table.hpp"
+
+namespace {
+
+constexpr int kLiveAllocations = 256; // outstanding allocations per thread
+constexpr uint64_t kAlignment = 512;
+
+struct LegacyTable {
+    struct MemoryBlock {
+        int idx;
+        uint64_t ptr;
+        size_t size;
+    };
+
+    void insert(uint64_t ptr, uint64_t size, int device) {
+        std::lock_guard<std::mutex> lock(mutex);
+        blocks[ptr] = MemoryBlock{device, ptr, size};
+    }
+
+    void erase(uint64_t ptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (const auto it = blocks.find(ptr); it != blocks.end()) {
+            blocks.erase(it);
+        }
+    }
+
+    std::mutex mutex;
+    std::map<uint64_t, MemoryBlock> blocks;
+};
+
+struct ShardedTable {
+    void insert(uint64_t ptr, uint64_t size, int device) {
+        AllocationTable::Record replaced;
+        table.insert(ptr, size, device, replaced);
+    }
+
+    void erase(uint64_t ptr) {
+        AllocationTable::Record removed;
+        table.erase(ptr, removed);
+    }
+
+    AllocationTable table;
+};
+
+// every thread cycles through its own address range: keep kLiveAllocations
+// outstanding, free the oldest and allocate a new one, like a caching loader
+template <typename Table>
+void worker(Table& table, int thread, int iterations) {
+    const uint64_t base = 0x7f0000000000ull + (static_cast<uint64_t>(thread) << 36);
+    std::vector<uint64_t> live(kLiveAllocations);
+    uint64_t next = base;
+
+    for (auto& ptr : live) {
+        ptr = next;
+        next += kAlignment * (1 + (next >> 9) % 7);
+        table.insert(ptr, 4096, 0);
+    }
+    for (int i = 0; i < iterations; ++i) {
+        uint64_t& slot = live[i % kLiveAllocations];
+        table.erase(slot);
+        slot = next;
+        next += kAlignment * (1 + (next >> 9) % 7);
+        table.insert(slot, 4096, 0);
+    }
+    for (uint64_t ptr : live) {
+        table.erase(ptr);
+    }
+}
+
+// million alloc+free pairs per second
+template <typename Table>
+double run(int threads, int iterations) {
+    Table table;
+    std::vector<std::thread> workers;
+    const auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back(worker<Table>, std::ref(table), t, iterations);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(threads) * iterations / seconds / 1e6;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int iterations = 200000;
+    int max_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--iterations") == 0) {
+            iterations = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--threads") == 0) {
+            max_threads = std::atoi(argv[i + 1]);
+        }
+    }
+
+    std::printf("%-8s %16s %16s %8s\n", "threads", "map+mutex Mops", "sharded Mops", "speedup");
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        const double legacy = run<LegacyTable>(threads, iterations);
+        const double sharded = run<ShardedTable>(threads, iterations);
+        std::printf("%-8d %16.2f %16.2f %7.1fx\n", threads, legacy, sharded, sharded / legacy);
+    }
+    return 0;
+}
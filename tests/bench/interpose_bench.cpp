@@ -0,0 +1,208 @@
+// Per-call overhead of libvcuda-hook.so against the mock driver libraries.
+// The parent re-executes itself twice, once as-is and once with the hook in
+// LD_PRELOAD, and prints ns/op for both runs side by side.
+//
+//   interpose_bench [--iterations N] [--hook path/to/libvcuda-hook.so]
+//                   [--max-overhead-ns NS]
+//
+// With --max-overhead-ns the exit code is non-zero when any API regresses
+// past the given per-call overhead, which is what CI runs against.
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <cuda.h>
+#include <nvml.h>
+
+namespace {
+
+constexpr const char* kChildEnv = "VCUDA_BENCH_CHILD";
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemAlloc_t = CUresult (*)(CUdeviceptr*, size_t);
+using cuMemFree_t = CUresult (*)(CUdeviceptr);
+using cuMemGetInfo_t = CUresult (*)(size_t*, size_t*);
+using cuGetProcAddress_t = CUresult (*)(const char*, void**, int, cuuint64_t, CUdriverProcAddressQueryResult*);
+using nvmlInit_t = nvmlReturn_t (*)();
+using nvmlDeviceGetHandleByIndex_t = nvmlReturn_t (*)(unsigned int, nvmlDevice_t*);
+using nvmlDeviceGetMemoryInfo_t = nvmlReturn_t (*)(nvmlDevice_t, nvmlMemory_t*);
+
+template <typename Fn>
+Fn load(void* handle, const char* name) {
+    auto fn = reinterpret_cast<Fn>(dlsym(handle, name));
+    if (!fn) {
+        std::fprintf(stderr, "missing symbol %s\n", name);
+        std::exit(EXIT_FAILURE);
+    }
+    return fn;
+}
+
+template <typename Body>
+double nsPerOp(int iterations, Body&& body) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        body(i);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+// runs inside the re-executed process and prints "<api> <ns/op>" lines
+int runChild(int iterations) {
+    void* cuda = dlopen("libcuda.so.1", RTLD_NOW | RTLD_LOCAL);
+    void* nvml = dlopen("libnvidia-ml.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!cuda || !nvml) {
+        std::fprintf(stderr, "dlopen mock driver failed: %s\n", dlerror());
+        return EXIT_FAILURE;
+    }
+
+    auto cuInit = load<cuInit_t>(cuda, "cuInit");
+    auto cuMemAlloc = load<cuMemAlloc_t>(cuda, "cuMemAlloc_v2");
+    auto cuMemFree = load<cuMemFree_t>(cuda, "cuMemFree_v2");
+    auto cuMemGetInfo = load<cuMemGetInfo_t>(cuda, "cuMemGetInfo_v2");
+    auto cuGetProcAddress = load<cuGetProcAddress_t>(cuda, "cuGetProcAddress_v2");
+    auto nvmlInit = load<nvmlInit_t>(nvml, "nvmlInit_v2");
+    auto nvmlDeviceGetHandleByIndex = load<nvmlDeviceGetHandleByIndex_t>(nvml, "nvmlDeviceGetHandleByIndex_v2");
+    auto nvmlDeviceGetMemoryInfo = load<nvmlDeviceGetMemoryInfo_t>(nvml, "nvmlDeviceGetMemoryInfo");
+
+    if (cuInit(0) != CUDA_SUCCESS || nvmlInit() != NVML_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<CUdeviceptr> ptrs(iterations);
+    const double alloc = nsPerOp(iterations, [&](int i) { cuMemAlloc(&ptrs[i], 4096); });
+    const double release = nsPerOp(iterations, [&](int i) { cuMemFree(ptrs[i]); });
+
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    const double mem_info = nsPerOp(iterations, [&](int) { cuMemGetInfo(&free_bytes, &total_bytes); });
+
+    void* pfn = nullptr;
+    CUdriverProcAddressQueryResult status;
+    const double proc_address = nsPerOp(iterations, [&](int) {
+        cuGetProcAddress("cuMemAlloc", &pfn, CUDA_VERSION, CU_GET_PROC_ADDRESS_DEFAULT, &status);
+    });
+
+    nvmlDevice_t device = nullptr;
+    nvmlDeviceGetHandleByIndex(0, &device);
+    nvmlMemory_t memory;
+    const double nvml_info = nsPerOp(iterations, [&](int) { nvmlDeviceGetMemoryInfo(device, &memory); });
+
+    std::printf("cuMemAlloc %.1f\n", alloc);
+    std::printf("cuMemFree %.1f\n", release);
+    std::printf("cuMemGetInfo %.1f\n", mem_info);
+    std::printf("cuGetProcAddress %.1f\n", proc_address);
+    std::printf("nvmlDeviceGetMemoryInfo %.1f\n", nvml_info);
+    return EXIT_SUCCESS;
+}
+
+// re-executes this binary with the given LD_PRELOAD and parses its results
+std::map<std::string, double> runVariant(const char* self, const std::string& preload, int iterations) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::perror("pipe");
+        std::exit(EXIT_FAILURE);
+    }
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        setenv(kChildEnv, std::to_string(iterations).c_str(), 1);
+        if (preload.empty()) {
+            unsetenv("LD_PRELOAD");
+        } else {
+            setenv("LD_PRELOAD", preload.c_str(), 1);
+        }
+        execl(self, self, static_cast<char*>(nullptr));
+        std::perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    std::map<std::string, double> results;
+    FILE* output = fdopen(fds[0], "r");
+    char api[64];
+    double value = 0;
+    while (std::fscanf(output, "%63s %lf", api, &value) == 2) {
+        results[api] = value;
+    }
+    std::fclose(output);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::fprintf(stderr, "benchmark run (%s) failed\n", preload.empty() ? "baseline" : "hooked");
+        std::exit(EXIT_FAILURE);
+    }
+    return results;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (const char* child = std::getenv(kChildEnv)) {
+        return runChild(std::atoi(child));
+    }
+
+    int iterations = 100000;
+    double max_overhead = -1;
+    std::string hook = VCUDA_HOOK_LIBRARY;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--iterations") == 0) {
+            iterations = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--hook") == 0) {
+            hook = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--max-overhead-ns") == 0) {
+            max_overhead = std::atof(argv[i + 1]);
+        }
+    }
+
+    // both runs resolve libcuda.so.1 / libnvidia-ml.so.1 to the mocks
+    std::string library_path = VCUDA_MOCK_DIR;
+    if (const char* current = std::getenv("LD_LIBRARY_PATH"); current && *current) {
+        library_path += ":" + std::string(current);
+    }
+    setenv("LD_LIBRARY_PATH", library_path.c_str(), 1);
+    // give the hook a limit so the accounting paths are the ones measured,
+    // against a usage segment of our own
+    setenv("VCUDA_MEMORY_LIMIT", "64g", 0);
+    const std::string segment = "vcuda_bench_usage." + std::to_string(getpid());
+    setenv("VCUDA_USAGE_SEGMENT", segment.c_str(), 1);
+
+    char self[4096];
+    const ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length <= 0) {
+        std::perror("readlink");
+        return EXIT_FAILURE;
+    }
+    self[length] = '\0';
+
+    const auto baseline = runVariant(self, "", iterations);
+    const auto hooked = runVariant(self, hook, iterations);
+    shm_unlink(segment.c_str());
+
+    bool regressed = false;
+    std::printf("%-26s %12s %12s %12s\n", "api", "baseline", "hooked", "overhead");
+    for (const auto& [api, base] : baseline) {
+        const auto it = hooked.find(api);
+        if (it == hooked.end()) {
+            continue;
+        }
+        const double overhead = it->second - base;
+        std::printf("%-26s %9.1f ns %9.1f ns %9.1f ns\n", api.c_str(), base, it->second, overhead);
+        regressed |= max_overhead >= 0 && overhead > max_overhead;
+    }
+
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+// Launch latency of a latency-critical tenant sharing a device with a batch
+// tenant, with and without launch priorities. Both tenants run as re-executed
+// copies of this process with the hook preloaded, on one mock device timeline
+// (VCUDA_MOCK_TIMELINE) where every launch takes --kernel-us. The batch tenant
+// queues --batch-depth kernels per synchronization for as long as the other
+// runs; the inference tenant launches one kernel every --period-us and waits
+// for it, --requests times. Prints the inference tenant's p50/p99 latency,
+// launch to completion, and the number of batch kernels run.
+//
+//   launch_priority_bench [--requests N] [--kernel-us US] [--period-us US]
+//                         [--batch-depth N] [--hook path/to/libvcuda-hook.so]
+#include <dlfcn.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cuda.h>
+
+namespace {
+
+constexpr const char* kChildEnv = "VCUDA_BENCH_CHILD";
+
+volatile sig_atomic_t g_stop = 0; // batch tenant: SIGTERM from the parent
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuLaunchKernel_t = CUresult (*)(CUfunction, unsigned int, unsigned int, unsigned int, unsigned int,
+                                      unsigned int, unsigned int, unsigned int, CUstream, void**, void**);
+using cuCtxSynchronize_t = CUresult (*)();
+
+struct Options {
+    int requests = 200;
+    long kernel_us = 1000;
+    long period_us = 5000;
+    int batch_depth = 4;
+    std::string hook = VCUDA_HOOK_LIBRARY;
+};
+
+struct Driver {
+    cuLaunchKernel_t cuLaunchKernel;
+    cuCtxSynchronize_t cuCtxSynchronize;
+};
+
+template <typename Fn>
+Fn load(void* handle, const char* name) {
+    auto fn = reinterpret_cast<Fn>(dlsym(handle, name));
+    if (!fn) {
+        std::fprintf(stderr, "missing symbol %s\n", name);
+        std::exit(EXIT_FAILURE);
+    }
+    return fn;
+}
+
+bool launch(const Driver& drv) {
+    return drv.cuLaunchKernel(nullptr, 1, 1, 1, 1, 1, 1, 0, nullptr, nullptr, nullptr) == CUDA_SUCCESS;
+}
+
+// prints "<kernels launched>" once the parent sends SIGTERM
+int runBatch(const Driver& drv, const Options& options) {
+    long kernels = 0;
+    while (!g_stop) {
+        for (int i = 0; i < options.batch_depth; ++i) {
+            if (!launch(drv)) {
+                return EXIT_FAILURE;
+            }
+        }
+        drv.cuCtxSynchronize();
+        kernels += options.batch_depth;
+    }
+    std::printf("%ld\n", kernels);
+    return EXIT_SUCCESS;
+}
+
+// prints "<p50 us> <p99 us>"
+int runInference(const Driver& drv, const Options& options) {
+    std::vector<double> latencies;
+    latencies.reserve(options.requests);
+    auto next = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.requests; ++i) {
+        next += std::chrono::microseconds(options.period_us);
+        std::this_thread::sleep_until(next);
+
+        const auto start = std::chrono::steady_clock::now();
+        if (!launch(drv) || drv.cuCtxSynchronize() != CUDA_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+    std::printf("%.0f %.0f\n", percentile(0.50), percentile(0.99));
+    return EXIT_SUCCESS;
+}
+
+int runChild(const std::string& role, const Options& options) {
+    void* cuda = dlopen("libcuda.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!cuda) {
+        std::fprintf(stderr, "dlopen mock driver failed: %s\n", dlerror());
+        return EXIT_FAILURE;
+    }
+
+    Driver drv{
+        load<cuLaunchKernel_t>(cuda, "cuLaunchKernel"),
+        load<cuCtxSynchronize_t>(cuda, "cuCtxSynchronize"),
+    };
+    if (load<cuInit_t>(cuda, "cuInit")(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+    return role == "batch" ? runBatch(drv, options) : runInference(drv, options);
+}
+
+struct Child {
+    pid_t pid = -1;
+    FILE* output = nullptr;
+};
+
+// re-execute with the hook preloaded, stdout to a pipe
+Child spawn(const char* self, char** argv, const Options& options, const char* role,
+            const std::vector<std::pair<const char*, const char*>>& env) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::perror("pipe");
+        std::exit(EXIT_FAILURE);
+    }
+
+    Child child;
+    child.pid = fork();
+    if (child.pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        setenv(kChildEnv, role, 1);
+        setenv("LD_PRELOAD", options.hook.c_str(), 1);
+        for (const auto& [name, value] : env) {
+            setenv(name, value, 1);
+        }
+        execv(self, argv);
+        std::perror("execv");
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+    child.output = fdopen(fds[0], "r");
+    return child;
+}
+
+bool finish(Child& child, const char* format, void* first, void* second) {
+    const int parsed = second ? std::fscanf(child.output, format, first, second) : std::fscanf(child.output, format, first);
+    std::fclose(child.output);
+    int status = 0;
+    waitpid(child.pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 && parsed == (second ? 2 : 1);
+}
+
+// one run of both tenants, the batch tenant stopped once the inference tenant is done
+bool runScenario(const char* self, char** argv, const Options& options, const char* name, const char* priority) {
+    const std::string timeline = "/vcuda_bench_timeline." + std::to_string(getpid());
+    const std::string kernel_ns = std::to_string(options.kernel_us * 1000);
+    const std::vector<std::pair<const char*, const char*>> env = {
+        {"VCUDA_MOCK_TIMELINE", timeline.c_str()},
+        {"VCUDA_MOCK_KERNEL_NS", kernel_ns.c_str()},
+    };
+
+    Child batch = spawn(self, argv, options, "batch", env);
+    auto inference_env = env;
+    if (priority) {
+        inference_env.emplace_back("VCUDA_PRIORITY", priority);
+    }
+    Child inference = spawn(self, argv, options, "inference", inference_env);
+
+    double p50 = 0;
+    double p99 = 0;
+    long kernels = 0;
+    const bool inference_ok = finish(inference, "%lf %lf", &p50, &p99);
+    kill(batch.pid, SIGTERM);
+    const bool batch_ok = finish(batch, "%ld", &kernels, nullptr);
+    shm_unlink(timeline.c_str());
+
+    if (!inference_ok || !batch_ok) {
+        std::printf("%-12s FAILED\n", name);
+        return false;
+    }
+    std::printf("%-12s %10.0f %10.0f %14ld\n", name, p50, p99, kernels);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--requests") == 0) {
+            options.requests = std::max(1, std::atoi(argv[i + 1]));
+        } else if (std::strcmp(argv[i], "--kernel-us") == 0) {
+            options.kernel_us = std::atol(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--period-us") == 0) {
+            options.period_us = std::atol(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--batch-depth") == 0) {
+            options.batch_depth = std::max(1, std::atoi(argv[i + 1]));
+        } else if (std::strcmp(argv[i], "--hook") == 0) {
+            options.hook = argv[i + 1];
+        }
+    }
+
+    if (const char* role = std::getenv(kChildEnv)) {
+        signal(SIGTERM, [](int) { g_stop = 1; });
+        return runChild(role, options);
+    }
+
+    char self[4096];
+    const ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length <= 0) {
+        std::perror("readlink");
+        return EXIT_FAILURE;
+    }
+    self[length] = '\0';
+
+    std::string library_path = VCUDA_MOCK_DIR;
+    if (const char* current = std::getenv("LD_LIBRARY_PATH"); current && *current) {
+        library_path += ":" + std::string(current);
+    }
+    setenv("LD_LIBRARY_PATH", library_path.c_str(), 1);
+    unsetenv("VCUDA_PRIORITY");
+    unsetenv("VCUDA_COMPUTE_LIMIT");
+    // the tenants meet in a usage segment of their own
+    const std::string segment = "vcuda_bench_usage." + std::to_string(getpid());
+    setenv("VCUDA_USAGE_SEGMENT", segment.c_str(), 1);
+
+    std::printf("%d requests, %ld us kernels every %ld us, batch depth %d\n",
+                options.requests, options.kernel_us, options.period_us, options.batch_depth);
+    std::printf("%-12s %10s %10s %14s\n", "priority", "p50 us", "p99 us", "batch kernels");
+    bool passed = runScenario(self, argv, options, "off", nullptr);
+    passed &= runScenario(self, argv, options, "on", "1");
+    shm_unlink(segment.c_str());
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
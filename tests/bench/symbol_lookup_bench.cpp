@@ -0,0 +1,86 @@
+// Compares the compile-time hook symbol table against the std::string keyed
+// unordered_map lookup it replaced, using the names resolved on the dlsym path.
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cuda/cuda_hook.hpp"
+#include "nvml/nvml_hook.hpp"
+
+namespace {
+
+// shape of the previous HookFuncInfo, copied out on every lookup
+struct LegacyHookFuncInfo {
+    void* hookedFunc;
+    std::function<void(void*)> original;
+};
+
+constexpr int kRounds = 20000;
+
+// symbols frameworks commonly resolve at startup, most of them are not hooked
+const char* const kUnhookedSymbols[] = {
+    "cuLaunchKernel", "cuStreamCreate", "cuStreamSynchronize", "cuEventRecord",
+    "cuModuleLoadData", "cuModuleGetFunction", "cuMemcpyHtoD_v2", "cuMemcpyDtoH_v2",
+    "cuCtxGetCurrent", "cuDevicePrimaryCtxRetain", "cuMemsetD8_v2", "cuFuncGetAttribute",
+    "nvmlInit_v2", "nvmlDeviceGetCount_v2", "nvmlDeviceGetHandleByIndex_v2", "nvmlShutdown",
+};
+
+template <typename Fn>
+double nsPerLookup(const std::vector<const char*>& queries, Fn&& lookup) {
+    std::size_t sink = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+        for (const char* query : queries) {
+            sink += lookup(query);
+        }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (sink == 0) {
+        std::printf("# no symbol matched\n");
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(kRounds) * queries.size());
+}
+
+} // namespace
+
+int main() {
+    std::vector<const char*> queries;
+    std::unordered_map<std::string, LegacyHookFuncInfo> legacy_cuda;
+    std::unordered_map<std::string, LegacyHookFuncInfo> legacy_nvml;
+
+    for (const auto& name : CudaHook::kSymbolNames) {
+        queries.push_back(name.data());
+        legacy_cuda.emplace(std::string(name), LegacyHookFuncInfo{nullptr, [](void*) {}});
+    }
+    for (const auto& name : NvmlHook::kSymbolNames) {
+        queries.push_back(name.data());
+        legacy_nvml.emplace(std::string(name), LegacyHookFuncInfo{nullptr, [](void*) {}});
+    }
+    for (const char* name : kUnhookedSymbols) {
+        queries.push_back(name);
+    }
+
+    const double legacy = nsPerLookup(queries, [&](const char* symbol) -> std::size_t {
+        const auto& map = symbol[0] == 'n' ? legacy_nvml : legacy_cuda;
+        if (auto it = map.find(symbol); it != map.end()) {
+            LegacyHookFuncInfo info = it->second;
+            return info.original ? 1 : 0;
+        }
+        return 0;
+    });
+
+    const double table = nsPerLookup(queries, [](const char* symbol) -> std::size_t {
+        const int idx = symbol[0] == 'n' ? NvmlHook::kSymbolTable.find(symbol)
+                                         : CudaHook::kSymbolTable.find(symbol);
+        return idx >= 0 ? 1 : 0;
+    });
+
+    std::printf("symbols: %zu queries (%zu hooked)\n", queries.size(),
+                queries.size() - std::size(kUnhookedSymbols));
+    std::printf("unordered_map<std::string> + copy : %8.2f ns/lookup\n", legacy);
+    std::printf("constexpr perfect hash            : %8.2f ns/lookup\n", table);
+    return 0;
+}
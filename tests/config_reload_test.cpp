@@ -0,0 +1,145 @@
+// Config file reload against the mock driver: a memory limit changed in the
+// file applies to the running process. Raised, it admits allocations that
+// failed before; lowered below the usage, it fails new allocations, leased
+// quota included, while the existing ones stay until they are freed. A file
+// that does not parse keeps the limit in force.
+//
+//   config_reload_test [--hook path/to/libvcuda-hook.so]
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr const char* kConfigFileEnv = "VCUDA_CONFIG_FILE";
+constexpr size_t kMiB = 1ull << 20;
+constexpr auto kReloadTimeout = std::chrono::seconds(3);
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemAlloc_t = CUresult (*)(CUdeviceptr*, size_t);
+using cuMemFree_t = CUresult (*)(CUdeviceptr);
+using cuMemGetInfo_t = CUresult (*)(size_t*, size_t*);
+
+struct Driver {
+    cuInit_t cuInit;
+    cuMemAlloc_t cuMemAlloc;
+    cuMemFree_t cuMemFree;
+    cuMemGetInfo_t cuMemGetInfo;
+};
+
+// replaced in one rename, the way editors and ConfigMap updates do it
+void writeConfig(const std::string& path, const std::string& text) {
+    const std::string staged = path + ".tmp";
+    std::ofstream(staged) << text;
+    if (std::rename(staged.c_str(), path.c_str()) != 0) {
+        std::perror("rename");
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+size_t totalMemory(const Driver& drv) {
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    return total_bytes;
+}
+
+// the reported total is the limit once the reload went through
+bool waitForLimit(const Driver& drv, size_t limit) {
+    const auto deadline = std::chrono::steady_clock::now() + kReloadTimeout;
+    while (totalMemory(drv) != limit) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+void reloadScenario(const Driver& drv, const std::string& path) {
+    EXPECT(totalMemory(drv) == 1024 * kMiB);
+    CUdeviceptr large = 0;
+    CUdeviceptr medium = 0;
+    EXPECT(drv.cuMemAlloc(&large, 768 * kMiB) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAlloc(&medium, 512 * kMiB) == CUDA_ERROR_OUT_OF_MEMORY);
+
+    // raised: what did not fit now does
+    writeConfig(path, "memory_limit: 2g\n");
+    EXPECT(waitForLimit(drv, 2048 * kMiB));
+    EXPECT(drv.cuMemAlloc(&medium, 512 * kMiB) == CUDA_SUCCESS);
+
+    // lowered below the usage: nothing new, not even from the unused lease
+    writeConfig(path, "memory_limit: 512m\n");
+    EXPECT(waitForLimit(drv, 512 * kMiB));
+    CUdeviceptr small = 0;
+    EXPECT(drv.cuMemAlloc(&small, 16 * kMiB) == CUDA_ERROR_OUT_OF_MEMORY);
+
+    // a broken file changes nothing
+    writeConfig(path, "memory_limit: [\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT(totalMemory(drv) == 512 * kMiB);
+
+    // the existing allocations stay usable and are freed as usual
+    EXPECT(drv.cuMemFree(large) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAlloc(&small, 16 * kMiB) == CUDA_ERROR_OUT_OF_MEMORY);
+    EXPECT(drv.cuMemFree(medium) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAlloc(&small, 16 * kMiB) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemFree(small) == CUDA_SUCCESS);
+}
+
+int runChild(const std::string&) {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuMemAlloc_t>(cuda, "cuMemAlloc_v2"),
+        load<cuMemFree_t>(cuda, "cuMemFree_v2"),
+        load<cuMemGetInfo_t>(cuda, "cuMemGetInfo_v2"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+
+    reloadScenario(drv, std::getenv(kConfigFileEnv));
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (const char* scenario = preload::childScenario()) {
+        return runChild(scenario);
+    }
+
+    preload::setUp(argc, argv);
+    unsetenv("VCUDA_MEMORY_LIMIT");
+    unsetenv("VCUDA_DEVICE_MEMORY_LIMITS");
+    unsetenv("VCUDA_OVERSUBSCRIPTION_RATIO");
+    unsetenv("VCUDA_SLAB_ALLOC_MAX");
+    setenv("VCUDA_QUOTA_LEASE", "64m", 1);
+
+    char dir[] = "/tmp/vcuda_config_XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    const std::string path = std::string(dir) + "/config.yaml";
+    std::ofstream(path) << "memory_limit: 1g\n";
+    setenv(kConfigFileEnv, path.c_str(), 1);
+
+    const bool passed = preload::runScenario("reload");
+    std::remove(path.c_str());
+    rmdir(dir);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,137 @@
+// Context teardown against the mock driver, which frees a context's memory
+// when it is destroyed: cuCtxDestroy, the last cuDevicePrimaryCtxRelease and
+// cuDevicePrimaryCtxReset give the context's allocations, pooled small ones
+// included, back to the quota at once.
+//
+//   context_release_test [--hook path/to/libvcuda-hook.so]
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr size_t kLimit = 1ull << 30;
+constexpr size_t kBlock = 256ull << 20;
+constexpr size_t kSmall = 4096;
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemAlloc_t = CUresult (*)(CUdeviceptr*, size_t);
+using cuMemFree_t = CUresult (*)(CUdeviceptr);
+using cuMemGetInfo_t = CUresult (*)(size_t*, size_t*);
+using cuCtxCreate_t = CUresult (*)(CUcontext*, unsigned int, CUdevice);
+using cuCtxDestroy_t = CUresult (*)(CUcontext);
+using cuCtxSetCurrent_t = CUresult (*)(CUcontext);
+using cuDevicePrimaryCtxRetain_t = CUresult (*)(CUcontext*, CUdevice);
+using cuDevicePrimaryCtxRelease_t = CUresult (*)(CUdevice);
+using cuDevicePrimaryCtxReset_t = CUresult (*)(CUdevice);
+
+struct Driver {
+    cuInit_t cuInit;
+    cuMemAlloc_t cuMemAlloc;
+    cuMemFree_t cuMemFree;
+    cuMemGetInfo_t cuMemGetInfo;
+    cuCtxCreate_t cuCtxCreate;
+    cuCtxDestroy_t cuCtxDestroy;
+    cuCtxSetCurrent_t cuCtxSetCurrent;
+    cuDevicePrimaryCtxRetain_t cuDevicePrimaryCtxRetain;
+    cuDevicePrimaryCtxRelease_t cuDevicePrimaryCtxRelease;
+    cuDevicePrimaryCtxReset_t cuDevicePrimaryCtxReset;
+};
+
+size_t freeBytes(const Driver& drv) {
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    EXPECT(total_bytes == kLimit);
+    return free_bytes;
+}
+
+// fill the current context up to the limit, a pooled block included
+void fill(const Driver& drv) {
+    CUdeviceptr small = 0;
+    EXPECT(drv.cuMemAlloc(&small, kSmall) == CUDA_SUCCESS);
+    CUdeviceptr ptr = 0;
+    for (int i = 0; i < 3; ++i) {
+        EXPECT(drv.cuMemAlloc(&ptr, kBlock) == CUDA_SUCCESS);
+    }
+    EXPECT(drv.cuMemAlloc(&ptr, kBlock) == CUDA_ERROR_OUT_OF_MEMORY);
+    EXPECT(freeBytes(drv) < kBlock);
+}
+
+void run(const Driver& drv) {
+    CUcontext primary = nullptr;
+    EXPECT(drv.cuDevicePrimaryCtxRetain(&primary, 0) == CUDA_SUCCESS);
+
+    // a context of our own
+    CUcontext ctx = nullptr;
+    EXPECT(drv.cuCtxCreate(&ctx, 0, 0) == CUDA_SUCCESS);
+    fill(drv);
+    EXPECT(drv.cuCtxDestroy(ctx) == CUDA_SUCCESS);
+    EXPECT(drv.cuCtxSetCurrent(primary) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit);
+
+    // the pool lost its slab with the context and makes a new one
+    CUdeviceptr small = 0;
+    EXPECT(drv.cuMemAlloc(&small, kSmall) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemFree(small) == CUDA_SUCCESS);
+
+    // the primary context survives a release while retained twice
+    EXPECT(drv.cuDevicePrimaryCtxRetain(&primary, 0) == CUDA_SUCCESS);
+    fill(drv);
+    EXPECT(drv.cuDevicePrimaryCtxRelease(0) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) < kBlock);
+    EXPECT(drv.cuDevicePrimaryCtxRelease(0) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit);
+
+    // and goes on reset whatever its retains
+    EXPECT(drv.cuDevicePrimaryCtxRetain(&primary, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuCtxSetCurrent(primary) == CUDA_SUCCESS);
+    fill(drv);
+    EXPECT(drv.cuDevicePrimaryCtxReset(0) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit);
+}
+
+int runChild() {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuMemAlloc_t>(cuda, "cuMemAlloc_v2"),
+        load<cuMemFree_t>(cuda, "cuMemFree_v2"),
+        load<cuMemGetInfo_t>(cuda, "cuMemGetInfo_v2"),
+        load<cuCtxCreate_t>(cuda, "cuCtxCreate_v2"),
+        load<cuCtxDestroy_t>(cuda, "cuCtxDestroy_v2"),
+        load<cuCtxSetCurrent_t>(cuda, "cuCtxSetCurrent"),
+        load<cuDevicePrimaryCtxRetain_t>(cuda, "cuDevicePrimaryCtxRetain"),
+        load<cuDevicePrimaryCtxRelease_t>(cuda, "cuDevicePrimaryCtxRelease_v2"),
+        load<cuDevicePrimaryCtxReset_t>(cuda, "cuDevicePrimaryCtxReset_v2"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+
+    run(drv);
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (preload::childScenario()) {
+        return runChild();
+    }
+
+    preload::setUp(argc, argv);
+    unsetenv("VCUDA_DEVICE_MEMORY_LIMITS");
+    unsetenv("VCUDA_QUOTA_LEASE");
+    unsetenv("VCUDA_OVERSUBSCRIPTION_RATIO");
+
+    const preload::Env env = {{"VCUDA_MEMORY_LIMIT", "1g"}, {"VCUDA_SLAB_ALLOC_MAX", "64k"}};
+    return preload::runScenario("release", env) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
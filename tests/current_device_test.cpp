@@ -0,0 +1,165 @@
+// Per-thread current device against a two-device mock driver: two threads
+// bound to different devices allocate in lockstep right after each other's
+// cuCtxSetCurrent, and every allocation must land on the device of the
+// thread that made it. The device is resolved from the current context, so
+// the driver sees one cuCtxGetDevice per context, not one per allocation.
+//
+//   current_device_test [--hook path/to/libvcuda-hook.so]
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr size_t kLimit = 1ull << 30;
+constexpr int kDevices = 2;
+constexpr int kRounds = 64;
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemAlloc_t = CUresult (*)(CUdeviceptr*, size_t);
+using cuMemFree_t = CUresult (*)(CUdeviceptr);
+using cuMemGetInfo_t = CUresult (*)(size_t*, size_t*);
+using cuCtxSetCurrent_t = CUresult (*)(CUcontext);
+using cuDevicePrimaryCtxRetain_t = CUresult (*)(CUcontext*, CUdevice);
+using vcudaMockCtxGetDeviceCalls_t = unsigned long long (*)();
+
+struct Driver {
+    cuInit_t cuInit;
+    cuMemAlloc_t cuMemAlloc;
+    cuMemFree_t cuMemFree;
+    cuMemGetInfo_t cuMemGetInfo;
+    cuCtxSetCurrent_t cuCtxSetCurrent;
+    cuDevicePrimaryCtxRetain_t cuDevicePrimaryCtxRetain;
+    vcudaMockCtxGetDeviceCalls_t ctxGetDeviceCalls;
+};
+
+class Barrier {
+public:
+    explicit Barrier(int parties) : parties_(parties) {}
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const unsigned generation = generation_;
+        if (++waiting_ == parties_) {
+            waiting_ = 0;
+            ++generation_;
+            cv_.notify_all();
+            return;
+        }
+        cv_.wait(lock, [&] { return generation_ != generation; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    const int parties_;
+    int waiting_ = 0;
+    unsigned generation_ = 0;
+};
+
+size_t usedBytes(const Driver& drv) {
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    EXPECT(total_bytes == kLimit);
+    return total_bytes - free_bytes;
+}
+
+// thread dev allocates (dev + 1) MiB a round on device dev; each round both
+// threads bind again, one after the other, before either allocates
+void worker(const Driver& drv, Barrier& barrier, CUcontext ctx, int dev, std::vector<CUdeviceptr>& blocks) {
+    const size_t block = (dev + 1) * (1ull << 20);
+    for (int round = 0; round < kRounds; ++round) {
+        for (int turn = 0; turn < kDevices; ++turn) {
+            if (turn == dev) {
+                EXPECT(drv.cuCtxSetCurrent(ctx) == CUDA_SUCCESS);
+            }
+            barrier.wait();
+        }
+        CUdeviceptr ptr = 0;
+        EXPECT(drv.cuMemAlloc(&ptr, block) == CUDA_SUCCESS);
+        blocks.push_back(ptr);
+        barrier.wait();
+    }
+    EXPECT(usedBytes(drv) == kRounds * block);
+}
+
+void run(const Driver& drv) {
+    CUcontext contexts[kDevices] = {};
+    for (int dev = 0; dev < kDevices; ++dev) {
+        EXPECT(drv.cuDevicePrimaryCtxRetain(&contexts[dev], dev) == CUDA_SUCCESS);
+    }
+    const unsigned long long calls_before = drv.ctxGetDeviceCalls();
+
+    Barrier barrier(kDevices);
+    std::vector<CUdeviceptr> blocks[kDevices];
+    std::vector<std::thread> threads;
+    for (int dev = 0; dev < kDevices; ++dev) {
+        threads.emplace_back(worker, std::cref(drv), std::ref(barrier), contexts[dev], dev, std::ref(blocks[dev]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // one lookup per context, however many allocations
+    EXPECT(drv.ctxGetDeviceCalls() - calls_before <= kDevices);
+
+    // frees find their device by pointer, from any thread
+    EXPECT(drv.cuCtxSetCurrent(contexts[0]) == CUDA_SUCCESS);
+    for (const auto& device_blocks : blocks) {
+        for (const CUdeviceptr ptr : device_blocks) {
+            EXPECT(drv.cuMemFree(ptr) == CUDA_SUCCESS);
+        }
+    }
+    for (int dev = 0; dev < kDevices; ++dev) {
+        EXPECT(drv.cuCtxSetCurrent(contexts[dev]) == CUDA_SUCCESS);
+        EXPECT(usedBytes(drv) == 0);
+    }
+}
+
+int runChild() {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuMemAlloc_t>(cuda, "cuMemAlloc_v2"),
+        load<cuMemFree_t>(cuda, "cuMemFree_v2"),
+        load<cuMemGetInfo_t>(cuda, "cuMemGetInfo_v2"),
+        load<cuCtxSetCurrent_t>(cuda, "cuCtxSetCurrent"),
+        load<cuDevicePrimaryCtxRetain_t>(cuda, "cuDevicePrimaryCtxRetain"),
+        load<vcudaMockCtxGetDeviceCalls_t>(cuda, "vcudaMockCtxGetDeviceCalls"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+
+    run(drv);
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (preload::childScenario()) {
+        return runChild();
+    }
+
+    preload::setUp(argc, argv);
+    unsetenv("VCUDA_DEVICE_MEMORY_LIMITS");
+    unsetenv("VCUDA_QUOTA_LEASE");
+    unsetenv("VCUDA_OVERSUBSCRIPTION_RATIO");
+    unsetenv("VCUDA_SLAB_ALLOC_MAX");
+
+    const preload::Env env = {{"VCUDA_MEMORY_LIMIT", "1g"}, {"VCUDA_MOCK_DEVICE_COUNT", "2"}};
+    return preload::runScenario("devices", env) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
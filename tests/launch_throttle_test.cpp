@@ -0,0 +1,80 @@
+// Compute throttling against the mock driver, whose launches each keep the
+// device busy for VCUDA_MOCK_KERNEL_NS and whose NVML reports that back as
+// process utilization. A child launches and synchronizes in a loop for a
+// while and reports the fraction of the time its device was busy: close to
+// the VCUDA_COMPUTE_LIMIT share when throttled, close to all of it when not.
+//
+//   launch_throttle_test [--hook path/to/libvcuda-hook.so]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr long kKernelNs = 2000000;
+constexpr auto kRunTime = std::chrono::milliseconds(1500);
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuLaunchKernel_t = CUresult (*)(CUfunction, unsigned int, unsigned int, unsigned int, unsigned int,
+                                      unsigned int, unsigned int, unsigned int, CUstream, void**, void**);
+using cuCtxSynchronize_t = CUresult (*)();
+
+// busy fraction of the device, in percent, as the exit code
+int runChild() {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    const auto cuInit = load<cuInit_t>(cuda, "cuInit");
+    const auto cuLaunchKernel = load<cuLaunchKernel_t>(cuda, "cuLaunchKernel");
+    const auto cuCtxSynchronize = load<cuCtxSynchronize_t>(cuda, "cuCtxSynchronize");
+    if (cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return 255;
+    }
+
+    long launches = 0;
+    const auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < kRunTime) {
+        if (cuLaunchKernel(nullptr, 1, 1, 1, 1, 1, 1, 0, nullptr, nullptr, nullptr) != CUDA_SUCCESS ||
+            cuCtxSynchronize() != CUDA_SUCCESS) {
+            std::fprintf(stderr, "launch failed\n");
+            return 255;
+        }
+        ++launches;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<int>(launches * kKernelNs * 100 / std::chrono::nanoseconds(elapsed).count());
+}
+
+// busy percent of one scenario, -1 when it failed; percents run up to 100
+int busyPercent(const char* scenario, const preload::Env& env = {}) {
+    const int code = preload::waitScenario(preload::startScenario(scenario, env));
+    return code > 100 ? -1 : code;
+}
+
+bool expectBusy(const char* scenario, int busy, int low, int high) {
+    const bool passed = busy >= low && busy <= high;
+    std::printf("%-12s busy %3d%% (expected %d-%d%%) %s\n", scenario, busy, low, high, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (preload::childScenario()) {
+        return runChild();
+    }
+
+    preload::setUp(argc, argv);
+    setenv("VCUDA_MOCK_KERNEL_NS", std::to_string(kKernelNs).c_str(), 1);
+    unsetenv("VCUDA_COMPUTE_LIMIT");
+
+    bool passed = expectBusy("throttled", busyPercent("throttled", {{"VCUDA_COMPUTE_LIMIT", "30%"}}), 15, 45);
+    passed &= expectBusy("unthrottled", busyPercent("unthrottled"), 80, 100);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,148 @@
+// Stream-ordered allocation against the mock driver: memory pools are charged
+// by what they reserve from the device, memory a pool keeps after
+// cuMemFreeAsync stays charged until it is trimmed, and pools are trimmed
+// before an allocation is refused.
+//
+//   mem_pool_test [--hook path/to/libvcuda-hook.so]
+#include <cstdio>
+#include <cstdlib>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr size_t kMiB = 1ull << 20;
+constexpr size_t kLimit = 256 * kMiB;
+constexpr size_t kPoolChunk = 32 * kMiB; // growth step of the mock pools
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemGetInfo_t = CUresult (*)(size_t*, size_t*);
+using cuMemAllocAsync_t = CUresult (*)(CUdeviceptr*, size_t, CUstream);
+using cuMemAllocFromPoolAsync_t = CUresult (*)(CUdeviceptr*, size_t, CUmemoryPool, CUstream);
+using cuMemFreeAsync_t = CUresult (*)(CUdeviceptr, CUstream);
+using cuMemPoolCreate_t = CUresult (*)(CUmemoryPool*, const CUmemPoolProps*);
+using cuMemPoolDestroy_t = CUresult (*)(CUmemoryPool);
+using cuMemPoolTrimTo_t = CUresult (*)(CUmemoryPool, size_t);
+using cuDeviceGetMemPool_t = CUresult (*)(CUmemoryPool*, CUdevice);
+
+struct Driver {
+    cuInit_t cuInit;
+    cuMemGetInfo_t cuMemGetInfo;
+    cuMemAllocAsync_t cuMemAllocAsync;
+    cuMemAllocFromPoolAsync_t cuMemAllocFromPoolAsync;
+    cuMemFreeAsync_t cuMemFreeAsync;
+    cuMemPoolCreate_t cuMemPoolCreate;
+    cuMemPoolDestroy_t cuMemPoolDestroy;
+    cuMemPoolTrimTo_t cuMemPoolTrimTo;
+    cuDeviceGetMemPool_t cuDeviceGetMemPool;
+};
+
+size_t freeBytes(const Driver& drv) {
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    EXPECT(total_bytes == kLimit);
+    return free_bytes;
+}
+
+CUmemoryPool createPool(const Driver& drv) {
+    CUmemPoolProps props{};
+    props.allocType = CU_MEM_ALLOCATION_TYPE_PINNED;
+    props.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+    props.location.id = 0;
+    CUmemoryPool pool = nullptr;
+    EXPECT(drv.cuMemPoolCreate(&pool, &props) == CUDA_SUCCESS);
+    return pool;
+}
+
+void poolScenario(const Driver& drv) {
+    CUmemoryPool default_pool = nullptr;
+    EXPECT(drv.cuDeviceGetMemPool(&default_pool, 0) == CUDA_SUCCESS);
+
+    // charged by the chunk the pool reserved, not by the request
+    CUdeviceptr small = 0;
+    EXPECT(drv.cuMemAllocAsync(&small, kMiB, nullptr) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit - kPoolChunk);
+
+    // served from the reservation, nothing more to charge
+    CUdeviceptr second = 0;
+    EXPECT(drv.cuMemAllocAsync(&second, kMiB, nullptr) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit - kPoolChunk);
+
+    // the pool keeps freed memory until it is trimmed
+    EXPECT(drv.cuMemFreeAsync(small, nullptr) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemFreeAsync(second, nullptr) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit - kPoolChunk);
+    EXPECT(drv.cuMemPoolTrimTo(default_pool, 0) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit);
+
+    // an explicit pool holding most of the limit
+    CUmemoryPool pool = createPool(drv);
+    CUdeviceptr big = 0;
+    EXPECT(drv.cuMemAllocFromPoolAsync(&big, 200 * kMiB, pool, nullptr) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit - 224 * kMiB);
+
+    CUdeviceptr refused = 0;
+    EXPECT(drv.cuMemAllocAsync(&refused, 64 * kMiB, nullptr) == CUDA_ERROR_OUT_OF_MEMORY);
+
+    // once freed, the idle reservation of the other pool is trimmed to make room
+    EXPECT(drv.cuMemFreeAsync(big, nullptr) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit - 224 * kMiB);
+    CUdeviceptr medium = 0;
+    EXPECT(drv.cuMemAllocAsync(&medium, 64 * kMiB, nullptr) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit - 64 * kMiB);
+
+    // destroying a pool gives back what it still reserved
+    CUdeviceptr leaked = 0;
+    EXPECT(drv.cuMemAllocFromPoolAsync(&leaked, 10 * kMiB, pool, nullptr) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit - 64 * kMiB - kPoolChunk);
+    EXPECT(drv.cuMemPoolDestroy(pool) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit - 64 * kMiB);
+
+    EXPECT(drv.cuMemFreeAsync(medium, nullptr) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemPoolTrimTo(default_pool, 0) == CUDA_SUCCESS);
+    EXPECT(freeBytes(drv) == kLimit);
+}
+
+int runChild() {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuMemGetInfo_t>(cuda, "cuMemGetInfo_v2"),
+        load<cuMemAllocAsync_t>(cuda, "cuMemAllocAsync"),
+        load<cuMemAllocFromPoolAsync_t>(cuda, "cuMemAllocFromPoolAsync"),
+        load<cuMemFreeAsync_t>(cuda, "cuMemFreeAsync"),
+        load<cuMemPoolCreate_t>(cuda, "cuMemPoolCreate"),
+        load<cuMemPoolDestroy_t>(cuda, "cuMemPoolDestroy"),
+        load<cuMemPoolTrimTo_t>(cuda, "cuMemPoolTrimTo"),
+        load<cuDeviceGetMemPool_t>(cuda, "cuDeviceGetMemPool"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+
+    poolScenario(drv);
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (preload::childScenario()) {
+        return runChild();
+    }
+
+    preload::setUp(argc, argv);
+    unsetenv("VCUDA_DEVICE_MEMORY_LIMITS");
+    unsetenv("VCUDA_QUOTA_LEASE");
+    unsetenv("VCUDA_OVERSUBSCRIPTION_RATIO");
+    unsetenv("VCUDA_SLAB_ALLOC_MAX");
+
+    const preload::Env env = {{"VCUDA_MEMORY_LIMIT", "256m"}};
+    return preload::runScenario("pools", env) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1030 @@
+// Stand-in for libcuda.so.1 used by the benchmarks and tests on machines
+// without a GPU. Device memory is a bump allocator over fake device pointers
+// that are never dereferenced; every entry point can be slowed down with
+// VCUDA_MOCK_LATENCY_NS to mimic driver cost. Managed memory comes from a
+// range of its own and is not counted as device memory; the advice given for
+// it can be read back through cuMemRangeGetAttribute. Memory pools reserve
+// device memory in kPoolChunk steps and keep it after cuMemFreeAsync until
+// they are trimmed or destroyed, like a pool with an unbounded release threshold.
+// Allocations belong to the current context and are freed with it, by
+// cuCtxDestroy or when the primary context is reset or released for good.
+// Kernel and graph launches queue VCUDA_MOCK_KERNEL_NS of work on a timeline
+// per device that synchronization waits out; vcudaMockBusyNs reports how much
+// of it has run, for the mock NVML's utilization samples. Processes naming the
+// same VCUDA_MOCK_TIMELINE segment queue on one timeline, as if they shared
+// the devices. Events recorded on the current device complete when the work
+// queued before them has run. Streams under graph capture queue no work, and
+// events recorded on them report CUDA_ERROR_CAPTURED_EVENT until destroyed;
+// vcudaMockEventCount reports how many events exist. vcudaMockCtxGetDeviceCalls
+// counts cuCtxGetDevice round trips.
+//
+//   VCUDA_MOCK_DEVICE_COUNT  number of devices (default 1)
+//   VCUDA_MOCK_TOTAL_MEMORY  bytes of memory per device (default 80 GiB)
+//   VCUDA_MOCK_LATENCY_NS    busy-wait added to every call (default 0)
+//   VCUDA_MOCK_KERNEL_NS     device time of every launch (default 0)
+//   VCUDA_MOCK_TIMELINE      shared memory name of a timeline shared between processes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <cuda.h>
+
+namespace {
+
+constexpr int kMaxDevices = 8;
+constexpr CUdeviceptr kDeviceBase = 0x7f0000000000ull;
+constexpr CUdeviceptr kDeviceSpan = 0x10000000000ull; // 1 TiB of fake VA per device
+constexpr size_t kAlignment = 512;
+constexpr size_t kGranularity = 2ull << 20;
+constexpr CUdeviceptr kManagedBase = 0x7e0000000000ull;
+constexpr size_t kPoolChunk = 32ull << 20;
+
+struct Allocation {
+    int device;
+    size_t size;
+    bool managed = false;
+    CUdevice preferred_location = CU_DEVICE_INVALID;
+    CUmemoryPool pool = nullptr;
+    CUcontext ctx = nullptr;
+};
+
+struct Event {
+    long long stamp = 0; // steady clock nanoseconds the event completes at
+    bool recorded = false;
+    bool captured = false; // recorded into a graph capture
+};
+
+struct MemPool {
+    int device;
+    size_t reserved = 0;
+    size_t used = 0;
+};
+
+struct MockDriver {
+    int device_count = 1;
+    size_t total_memory = 80ull << 30;
+    long latency_ns = 0;
+    long kernel_ns = 0;
+    bool initialized = false;
+
+    std::mutex mutex;
+    std::atomic<size_t> used[kMaxDevices] = {};
+    CUdeviceptr next_ptr[kMaxDevices] = {};
+    CUdeviceptr next_managed = kManagedBase;
+    unsigned long long next_handle = 1;
+    std::unordered_map<CUdeviceptr, Allocation> allocations;
+    std::unordered_map<CUmemGenericAllocationHandle, Allocation> handles;
+    std::unordered_map<CUmemoryPool, MemPool> pools;
+    std::unordered_map<CUevent, Event> events;
+    std::unordered_set<CUstream> capturing;
+    uintptr_t next_event = 0x3000;
+    std::unordered_set<void*> registered_host;
+    CUmemoryPool default_pool[kMaxDevices] = {};
+    int primary_refs[kMaxDevices] = {};
+    unsigned next_context = 1;
+    std::atomic<unsigned long long> ctx_get_device_calls{0};
+    uintptr_t next_pool = 0x2000;
+
+    // launched work, in steady clock nanoseconds: the device is busy until
+    // timeline[device], our own part of that work ends at own_end and sums
+    // up to queued_ns
+    std::atomic<long long> local_timeline[kMaxDevices] = {};
+    std::atomic<long long>* timeline = local_timeline;
+    std::atomic<long long> own_end[kMaxDevices] = {};
+    std::atomic<unsigned long long> queued_ns[kMaxDevices] = {};
+
+    MockDriver() {
+        if (const char* value = std::getenv("VCUDA_MOCK_DEVICE_COUNT")) {
+            device_count = std::atoi(value);
+            device_count = device_count < 1 ? 1 : (device_count > kMaxDevices ? kMaxDevices : device_count);
+        }
+        if (const char* value = std::getenv("VCUDA_MOCK_TOTAL_MEMORY")) {
+            total_memory = std::strtoull(value, nullptr, 10);
+        }
+        if (const char* value = std::getenv("VCUDA_MOCK_LATENCY_NS")) {
+            latency_ns = std::atol(value);
+        }
+        if (const char* value = std::getenv("VCUDA_MOCK_KERNEL_NS")) {
+            kernel_ns = std::atol(value);
+        }
+        if (const char* value = std::getenv("VCUDA_MOCK_TIMELINE")) {
+            const int fd = shm_open(value, O_CREAT | O_RDWR, 0600);
+            const size_t size = sizeof(local_timeline);
+            void* shared = fd == -1 || ftruncate(fd, size) != 0
+                ? MAP_FAILED : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (shared != MAP_FAILED) {
+                timeline = static_cast<std::atomic<long long>*>(shared);
+            }
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        for (int i = 0; i < kMaxDevices; ++i) {
+            next_ptr[i] = kDeviceBase + kDeviceSpan * i;
+        }
+    }
+};
+
+MockDriver& driver() {
+    static MockDriver instance;
+    return instance;
+}
+
+// fake contexts: number n of a device, 0 is its primary context; every
+// thread starts on the primary context of device 0
+CUcontext contextOf(int device, unsigned n = 0) {
+    return reinterpret_cast<CUcontext>(static_cast<uintptr_t>(0x1000 + (n << 8) + device));
+}
+
+int deviceOf(CUcontext ctx) {
+    return static_cast<int>((reinterpret_cast<uintptr_t>(ctx) - 0x1000) & 0xff);
+}
+
+thread_local CUcontext t_current = contextOf(0);
+
+void simulateLatency() {
+    const long latency = driver().latency_ns;
+    if (latency <= 0) {
+        return;
+    }
+    const auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(latency);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+
+bool validDevice(int device) {
+    return device >= 0 && device < driver().device_count;
+}
+
+CUresult allocate(int device, size_t size, CUdeviceptr* dptr) {
+    auto& drv = driver();
+    const size_t aligned = (size + kAlignment - 1) / kAlignment * kAlignment;
+
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    if (drv.used[device].load(std::memory_order_relaxed) + aligned > drv.total_memory) {
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    *dptr = drv.next_ptr[device];
+    drv.next_ptr[device] += aligned;
+    drv.used[device].fetch_add(aligned, std::memory_order_relaxed);
+    drv.allocations[*dptr] = Allocation{device, aligned};
+    drv.allocations[*dptr].ctx = t_current;
+    return CUDA_SUCCESS;
+}
+
+// what the driver frees with a context; pool memory belongs to the pool
+void freeContextAllocations(CUcontext ctx) {
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    for (auto it = drv.allocations.begin(); it != drv.allocations.end();) {
+        const Allocation& allocation = it->second;
+        if (allocation.ctx != ctx || allocation.pool) {
+            ++it;
+            continue;
+        }
+        if (!allocation.managed) {
+            drv.used[allocation.device].fetch_sub(allocation.size, std::memory_order_relaxed);
+        }
+        it = drv.allocations.erase(it);
+    }
+}
+
+size_t roundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// callers hold drv.mutex
+CUmemoryPool createPool(MockDriver& drv, int device) {
+    auto* pool = reinterpret_cast<CUmemoryPool>(drv.next_pool++);
+    drv.pools.emplace(pool, MemPool{device});
+    return pool;
+}
+
+CUmemoryPool defaultPool(int device) {
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    if (!drv.default_pool[device]) {
+        drv.default_pool[device] = createPool(drv, device);
+    }
+    return drv.default_pool[device];
+}
+
+CUresult allocateFromPool(CUmemoryPool handle, size_t size, CUdeviceptr* dptr) {
+    auto& drv = driver();
+    const size_t aligned = roundUp(size, kAlignment);
+
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.pools.find(handle);
+    if (it == drv.pools.end()) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    MemPool& pool = it->second;
+    if (pool.used + aligned > pool.reserved) {
+        const size_t grow = roundUp(pool.used + aligned - pool.reserved, kPoolChunk);
+        if (drv.used[pool.device].load(std::memory_order_relaxed) + grow > drv.total_memory) {
+            return CUDA_ERROR_OUT_OF_MEMORY;
+        }
+        drv.used[pool.device].fetch_add(grow, std::memory_order_relaxed);
+        pool.reserved += grow;
+    }
+    pool.used += aligned;
+    *dptr = drv.next_ptr[pool.device];
+    drv.next_ptr[pool.device] += aligned;
+    drv.allocations[*dptr] = Allocation{pool.device, aligned, false, CU_DEVICE_INVALID, handle};
+    return CUDA_SUCCESS;
+}
+
+long long steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// launches on a stream under capture only add to its graph
+bool isCapturing(CUstream stream) {
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    return drv.capturing.count(stream) != 0;
+}
+
+// queue one launch on the current device, behind whatever is queued already
+CUresult launch() {
+    if (!t_current) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    auto& drv = driver();
+    const int device = deviceOf(t_current);
+    const long long now = steadyNs();
+    long long busy_until = drv.timeline[device].load(std::memory_order_relaxed);
+    long long end = 0;
+    do {
+        end = std::max(now, busy_until) + drv.kernel_ns;
+    } while (!drv.timeline[device].compare_exchange_weak(busy_until, end, std::memory_order_relaxed));
+
+    long long own_end = drv.own_end[device].load(std::memory_order_relaxed);
+    while (own_end < end && !drv.own_end[device].compare_exchange_weak(own_end, end, std::memory_order_relaxed)) {
+    }
+    drv.queued_ns[device].fetch_add(drv.kernel_ns, std::memory_order_relaxed);
+    return CUDA_SUCCESS;
+}
+
+// wait for everything this process launched on the current device; streams
+// are not told apart
+CUresult waitIdle() {
+    if (!t_current) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    const long long until = driver().own_end[deviceOf(t_current)].load(std::memory_order_relaxed);
+    if (const long long wait = until - steadyNs(); wait > 0) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+    }
+    return CUDA_SUCCESS;
+}
+
+} // namespace
+
+// Entry points never call each other: with the hook preloaded the call would
+// go through the hook again.
+extern "C" {
+
+#define MOCK_EXPORT __attribute__((visibility("default")))
+
+MOCK_EXPORT CUresult cuInit(unsigned int) {
+    simulateLatency();
+    driver().initialized = true;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDriverGetVersion(int* version) {
+    *version = CUDA_VERSION;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuGetErrorString(CUresult error, const char** str) {
+    switch (error) {
+        case CUDA_SUCCESS: *str = "no error"; break;
+        case CUDA_ERROR_INVALID_VALUE: *str = "invalid argument"; break;
+        case CUDA_ERROR_OUT_OF_MEMORY: *str = "out of memory"; break;
+        case CUDA_ERROR_NOT_INITIALIZED: *str = "initialization error"; break;
+        case CUDA_ERROR_NOT_FOUND: *str = "named symbol not found"; break;
+        default: *str = "unknown error"; break;
+    }
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDeviceGetCount(int* count) {
+    *count = driver().device_count;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDeviceGet(CUdevice* device, int ordinal) {
+    simulateLatency();
+    if (!validDevice(ordinal)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    *device = ordinal;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDeviceTotalMem(size_t* bytes, CUdevice device) {
+    simulateLatency();
+    if (!validDevice(device)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    *bytes = driver().total_memory;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDeviceGetUuid(CUuuid* uuid, CUdevice device) {
+    if (!validDevice(device)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    std::memset(uuid, 0, sizeof(*uuid));
+    uuid->bytes[15] = static_cast<char>(device + 1);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuCtxGetCurrent(CUcontext* ctx) {
+    *ctx = t_current;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuCtxSetCurrent(CUcontext ctx) {
+    simulateLatency();
+    if (ctx && !validDevice(deviceOf(ctx))) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    t_current = ctx;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuCtxGetDevice(CUdevice* device) {
+    simulateLatency();
+    driver().ctx_get_device_calls.fetch_add(1, std::memory_order_relaxed);
+    if (!t_current) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    *device = deviceOf(t_current);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDevicePrimaryCtxRetain(CUcontext* ctx, CUdevice device) {
+    if (!validDevice(device)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    ++drv.primary_refs[device];
+    *ctx = contextOf(device);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDevicePrimaryCtxRelease_v2(CUdevice device) {
+    simulateLatency();
+    if (!validDevice(device)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    auto& drv = driver();
+    {
+        std::lock_guard<std::mutex> lock(drv.mutex);
+        if (drv.primary_refs[device] == 0) {
+            return CUDA_ERROR_INVALID_CONTEXT;
+        }
+        if (--drv.primary_refs[device] > 0) {
+            return CUDA_SUCCESS;
+        }
+    }
+    freeContextAllocations(contextOf(device));
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDevicePrimaryCtxReset_v2(CUdevice device) {
+    simulateLatency();
+    if (!validDevice(device)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    auto& drv = driver();
+    {
+        std::lock_guard<std::mutex> lock(drv.mutex);
+        drv.primary_refs[device] = 0;
+    }
+    freeContextAllocations(contextOf(device));
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDevicePrimaryCtxGetState(CUdevice device, unsigned int* flags, int* active) {
+    if (!validDevice(device)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    *flags = 0;
+    *active = drv.primary_refs[device] > 0;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuCtxCreate_v2(CUcontext* ctx, unsigned int, CUdevice device) {
+    simulateLatency();
+    if (!validDevice(device)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    auto& drv = driver();
+    {
+        std::lock_guard<std::mutex> lock(drv.mutex);
+        *ctx = contextOf(device, drv.next_context++);
+    }
+    t_current = *ctx;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuCtxDestroy_v2(CUcontext ctx) {
+    simulateLatency();
+    if (!ctx || !validDevice(deviceOf(ctx))) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    freeContextAllocations(ctx);
+    if (t_current == ctx) {
+        t_current = nullptr;
+    }
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemAlloc(CUdeviceptr* dptr, size_t bytesize) {
+    simulateLatency();
+    if (!dptr || bytesize == 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (!t_current) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    return allocate(deviceOf(t_current), bytesize, dptr);
+}
+
+MOCK_EXPORT CUresult cuMemFree(CUdeviceptr dptr) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.allocations.find(dptr);
+    if (it == drv.allocations.end()) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (!it->second.managed) {
+        drv.used[it->second.device].fetch_sub(it->second.size, std::memory_order_relaxed);
+    }
+    drv.allocations.erase(it);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemAllocManaged(CUdeviceptr* dptr, size_t bytesize, unsigned int flags) {
+    simulateLatency();
+    if (!dptr || bytesize == 0 || (flags != CU_MEM_ATTACH_GLOBAL && flags != CU_MEM_ATTACH_HOST)) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    *dptr = drv.next_managed;
+    drv.next_managed += (bytesize + kAlignment - 1) / kAlignment * kAlignment;
+    drv.allocations[*dptr] = Allocation{t_current ? deviceOf(t_current) : 0, bytesize, true};
+    drv.allocations[*dptr].ctx = t_current;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemAdvise(CUdeviceptr dptr, size_t count, CUmem_advise advice, CUdevice device) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.allocations.find(dptr);
+    if (it == drv.allocations.end() || !it->second.managed || count > it->second.size ||
+        (device != CU_DEVICE_CPU && !validDevice(device))) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (advice == CU_MEM_ADVISE_SET_PREFERRED_LOCATION) {
+        it->second.preferred_location = device;
+    }
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuPointerGetAttribute(void* data, CUpointer_attribute attribute, CUdeviceptr ptr) {
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.allocations.find(ptr);
+    if (it == drv.allocations.end()) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (attribute != CU_POINTER_ATTRIBUTE_IS_MANAGED) {
+        return CUDA_ERROR_NOT_SUPPORTED;
+    }
+    *static_cast<unsigned int*>(data) = it->second.managed ? 1 : 0;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemRangeGetAttribute(void* data, size_t dataSize, CUmem_range_attribute attribute, CUdeviceptr ptr, size_t) {
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.allocations.find(ptr);
+    if (it == drv.allocations.end() || !it->second.managed) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (attribute != CU_MEM_RANGE_ATTRIBUTE_PREFERRED_LOCATION || dataSize != sizeof(int)) {
+        return CUDA_ERROR_NOT_SUPPORTED;
+    }
+    *static_cast<int*>(data) = it->second.preferred_location;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemGetInfo(size_t* free, size_t* total) {
+    simulateLatency();
+    if (!t_current) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    auto& drv = driver();
+    *total = drv.total_memory;
+    *free = drv.total_memory - drv.used[deviceOf(t_current)].load(std::memory_order_relaxed);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemAllocHost(void** pp, size_t bytesize) {
+    simulateLatency();
+    *pp = std::malloc(bytesize);
+    return *pp ? CUDA_SUCCESS : CUDA_ERROR_OUT_OF_MEMORY;
+}
+
+MOCK_EXPORT CUresult cuMemFreeHost(void* p) {
+    simulateLatency();
+    std::free(p);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemHostAlloc(void** pp, size_t bytesize, unsigned int) {
+    simulateLatency();
+    *pp = std::malloc(bytesize);
+    return *pp ? CUDA_SUCCESS : CUDA_ERROR_OUT_OF_MEMORY;
+}
+
+MOCK_EXPORT CUresult cuMemHostRegister(void* p, size_t bytesize, unsigned int) {
+    simulateLatency();
+    if (!p || bytesize == 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    return drv.registered_host.insert(p).second ? CUDA_SUCCESS : CUDA_ERROR_HOST_MEMORY_ALREADY_REGISTERED;
+}
+
+MOCK_EXPORT CUresult cuMemHostUnregister(void* p) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    return drv.registered_host.erase(p) > 0 ? CUDA_SUCCESS : CUDA_ERROR_HOST_MEMORY_NOT_REGISTERED;
+}
+
+MOCK_EXPORT CUresult cuMemGetAllocationGranularity(size_t* granularity, const CUmemAllocationProp*, CUmemAllocationGranularity_flags) {
+    *granularity = kGranularity;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemCreate(CUmemGenericAllocationHandle* handle, size_t size, const CUmemAllocationProp* prop, unsigned long long) {
+    simulateLatency();
+    if (!prop || size == 0 || size % kGranularity != 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    auto& drv = driver();
+    const int device = prop->location.id;
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    if (drv.used[device].load(std::memory_order_relaxed) + size > drv.total_memory) {
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    drv.used[device].fetch_add(size, std::memory_order_relaxed);
+    *handle = drv.next_handle++;
+    drv.handles[*handle] = Allocation{device, size};
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemRelease(CUmemGenericAllocationHandle handle) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.handles.find(handle);
+    if (it == drv.handles.end()) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    drv.used[it->second.device].fetch_sub(it->second.size, std::memory_order_relaxed);
+    drv.handles.erase(it);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemAddressReserve(CUdeviceptr* ptr, size_t size, size_t, CUdeviceptr, unsigned long long) {
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    *ptr = drv.next_ptr[kMaxDevices - 1];
+    drv.next_ptr[kMaxDevices - 1] += (size + kGranularity - 1) / kGranularity * kGranularity;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemAddressFree(CUdeviceptr, size_t) {
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemMap(CUdeviceptr, size_t, size_t, CUmemGenericAllocationHandle, unsigned long long) {
+    simulateLatency();
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemUnmap(CUdeviceptr, size_t) {
+    simulateLatency();
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuDeviceGetMemPool(CUmemoryPool* pool, CUdevice device) {
+    if (!validDevice(device)) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    *pool = defaultPool(device);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemPoolCreate(CUmemoryPool* pool, const CUmemPoolProps* props) {
+    simulateLatency();
+    if (!pool || !props || props->location.type != CU_MEM_LOCATION_TYPE_DEVICE || !validDevice(props->location.id)) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    *pool = createPool(drv, props->location.id);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemPoolDestroy(CUmemoryPool handle) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.pools.find(handle);
+    if (it == drv.pools.end()) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    drv.used[it->second.device].fetch_sub(it->second.reserved, std::memory_order_relaxed);
+    for (auto alloc = drv.allocations.begin(); alloc != drv.allocations.end();) {
+        alloc = alloc->second.pool == handle ? drv.allocations.erase(alloc) : std::next(alloc);
+    }
+    drv.pools.erase(it);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemPoolTrimTo(CUmemoryPool handle, size_t minBytesToKeep) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.pools.find(handle);
+    if (it == drv.pools.end()) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    MemPool& pool = it->second;
+    const size_t keep = std::max(roundUp(pool.used, kPoolChunk), std::min(pool.reserved, roundUp(minBytesToKeep, kPoolChunk)));
+    if (keep < pool.reserved) {
+        drv.used[pool.device].fetch_sub(pool.reserved - keep, std::memory_order_relaxed);
+        pool.reserved = keep;
+    }
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuMemPoolGetAttribute(CUmemoryPool handle, CUmemPool_attribute attribute, void* value) {
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.pools.find(handle);
+    if (it == drv.pools.end()) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    switch (attribute) {
+    case CU_MEMPOOL_ATTR_RESERVED_MEM_CURRENT:
+        *static_cast<cuuint64_t*>(value) = it->second.reserved;
+        return CUDA_SUCCESS;
+    case CU_MEMPOOL_ATTR_USED_MEM_CURRENT:
+        *static_cast<cuuint64_t*>(value) = it->second.used;
+        return CUDA_SUCCESS;
+    default:
+        return CUDA_ERROR_NOT_SUPPORTED;
+    }
+}
+
+MOCK_EXPORT CUresult cuMemAllocFromPoolAsync(CUdeviceptr* dptr, size_t bytesize, CUmemoryPool pool, CUstream) {
+    simulateLatency();
+    if (!dptr || bytesize == 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    return allocateFromPool(pool, bytesize, dptr);
+}
+
+MOCK_EXPORT CUresult cuMemAllocAsync(CUdeviceptr* dptr, size_t bytesize, CUstream) {
+    simulateLatency();
+    if (!dptr || bytesize == 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (!t_current) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    return allocateFromPool(defaultPool(deviceOf(t_current)), bytesize, dptr);
+}
+
+// frees right away: there is no stream to order against
+MOCK_EXPORT CUresult cuMemFreeAsync(CUdeviceptr dptr, CUstream) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.allocations.find(dptr);
+    if (it == drv.allocations.end()) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (it->second.pool) {
+        drv.pools[it->second.pool].used -= it->second.size;
+    } else if (!it->second.managed) {
+        drv.used[it->second.device].fetch_sub(it->second.size, std::memory_order_relaxed);
+    }
+    drv.allocations.erase(it);
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuLaunchKernel(CUfunction, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int,
+                                    unsigned int, unsigned int, CUstream hStream, void**, void**) {
+    simulateLatency();
+    return isCapturing(hStream) ? CUDA_SUCCESS : launch();
+}
+
+MOCK_EXPORT CUresult cuLaunchKernelEx(const CUlaunchConfig* config, CUfunction, void**, void**) {
+    simulateLatency();
+    if (!config) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    return isCapturing(config->hStream) ? CUDA_SUCCESS : launch();
+}
+
+MOCK_EXPORT CUresult cuGraphLaunch(CUgraphExec, CUstream hStream) {
+    simulateLatency();
+    return isCapturing(hStream) ? CUDA_SUCCESS : launch();
+}
+
+MOCK_EXPORT CUresult cuStreamBeginCapture_v2(CUstream hStream, CUstreamCaptureMode) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    return drv.capturing.insert(hStream).second ? CUDA_SUCCESS : CUDA_ERROR_INVALID_VALUE;
+}
+
+MOCK_EXPORT CUresult cuStreamEndCapture(CUstream hStream, CUgraph* phGraph) {
+    simulateLatency();
+    if (!phGraph) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    if (drv.capturing.erase(hStream) == 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *phGraph = nullptr; // no graph is ever instantiated from it
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuStreamIsCapturing(CUstream hStream, CUstreamCaptureStatus* captureStatus) {
+    simulateLatency();
+    if (!captureStatus) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *captureStatus = isCapturing(hStream) ? CU_STREAM_CAPTURE_STATUS_ACTIVE : CU_STREAM_CAPTURE_STATUS_NONE;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuStreamIsCapturing_ptsz(CUstream hStream, CUstreamCaptureStatus* captureStatus) {
+    return cuStreamIsCapturing(hStream, captureStatus);
+}
+
+MOCK_EXPORT CUresult cuEventCreate(CUevent* event, unsigned int) {
+    simulateLatency();
+    if (!event) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    *event = reinterpret_cast<CUevent>(drv.next_event++);
+    drv.events[*event] = Event{};
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuEventDestroy_v2(CUevent event) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    return drv.events.erase(event) ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+// the event completes behind everything queued on the device so far
+MOCK_EXPORT CUresult cuEventRecord(CUevent event, CUstream hStream) {
+    simulateLatency();
+    if (!t_current) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    auto& drv = driver();
+    const long long stamp = std::max(steadyNs(), drv.timeline[deviceOf(t_current)].load(std::memory_order_relaxed));
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.events.find(event);
+    if (it == drv.events.end()) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    it->second = Event{stamp, true, drv.capturing.count(hStream) != 0};
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuEventRecord_ptsz(CUevent event, CUstream stream) {
+    return cuEventRecord(event, stream);
+}
+
+MOCK_EXPORT CUresult cuEventQuery(CUevent event) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto it = drv.events.find(event);
+    if (it == drv.events.end()) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    if (it->second.captured) {
+        return CUDA_ERROR_CAPTURED_EVENT;
+    }
+    return it->second.stamp <= steadyNs() ? CUDA_SUCCESS : CUDA_ERROR_NOT_READY;
+}
+
+MOCK_EXPORT CUresult cuEventElapsedTime(float* milliseconds, CUevent start, CUevent end) {
+    simulateLatency();
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    const auto first = drv.events.find(start);
+    const auto last = drv.events.find(end);
+    if (!milliseconds || first == drv.events.end() || last == drv.events.end()) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    if (!first->second.recorded || !last->second.recorded) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    if (first->second.captured || last->second.captured) {
+        return CUDA_ERROR_CAPTURED_EVENT;
+    }
+    if (std::max(first->second.stamp, last->second.stamp) > steadyNs()) {
+        return CUDA_ERROR_NOT_READY;
+    }
+    *milliseconds = static_cast<float>(last->second.stamp - first->second.stamp) / 1e6f;
+    return CUDA_SUCCESS;
+}
+
+MOCK_EXPORT CUresult cuCtxSynchronize() {
+    simulateLatency();
+    return waitIdle();
+}
+
+MOCK_EXPORT CUresult cuStreamSynchronize(CUstream) {
+    simulateLatency();
+    return waitIdle();
+}
+
+// device time this process's launches on device have run so far, in
+// nanoseconds; on a shared timeline work of others queued in between counts
+// as pending, so it lags behind
+MOCK_EXPORT unsigned long long vcudaMockBusyNs(int device) {
+    if (!validDevice(device)) {
+        return 0;
+    }
+    auto& drv = driver();
+    const unsigned long long queued = drv.queued_ns[device].load(std::memory_order_relaxed);
+    const long long pending = drv.own_end[device].load(std::memory_order_relaxed) - steadyNs();
+    return queued - std::min<unsigned long long>(queued, static_cast<unsigned long long>(std::max(pending, 0ll)));
+}
+
+// events created and not yet destroyed, the hook's own included
+MOCK_EXPORT unsigned long long vcudaMockEventCount() {
+    auto& drv = driver();
+    std::lock_guard<std::mutex> lock(drv.mutex);
+    return drv.events.size();
+}
+
+// cuCtxGetDevice calls so far, the hook's own included
+MOCK_EXPORT unsigned long long vcudaMockCtxGetDeviceCalls() {
+    return driver().ctx_get_device_calls.load(std::memory_order_relaxed);
+}
+
+MOCK_EXPORT CUresult cuGetProcAddress(const char* symbol, void** pfn, int cudaVersion, cuuint64_t flags, CUdriverProcAddressQueryResult* symbolStatus);
+
+} // extern "C"
+
+namespace {
+
+struct MockSymbol {
+    const char* name;
+    void* fn;
+};
+
+#define MOCK_SYMBOL(name) MockSymbol{#name, reinterpret_cast<void*>(&name)}
+
+const MockSymbol kMockSymbols[] = {
+    MOCK_SYMBOL(cuInit),
+    MOCK_SYMBOL(cuDriverGetVersion),
+    MOCK_SYMBOL(cuGetErrorString),
+    MOCK_SYMBOL(cuGetProcAddress_v2),
+    MOCK_SYMBOL(cuDeviceGetCount),
+    MOCK_SYMBOL(cuDeviceGet),
+    MOCK_SYMBOL(cuDeviceTotalMem_v2),
+    MOCK_SYMBOL(cuDeviceGetUuid),
+    MOCK_SYMBOL(cuCtxGetCurrent),
+    MOCK_SYMBOL(cuCtxSetCurrent),
+    MOCK_SYMBOL(cuCtxGetDevice),
+    MOCK_SYMBOL(cuDevicePrimaryCtxRetain),
+    MOCK_SYMBOL(cuDevicePrimaryCtxRelease_v2),
+    MOCK_SYMBOL(cuDevicePrimaryCtxReset_v2),
+    MOCK_SYMBOL(cuDevicePrimaryCtxGetState),
+    MOCK_SYMBOL(cuCtxCreate_v2),
+    MOCK_SYMBOL(cuCtxDestroy_v2),
+    MOCK_SYMBOL(cuMemAlloc_v2),
+    MOCK_SYMBOL(cuMemFree_v2),
+    MOCK_SYMBOL(cuMemGetInfo_v2),
+    MOCK_SYMBOL(cuMemAllocManaged),
+    MOCK_SYMBOL(cuMemAdvise),
+    MOCK_SYMBOL(cuPointerGetAttribute),
+    MOCK_SYMBOL(cuMemRangeGetAttribute),
+    MOCK_SYMBOL(cuMemAllocHost_v2),
+    MOCK_SYMBOL(cuMemFreeHost),
+    MOCK_SYMBOL(cuMemHostAlloc),
+    MOCK_SYMBOL(cuMemHostRegister_v2),
+    MOCK_SYMBOL(cuMemHostUnregister),
+    MOCK_SYMBOL(cuMemGetAllocationGranularity),
+    MOCK_SYMBOL(cuMemCreate),
+    MOCK_SYMBOL(cuMemRelease),
+    MOCK_SYMBOL(cuMemAddressReserve),
+    MOCK_SYMBOL(cuMemAddressFree),
+    MOCK_SYMBOL(cuMemMap),
+    MOCK_SYMBOL(cuMemUnmap),
+    MOCK_SYMBOL(cuDeviceGetMemPool),
+    MOCK_SYMBOL(cuMemPoolCreate),
+    MOCK_SYMBOL(cuMemPoolDestroy),
+    MOCK_SYMBOL(cuMemPoolTrimTo),
+    MOCK_SYMBOL(cuMemPoolGetAttribute),
+    MOCK_SYMBOL(cuMemAllocFromPoolAsync),
+    MOCK_SYMBOL(cuMemAllocAsync),
+    MOCK_SYMBOL(cuMemFreeAsync),
+    MOCK_SYMBOL(cuLaunchKernel),
+    MOCK_SYMBOL(cuLaunchKernelEx),
+    MOCK_SYMBOL(cuGraphLaunch),
+    MOCK_SYMBOL(cuStreamBeginCapture_v2),
+    MOCK_SYMBOL(cuStreamEndCapture),
+    MOCK_SYMBOL(cuStreamIsCapturing),
+    MOCK_SYMBOL(cuStreamIsCapturing_ptsz),
+    MOCK_SYMBOL(cuEventCreate),
+    MOCK_SYMBOL(cuEventDestroy_v2),
+    MOCK_SYMBOL(cuEventRecord),
+    MOCK_SYMBOL(cuEventRecord_ptsz),
+    MOCK_SYMBOL(cuEventQuery),
+    MOCK_SYMBOL(cuEventElapsedTime),
+    MOCK_SYMBOL(cuCtxSynchronize),
+    MOCK_SYMBOL(cuStreamSynchronize),
+};
+
+void* findMockSymbol(const char* name) {
+    for (const auto& symbol : kMockSymbols) {
+        if (std::strcmp(symbol.name, name) == 0) {
+            return symbol.fn;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+// Same resolution order as the driver: a per-thread default stream variant
+// when asked for, then the _v2 ABI for versions that have it, then the name.
+CUresult cuGetProcAddress(const char* symbol, void** pfn, int cudaVersion, cuuint64_t flags, CUdriverProcAddressQueryResult* symbolStatus) {
+    simulateLatency();
+    char name[128];
+    void* fn = nullptr;
+
+    if (flags & CU_GET_PROC_ADDRESS_PER_THREAD_DEFAULT_STREAM) {
+        std::snprintf(name, sizeof(name), "%s_ptsz", symbol);
+        fn = findMockSymbol(name);
+    }
+    if (!fn && cudaVersion >= 3020) {
+        std::snprintf(name, sizeof(name), "%s_v2", symbol);
+        fn = findMockSymbol(name);
+    }
+    if (!fn) {
+        fn = findMockSymbol(symbol);
+    }
+
+    if (symbolStatus) {
+        *symbolStatus = fn ? CU_GET_PROC_ADDRESS_SUCCESS : CU_GET_PROC_ADDRESS_SYMBOL_NOT_FOUND;
+    }
+    *pfn = fn;
+    return fn ? CUDA_SUCCESS : CUDA_ERROR_NOT_FOUND;
+}
@@ -0,0 +1,239 @@
+// Stand-in for libnvidia-ml.so.1, reporting the same devices as the mock
+// libcuda (VCUDA_MOCK_DEVICE_COUNT, VCUDA_MOCK_TOTAL_MEMORY,
+// VCUDA_MOCK_LATENCY_NS). Memory usage is static: nothing is ever allocated.
+// Process utilization comes from the mock libcuda's launch timeline: every
+// query returns one sample for the calling process covering the time since
+// the query before. Device utilization rates are fixed at kDeviceGpuUtil and
+// kDeviceMemoryUtil, as if neighbours kept the device busy.
+// vcudaMockNvmlIndexCalls counts nvmlDeviceGetIndex calls.
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <nvml.h>
+
+namespace {
+
+constexpr unsigned int kMaxDevices = 8;
+constexpr unsigned int kDeviceGpuUtil = 100;
+constexpr unsigned int kDeviceMemoryUtil = 50;
+
+struct MockDevice {
+    unsigned int index;
+    // previous utilization query
+    unsigned long long sampled_us = 0;
+    unsigned long long sampled_busy_ns = 0;
+};
+
+struct MockNvml {
+    unsigned int device_count = 1;
+    unsigned long long total_memory = 80ull << 30;
+    long latency_ns = 0;
+    MockDevice devices[kMaxDevices] = {};
+    std::atomic<unsigned long long> index_calls{0};
+
+    MockNvml() {
+        if (const char* value = std::getenv("VCUDA_MOCK_DEVICE_COUNT")) {
+            const int count = std::atoi(value);
+            device_count = count < 1 ? 1 : (count > static_cast<int>(kMaxDevices) ? kMaxDevices : count);
+        }
+        if (const char* value = std::getenv("VCUDA_MOCK_TOTAL_MEMORY")) {
+            total_memory = std::strtoull(value, nullptr, 10);
+        }
+        if (const char* value = std::getenv("VCUDA_MOCK_LATENCY_NS")) {
+            latency_ns = std::atol(value);
+        }
+        for (unsigned int i = 0; i < kMaxDevices; ++i) {
+            devices[i].index = i;
+        }
+    }
+};
+
+MockNvml& nvml() {
+    static MockNvml instance;
+    return instance;
+}
+
+void simulateLatency() {
+    const long latency = nvml().latency_ns;
+    if (latency <= 0) {
+        return;
+    }
+    const auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(latency);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+
+MockDevice* toDevice(nvmlDevice_t device) {
+    auto* mock = reinterpret_cast<MockDevice*>(device);
+    auto& state = nvml();
+    if (mock < state.devices || mock >= state.devices + state.device_count) {
+        return nullptr;
+    }
+    return mock;
+}
+
+unsigned long long nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// busy time of the mock libcuda, 0 when it is not loaded
+unsigned long long deviceBusyNs(unsigned int index) {
+    using BusyFn = unsigned long long (*)(int);
+    static const BusyFn busy = [] {
+        void* cuda = dlopen("libcuda.so.1", RTLD_NOW | RTLD_NOLOAD);
+        return cuda ? reinterpret_cast<BusyFn>(dlsym(cuda, "vcudaMockBusyNs")) : nullptr;
+    }();
+    return busy ? busy(static_cast<int>(index)) : 0;
+}
+
+} // namespace
+
+extern "C" {
+
+#define MOCK_EXPORT __attribute__((visibility("default")))
+
+MOCK_EXPORT nvmlReturn_t nvmlInit_v2() {
+    simulateLatency();
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlInitWithFlags(unsigned int) {
+    return nvmlInit_v2();
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlShutdown() {
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT const char* nvmlErrorString(nvmlReturn_t result) {
+    switch (result) {
+        case NVML_SUCCESS: return "Success";
+        case NVML_ERROR_UNINITIALIZED: return "Uninitialized";
+        case NVML_ERROR_INVALID_ARGUMENT: return "Invalid Argument";
+        case NVML_ERROR_NOT_FOUND: return "Not Found";
+        default: return "Unknown Error";
+    }
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetCount_v2(unsigned int* count) {
+    simulateLatency();
+    *count = nvml().device_count;
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetHandleByIndex_v2(unsigned int index, nvmlDevice_t* device) {
+    simulateLatency();
+    if (index >= nvml().device_count) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    *device = reinterpret_cast<nvmlDevice_t>(&nvml().devices[index]);
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetIndex(nvmlDevice_t device, unsigned int* index) {
+    simulateLatency();
+    nvml().index_calls.fetch_add(1, std::memory_order_relaxed);
+    const auto* mock = toDevice(device);
+    if (!mock) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    *index = mock->index;
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetUUID(nvmlDevice_t device, char* uuid, unsigned int length) {
+    const auto* mock = toDevice(device);
+    if (!mock) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    // matches the bytes reported by the mock cuDeviceGetUuid
+    const int written = std::snprintf(uuid, length, "GPU-00000000-0000-0000-0000-0000000000%02x", mock->index + 1);
+    return written < static_cast<int>(length) ? NVML_SUCCESS : NVML_ERROR_INSUFFICIENT_SIZE;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetName(nvmlDevice_t device, char* name, unsigned int length) {
+    if (!toDevice(device)) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    std::snprintf(name, length, "vcuda mock device");
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetMemoryInfo(nvmlDevice_t device, nvmlMemory_t* memory) {
+    simulateLatency();
+    if (!toDevice(device)) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    memory->total = nvml().total_memory;
+    memory->used = 0;
+    memory->free = memory->total;
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetMemoryInfo_v2(nvmlDevice_t device, nvmlMemory_v2_t* memory) {
+    simulateLatency();
+    if (!toDevice(device)) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    memory->total = nvml().total_memory;
+    memory->reserved = 0;
+    memory->used = 0;
+    memory->free = memory->total;
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetProcessUtilization(nvmlDevice_t device, nvmlProcessUtilizationSample_t* utilization,
+                                                         unsigned int* processSamplesCount, unsigned long long lastSeenTimeStamp) {
+    simulateLatency();
+    auto* mock = toDevice(device);
+    if (!mock || !processSamplesCount) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    const unsigned long long now = nowUs();
+    if (now <= lastSeenTimeStamp) {
+        return NVML_ERROR_NOT_FOUND;
+    }
+    if (!utilization || *processSamplesCount < 1) {
+        *processSamplesCount = 1;
+        return NVML_ERROR_INSUFFICIENT_SIZE;
+    }
+
+    const unsigned long long busy = deviceBusyNs(mock->index);
+    unsigned int percent = 0;
+    if (mock->sampled_us != 0 && now > mock->sampled_us) {
+        const double elapsed_ns = static_cast<double>(now - mock->sampled_us) * 1000;
+        percent = static_cast<unsigned int>(std::min(100.0, (busy - mock->sampled_busy_ns) * 100 / elapsed_ns + 0.5));
+    }
+    mock->sampled_us = now;
+    mock->sampled_busy_ns = busy;
+
+    utilization[0] = nvmlProcessUtilizationSample_t{};
+    utilization[0].pid = static_cast<unsigned int>(getpid());
+    utilization[0].timeStamp = now;
+    utilization[0].smUtil = percent;
+    *processSamplesCount = 1;
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT nvmlReturn_t nvmlDeviceGetUtilizationRates(nvmlDevice_t device, nvmlUtilization_t* utilization) {
+    simulateLatency();
+    if (!toDevice(device) || !utilization) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    utilization->gpu = kDeviceGpuUtil;
+    utilization->memory = kDeviceMemoryUtil;
+    return NVML_SUCCESS;
+}
+
+MOCK_EXPORT unsigned long long vcudaMockNvmlIndexCalls() {
+    return nvml().index_calls.load(std::memory_order_relaxed);
+}
+
+} // extern "C"
@@ -0,0 +1,99 @@
+// NVML memory queries against the mock NVML: with a limit they are answered
+// by the hook alone, the device of a handle coming from the cache filled at
+// nvmlInit rather than from nvmlDeviceGetIndex. A handle the hook has not
+// seen yet costs one lookup.
+//
+//   nvml_cache_test [--hook path/to/libvcuda-hook.so]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <nvml.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr unsigned long long kLimit = 1ull << 30;
+constexpr unsigned int kDevices = 2;
+constexpr int kPolls = 1000;
+
+using nvmlInit_t = nvmlReturn_t (*)();
+using nvmlInitWithFlags_t = nvmlReturn_t (*)(unsigned int);
+using nvmlDeviceGetHandleByIndex_t = nvmlReturn_t (*)(unsigned int, nvmlDevice_t*);
+using nvmlDeviceGetMemoryInfo_t = nvmlReturn_t (*)(nvmlDevice_t, nvmlMemory_t*);
+using nvmlDeviceGetMemoryInfo_v2_t = nvmlReturn_t (*)(nvmlDevice_t, nvmlMemory_v2_t*);
+using vcudaMockNvmlIndexCalls_t = unsigned long long (*)();
+
+struct Nvml {
+    nvmlInit_t nvmlInit;
+    nvmlInitWithFlags_t nvmlInitWithFlags;
+    nvmlDeviceGetHandleByIndex_t nvmlDeviceGetHandleByIndex;
+    nvmlDeviceGetMemoryInfo_t nvmlDeviceGetMemoryInfo;
+    nvmlDeviceGetMemoryInfo_v2_t nvmlDeviceGetMemoryInfo_v2;
+    vcudaMockNvmlIndexCalls_t indexCalls;
+};
+
+// a sidecar polling every device
+void poll(const Nvml& nvml) {
+    nvmlDevice_t devices[kDevices] = {};
+    for (unsigned int i = 0; i < kDevices; ++i) {
+        EXPECT(nvml.nvmlDeviceGetHandleByIndex(i, &devices[i]) == NVML_SUCCESS);
+    }
+    for (int round = 0; round < kPolls; ++round) {
+        for (const nvmlDevice_t device : devices) {
+            nvmlMemory_t memory{};
+            EXPECT(nvml.nvmlDeviceGetMemoryInfo(device, &memory) == NVML_SUCCESS);
+            EXPECT(memory.total == kLimit && memory.free == kLimit);
+            nvmlMemory_v2_t memory_v2{};
+            EXPECT(nvml.nvmlDeviceGetMemoryInfo_v2(device, &memory_v2) == NVML_SUCCESS);
+            EXPECT(memory_v2.total == kLimit);
+        }
+    }
+}
+
+int runChild(const std::string& scenario) {
+    void* library = preload::openLibrary("libnvidia-ml.so.1");
+
+    Nvml nvml{
+        load<nvmlInit_t>(library, "nvmlInit_v2"),
+        load<nvmlInitWithFlags_t>(library, "nvmlInitWithFlags"),
+        load<nvmlDeviceGetHandleByIndex_t>(library, "nvmlDeviceGetHandleByIndex_v2"),
+        load<nvmlDeviceGetMemoryInfo_t>(library, "nvmlDeviceGetMemoryInfo"),
+        load<nvmlDeviceGetMemoryInfo_v2_t>(library, "nvmlDeviceGetMemoryInfo_v2"),
+        load<vcudaMockNvmlIndexCalls_t>(library, "vcudaMockNvmlIndexCalls"),
+    };
+
+    if (scenario == "init") {
+        // every handle is known once nvmlInit returns
+        EXPECT(nvml.nvmlInit() == NVML_SUCCESS);
+        poll(nvml);
+        EXPECT(nvml.indexCalls() == 0);
+    } else {
+        // nvmlInitWithFlags goes by the hook: each handle is looked up once
+        // at most, unless resolving the limits cached it already
+        EXPECT(nvml.nvmlInitWithFlags(0) == NVML_SUCCESS);
+        poll(nvml);
+        EXPECT(nvml.indexCalls() <= kDevices);
+    }
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (const char* scenario = preload::childScenario()) {
+        return runChild(scenario);
+    }
+
+    preload::setUp(argc, argv);
+    unsetenv("VCUDA_DEVICE_MEMORY_LIMITS");
+    unsetenv("VCUDA_QUOTA_LEASE");
+    setenv("VCUDA_MEMORY_LIMIT", "1g", 1);
+    setenv("VCUDA_MOCK_DEVICE_COUNT", "2", 1);
+
+    bool passed = preload::runScenario("init");
+    passed &= preload::runScenario("flags");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,152 @@
+// Oversubscription against the mock driver: allocations past the limit, or
+// past the memory the device has, fall back to managed memory placed on the
+// host, up to the configured ratio.
+//
+//   oversubscription_test [--hook path/to/libvcuda-hook.so]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr size_t kBlock = 256ull << 20;
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemAlloc_t = CUresult (*)(CUdeviceptr*, size_t);
+using cuMemFree_t = CUresult (*)(CUdeviceptr);
+using cuMemGetInfo_t = CUresult (*)(size_t*, size_t*);
+using cuPointerGetAttribute_t = CUresult (*)(void*, CUpointer_attribute, CUdeviceptr);
+using cuMemRangeGetAttribute_t = CUresult (*)(void*, size_t, CUmem_range_attribute, CUdeviceptr, size_t);
+
+struct Driver {
+    cuInit_t cuInit;
+    cuMemAlloc_t cuMemAlloc;
+    cuMemFree_t cuMemFree;
+    cuMemGetInfo_t cuMemGetInfo;
+    cuPointerGetAttribute_t cuPointerGetAttribute;
+    cuMemRangeGetAttribute_t cuMemRangeGetAttribute;
+};
+
+bool isManaged(const Driver& drv, CUdeviceptr ptr) {
+    unsigned int managed = 0;
+    return drv.cuPointerGetAttribute(&managed, CU_POINTER_ATTRIBUTE_IS_MANAGED, ptr) == CUDA_SUCCESS && managed != 0;
+}
+
+int preferredLocation(const Driver& drv, CUdeviceptr ptr) {
+    int location = CU_DEVICE_INVALID;
+    drv.cuMemRangeGetAttribute(&location, sizeof(location), CU_MEM_RANGE_ATTRIBUTE_PREFERRED_LOCATION, ptr, kBlock);
+    return location;
+}
+
+// limit 1g, ratio 1.5: four device blocks, then two managed ones on the host
+void quotaScenario(const Driver& drv) {
+    std::vector<CUdeviceptr> device_blocks(4);
+    for (auto& ptr : device_blocks) {
+        EXPECT(drv.cuMemAlloc(&ptr, kBlock) == CUDA_SUCCESS);
+        EXPECT(!isManaged(drv, ptr));
+    }
+
+    std::vector<CUdeviceptr> managed_blocks(2);
+    for (auto& ptr : managed_blocks) {
+        EXPECT(drv.cuMemAlloc(&ptr, kBlock) == CUDA_SUCCESS);
+        EXPECT(isManaged(drv, ptr));
+        EXPECT(preferredLocation(drv, ptr) == CU_DEVICE_CPU);
+    }
+
+    CUdeviceptr extra = 0;
+    EXPECT(drv.cuMemAlloc(&extra, kBlock) == CUDA_ERROR_OUT_OF_MEMORY);
+
+    // managed blocks are not device usage
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    EXPECT(total_bytes == 4 * kBlock);
+    EXPECT(free_bytes == 0);
+
+    // freeing a managed block gives back oversubscription budget only
+    EXPECT(drv.cuMemFree(managed_blocks[0]) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    EXPECT(free_bytes == 0);
+    EXPECT(drv.cuMemAlloc(&managed_blocks[0], kBlock) == CUDA_SUCCESS);
+    EXPECT(isManaged(drv, managed_blocks[0]));
+
+    // freeing a device block makes room on the device again
+    EXPECT(drv.cuMemFree(device_blocks[0]) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    EXPECT(free_bytes == kBlock);
+    EXPECT(drv.cuMemAlloc(&device_blocks[0], kBlock) == CUDA_SUCCESS);
+    EXPECT(!isManaged(drv, device_blocks[0]));
+
+    for (const auto ptr : device_blocks) {
+        EXPECT(drv.cuMemFree(ptr) == CUDA_SUCCESS);
+    }
+    for (const auto ptr : managed_blocks) {
+        EXPECT(drv.cuMemFree(ptr) == CUDA_SUCCESS);
+    }
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    EXPECT(free_bytes == total_bytes);
+}
+
+// no limit, a 512m device and ratio 1.5: the driver's own out of memory
+// falls back too, with the device memory as the base of the budget
+void physicalScenario(const Driver& drv) {
+    CUdeviceptr ptrs[4] = {};
+    EXPECT(drv.cuMemAlloc(&ptrs[0], kBlock) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAlloc(&ptrs[1], kBlock) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAlloc(&ptrs[2], kBlock) == CUDA_SUCCESS);
+    EXPECT(!isManaged(drv, ptrs[1]));
+    EXPECT(isManaged(drv, ptrs[2]));
+    EXPECT(drv.cuMemAlloc(&ptrs[3], kBlock) == CUDA_ERROR_OUT_OF_MEMORY);
+
+    for (int i = 0; i < 3; ++i) {
+        EXPECT(drv.cuMemFree(ptrs[i]) == CUDA_SUCCESS);
+    }
+}
+
+int runChild(const std::string& scenario) {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuMemAlloc_t>(cuda, "cuMemAlloc_v2"),
+        load<cuMemFree_t>(cuda, "cuMemFree_v2"),
+        load<cuMemGetInfo_t>(cuda, "cuMemGetInfo_v2"),
+        load<cuPointerGetAttribute_t>(cuda, "cuPointerGetAttribute"),
+        load<cuMemRangeGetAttribute_t>(cuda, "cuMemRangeGetAttribute"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (scenario == "quota") {
+        quotaScenario(drv);
+    } else {
+        physicalScenario(drv);
+    }
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (const char* scenario = preload::childScenario()) {
+        return runChild(scenario);
+    }
+
+    preload::setUp(argc, argv);
+    unsetenv("VCUDA_MEMORY_LIMIT");
+    unsetenv("VCUDA_DEVICE_MEMORY_LIMITS");
+    unsetenv("VCUDA_QUOTA_LEASE");
+    setenv("VCUDA_OVERSUBSCRIPTION_RATIO", "1.5", 1);
+
+    bool passed = preload::runScenario("quota", {{"VCUDA_MEMORY_LIMIT", "1g"}});
+    passed &= preload::runScenario("physical", {{"VCUDA_MOCK_TOTAL_MEMORY", "536870912"}});
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
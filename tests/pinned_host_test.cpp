@@ -0,0 +1,94 @@
+// Pinned host memory quota against the mock driver: cuMemAllocHost,
+// cuMemHostAlloc and cuMemHostRegister share one limit, charged by the pages
+// they lock, and freeing or unregistering gives the pages back. Two children
+// run the scenario one after the other to check that a process exiting with
+// memory still pinned does not keep it charged.
+//
+//   pinned_host_test [--hook path/to/libvcuda-hook.so]
+#include <cstdio>
+#include <cstdlib>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr size_t kMiB = 1ull << 20;
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemAllocHost_t = CUresult (*)(void**, size_t);
+using cuMemHostAlloc_t = CUresult (*)(void**, size_t, unsigned int);
+using cuMemFreeHost_t = CUresult (*)(void*);
+using cuMemHostRegister_t = CUresult (*)(void*, size_t, unsigned int);
+using cuMemHostUnregister_t = CUresult (*)(void*);
+
+struct Driver {
+    cuInit_t cuInit;
+    cuMemAllocHost_t cuMemAllocHost;
+    cuMemHostAlloc_t cuMemHostAlloc;
+    cuMemFreeHost_t cuMemFreeHost;
+    cuMemHostRegister_t cuMemHostRegister;
+    cuMemHostUnregister_t cuMemHostUnregister;
+};
+
+// limit 8m
+void pinnedScenario(const Driver& drv) {
+    void* staging = nullptr;
+    EXPECT(drv.cuMemAllocHost(&staging, 4 * kMiB) == CUDA_SUCCESS);
+
+    // registering a range that is not page aligned locks one page more
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    char* buffer = static_cast<char*>(std::aligned_alloc(page, 4 * kMiB));
+    EXPECT(drv.cuMemHostRegister(buffer + 16, 4 * kMiB - page, 0) == CUDA_SUCCESS);
+
+    void* refused = nullptr;
+    EXPECT(drv.cuMemHostAlloc(&refused, kMiB, 0) == CUDA_ERROR_OUT_OF_MEMORY);
+
+    EXPECT(drv.cuMemHostUnregister(buffer + 16) == CUDA_SUCCESS);
+    void* portable = nullptr;
+    EXPECT(drv.cuMemHostAlloc(&portable, 4 * kMiB, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAllocHost(&refused, page) == CUDA_ERROR_OUT_OF_MEMORY);
+
+    EXPECT(drv.cuMemFreeHost(staging) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemHostRegister(buffer, 4 * kMiB, 0) == CUDA_SUCCESS);
+
+    // left pinned on exit: the next process must still get the whole limit
+    std::free(buffer);
+    (void)portable;
+}
+
+int runChild() {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuMemAllocHost_t>(cuda, "cuMemAllocHost_v2"),
+        load<cuMemHostAlloc_t>(cuda, "cuMemHostAlloc"),
+        load<cuMemFreeHost_t>(cuda, "cuMemFreeHost"),
+        load<cuMemHostRegister_t>(cuda, "cuMemHostRegister_v2"),
+        load<cuMemHostUnregister_t>(cuda, "cuMemHostUnregister"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+
+    pinnedScenario(drv);
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (preload::childScenario()) {
+        return runChild();
+    }
+
+    preload::setUp(argc, argv);
+    const preload::Env env = {{"VCUDA_HOST_PINNED_LIMIT", "8m"}};
+    bool passed = preload::runScenario("first", env);
+    passed &= preload::runScenario("second", env);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
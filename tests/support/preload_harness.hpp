@@ -0,0 +1,152 @@
+// Harness of the tests that run against the mock driver libraries (tests/mock)
+// with the hook preloaded. The test re-executes itself once per scenario with
+// the hook in LD_PRELOAD and checks the exit codes; the re-executed process
+// finds its scenario in childScenario() and reports failed EXPECTs through
+// its exit code:
+//
+//   int main(int argc, char** argv) {
+//       if (const char* scenario = preload::childScenario()) {
+//           return runChild(scenario);
+//       }
+//       preload::setUp(argc, argv);
+//       return preload::runScenario("quota", {{"VCUDA_MEMORY_LIMIT", "1g"}}) ? EXIT_SUCCESS : EXIT_FAILURE;
+//   }
+//
+// --hook path/to/libvcuda-hook.so replaces the hook the test was built with.
+// Each test run has a usage segment of its own, removed when the parent
+// exits, so that tests neither see each other nor the node's hooked processes.
+#ifndef VCUDA_TESTS_PRELOAD_HARNESS_HPP
+#define VCUDA_TESTS_PRELOAD_HARNESS_HPP
+
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define EXPECT(condition)                                                           \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            std::fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #condition); \
+            ++preload::g_failures;                                                  \
+        }                                                                           \
+    } while (0)
+
+namespace preload {
+
+constexpr const char* kChildEnv = "VCUDA_TEST_CHILD";
+// exit code of a child that could not be executed
+constexpr int kExecFailed = 127;
+
+using Env = std::vector<std::pair<const char*, const char*>>;
+
+inline std::atomic<int> g_failures{0};
+inline std::string g_hook;
+inline std::string g_segment;
+
+// the scenario of a re-executed child, nullptr in the parent
+inline const char* childScenario() {
+    return std::getenv(kChildEnv);
+}
+
+// exit code of a child, by its EXPECTs
+inline int exitCode() {
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// dlopen of a mock library by its soname; the test cannot go on without it
+inline void* openLibrary(const char* name) {
+    void* handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        std::fprintf(stderr, "dlopen %s failed: %s\n", name, dlerror());
+        std::exit(EXIT_FAILURE);
+    }
+    return handle;
+}
+
+template <typename Fn>
+Fn load(void* handle, const char* name) {
+    auto fn = reinterpret_cast<Fn>(dlsym(handle, name));
+    if (!fn) {
+        std::fprintf(stderr, "missing symbol %s\n", name);
+        std::exit(EXIT_FAILURE);
+    }
+    return fn;
+}
+
+// value of --name on the command line, fallback without one
+inline std::string option(int argc, char** argv, const char* name, const std::string& fallback) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return fallback;
+}
+
+inline void removeSegment() {
+    shm_unlink(g_segment.c_str());
+}
+
+// Parent side: pick the hook and the usage segment, and put the mock
+// libraries first on the library path, so that children load them as
+// libcuda.so.1 / libnvidia-ml.so.1.
+inline void setUp(int argc, char** argv) {
+    g_hook = option(argc, argv, "--hook", VCUDA_HOOK_LIBRARY);
+
+    g_segment = "vcuda_test_usage." + std::to_string(getpid());
+    setenv("VCUDA_USAGE_SEGMENT", g_segment.c_str(), 1);
+    std::atexit(removeSegment);
+
+    std::string library_path = VCUDA_MOCK_DIR;
+    if (const char* current = std::getenv("LD_LIBRARY_PATH"); current && *current) {
+        library_path += ":" + std::string(current);
+    }
+    setenv("LD_LIBRARY_PATH", library_path.c_str(), 1);
+}
+
+// Re-execute the test for scenario with env on top of ours. From the parent
+// the hook goes into LD_PRELOAD; a child starting another keeps its own.
+inline pid_t startScenario(const char* scenario, const Env& env = {}) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        setenv(kChildEnv, scenario, 1);
+        if (!g_hook.empty()) {
+            setenv("LD_PRELOAD", g_hook.c_str(), 1);
+        }
+        for (const auto& [name, value] : env) {
+            setenv(name, value, 1);
+        }
+        execl("/proc/self/exe", "/proc/self/exe", static_cast<char*>(nullptr));
+        std::perror("execl");
+        _exit(kExecFailed);
+    }
+    return pid;
+}
+
+// exit code of a scenario, -1 when it did not exit
+inline int waitScenario(pid_t pid) {
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+// run scenario to its end and report it
+inline bool runScenario(const char* scenario, const Env& env = {}) {
+    const bool passed = waitScenario(startScenario(scenario, env)) == EXIT_SUCCESS;
+    std::printf("%-10s %s\n", scenario, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+} // namespace preload
+
+#endif // VCUDA_TESTS_PRELOAD_HARNESS_HPP
@@ -0,0 +1,175 @@
+// Per-container GPU utilization against the mock driver and NVML: with
+// VCUDA_VIRTUAL_UTILIZATION the GPU figure of nvmlDeviceGetUtilizationRates
+// is the device time of our own container's launches in the last complete
+// second, while the mock reports the whole device busy. Launches on a stream
+// under graph capture are left untimed, and their events are not leaked.
+//
+//   utilization_test [--hook path/to/libvcuda-hook.so]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <cuda.h>
+#include <nvml.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+// 1 ms kernels with 1 ms pauses: about half of every second busy
+constexpr auto kKernel = std::chrono::milliseconds(1);
+constexpr auto kLoadTime = std::chrono::milliseconds(2500);
+constexpr auto kIdleTime = std::chrono::milliseconds(2100);
+// into the neighbour's load, past its first complete second
+constexpr auto kNeighbourTime = std::chrono::milliseconds(2200);
+// launches captured into a graph, and a few periods of the hook's collector
+constexpr int kCapturedLaunches = 100;
+constexpr auto kCollectTime = std::chrono::milliseconds(100);
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuLaunchKernel_t = CUresult (*)(CUfunction, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int,
+                                      unsigned int, unsigned int, CUstream, void**, void**);
+using cuCtxSynchronize_t = CUresult (*)();
+using cuStreamBeginCapture_t = CUresult (*)(CUstream, CUstreamCaptureMode);
+using cuStreamEndCapture_t = CUresult (*)(CUstream, CUgraph*);
+using vcudaMockEventCount_t = unsigned long long (*)();
+using nvmlInit_t = nvmlReturn_t (*)();
+using nvmlDeviceGetHandleByIndex_t = nvmlReturn_t (*)(unsigned int, nvmlDevice_t*);
+using nvmlDeviceGetUtilizationRates_t = nvmlReturn_t (*)(nvmlDevice_t, nvmlUtilization_t*);
+
+struct Driver {
+    cuInit_t cuInit;
+    cuLaunchKernel_t cuLaunchKernel;
+    cuCtxSynchronize_t cuCtxSynchronize;
+    cuStreamBeginCapture_t cuStreamBeginCapture;
+    cuStreamEndCapture_t cuStreamEndCapture;
+    vcudaMockEventCount_t eventCount;
+    nvmlInit_t nvmlInit;
+    nvmlDeviceGetHandleByIndex_t nvmlDeviceGetHandleByIndex;
+    nvmlDeviceGetUtilizationRates_t nvmlDeviceGetUtilizationRates;
+};
+
+nvmlUtilization_t utilization(const Driver& drv, nvmlDevice_t device) {
+    nvmlUtilization_t rates{};
+    EXPECT(drv.nvmlDeviceGetUtilizationRates(device, &rates) == NVML_SUCCESS);
+    return rates;
+}
+
+// the load outlasts two seconds, so the last complete one lies inside it
+void runLoad(const Driver& drv) {
+    const auto until = std::chrono::steady_clock::now() + kLoadTime;
+    while (std::chrono::steady_clock::now() < until) {
+        EXPECT(drv.cuLaunchKernel(nullptr, 1, 1, 1, 1, 1, 1, 0, nullptr, nullptr, nullptr) == CUDA_SUCCESS);
+        EXPECT(drv.cuCtxSynchronize() == CUDA_SUCCESS);
+        std::this_thread::sleep_for(kKernel);
+    }
+}
+
+// our launches are what the device reports, an idle second reads 0
+void virtualScenario(const Driver& drv, nvmlDevice_t device) {
+    runLoad(drv);
+    const nvmlUtilization_t busy = utilization(drv, device);
+    std::printf("virtual: gpu %u%% under load\n", busy.gpu);
+    EXPECT(busy.gpu >= 20 && busy.gpu <= 70);
+    EXPECT(busy.memory == 50);
+
+    std::this_thread::sleep_for(kIdleTime);
+    EXPECT(utilization(drv, device).gpu == 0);
+}
+
+// the launches of another container on the node are not ours
+void neighbourScenario(const Driver& drv, nvmlDevice_t device) {
+    const pid_t pid = preload::startScenario("virtual", {{"VCUDA_CONTAINER_ID", "theirs"}});
+    std::this_thread::sleep_for(kNeighbourTime);
+    EXPECT(utilization(drv, device).gpu == 0);
+
+    EXPECT(preload::waitScenario(pid) == EXIT_SUCCESS);
+}
+
+// captured events never complete on their own: the launches go untimed
+// instead of leaving event pairs behind that the collector cannot query
+void captureScenario(const Driver& drv) {
+    EXPECT(drv.cuLaunchKernel(nullptr, 1, 1, 1, 1, 1, 1, 0, nullptr, nullptr, nullptr) == CUDA_SUCCESS);
+    EXPECT(drv.cuCtxSynchronize() == CUDA_SUCCESS);
+    std::this_thread::sleep_for(kCollectTime);
+    const unsigned long long events = drv.eventCount();
+
+    CUstream stream = reinterpret_cast<CUstream>(0x5000);
+    EXPECT(drv.cuStreamBeginCapture(stream, CU_STREAM_CAPTURE_MODE_GLOBAL) == CUDA_SUCCESS);
+    for (int i = 0; i < kCapturedLaunches; ++i) {
+        EXPECT(drv.cuLaunchKernel(nullptr, 1, 1, 1, 1, 1, 1, 0, stream, nullptr, nullptr) == CUDA_SUCCESS);
+    }
+    CUgraph graph = nullptr;
+    EXPECT(drv.cuStreamEndCapture(stream, &graph) == CUDA_SUCCESS);
+    std::this_thread::sleep_for(kCollectTime);
+    std::printf("capture: %llu events before, %llu after\n", events, drv.eventCount());
+    EXPECT(drv.eventCount() == events);
+}
+
+// without it the device's own figures pass through
+void offScenario(const Driver& drv, nvmlDevice_t device) {
+    runLoad(drv);
+    const nvmlUtilization_t rates = utilization(drv, device);
+    EXPECT(rates.gpu == 100);
+    EXPECT(rates.memory == 50);
+}
+
+int runChild(const std::string& scenario) {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+    void* nvml = preload::openLibrary("libnvidia-ml.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuLaunchKernel_t>(cuda, "cuLaunchKernel"),
+        load<cuCtxSynchronize_t>(cuda, "cuCtxSynchronize"),
+        load<cuStreamBeginCapture_t>(cuda, "cuStreamBeginCapture_v2"),
+        load<cuStreamEndCapture_t>(cuda, "cuStreamEndCapture"),
+        load<vcudaMockEventCount_t>(cuda, "vcudaMockEventCount"),
+        load<nvmlInit_t>(nvml, "nvmlInit_v2"),
+        load<nvmlDeviceGetHandleByIndex_t>(nvml, "nvmlDeviceGetHandleByIndex_v2"),
+        load<nvmlDeviceGetUtilizationRates_t>(nvml, "nvmlDeviceGetUtilizationRates"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS || drv.nvmlInit() != NVML_SUCCESS) {
+        std::fprintf(stderr, "mock initialization failed\n");
+        return EXIT_FAILURE;
+    }
+    nvmlDevice_t device = nullptr;
+    if (drv.nvmlDeviceGetHandleByIndex(0, &device) != NVML_SUCCESS) {
+        std::fprintf(stderr, "no mock device\n");
+        return EXIT_FAILURE;
+    }
+
+    if (scenario == "virtual") {
+        virtualScenario(drv, device);
+    } else if (scenario == "neighbour") {
+        neighbourScenario(drv, device);
+    } else if (scenario == "capture") {
+        captureScenario(drv);
+    } else {
+        offScenario(drv, device);
+    }
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (const char* scenario = preload::childScenario()) {
+        return runChild(scenario);
+    }
+
+    preload::setUp(argc, argv);
+    unsetenv("VCUDA_COMPUTE_LIMIT");
+    unsetenv("VCUDA_PRIORITY");
+    unsetenv("VCUDA_MOCK_TIMELINE");
+    setenv("VCUDA_MOCK_KERNEL_NS", std::to_string(std::chrono::nanoseconds(kKernel).count()).c_str(), 1);
+
+    bool passed = preload::runScenario("virtual", {{"VCUDA_VIRTUAL_UTILIZATION", "1"}});
+    passed &= preload::runScenario("neighbour", {{"VCUDA_VIRTUAL_UTILIZATION", "1"}, {"VCUDA_CONTAINER_ID", "ours"}});
+    passed &= preload::runScenario("capture", {{"VCUDA_VIRTUAL_UTILIZATION", "1"}});
+    passed &= preload::runScenario("off", {{"VCUDA_VIRTUAL_UTILIZATION", "0"}});
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
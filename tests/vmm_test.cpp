@@ -0,0 +1,133 @@
+// Virtual memory management accounting against the mock driver: a handle is
+// charged once however often it is mapped, and a handle released while
+// mapped stays charged until its last mapping is gone, including mappings
+// that go away piecewise.
+//
+//   vmm_test [--hook path/to/libvcuda-hook.so]
+#include <cstdio>
+#include <cstdlib>
+#include <cuda.h>
+
+#include "support/preload_harness.hpp"
+
+namespace {
+
+using preload::load;
+
+constexpr size_t kLimit = 64ull << 20;
+constexpr size_t kChunk = 2ull << 20; // mock allocation granularity
+
+using cuInit_t = CUresult (*)(unsigned int);
+using cuMemGetInfo_t = CUresult (*)(size_t*, size_t*);
+using cuMemCreate_t = CUresult (*)(CUmemGenericAllocationHandle*, size_t, const CUmemAllocationProp*, unsigned long long);
+using cuMemRelease_t = CUresult (*)(CUmemGenericAllocationHandle);
+using cuMemAddressReserve_t = CUresult (*)(CUdeviceptr*, size_t, size_t, CUdeviceptr, unsigned long long);
+using cuMemMap_t = CUresult (*)(CUdeviceptr, size_t, size_t, CUmemGenericAllocationHandle, unsigned long long);
+using cuMemUnmap_t = CUresult (*)(CUdeviceptr, size_t);
+
+struct Driver {
+    cuInit_t cuInit;
+    cuMemGetInfo_t cuMemGetInfo;
+    cuMemCreate_t cuMemCreate;
+    cuMemRelease_t cuMemRelease;
+    cuMemAddressReserve_t cuMemAddressReserve;
+    cuMemMap_t cuMemMap;
+    cuMemUnmap_t cuMemUnmap;
+};
+
+size_t usedBytes(const Driver& drv) {
+    size_t free_bytes = 0;
+    size_t total_bytes = 0;
+    EXPECT(drv.cuMemGetInfo(&free_bytes, &total_bytes) == CUDA_SUCCESS);
+    return total_bytes - free_bytes;
+}
+
+void vmmScenario(const Driver& drv) {
+    CUmemAllocationProp prop{};
+    prop.type = CU_MEM_ALLOCATION_TYPE_PINNED;
+    prop.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+    prop.location.id = 0;
+
+    CUmemGenericAllocationHandle handle = 0;
+    EXPECT(drv.cuMemCreate(&handle, 2 * kChunk, &prop, 0) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 2 * kChunk);
+
+    // two views of the same memory cost nothing more
+    CUdeviceptr first = 0;
+    CUdeviceptr second = 0;
+    EXPECT(drv.cuMemAddressReserve(&first, 2 * kChunk, 0, 0, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAddressReserve(&second, 2 * kChunk, 0, 0, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemMap(first, 2 * kChunk, 0, handle, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemMap(second, 2 * kChunk, 0, handle, 0) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 2 * kChunk);
+
+    // released while mapped: still allocated
+    EXPECT(drv.cuMemRelease(handle) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 2 * kChunk);
+
+    EXPECT(drv.cuMemUnmap(first, 2 * kChunk) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 2 * kChunk);
+
+    // the second view goes away in two pieces, the memory with the last one
+    EXPECT(drv.cuMemUnmap(second + kChunk, kChunk) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 2 * kChunk);
+    EXPECT(drv.cuMemUnmap(second, kChunk) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 0);
+
+    // a handle that was never mapped is freed by cuMemRelease
+    EXPECT(drv.cuMemCreate(&handle, kChunk, &prop, 0) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == kChunk);
+    EXPECT(drv.cuMemRelease(handle) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 0);
+
+    // one unmap across two adjacent mappings of different handles
+    CUmemGenericAllocationHandle low = 0;
+    CUmemGenericAllocationHandle high = 0;
+    CUdeviceptr range = 0;
+    EXPECT(drv.cuMemCreate(&low, kChunk, &prop, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemCreate(&high, kChunk, &prop, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemAddressReserve(&range, 2 * kChunk, 0, 0, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemMap(range, kChunk, 0, low, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemMap(range + kChunk, kChunk, 0, high, 0) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemRelease(low) == CUDA_SUCCESS);
+    EXPECT(drv.cuMemRelease(high) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 2 * kChunk);
+    EXPECT(drv.cuMemUnmap(range, 2 * kChunk) == CUDA_SUCCESS);
+    EXPECT(usedBytes(drv) == 0);
+}
+
+int runChild() {
+    void* cuda = preload::openLibrary("libcuda.so.1");
+
+    Driver drv{
+        load<cuInit_t>(cuda, "cuInit"),
+        load<cuMemGetInfo_t>(cuda, "cuMemGetInfo_v2"),
+        load<cuMemCreate_t>(cuda, "cuMemCreate"),
+        load<cuMemRelease_t>(cuda, "cuMemRelease"),
+        load<cuMemAddressReserve_t>(cuda, "cuMemAddressReserve"),
+        load<cuMemMap_t>(cuda, "cuMemMap"),
+        load<cuMemUnmap_t>(cuda, "cuMemUnmap"),
+    };
+    if (drv.cuInit(0) != CUDA_SUCCESS) {
+        std::fprintf(stderr, "mock driver initialization failed\n");
+        return EXIT_FAILURE;
+    }
+
+    vmmScenario(drv);
+    return preload::exitCode();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (preload::childScenario()) {
+        return runChild();
+    }
+
+    preload::setUp(argc, argv);
+    unsetenv("VCUDA_DEVICE_MEMORY_LIMITS");
+    unsetenv("VCUDA_QUOTA_LEASE");
+
+    const preload::Env env = {{"VCUDA_MEMORY_LIMIT", "64m"}};
+    return preload::runScenario("vmm", env) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
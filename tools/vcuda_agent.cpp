@@ -0,0 +1,73 @@
+#include <signal.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "agent/agent.hpp"
+#include "util/config.hpp"
+
+// Node agent of the usage segment: publishes the limits of its config file
+// (VCUDA_CONFIG_FILE) to every hooked process of the node, reclaims the slots
+// of exited processes and answers queries on a Unix socket.
+namespace {
+
+void usage(const char* argv0) {
+    std::fprintf(stderr,
+                 "usage: %s [--socket PATH] [--config FILE]    run the agent\n"
+                 "       %s [--socket PATH] --query REQUEST    ask a running agent: usage, processes or policy\n",
+                 argv0, argv0);
+}
+
+void onSignal(int) {
+    agent::NodeAgent::stop();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string socket_path = AGENT_SOCKET_PATH;
+    const char* request = nullptr;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (std::strcmp(argv[i], "--socket") == 0) {
+            socket_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--config") == 0) {
+            setenv("VCUDA_CONFIG_FILE", argv[i + 1], 1);
+        } else if (std::strcmp(argv[i], "--query") == 0) {
+            request = argv[i + 1];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (request) {
+        std::string reply;
+        if (!agent::NodeAgent::query(socket_path, request, &reply)) {
+            std::fprintf(stderr, "no agent on %s\n", socket_path.c_str());
+            return 1;
+        }
+        std::fputs(reply.c_str(), stdout);
+        return reply.compare(0, 5, "error") == 0 ? 1 : 0;
+    }
+
+    // the config file is the agent's own, also once a policy was published
+    util::Config::setFileGate(nullptr);
+
+    struct sigaction action {};
+    action.sa_handler = onSignal;
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    agent::NodeAgent node_agent(socket_path);
+    if (!node_agent.start()) {
+        return 1;
+    }
+    return node_agent.run();
+}
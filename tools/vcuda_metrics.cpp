@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "util/metrics.hpp"
+
+// Reads the per-API call metrics a hooked process exports through
+// /dev/shm/vcuda_metrics.<pid>.<random>, or switches collection on and off.
+// Processes are named by pid, or by segment when pid namespaces sharing
+// /dev/shm give several processes the same pid.
+namespace {
+
+void usage(const char* argv0) {
+    std::fprintf(stderr,
+                 "usage: %s <pid|segment>            print call count, errors and latency per API\n"
+                 "       %s <pid|segment> enable     start collecting\n"
+                 "       %s <pid|segment> disable    stop collecting\n"
+                 "       %s prune                    remove segments of exited processes\n",
+                 argv0, argv0, argv0, argv0);
+}
+
+// the one segment named by target, a pid or a segment name
+bool resolveSegment(const char* target, std::string* segment) {
+    char* end = nullptr;
+    const long pid = std::strtol(target, &end, 10);
+    if (*end != '\0' || pid <= 0) {
+        *segment = target;
+        return true;
+    }
+
+    const auto segments = util::Metrics::findSegments(static_cast<pid_t>(pid));
+    if (segments.empty()) {
+        std::fprintf(stderr, "no metrics segment for pid %ld\n", pid);
+        return false;
+    }
+    if (segments.size() > 1) {
+        std::fprintf(stderr, "pid %ld has a segment in several pid namespaces, name one of:\n", pid);
+        for (const auto& name : segments) {
+            std::fprintf(stderr, "  %s\n", name.c_str());
+        }
+        return false;
+    }
+    *segment = segments.front();
+    return true;
+}
+
+int printSnapshot(const std::string& segment) {
+    std::vector<util::Metrics::ApiSnapshot> snapshot;
+    if (!util::Metrics::readSnapshot(segment, snapshot)) {
+        std::fprintf(stderr, "no metrics segment %s\n", segment.c_str());
+        return 1;
+    }
+
+    std::printf("%-32s %12s %10s %12s %12s %12s %12s\n",
+                "api", "calls", "errors", "mean(ns)", "p50(ns)", "p99(ns)", "p99.9(ns)");
+    for (const auto& api : snapshot) {
+        if (api.calls == 0) {
+            continue;
+        }
+        std::printf("%-32s %12llu %10llu %12llu %12llu %12llu %12llu\n",
+                    api.name.c_str(),
+                    static_cast<unsigned long long>(api.calls),
+                    static_cast<unsigned long long>(api.errors),
+                    static_cast<unsigned long long>(api.total_ns / api.calls),
+                    static_cast<unsigned long long>(api.percentileNs(0.5)),
+                    static_cast<unsigned long long>(api.percentileNs(0.99)),
+                    static_cast<unsigned long long>(api.percentileNs(0.999)));
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (argc == 2 && std::strcmp(argv[1], "prune") == 0) {
+        std::printf("removed %zu stale segments\n", util::Metrics::pruneStaleSegments());
+        return 0;
+    }
+
+    std::string segment;
+    if (!resolveSegment(argv[1], &segment)) {
+        return 1;
+    }
+
+    if (argc == 2) {
+        return printSnapshot(segment);
+    }
+
+    const std::string action = argv[2];
+    if (action != "enable" && action != "disable") {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!util::Metrics::setEnabled(segment, action == "enable")) {
+        std::fprintf(stderr, "no metrics segment %s\n", segment.c_str());
+        return 1;
+    }
+    return 0;
+}